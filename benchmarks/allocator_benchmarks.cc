@@ -0,0 +1,109 @@
+#include <string>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "benchmark/benchmark.h"
+
+#include "mem_utils.h"
+
+namespace {
+
+// Allocation and free throughput of the aligned allocation paths, across block
+// sizes (range_x, in bytes) and alignments (range_y).  Each iteration
+// allocates a batch of blocks and then frees them all, so the allocator cannot
+// just hand the same block back every time.  The label reports the heap memory
+// used per block beyond the requested size, as seen by glibc.
+
+const int ALLOC_BATCH_SIZE = 64;
+
+// Bytes of heap currently handed out, including mmap'd blocks, or -1 if we
+// can't tell on this platform.
+int64_t HeapBytesInUse() {
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  const struct mallinfo2 info = mallinfo2();
+  return static_cast<int64_t>(info.uordblks + info.hblkhd);
+#else
+  return -1;
+#endif
+}
+
+struct AlignedNewPath {
+  static uint8_t* Allocate(std::size_t n, std::size_t align) {
+    return jr::mem_utils::AlignedNew<uint8_t>(n, align);
+  }
+  static void Free(uint8_t* p, std::size_t n) {
+    jr::mem_utils::AlignedDelete(p);
+  }
+};
+
+struct HeaderAlignedNewPath {
+  static uint8_t* Allocate(std::size_t n, std::size_t align) {
+    return jr::mem_utils::HeaderAlignedNew<uint8_t>(n, align);
+  }
+  static void Free(uint8_t* p, std::size_t n) {
+    jr::mem_utils::HeaderAlignedDelete(p);
+  }
+};
+
+// Baseline; ignores the requested alignment.
+struct StdAllocatorPath {
+  static uint8_t* Allocate(std::size_t n, std::size_t align) {
+    return std::allocator<uint8_t>().allocate(n);
+  }
+  static void Free(uint8_t* p, std::size_t n) {
+    std::allocator<uint8_t>().deallocate(p, n);
+  }
+};
+
+template <typename PathT>
+void BM_memutils_Alloc(benchmark::State& state) {
+  const std::size_t num_bytes = state.range_x();
+  const std::size_t alignment = state.range_y();
+  std::vector<uint8_t*> blocks(ALLOC_BATCH_SIZE);
+
+  // Measure the overhead once, outside the timed loop.
+  const int64_t heap_before = HeapBytesInUse();
+  for (int i = 0; i < ALLOC_BATCH_SIZE; ++i) {
+    blocks[i] = PathT::Allocate(num_bytes, alignment);
+  }
+  const int64_t heap_after = HeapBytesInUse();
+  for (int i = 0; i < ALLOC_BATCH_SIZE; ++i) {
+    PathT::Free(blocks[i], num_bytes);
+  }
+  if (heap_before >= 0) {
+    const int64_t overhead =
+        (heap_after - heap_before) / ALLOC_BATCH_SIZE -
+        static_cast<int64_t>(num_bytes);
+    state.SetLabel("overhead: " + std::to_string(overhead) + " B/alloc");
+  }
+
+  while (state.KeepRunning()) {
+    for (int i = 0; i < ALLOC_BATCH_SIZE; ++i) {
+      blocks[i] = PathT::Allocate(num_bytes, alignment);
+      // Touch the block so that the allocation can't be optimized away.
+      blocks[i][0] = static_cast<uint8_t>(i);
+    }
+    for (int i = 0; i < ALLOC_BATCH_SIZE; ++i) {
+      PathT::Free(blocks[i], num_bytes);
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          ALLOC_BATCH_SIZE);
+}
+
+// Small blocks (where per-block overhead matters most) up to blocks large
+// enough to be served by mmap, at SIMD through page alignments.
+BENCHMARK_TEMPLATE(BM_memutils_Alloc, AlignedNewPath)
+    ->RangePair(16, 1 << 20, 16, 4 << 10);
+BENCHMARK_TEMPLATE(BM_memutils_Alloc, HeaderAlignedNewPath)
+    ->RangePair(16, 1 << 20, 16, 4 << 10);
+BENCHMARK_TEMPLATE(BM_memutils_Alloc, StdAllocatorPath)
+    ->RangePair(16, 1 << 20, 16, 4 << 10);
+
+}  // anonymous namespace
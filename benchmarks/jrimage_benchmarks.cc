@@ -1,10 +1,22 @@
 #include <string>
+#include <cmath>
+#include <deque>
 #include <iostream>
+#include <mutex>
 #include <random>
+#include <utility>
+#include <vector>
 
 #include "benchmark/benchmark.h"
 
 #include "jrimage.h"
+#include "jrimage_compare.h"
+#include "jrimage_cow.h"
+#include "jrimage_fixed.h"
+#include "jrimage_pool.h"
+#include "jrimage_ring.h"
+#include "jrimage_sparse.h"
+#include "jrimage_tiled.h"
 
 namespace {
 
@@ -18,6 +30,113 @@ void BM_JRImageBuf_CopyInto(benchmark::State& state) {
 }
 BENCHMARK(BM_JRImageBuf_CopyInto);
 
+// Same as above, but the destination is created once and handed back and forth
+// between two "pipeline stages" with O(1) moves, so no iteration allocates.
+void BM_JRImageBuf_CopyIntoWithMoveHandoff(benchmark::State& state) {
+  jr::ImageBuf<float> image(100, 200, 4);
+  jr::ImageBuf<float> stage_output;
+  while (state.KeepRunning()) {
+    image.CopyInto(stage_output);
+    jr::ImageBuf<float> stage_input(std::move(stage_output));
+    stage_output = std::move(stage_input);
+  }
+}
+BENCHMARK(BM_JRImageBuf_CopyIntoWithMoveHandoff);
+
+// Same as BM_JRImageBuf_CopyInto, but the destination comes from an ImagePool.
+// Only the first iteration misses (and allocates); the label reports it.
+void BM_JRImageBuf_CopyIntoPooled(benchmark::State& state) {
+  jr::ImageBuf<float> image(100, 200, 4);
+  jr::ImagePool<jr::ImageBuf<float>> pool(64 << 20);
+  while (state.KeepRunning()) {
+    jr::ImagePool<jr::ImageBuf<float>>::Handle copy = pool.Acquire(100, 200, 4);
+    image.CopyInto(*copy);
+  }
+  state.SetLabel("misses: " + std::to_string(pool.GetStats().misses));
+}
+BENCHMARK(BM_JRImageBuf_CopyIntoPooled);
+
+// Fan a 1080p frame out to four consumers, one of which writes to a 64 row
+// region of interest.  With ImageBuf every consumer needs an up front copy;
+// with CowImageBuf only the writer copies, and only the blocks it touches.
+const int FAN_OUT_CONSUMERS = 4;
+
+void BM_JRImageBuf_FanOutCopies(benchmark::State& state) {
+  jr::ImageBuf<uint8_t, 3> frame(1920, 1080);
+  frame.SetAll(128);
+  while (state.KeepRunning()) {
+    jr::ImageBuf<uint8_t, 3> consumers[FAN_OUT_CONSUMERS];
+    for (int i = 0; i < FAN_OUT_CONSUMERS; ++i) {
+      frame.CopyInto(consumers[i]);
+    }
+    for (int y = 500; y < 564; ++y) {
+      consumers[0].GetRow(y)[0] = 0;
+    }
+  }
+}
+BENCHMARK(BM_JRImageBuf_FanOutCopies);
+
+void BM_JRCowImageBuf_FanOutCopies(benchmark::State& state) {
+  typedef jr::CowImageBuf<uint8_t, 3, std::allocator<uint8_t>, 32> CowT;
+  CowT frame(1920, 1080);
+  frame.SetAll(128);
+  frame.Detach();  // Materialize the frame, as a decoder writing it would.
+  while (state.KeepRunning()) {
+    std::vector<CowT> consumers(FAN_OUT_CONSUMERS, frame);
+    for (int y = 500; y < 564; ++y) {
+      consumers[0].GetRow(y)[0] = 0;
+    }
+  }
+}
+BENCHMARK(BM_JRCowImageBuf_FanOutCopies);
+
+// Benchmark resizing an image between a few region of interest sizes each
+// frame, as a video pipeline does.  Only the first frame should allocate.
+void BM_JRImageBuf_ResizeBetweenROIs(benchmark::State& state) {
+  const int rois[][2] = {{640, 480}, {1280, 720}, {320, 240}, {1920, 1080}};
+  jr::ImageBuf<uint8_t, 3> image;
+  std::size_t i = 0;
+  while (state.KeepRunning()) {
+    const int* roi = rois[i++ % 4];
+    image.Resize(roi[0], roi[1], 3);
+    image.Set(roi[0] - 1, roi[1] - 1, 2, 255);
+  }
+}
+BENCHMARK(BM_JRImageBuf_ResizeBetweenROIs);
+
+// A per-frame pipeline that creates a few intermediate images each frame, with
+// the intermediates on the heap vs. in a FrameArena.
+void BM_JRImageBuf_FrameIntermediatesHeap(benchmark::State& state) {
+  typedef jr::ImageBuf<float, 3, jr::AlignedAllocator<float, 64>, 64> ImageT;
+  ImageT input(640, 480);
+  input.SetAll(1.0f);
+  while (state.KeepRunning()) {
+    ImageT a, b, c;
+    input.CopyInto(a);
+    a.CopyInto(b);
+    b.CopyInto(c);
+  }
+}
+BENCHMARK(BM_JRImageBuf_FrameIntermediatesHeap);
+
+void BM_JRImageBuf_FrameIntermediatesArena(benchmark::State& state) {
+  typedef jr::ImageBuf<float, 3, jr::ArenaAllocator<float>, 64> ImageT;
+  jr::FrameArena arena;
+  const jr::ArenaAllocator<float> allocator(&arena);
+  ImageT input(640, 480);
+  input.SetAll(1.0f);
+  while (state.KeepRunning()) {
+    {
+      ImageT a(allocator), b(allocator), c(allocator);
+      input.CopyInto(a);
+      a.CopyInto(b);
+      b.CopyInto(c);
+    }
+    arena.Reset();
+  }
+}
+BENCHMARK(BM_JRImageBuf_FrameIntermediatesArena);
+
 // Benchmark for the SetAll function.
 void BM_JRImageBuf_SetAllFloat(benchmark::State& state) {
   jr::ImageBuf<float> image(1000, 1000, 3);
@@ -29,4 +148,428 @@ void BM_JRImageBuf_SetAllFloat(benchmark::State& state) {
 }
 BENCHMARK(BM_JRImageBuf_SetAllFloat);
 
+// Fill a 1080p RGB frame with one color, pixel by pixel vs. SetAllPixels.
+void BM_JRImageBuf_FillColorPerPixel(benchmark::State& state) {
+  jr::ImageBuf<uint8_t, 3> image(1920, 1080);
+  uint8_t color[3] = {10, 20, 30};
+  while (state.KeepRunning()) {
+    for (int y = 0; y < image.Height(); ++y) {
+      for (int x = 0; x < image.Width(); ++x) {
+        image.SetAllChannels(x, y, color);
+      }
+    }
+    ++color[0];
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(image.TotalByteCount()));
+}
+BENCHMARK(BM_JRImageBuf_FillColorPerPixel);
+
+void BM_JRImageBuf_FillColorSetAllPixels(benchmark::State& state) {
+  jr::ImageBuf<uint8_t, 3> image(1920, 1080);
+  uint8_t color[3] = {10, 20, 30};
+  while (state.KeepRunning()) {
+    image.SetAllPixels(color);
+    ++color[0];
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(image.TotalByteCount()));
+}
+BENCHMARK(BM_JRImageBuf_FillColorSetAllPixels);
+
+// Full frame passes over a large (~200MB) image, with 4KB vs. 2MB pages.
+template <typename Allocator>
+void BM_JRImageBuf_LargeFramePass(benchmark::State& state) {
+  jr::ImageBuf<float, 4, Allocator> image(4096, 3072);
+  jr::ParallelFirstTouch(image, 4);
+  float val = 1.0f;
+  while (state.KeepRunning()) {
+    image.SetAll(val);
+    val += 1.0f;
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(image.TotalByteCount()));
+}
+BENCHMARK_TEMPLATE(BM_JRImageBuf_LargeFramePass, std::allocator<float>);
+BENCHMARK_TEMPLATE(BM_JRImageBuf_LargeFramePass, jr::HugePageAllocator<float>);
+
+// SetAll and CopyInto on 1MB, 32MB and 512MB float4 images (rows of 16KB),
+// with each cache hint.  Beyond the last level cache, non-temporal stores
+// skip reading the destination into the cache before overwriting it.
+template <jr::mem_utils::CacheHint HINT>
+void BM_JRImageBuf_SetAllHint(benchmark::State& state) {
+  jr::ImageBuf<float, 4> image(1024, 64 * state.range_x());
+  image.SetAll(0.5f);  // Fault the pages in before timing.
+  float val = 1.0f;
+  while (state.KeepRunning()) {
+    image.SetAll(val, HINT);
+    val += 1.0f;
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(image.TotalByteCount()));
+}
+BENCHMARK_TEMPLATE(BM_JRImageBuf_SetAllHint, jr::mem_utils::CACHE_HINT_AUTO)
+    ->Arg(1)->Arg(32)->Arg(512);
+BENCHMARK_TEMPLATE(BM_JRImageBuf_SetAllHint, jr::mem_utils::CACHE_HINT_CACHED)
+    ->Arg(1)->Arg(32)->Arg(512);
+BENCHMARK_TEMPLATE(BM_JRImageBuf_SetAllHint,
+                   jr::mem_utils::CACHE_HINT_NON_TEMPORAL)
+    ->Arg(1)->Arg(32)->Arg(512);
+
+template <jr::mem_utils::CacheHint HINT>
+void BM_JRImageBuf_CopyIntoHint(benchmark::State& state) {
+  jr::ImageBuf<float, 4> image(1024, 64 * state.range_x());
+  image.Set(0, 0, 0, 1.0f);  // Not uniform, so CopyInto really copies.
+  jr::ImageBuf<float, 4> copy(image.Width(), image.Height());
+  copy.SetAll(0.5f);  // Fault the pages in before timing.
+  while (state.KeepRunning()) {
+    image.CopyInto(copy, HINT);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(image.TotalByteCount()));
+}
+BENCHMARK_TEMPLATE(BM_JRImageBuf_CopyIntoHint, jr::mem_utils::CACHE_HINT_AUTO)
+    ->Arg(1)->Arg(32)->Arg(512);
+BENCHMARK_TEMPLATE(BM_JRImageBuf_CopyIntoHint,
+                   jr::mem_utils::CACHE_HINT_CACHED)
+    ->Arg(1)->Arg(32)->Arg(512);
+BENCHMARK_TEMPLATE(BM_JRImageBuf_CopyIntoHint,
+                   jr::mem_utils::CACHE_HINT_NON_TEMPORAL)
+    ->Arg(1)->Arg(32)->Arg(512);
+
+// Creating a zero filled 4k float image, either by allocating and calling
+// SetAll(0), or by getting already zeroed pages from the OS.
+template <typename Allocator>
+void BM_JRImageBuf_CreateZeroed(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    jr::ImageBuf<float, 4, Allocator> image(3840, 2160);
+    image.SetAll(0.0f);
+  }
+}
+BENCHMARK_TEMPLATE(BM_JRImageBuf_CreateZeroed, std::allocator<float>);
+BENCHMARK_TEMPLATE(BM_JRImageBuf_CreateZeroed, jr::ZeroedAllocator<float>);
+
+// Benchmarks for converting between interleaved and planar layouts.
+void BM_JRImageBuf_CopyIntoPlanar(benchmark::State& state) {
+  jr::ImageBuf<float, 3> image(1000, 1000);
+  image.SetAll(1.0f);
+  jr::PlanarImageBuf<float, 3> planar(1000, 1000);
+  while (state.KeepRunning()) {
+    image.CopyInto(planar);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(image.TotalByteCount()));
+}
+BENCHMARK(BM_JRImageBuf_CopyIntoPlanar);
+
+void BM_JRImageBuf_CopyIntoInterleaved(benchmark::State& state) {
+  jr::PlanarImageBuf<float, 3> planar(1000, 1000);
+  planar.SetAll(1.0f);
+  jr::ImageBuf<float, 3> image(1000, 1000);
+  while (state.KeepRunning()) {
+    planar.CopyInto(image);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(planar.TotalByteCount()));
+}
+BENCHMARK(BM_JRImageBuf_CopyIntoInterleaved);
+
+// Benchmarks comparing column traversal (as done by vertical filters) on row
+// major and tiled images.
+template <typename ImageT>
+void ColumnTraversalHelper(benchmark::State& state) {
+  ImageT image(state.range_x(), state.range_x());
+  image.SetAll(1.0f);
+  volatile float sink = 0.0f;
+  while (state.KeepRunning()) {
+    float sum = 0.0f;
+    for (int x = 0; x < image.Width(); ++x) {
+      for (int y = 0; y < image.Height(); ++y) {
+        sum += image.Get(x, y, 0);
+      }
+    }
+    sink = sum;
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(image.NumPixels()));
+}
+
+void BM_JRImageBuf_ColumnTraversal(benchmark::State& state) {
+  ColumnTraversalHelper<jr::ImageBuf<float, 1>>(state);
+}
+BENCHMARK(BM_JRImageBuf_ColumnTraversal)->Arg(1<<10)->Arg(4<<10)->Arg(16<<10);
+
+void BM_JRTiledImageBuf_ColumnTraversal(benchmark::State& state) {
+  ColumnTraversalHelper<jr::TiledImageBuf<float, 1>>(state);
+}
+BENCHMARK(BM_JRTiledImageBuf_ColumnTraversal)->Arg(1<<10)->Arg(4<<10)->Arg(16<<10);
+
+void BM_JRZOrderImageBuf_ColumnTraversal(benchmark::State& state) {
+  ColumnTraversalHelper<jr::ZOrderImageBuf<float, 1>>(state);
+}
+BENCHMARK(BM_JRZOrderImageBuf_ColumnTraversal)->Arg(1<<10)->Arg(4<<10)->Arg(16<<10);
+
+// Column traversal of a tiled image, visiting the image one tile at a time.
+void BM_JRTiledImageBuf_ColumnTraversalByTile(benchmark::State& state) {
+  typedef jr::TiledImageBuf<float, 1> TiledT;
+  TiledT image(state.range_x(), state.range_x());
+  image.SetAll(1.0f);
+  volatile float sink = 0.0f;
+  while (state.KeepRunning()) {
+    float sum = 0.0f;
+    image.ForEachTile([&sum](int x0, int y0, int w, int h, const float* tile) {
+      for (int x = 0; x < w; ++x) {
+        for (int y = 0; y < h; ++y) {
+          sum += tile[TiledT::TileOffset(x, y)];
+        }
+      }
+    });
+    sink = sum;
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(image.NumPixels()));
+}
+BENCHMARK(BM_JRTiledImageBuf_ColumnTraversalByTile)->Arg(1<<10)->Arg(4<<10)->Arg(16<<10);
+
+// Extract a 16x16 patch around each of a grid of keypoints and sum it, once
+// into a heap backed ImageBuf (through a window) and once into a FixedImageBuf.
+const int PATCH_SIZE = 16;
+
+template <typename PatchT>
+float SumPatch(const PatchT& patch) {
+  float sum = 0.0f;
+  for (int y = 0; y < patch.Height(); ++y) {
+    const float* row = patch.GetRow(y);
+    for (int x = 0; x < patch.Width(); ++x) {
+      sum += row[x];
+    }
+  }
+  return sum;
+}
+
+void BM_JRImageBuf_PatchExtractionHeap(benchmark::State& state) {
+  jr::ImageBuf<float, 1> image(640, 480);
+  image.SetAll(1.0f);
+  volatile float sink = 0.0f;
+  int num_patches = 0;
+  while (state.KeepRunning()) {
+    for (int y = 0; y + PATCH_SIZE <= image.Height(); y += 8) {
+      for (int x = 0; x + PATCH_SIZE <= image.Width(); x += 8) {
+        jr::ImageBuf<float, 1> window, patch;
+        image.GetWindow(x, y, PATCH_SIZE, PATCH_SIZE, window);
+        window.CopyInto(patch);
+        sink = SumPatch(patch);
+        ++num_patches;
+      }
+    }
+  }
+  state.SetItemsProcessed(num_patches);
+}
+BENCHMARK(BM_JRImageBuf_PatchExtractionHeap);
+
+void BM_JRFixedImageBuf_PatchExtraction(benchmark::State& state) {
+  jr::ImageBuf<float, 1> image(640, 480);
+  image.SetAll(1.0f);
+  volatile float sink = 0.0f;
+  int num_patches = 0;
+  while (state.KeepRunning()) {
+    for (int y = 0; y + PATCH_SIZE <= image.Height(); y += 8) {
+      for (int x = 0; x + PATCH_SIZE <= image.Width(); x += 8) {
+        jr::FixedImageBuf<float, PATCH_SIZE, PATCH_SIZE, 1> patch;
+        patch.CopyFrom(image, x, y);
+        sink = SumPatch(patch);
+        ++num_patches;
+      }
+    }
+  }
+  state.SetItemsProcessed(num_patches);
+}
+BENCHMARK(BM_JRFixedImageBuf_PatchExtraction);
+
+// Clear a large mask each frame and then draw a small box into it.  A uniform
+// CowImageBuf only materializes the row blocks the box touches.
+template <typename ImageT>
+void DrawBox(ImageT& mask) {
+  for (int y = 1000; y < 1100; ++y) {
+    for (int x = 2000; x < 2100; ++x) {
+      mask.Set(x, y, 0, 1.0f);
+    }
+  }
+}
+
+void BM_JRImageBuf_ClearAndDrawBox(benchmark::State& state) {
+  jr::ImageBuf<float, 1> mask(4096, 4096);
+  while (state.KeepRunning()) {
+    mask.SetAll(0.0f);
+    DrawBox(mask);
+  }
+}
+BENCHMARK(BM_JRImageBuf_ClearAndDrawBox);
+
+void BM_JRCowImageBuf_ClearAndDrawBox(benchmark::State& state) {
+  jr::CowImageBuf<float, 1, std::allocator<float>, 64> mask(4096, 4096);
+  while (state.KeepRunning()) {
+    mask.SetAll(0.0f);
+    DrawBox(mask);
+  }
+}
+BENCHMARK(BM_JRCowImageBuf_ClearAndDrawBox);
+
+// Check that two 1080p RGB frames, which differ by a little everywhere, are
+// within tolerance: with CompareImages vs. a per-value loop over Get(...).
+template <typename T>
+void MakeSlightlyDifferentFrames(jr::ImageBuf<T, 3>& a,
+                                 jr::ImageBuf<T, 3>& b) {
+  a.Resize(1920, 1080, 3);
+  b.Resize(1920, 1080, 3);
+  for (int y = 0; y < a.Height(); ++y) {
+    for (int x = 0; x < a.Width(); ++x) {
+      for (int c = 0; c < 3; ++c) {
+        const T value = static_cast<T>((x + y * 3 + c) % 200);
+        a.Set(x, y, c, value);
+        b.Set(x, y, c, static_cast<T>(value + (x + c) % 2));
+      }
+    }
+  }
+}
+
+template <typename T>
+void BM_JRImageBuf_CompareWithinToleranceLoop(benchmark::State& state) {
+  jr::ImageBuf<T, 3> a, b;
+  MakeSlightlyDifferentFrames(a, b);
+  volatile bool close = false;
+  while (state.KeepRunning()) {
+    double max_error = 0.0;
+    for (int y = 0; y < a.Height(); ++y) {
+      for (int x = 0; x < a.Width(); ++x) {
+        for (int c = 0; c < 3; ++c) {
+          max_error = std::max(max_error,
+                               std::fabs(static_cast<double>(a.Get(x, y, c)) -
+                                         static_cast<double>(b.Get(x, y, c))));
+        }
+      }
+    }
+    close = max_error <= 1.0;
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(2 * a.TotalByteCount()));
+}
+BENCHMARK_TEMPLATE(BM_JRImageBuf_CompareWithinToleranceLoop, uint8_t);
+BENCHMARK_TEMPLATE(BM_JRImageBuf_CompareWithinToleranceLoop, float);
+
+template <typename T>
+void BM_JRImageBuf_CompareWithinTolerance(benchmark::State& state) {
+  jr::ImageBuf<T, 3> a, b;
+  MakeSlightlyDifferentFrames(a, b);
+  volatile bool close = false;
+  while (state.KeepRunning()) {
+    close = jr::ImagesAreClose(a, b, jr::ImageTolerance(1.0));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(2 * a.TotalByteCount()));
+}
+BENCHMARK_TEMPLATE(BM_JRImageBuf_CompareWithinTolerance, uint8_t);
+BENCHMARK_TEMPLATE(BM_JRImageBuf_CompareWithinTolerance, float);
+
 }  // anonymous namespace
+
+// Hand a 1080p frame from a producer to a consumer: through a mutex guarded
+// queue of freshly allocated images, vs. through a FrameRing's preallocated
+// slots.  Both sides run on one thread, so this measures the handoff overhead.
+void BM_JRImageBuf_MutexQueueHandoff(benchmark::State& state) {
+  typedef jr::ImageBuf<uint8_t, 3> ImageT;
+  std::mutex mutex;
+  std::deque<ImageT> queue;
+  uint8_t value = 0;
+  while (state.KeepRunning()) {
+    ImageT frame(1920, 1080);
+    frame.Set(0, 0, 0, ++value);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back(std::move(frame));
+    }
+    ImageT received;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      received = std::move(queue.front());
+      queue.pop_front();
+    }
+    volatile uint8_t sink = received.Get(0, 0, 0);
+    (void)sink;
+  }
+}
+BENCHMARK(BM_JRImageBuf_MutexQueueHandoff);
+
+void BM_JRFrameRing_Handoff(benchmark::State& state) {
+  typedef jr::ImageBuf<uint8_t, 3> ImageT;
+  jr::FrameRing<ImageT> ring(4, 1920, 1080, 3);
+  uint8_t value = 0;
+  while (state.KeepRunning()) {
+    ring.AcquireWrite()->Set(0, 0, 0, ++value);
+    ring.Publish();
+    const ImageT* received = ring.AcquireRead();
+    volatile uint8_t sink = received->Get(0, 0, 0);
+    (void)sink;
+    ring.Release();
+  }
+}
+BENCHMARK(BM_JRFrameRing_Handoff);
+
+// Clear and compare two 4096x4096 label masks that are ~1% foreground: a few
+// 64x64 blobs.
+template <typename ImageT>
+void DrawBlobs(ImageT& mask) {
+  mask.SetAll(0);
+  for (int blob = 0; blob < 40; ++blob) {
+    const int x0 = (blob * 997) % 4000, y0 = (blob * 1543) % 4000;
+    for (int y = y0; y < y0 + 64; ++y) {
+      for (int x = x0; x < x0 + 64; ++x) {
+        mask.Set(x, y, 0, static_cast<uint8_t>(blob + 1));
+      }
+    }
+  }
+}
+
+void BM_JRImageBuf_MaskClearAndCompare(benchmark::State& state) {
+  jr::ImageBuf<uint8_t, 1> a(4096, 4096), b(4096, 4096);
+  DrawBlobs(b);
+  while (state.KeepRunning()) {
+    a.SetAll(0);
+    a.Set(100, 100, 0, 1);
+    volatile bool sink = (a == b);
+    (void)sink;
+  }
+}
+BENCHMARK(BM_JRImageBuf_MaskClearAndCompare);
+
+void BM_JRSparseImageBuf_MaskClearAndCompare(benchmark::State& state) {
+  jr::SparseImageBuf<uint8_t, 1> a(4096, 4096), b(4096, 4096);
+  DrawBlobs(b);
+  while (state.KeepRunning()) {
+    a.SetAll(0);
+    a.Set(100, 100, 0, 1);
+    volatile bool sink = (a == b);
+    (void)sink;
+  }
+}
+BENCHMARK(BM_JRSparseImageBuf_MaskClearAndCompare);
+
+void BM_JRSparseImageBuf_MaskCopyIntoDense(benchmark::State& state) {
+  jr::SparseImageBuf<uint8_t, 1> mask(4096, 4096);
+  DrawBlobs(mask);
+  jr::ImageBuf<uint8_t, 1> dense(4096, 4096);
+  while (state.KeepRunning()) {
+    mask.CopyInto(dense);
+  }
+}
+BENCHMARK(BM_JRSparseImageBuf_MaskCopyIntoDense);
+
+void BM_JRImageBuf_MaskCopyIntoDense(benchmark::State& state) {
+  jr::ImageBuf<uint8_t, 1> mask(4096, 4096);
+  DrawBlobs(mask);
+  jr::ImageBuf<uint8_t, 1> dense(4096, 4096);
+  while (state.KeepRunning()) {
+    mask.CopyInto(dense);
+  }
+}
+BENCHMARK(BM_JRImageBuf_MaskCopyIntoDense);
@@ -3,6 +3,8 @@
 
 #include "benchmark/benchmark.h"
 
+#include "mem_utils.h"
+
 int main(int argc, const char** argv) {
 #ifdef SLOW_AND_STEADY
   std::cout << "Compiled with SLOW_AND_STEADY!" << std::endl;
@@ -10,6 +12,9 @@ int main(int argc, const char** argv) {
   std::cout << "Normal compilation." << std::endl;
 #endif
   benchmark::Initialize(&argc, argv);
+  // Pick MemFill(...) strategies for this machine up front, as an application
+  // would at startup.
+  jr::mem_utils::CalibrateMemFill();
   benchmark::RunSpecifiedBenchmarks();
   return 0;
 }
@@ -1,6 +1,7 @@
 #include <string>
 #include <iostream>
 #include <random>
+#include <vector>
 
 #include "benchmark/benchmark.h"
 
@@ -38,6 +39,19 @@ MAKE_SET_MEMORY_BENCHMARK(double);
 
 // Benchmarks for the non-templated MemFill function.
 
+// The strategy MemFill(...) uses for a buffer and pattern size; each cell of
+// the benchmarks below is labeled with it.
+std::string MemFillChoice(std::size_t buffer_size_bytes,
+                          std::size_t pattern_size_bytes) {
+  if (pattern_size_bytes == 1) {
+    return "MemFill uses memset";
+  }
+  return std::string("MemFill uses ") +
+         jr::mem_utils::MemFillStrategyName(
+             jr::mem_utils::GetMemFillDispatchTable().Lookup(
+                 buffer_size_bytes, pattern_size_bytes));
+}
+
 #define MAKE_MEM_FILL_BENCHMARK(FILL_FUNC_NAME) \
 static void BM_memutils_ ## FILL_FUNC_NAME(benchmark::State& state) { \
   uint8_t* buffer = new uint8_t[state.range_x()]; \
@@ -48,6 +62,7 @@ static void BM_memutils_ ## FILL_FUNC_NAME(benchmark::State& state) { \
   } \
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * \
       static_cast<int64_t>(state.range_x())); \
+  state.SetLabel(MemFillChoice(state.range_x(), state.range_y())); \
   delete[] buffer; \
   delete[] pattern; \
 } \
@@ -56,7 +71,97 @@ BENCHMARK(BM_memutils_ ## FILL_FUNC_NAME)->RangePair(1<<10, 20<<10, 1, 128);
 MAKE_MEM_FILL_BENCHMARK(MemFill);
 MAKE_MEM_FILL_BENCHMARK(MemFillSimple);
 MAKE_MEM_FILL_BENCHMARK(MemFillChunks);
+MAKE_MEM_FILL_BENCHMARK(MemFillPattern);
 
 #undef MAKE_MEM_FILL_BENCHMARK
 
+// The same, for pixel sized patterns (2 to 4 channels of 1 to 4 bytes) over a
+// 256KB buffer.
+
+#define MAKE_PIXEL_FILL_BENCHMARK(FILL_FUNC_NAME) \
+static void BM_memutils_ ## FILL_FUNC_NAME ## _Pixels(benchmark::State& state) { \
+  const int kBufferSize = 256 << 10; \
+  uint8_t* buffer = new uint8_t[kBufferSize]; \
+  uint8_t* pattern = new uint8_t[state.range_x()]; \
+  while (state.KeepRunning()) { \
+    jr::mem_utils::FILL_FUNC_NAME(buffer, kBufferSize, \
+                                  pattern, state.range_x()); \
+  } \
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * \
+      static_cast<int64_t>(kBufferSize)); \
+  state.SetLabel(MemFillChoice(kBufferSize, state.range_x())); \
+  delete[] buffer; \
+  delete[] pattern; \
+} \
+BENCHMARK(BM_memutils_ ## FILL_FUNC_NAME ## _Pixels) \
+    ->Arg(2)->Arg(3)->Arg(4)->Arg(6)->Arg(8)->Arg(12)->Arg(16);
+
+MAKE_PIXEL_FILL_BENCHMARK(MemFill);
+MAKE_PIXEL_FILL_BENCHMARK(MemFillSimple);
+MAKE_PIXEL_FILL_BENCHMARK(MemFillChunks);
+MAKE_PIXEL_FILL_BENCHMARK(MemFillPattern);
+
+#undef MAKE_PIXEL_FILL_BENCHMARK
+
+// Find the first difference between two 4MB arrays that only differ in their
+// last element, with ArraysAreDifferent(...) vs. a scalar loop (which is how
+// ArraysAreDifferent(...) used to work when asked for the index).
+const std::size_t ARRAY_COMPARE_BYTES = 4 << 20;
+
+template<typename T>
+void BM_memutils_ArraysAreDifferentIndex(benchmark::State& state) {
+  const std::size_t n = ARRAY_COMPARE_BYTES / sizeof(T);
+  std::vector<T> a(n, T(1)), b(n, T(1));
+  b[n - 1] = T(2);
+  volatile std::size_t sink = 0;
+  while (state.KeepRunning()) {
+    std::size_t diff_index = 0;
+    jr::mem_utils::ArraysAreDifferent(a.data(), b.data(), n, &diff_index);
+    sink = diff_index;
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(2 * ARRAY_COMPARE_BYTES));
+}
+BENCHMARK_TEMPLATE(BM_memutils_ArraysAreDifferentIndex, uint8_t);
+BENCHMARK_TEMPLATE(BM_memutils_ArraysAreDifferentIndex, uint16_t);
+BENCHMARK_TEMPLATE(BM_memutils_ArraysAreDifferentIndex, float);
+
+template<typename T>
+void BM_memutils_ScalarFirstDifference(benchmark::State& state) {
+  const std::size_t n = ARRAY_COMPARE_BYTES / sizeof(T);
+  std::vector<T> a(n, T(1)), b(n, T(1));
+  b[n - 1] = T(2);
+  volatile std::size_t sink = 0;
+  while (state.KeepRunning()) {
+    std::size_t i = 0;
+    while (i < n && a[i] == b[i]) {
+      ++i;
+    }
+    sink = i;
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(2 * ARRAY_COMPARE_BYTES));
+}
+BENCHMARK_TEMPLATE(BM_memutils_ScalarFirstDifference, uint8_t);
+BENCHMARK_TEMPLATE(BM_memutils_ScalarFirstDifference, uint16_t);
+BENCHMARK_TEMPLATE(BM_memutils_ScalarFirstDifference, float);
+
+template<typename T>
+void BM_memutils_CountDifferences(benchmark::State& state) {
+  const std::size_t n = ARRAY_COMPARE_BYTES / sizeof(T);
+  std::vector<T> a(n, T(1)), b(n, T(1));
+  for (std::size_t i = 0; i < n; i += 97) {
+    b[i] = T(2);
+  }
+  volatile std::size_t sink = 0;
+  while (state.KeepRunning()) {
+    sink = jr::mem_utils::CountDifferences(a.data(), b.data(), n);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+      static_cast<int64_t>(2 * ARRAY_COMPARE_BYTES));
+}
+BENCHMARK_TEMPLATE(BM_memutils_CountDifferences, uint8_t);
+BENCHMARK_TEMPLATE(BM_memutils_CountDifferences, uint16_t);
+BENCHMARK_TEMPLATE(BM_memutils_CountDifferences, float);
+
 }  // anonymous namespace
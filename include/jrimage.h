@@ -6,13 +6,18 @@
 #include <cstring>
 #include <thread>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "mem_utils.h"
 #include "math_utils.h"
 #include "template_utils.h"
+#include "jrimage_allocators.h"
 
 // TODO(cbraley): Make all the pointer methods return void* instead of uchar*.
 
@@ -20,12 +25,45 @@ namespace jr {
 
 // Forward declarations of all classes.
 template<typename ImageImplT> class ImageBase;  // CRTP base class.
-template<typename T, int NumChannels, typename Allocator> class ImageBuf;  // Raw 2D buffer without color info.
+template<typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes, typename Layout> class ImageBuf;  // Raw 2D buffer without color info.
 template<typename T, typename ColorSpace, typename Allocator> class Image;  // Image class with color info.
 
 /// Constant used to create an image with a dynamic channel count.
 const constexpr int DYNAMIC_CHANNELS = -1;
 
+/// Constant used to create an image whose rows are tightly packed (no padding
+/// between the end of one row and the start of the next).
+const constexpr std::size_t PACKED_ROWS = 0;
+
+/// What ImageBuf::Resize does with the existing pixels.  DISCARD_CONTENTS
+/// leaves the resized image uninitialized.  PRESERVE_CONTENTS keeps every
+/// pixel (and channel) that lies inside both the old and new dimensions, and
+/// zeros the rest.
+enum ResizeContents { DISCARD_CONTENTS, PRESERVE_CONTENTS };
+
+/// Memory layout tags.
+/// InterleavedLayout stores all channels of a pixel next to each other
+/// (RGBRGBRGB...).  PlanarLayout stores each channel in its own plane
+/// (RRR...GGG...BBB...), with every plane sharing the same row pitch.
+struct InterleavedLayout {};
+struct PlanarLayout {};
+
+/// Tiled memory layout tag (see TiledImageBuf in jrimage_tiled.h).  The image
+/// is split into TileW x TileH tiles, each of which is stored contiguously with
+/// interleaved channels.  Inside a tile, pixels are stored row major, or in
+/// Morton (Z) order if ZOrder is true.
+template<int TileW = 64, int TileH = 64, bool ZOrder = false>
+struct TiledLayout {
+  static constexpr int TILE_WIDTH = TileW;
+  static constexpr int TILE_HEIGHT = TileH;
+  static constexpr bool Z_ORDER = ZOrder;
+};
+
+/// IsTiledLayout<L>::value is true if L is a TiledLayout.
+template<typename Layout> struct IsTiledLayout : std::false_type {};
+template<int TileW, int TileH, bool ZOrder>
+struct IsTiledLayout<TiledLayout<TileW, TileH, ZOrder>> : std::true_type {};
+
 // Traits class.  Each CTRP leaf node class must specialize ImageTraits.
 template<typename ImageT> struct ImageTraits;
 
@@ -42,6 +80,53 @@ template<typename ImageImplLhsT, typename ImageImplRhsT>
 bool operator==(const ImageBase<ImageImplLhsT> &lhs,
                 const ImageBase<ImageImplRhsT> &rhs);
 
+// Pixel-for-pixel comparison of two images with matching dimensions and
+// channel types.  The last argument is true_type if both images have linear
+// rows, and false_type otherwise.
+template<typename ImageImplLhsT, typename ImageImplRhsT>
+bool PixelsEqual(const ImageBase<ImageImplLhsT>& lhs,
+                 const ImageBase<ImageImplRhsT>& rhs, std::true_type);
+template<typename ImageImplLhsT, typename ImageImplRhsT>
+bool PixelsEqual(const ImageBase<ImageImplLhsT>& lhs,
+                 const ImageBase<ImageImplRhsT>& rhs, std::false_type);
+
+// Return true if every value of image has the same bytes as *value, which
+// must point to a single value of the image's channel type.  The last argument
+// of the helper overloads is true_type if the image has linear rows.
+template<typename ImageImplT>
+bool AllValuesEqual(const ImageBase<ImageImplT>& image, const void* value);
+template<typename ImageImplT>
+bool AllValuesEqual(const ImageBase<ImageImplT>& image, const void* value,
+                    std::true_type);
+template<typename ImageImplT>
+bool AllValuesEqual(const ImageBase<ImageImplT>& image, const void* value,
+                    std::false_type);
+
+// Deep comparison of a planar image against an interleaved one.  The images
+// must have matching dimensions and channel types.
+template<typename ImageImplPlanarT, typename ImageImplInterleavedT>
+bool PlanarMatchesInterleaved(const ImageBase<ImageImplPlanarT>& planar,
+                              const ImageBase<ImageImplInterleavedT>& interleaved);
+
+// Walk two non-planar images with matching dimensions in lockstep, calling
+// func(a_pixels, b_pixels, num_pixels) once for each run of pixels that is
+// stored contiguously in both images.  If func returns false the walk stops
+// early and this function returns false.  Pixels of a are read through
+// GetConstRowSpan(...), as are those of b if it is const; otherwise func gets
+// mutable pointers into b, from GetRowSpan(...).
+template<typename ImageImplAT, typename ImageBT, typename FuncT>
+bool ForEachMatchingRowSpan(const ImageBase<ImageImplAT>& a, ImageBT& b,
+                            FuncT func);
+
+// Zero image using num_threads threads, thread i touching the band of rows
+// [i * H / num_threads, (i + 1) * H / num_threads) of every plane.  Memory from
+// HugePageAllocator (or any mmap based allocator) is only placed on a NUMA node
+// when it is first written, so this puts each band on the node of the thread
+// that zeroed it.  Worker threads that later process the same bands (ideally
+// pinned to the same cores) then work on node local memory.
+template<typename ImageImplT>
+void ParallelFirstTouch(ImageBase<ImageImplT>& image, int num_threads);
+
 // Print information about an image to an ostream, and print it's full raster if
 // it is small.
 template<typename ImageImplT>
@@ -62,10 +147,18 @@ std::ostream& operator<<(std::ostream& os, const ImageBase<ImageImplT>& image);
 ///     bool IsMemoryContiguous() const;
 ///     std::size_t PixelSizeBytes() const
 ///     std::size_t TotalByteCount() const
+///     std::size_t PlaneStride() const
 ///
 ///     uint8_t* GetRow(int y)
 ///     const uint8_t* GetRow(int y) const
+///     uint8_t* GetPlaneRow(int plane, int y)
+///     const uint8_t* GetPlaneRow(int plane, int y) const
 ///     uint8_t* GetPointer(int x, int y, int c) const
+///     uint8_t* GetRowSpan(int x, int y, int* span_pixels) const
+///     const uint8_t* GetConstRowSpan(int x, int y, int* span_pixels) const
+///     bool IsKnownZero() const
+///     bool IsUniform(ChannelT* value) const
+///     bool SetUniform(const ChannelT& value)
 ///
 ///     bool Resize(int new_w, int new_h, int new_c);
 ///
@@ -100,14 +193,58 @@ class ImageBase {
     return !IsChannelCountStatic();
   }
 
+  // Static constexpr helper function that returns true if each channel is
+  // stored in its own plane.
+  static constexpr bool IsPlanar() {
+    return std::is_same<typename ImageTraits<ImageImplT>::LayoutT,
+                        PlanarLayout>::value;
+  }
+
+  // Static constexpr helper function that returns true if each row of each
+  // plane is stored contiguously, so GetRow(...) and GetPlaneRow(...) can be
+  // used.  This is false for tiled images.
+  static constexpr bool HasLinearRows() {
+    return !IsTiledLayout<typename ImageTraits<ImageImplT>::LayoutT>::value;
+  }
+
+  // Number of planes; this is 1 for interleaved images.
+  inline int NumPlanes() const { return IsPlanar() ? Channels() : 1; }
+  // Number of T's in a single row of a single plane (not including padding).
+  inline std::size_t PlaneRowNumel() const {
+    return IsPlanar() ? Width() : Width() * Channels();
+  }
+
   inline bool IsMemoryContiguous() const { return Impl().IsMemoryContiguous(); }
   inline std::size_t PixelSizeBytes() const { return Impl().PixelSizeBytes(); }
   inline std::size_t TotalByteCount() const { return Impl().TotalByteCount(); }
   inline ChannelT* GetRow(int y) { return Impl().GetRow(y); }
   inline const ChannelT* GetRow(int y) const { return Impl().GetRow(y); }
+  inline ChannelT* GetPlaneRow(int plane, int y) { return Impl().GetPlaneRow(plane, y); }
+  inline const ChannelT* GetPlaneRow(int plane, int y) const { return Impl().GetPlaneRow(plane, y); }
+  inline std::size_t PlaneStride() const { return Impl().PlaneStride(); }
   inline ChannelT* GetPointer(int x, int y, int c) const { return Impl().GetPointer(x, y, c); }
   inline ChannelT Get(int x, int y, int c) const { return Impl().Get(x, y, c); }
+  // Pointer to pixel (x, y).  The number of pixels starting at (x, y) and
+  // moving right that are stored contiguously is written to *span_pixels.
+  // Only valid for non-planar images.
+  inline ChannelT* GetRowSpan(int x, int y, int* span_pixels) const {
+    return Impl().GetRowSpan(x, y, span_pixels);
+  }
+  // Read-only version of GetRowSpan(...).  Unlike the mutable accessors this
+  // never counts as a write: it doesn't clear IsKnownZero(), detach shared
+  // CowImageBuf blocks, or allocate SparseImageBuf tiles.
+  inline const ChannelT* GetConstRowSpan(int x, int y, int* span_pixels) const {
+    return Impl().GetConstRowSpan(x, y, span_pixels);
+  }
   inline bool Resize(int new_w, int new_h, int new_c) { return Impl().Resize(new_w, new_h, new_c); }
+  // True if every value in the image is known to be zero without looking.
+  // Image types that don't track this always return false.
+  inline bool IsKnownZero() const { return Impl().IsKnownZero(); }
+  // True if every value in the image is known to equal *value (which is then
+  // set) without looking, e.g. because the image was filled by SetAll(...) and
+  // has not been written to since.  Image types that don't track this return
+  // true only when IsKnownZero().
+  inline bool IsUniform(ChannelT* value) const { return Impl().IsUniform(value); }
 
 
 
@@ -126,21 +263,56 @@ class ImageBase {
   // Total number of measurements.
   inline int Numel() const { return Width() * Height() * Channels(); }
 
-  void SetAll(const ChannelT& new_value) {
-    if (IsMemoryContiguous()) {
-      jr::mem_utils::SetMemory(GetRow(0), new_value, Numel());
-    } else {
-      for (int y = 0; y < Height(); ++y) {
-        ChannelT* row = GetRow(y);
-        jr::mem_utils::SetMemory(row, new_value, Width());
-      }
+  // Set every value of every pixel to new_value.  Large images are written
+  // with non-temporal stores (see mem_utils::CacheHint), which hint can force
+  // or disable.
+  void SetAll(const ChannelT& new_value,
+              jr::mem_utils::CacheHint hint = jr::mem_utils::CACHE_HINT_AUTO) {
+    ChannelT current_value;
+    if (IsUniform(&current_value) &&
+        memcmp(&current_value, &new_value, sizeof(ChannelT)) == 0) {
+      return;  // Nothing to write.
+    }
+    // Image types that can represent a uniform image without storing it (see
+    // CowImageBuf) just record the value.
+    if (Impl().SetUniform(new_value)) {
+      return;
+    }
+    SetAllHelper(new_value, UseNonTemporalStores(hint),
+                 std::integral_constant<bool, HasLinearRows()>());
+  }
+
+  // Set every pixel to the Channels() values starting at pixel.  Interleaved
+  // images are filled with mem_utils::PatternFiller, which streams the pixel
+  // out with vector stores rather than writing one pixel at a time.  The hint
+  // works as for SetAll(...).
+  void SetAllPixels(
+      const ChannelT* pixel,
+      jr::mem_utils::CacheHint hint = jr::mem_utils::CACHE_HINT_AUTO) {
+    // A pixel whose channels are all the same is an ordinary (and possibly
+    // lazy) SetAll(...).
+    bool channels_match = true;
+    for (int c = 1; c < Channels() && channels_match; ++c) {
+      channels_match = memcmp(&pixel[c], &pixel[0], sizeof(ChannelT)) == 0;
+    }
+    if (channels_match) {
+      SetAll(pixel[0], hint);
+    } else if (Numel() > 0) {
+      SetAllPixelsHelper(pixel, UseNonTemporalStores(hint),
+                         std::integral_constant<bool, HasLinearRows()>());
     }
   }
 
   void GetAllChannels(int x, int y, ChannelT* out) const {
-    memcpy(static_cast<void*>(out),
-           static_cast<const void*>(GetPointer(x, y, 0)),
-           PixelSizeBytes());
+    if (IsPlanar()) {
+      for (int c = 0; c < Channels(); ++c) {
+        out[c] = *GetPointer(x, y, c);
+      }
+    } else {
+      memcpy(static_cast<void*>(out),
+             static_cast<const void*>(GetPointer(x, y, 0)),
+             PixelSizeBytes());
+    }
   }
 
   void Set(int x, int y, int c, const ChannelT& val) {
@@ -148,13 +320,23 @@ class ImageBase {
   }
 
   void SetAllChannels(int x, int y, const ChannelT* values) {
-    memcpy(static_cast<void*>(GetPointer(x, y, 0)),
-           static_cast<const void*>(values),
-           PixelSizeBytes());
+    if (IsPlanar()) {
+      for (int c = 0; c < Channels(); ++c) {
+        *GetPointer(x, y, c) = values[c];
+      }
+    } else {
+      memcpy(static_cast<void*>(GetPointer(x, y, 0)),
+             static_cast<const void*>(values),
+             PixelSizeBytes());
+    }
   }
 
+  // Make result_window a view of the given region.  The window is usually an
+  // image of the same type; see the implementation's GetWin(...) for the
+  // window types it supports.
+  template <typename WindowT>
   bool GetWindow(int x, int y, int width, int height,
-                 ImageImplT& result_window) const {
+                 WindowT& result_window) const {
     // Ensure that the window location is valid.
     const bool window_loc_okay =
         InBounds(x, y) && InBounds(x + width - 1, y + height - 1);
@@ -169,14 +351,21 @@ class ImageBase {
 
   // More complex functions.
 
+  // Copy this image into dest, resizing dest to match.  Large destinations
+  // are written with non-temporal stores (see mem_utils::CacheHint), which
+  // hint can force or disable.
   template <class ImageImplOtherT>
-  bool CopyInto(jr::ImageBase<ImageImplOtherT> & dest) const {
+  bool CopyInto(
+      jr::ImageBase<ImageImplOtherT> & dest,
+      jr::mem_utils::CacheHint hint = jr::mem_utils::CACHE_HINT_AUTO) const {
     // If the destination image does not have a dynamic channel count, we
     // must have the exact same number of channels.
     if ((!dest.IsChannelCountDynamic()) && Channels() != dest.Channels()) {
       return false;
     }
-    assert(dest.Resize(Width(), Height(), Channels()));
+    if (!dest.Resize(Width(), Height(), Channels())) {
+      return false;
+    }
     assert(jr::DimensionsMatch(*this, dest));
 
     // TODO(cbraley): Remove this limitation and allow casting and conversions....
@@ -186,23 +375,189 @@ class ImageBase {
                      typename ImageTraits<ImageImplOtherT>::ChannelT>::value,
         "Channel types must match!");
 
-    // Copy the data over.
+    // A uniform source is a fill, which needs half the memory bandwidth of a
+    // copy (or none at all, if dest can be uniform too).
+    ChannelT uniform_value;
+    if (IsUniform(&uniform_value)) {
+      dest.SetAll(uniform_value, hint);
+      return true;
+    }
+
+    // Copy the data over.  Row padding (if any) is never copied.
+    CopyPixelsInto(dest, UseNonTemporalStores(hint),
+                   std::integral_constant<bool,
+                       HasLinearRows() &&
+                       ImageBase<ImageImplOtherT>::HasLinearRows()>());
+    return true;
+  }
+
+ private:
+  // Return true if writing every pixel of this image with the given hint
+  // should use non-temporal stores.
+  bool UseNonTemporalStores(jr::mem_utils::CacheHint hint) const {
+    return jr::mem_utils::UseNonTemporalStores(Numel() * sizeof(ChannelT),
+                                               hint);
+  }
+
+  static void FillValues(ChannelT* dst, const ChannelT& value, std::size_t num,
+                         bool non_temporal) {
+    if (non_temporal) {
+      jr::mem_utils::SetMemoryNonTemporal(dst, value, num);
+    } else {
+      jr::mem_utils::SetMemory(dst, value, num);
+    }
+  }
+
+  static void CopyBytes(void* dst, const void* src, std::size_t num_bytes,
+                        bool non_temporal) {
+    if (non_temporal) {
+      jr::mem_utils::CopyNonTemporal(dst, src, num_bytes);
+    } else {
+      memcpy(dst, src, num_bytes);
+    }
+  }
+
+  // Implementation of SetAll(...) for images with linear rows.
+  void SetAllHelper(const ChannelT& new_value, bool non_temporal,
+                    std::true_type) {
+    if (IsMemoryContiguous()) {
+      FillValues(GetPlaneRow(0, 0), new_value, Numel(), non_temporal);
+    } else {
+      // Only touch the pixel data in each row; never the row padding.
+      const std::size_t row_numel = PlaneRowNumel();
+      for (int p = 0; p < NumPlanes(); ++p) {
+        for (int y = 0; y < Height(); ++y) {
+          ChannelT* row = GetPlaneRow(p, y);
+          FillValues(row, new_value, row_numel, non_temporal);
+        }
+      }
+    }
+  }
+
+  // Implementation of SetAll(...) for tiled images; fill each contiguous run.
+  void SetAllHelper(const ChannelT& new_value, bool non_temporal,
+                    std::false_type) {
+    const int num_channels = Channels();
+    for (int y = 0; y < Height(); ++y) {
+      int span = 0;
+      for (int x = 0; x < Width(); x += span) {
+        ChannelT* pixels = GetRowSpan(x, y, &span);
+        FillValues(pixels, new_value, span * num_channels, non_temporal);
+      }
+    }
+  }
+
+  // Implementation of SetAllPixels(...) for images with linear rows.
+  void SetAllPixelsHelper(const ChannelT* pixel, bool non_temporal,
+                          std::true_type) {
+    if (IsPlanar()) {
+      // Each plane is a fill with a single value.
+      for (int p = 0; p < NumPlanes(); ++p) {
+        if (IsMemoryContiguous()) {
+          FillValues(GetPlaneRow(p, 0), pixel[p], Width() * Height(),
+                     non_temporal);
+        } else {
+          for (int y = 0; y < Height(); ++y) {
+            FillValues(GetPlaneRow(p, y), pixel[p], Width(), non_temporal);
+          }
+        }
+      }
+      return;
+    }
+    const jr::mem_utils::PatternFiller filler(pixel, PixelSizeBytes());
     if (IsMemoryContiguous()) {
-      memcpy(static_cast<void*>(dest.GetRow(0)),
-             static_cast<const void*>(GetRow(0)),
-             TotalByteCount());
+      FillPixels(filler, GetPlaneRow(0, 0), Numel() * sizeof(ChannelT),
+                 non_temporal);
     } else {
-      const std::size_t row_bytes = Width() * PixelSizeBytes();
+      // Only touch the pixel data in each row; never the row padding.
       for (int y = 0; y < Height(); ++y) {
-        memcpy(static_cast<void*>(dest.GetRow(y)),
-               static_cast<const void*>(GetRow(y)),
-               row_bytes);
+        FillPixels(filler, GetPlaneRow(0, y), RowSizeBytes(), non_temporal);
       }
     }
-    return true;
   }
 
- private:
+  // Implementation of SetAllPixels(...) for tiled images; fill each
+  // contiguous run.
+  void SetAllPixelsHelper(const ChannelT* pixel, bool non_temporal,
+                          std::false_type) {
+    const jr::mem_utils::PatternFiller filler(pixel, PixelSizeBytes());
+    for (int y = 0; y < Height(); ++y) {
+      int span = 0;
+      for (int x = 0; x < Width(); x += span) {
+        ChannelT* pixels = GetRowSpan(x, y, &span);
+        FillPixels(filler, pixels, span * PixelSizeBytes(), non_temporal);
+      }
+    }
+  }
+
+  static void FillPixels(const jr::mem_utils::PatternFiller& filler,
+                         ChannelT* dst, std::size_t num_bytes,
+                         bool non_temporal) {
+    if (non_temporal) {
+      filler.FillNonTemporal(dst, num_bytes);
+    } else {
+      filler.Fill(dst, num_bytes);
+    }
+  }
+
+  // Implementation of CopyInto(...) when both images have linear rows.
+  template <class ImageImplOtherT>
+  void CopyPixelsInto(jr::ImageBase<ImageImplOtherT>& dest, bool non_temporal,
+                      std::true_type) const {
+    if (IsPlanar() != dest.IsPlanar()) {
+      // Layout conversion; (de)interleave one row at a time.  These gather or
+      // scatter values, so they always use ordinary stores.
+      for (int y = 0; y < Height(); ++y) {
+        if (IsPlanar()) {
+          jr::mem_utils::Interleave(GetPlaneRow(0, y), PlaneStride(), Width(),
+                                    Channels(), dest.GetPlaneRow(0, y));
+        } else {
+          jr::mem_utils::Deinterleave(GetPlaneRow(0, y), Width(), Channels(),
+                                      dest.GetPlaneRow(0, y),
+                                      dest.PlaneStride());
+        }
+      }
+    } else if (IsMemoryContiguous() && dest.IsMemoryContiguous()) {
+      CopyBytes(static_cast<void*>(dest.GetPlaneRow(0, 0)),
+                static_cast<const void*>(GetPlaneRow(0, 0)),
+                TotalByteCount(), non_temporal);
+    } else {
+      const std::size_t row_bytes = PlaneRowNumel() * sizeof(ChannelT);
+      for (int p = 0; p < NumPlanes(); ++p) {
+        for (int y = 0; y < Height(); ++y) {
+          CopyBytes(static_cast<void*>(dest.GetPlaneRow(p, y)),
+                    static_cast<const void*>(GetPlaneRow(p, y)),
+                    row_bytes, non_temporal);
+        }
+      }
+    }
+  }
+
+  // Implementation of CopyInto(...) when either image is tiled.
+  template <class ImageImplOtherT>
+  void CopyPixelsInto(jr::ImageBase<ImageImplOtherT>& dest, bool non_temporal,
+                      std::false_type) const {
+    if (IsPlanar() || dest.IsPlanar()) {
+      // No contiguous runs in common; copy value by value.
+      for (int y = 0; y < Height(); ++y) {
+        for (int x = 0; x < Width(); ++x) {
+          for (int c = 0; c < Channels(); ++c) {
+            dest.Set(x, y, c, Get(x, y, c));
+          }
+        }
+      }
+    } else {
+      const std::size_t pixel_bytes = PixelSizeBytes();
+      ForEachMatchingRowSpan(*this, dest,
+          [pixel_bytes, non_temporal](const ChannelT* src, ChannelT* dst,
+                                      int num_pixels) {
+            CopyBytes(static_cast<void*>(dst), static_cast<const void*>(src),
+                      num_pixels * pixel_bytes, non_temporal);
+            return true;
+          });
+    }
+  }
+
   // The helper functions Impl(...) cast the "this" pointer to an instance
   // of the ImageImplT type (the concrete image implementation).
   inline const ImageImplT& Impl() const {
@@ -224,11 +579,73 @@ class ImageBase {
 };
 
 
-template<typename T, int NumChannels, typename Allocator>
-struct ImageTraits<ImageBuf<T, NumChannels, Allocator>> {
+namespace implementation_details {
+
+// Control block for an ImageBuf memory block that is owned jointly by an image
+// and some number of its windows.  The block (and the control block itself) is
+// released by whichever reference is dropped last, from any thread.  Only the
+// reference count is shared; each ImageBuf object is still meant to be used by
+// one thread at a time.
+//
+// The block is released through the allocator that allocated it, or, for
+// adopted external memory, through a caller supplied deleter.
+template <typename T, typename Allocator>
+class SharedImageStorage {
+ public:
+  typedef std::function<void(T*)> Deleter;
+
+  SharedImageStorage(T* buf, std::size_t numel, const Allocator& allocator)
+      : ref_count_(1), buf_(buf), numel_(numel), allocator_(allocator) {}
+  SharedImageStorage(T* buf, Deleter deleter)
+      : ref_count_(1), buf_(buf), numel_(0), deleter_(std::move(deleter)) {}
+
+  void AddRef() { ref_count_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Drop a reference, freeing the pixel memory and this control block if it
+  // was the last one.
+  void Release() {
+    if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      if (deleter_) {
+        deleter_(buf_);
+      } else {
+        allocator_.deallocate(buf_, numel_);
+      }
+      delete this;
+    }
+  }
+
+  long UseCount() const { return ref_count_.load(std::memory_order_relaxed); }
+
+  // True if the caller holds the only reference.  Unlike UseCount() == 1, this
+  // also orders every access made through other references before they were
+  // dropped ahead of the caller's subsequent writes.
+  bool IsUnique() const {
+    return ref_count_.load(std::memory_order_acquire) == 1;
+  }
+
+ private:
+  std::atomic<long> ref_count_;
+  T* buf_;
+  std::size_t numel_;
+  Allocator allocator_;
+  Deleter deleter_;
+
+  ~SharedImageStorage() {}
+  SharedImageStorage(const SharedImageStorage&) = delete;
+  SharedImageStorage& operator=(const SharedImageStorage&) = delete;
+};
+
+}  // namespace implementation_details
+
+template<typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+         typename Layout>
+struct ImageTraits<ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>> {
   // Primitive type used for a single channel.
   typedef T ChannelT;
 
+  // Memory layout tag; InterleavedLayout or PlanarLayout.
+  typedef Layout LayoutT;
+
   // ChannelCountKnownAtCompileTime is true_type if we know the channel count
   // at compile time, or false_type otherwise.
   typedef typename std::conditional<NumChannels != DYNAMIC_CHANNELS,
@@ -237,10 +654,36 @@ struct ImageTraits<ImageBuf<T, NumChannels, Allocator>> {
 };
 
 /// Core templated image class.
+///
+/// If RowAlignBytes is not PACKED_ROWS, every row is padded out so that
+/// consecutive rows start RowAlignBytes apart.  Paired with an Allocator that
+/// aligns the base pointer to RowAlignBytes (see AlignedImageBuf below) this
+/// guarantees that every row of the image starts on an aligned boundary, so
+/// vectorized kernels can run over each row without scalar prologues.  Padding
+/// elements are never read, written, copied, or compared.
+///
+/// With PlanarLayout, the image is stored as Channels() single channel planes
+/// laid out one after the other.  Each row of each plane is padded according
+/// to RowAlignBytes, and GetRow(y) returns row y of the first plane.
+///
+/// By default windows obtained from GetWin are plain non-owning aliases, and
+/// dangle once their parent is resized or destroyed.  Calling Share() (or
+/// GetSharedWin) moves the image's memory into reference counted storage;
+/// from then on every window of the image holds a reference, so windows and
+/// parent may be destroyed in any order and on any thread.  Resizing a shared
+/// image detaches it: it gets a fresh private buffer and the old block lives
+/// on for as long as any window still references it.
+///
+/// Like std::vector, an ImageBuf remembers how much memory it has allocated
+/// (Capacity()), and Resize/Allocate reuse the existing block whenever the new
+/// image fits inside it.  Use Reserve() to preallocate for the largest expected
+/// size, and ShrinkToFit() to give back unused memory.
 template <typename T,  // Primitive type stored in the array.
           int NumChannels = DYNAMIC_CHANNELS,  // Channel count, or DYNAMIC_CHANNELS.
-          typename Allocator = std::allocator<T>>  // Allocator used for memory allocation.
-class ImageBuf : public ImageBase<ImageBuf<T, NumChannels, Allocator>> {
+          typename Allocator = std::allocator<T>,  // Allocator used for memory allocation.
+          std::size_t RowAlignBytes = PACKED_ROWS,  // Row byte alignment, or PACKED_ROWS.
+          typename Layout = InterleavedLayout>  // InterleavedLayout or PlanarLayout.
+class ImageBuf : public ImageBase<ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>> {
  public:
   // Static assertions that the template arguments are reasonable.
   static_assert(std::is_trivial<T>::value,
@@ -253,19 +696,47 @@ class ImageBuf : public ImageBase<ImageBuf<T, NumChannels, Allocator>> {
       NumChannels == DYNAMIC_CHANNELS || NumChannels > 0,
       "NumChannels must either be a positive integer, or be the special "
       "DYNAMIC value.");
+  static_assert(RowAlignBytes % sizeof(T) == 0,
+                "ImageBuf RowAlignBytes must be a multiple of sizeof(T), "
+                "otherwise rows could not start on a T boundary.");
+  static_assert(std::is_same<Layout, InterleavedLayout>::value ||
+                std::is_same<Layout, PlanarLayout>::value,
+                "ImageBuf Layout must be InterleavedLayout or PlanarLayout.");
 
   // Constructors.
+  //
+  // Each constructor optionally takes the allocator instance to use, which is
+  // needed for stateful allocators such as ArenaAllocator.  The image keeps a
+  // copy of it for all later allocations, moves carry it along with the
+  // buffer, and windows obtained from GetWin inherit it.
 
   // Construct an image with a dynamic number of channels.
   // This constructor can only be called if NumChannels == DYNAMIC_CHANNELS.
-  ImageBuf(int width, int height, int num_channels);
+  ImageBuf(int width, int height, int num_channels,
+           const Allocator& allocator = Allocator());
 
   // Construct an ImageBuf with a static number of channels.
   // This constructor can only be called if NumChannels != DYNAMIC_CHANNELS.
-  ImageBuf(int width, int height);
+  ImageBuf(int width, int height, const Allocator& allocator = Allocator());
 
   // Construct an empty ImageBuf.
   ImageBuf();
+  explicit ImageBuf(const Allocator& allocator);
+
+  // The allocator used by this image.
+  inline const Allocator& GetAllocator() const { return allocator_; }
+
+  // Move construction and assignment.  These are O(1): the pixel buffer, its
+  // ownership, the allocator, and the strides are all transferred, and other
+  // is left empty (as if default constructed).  Windows into other's memory
+  // remain valid, since the buffer itself does not move.
+  ImageBuf(ImageBuf&& other) noexcept;
+  ImageBuf& operator=(ImageBuf&& other) noexcept;
+
+  // Exchange the contents of two images in O(1).  The allocators are swapped
+  // along with the buffers, so each buffer is always freed by the allocator
+  // that allocated it.
+  void swap(ImageBuf& other) noexcept;
 
   // Destructor.
   ~ImageBuf();
@@ -276,50 +747,242 @@ class ImageBuf : public ImageBase<ImageBuf<T, NumChannels, Allocator>> {
   inline int Channels() const {
     return SelfT::IsChannelCountDynamic() ? c_ : NumChannels;
   }
-  inline bool IsMemoryContiguous() const { return Width() == row_stride_; }
+  inline bool IsMemoryContiguous() const {
+    return static_cast<std::size_t>(this->PlaneRowNumel()) == row_stride_ &&
+           (!SelfT::IsPlanar() || plane_stride_ == row_stride_ * Height());
+  }
 
-  inline T* GetRow(int y) { return buf_ + y * row_stride_; }
+  // Every accessor that hands out a mutable pointer clears IsKnownZero().
+  inline T* GetRow(int y) {
+    ForgetKnownZero();
+    return buf_ + y * row_stride_;
+  }
   inline const T* GetRow(int y) const { return buf_ + y * row_stride_; }
-  inline T Get(int x, int y, int c) const { return *GetPointer(x, y, c); }
-  inline T* GetPointer(int x, int y, int c) const { return buf_ + (row_stride_ * y) + (x * Channels()) + c; }
+  inline T* GetPlaneRow(int plane, int y) {
+    ForgetKnownZero();
+    return buf_ + plane * plane_stride_ + y * row_stride_;
+  }
+  inline const T* GetPlaneRow(int plane, int y) const {
+    return buf_ + plane * plane_stride_ + y * row_stride_;
+  }
+  inline T Get(int x, int y, int c) const { return *PointerAt(x, y, c); }
+  inline T* GetPointer(int x, int y, int c) const {
+    ForgetKnownZero();
+    return PointerAt(x, y, c);
+  }
+  inline T* GetRowSpan(int x, int y, int* span_pixels) const {
+    assert(!SelfT::IsPlanar());
+    *span_pixels = Width() - x;
+    return GetPointer(x, y, 0);
+  }
+  inline const T* GetConstRowSpan(int x, int y, int* span_pixels) const {
+    assert(!SelfT::IsPlanar());
+    *span_pixels = Width() - x;
+    return PointerAt(x, y, 0);
+  }
+
+  // True if the whole memory block is known to be zero, because it came from
+  // an allocator that returns zeroed memory (see AllocatesZeroedMemory) and
+  // nothing has been handed a mutable pointer into it since.  SetAll(0) is
+  // free while this holds, so images allocated with e.g. ZeroedAllocator cost
+  // no memory bandwidth until they are first written.
+  inline bool IsKnownZero() const {
+    return known_zero_.load(std::memory_order_relaxed);
+  }
+  inline bool IsUniform(T* value) const {
+    if (!IsKnownZero()) {
+      return false;
+    }
+    memset(static_cast<void*>(value), 0, sizeof(T));
+    return true;
+  }
+  inline bool SetUniform(const T& value) { return false; }
   inline std::size_t PixelSizeBytes() const { return sizeof(T) * Channels(); }
 
   // Inclusive of padding.
   inline std::size_t TotalByteCount() const {
-    return row_stride_ * sizeof(T) * Height();
+    return SelfT::IsPlanar() ? plane_stride_ * sizeof(T) * Channels()
+                             : row_stride_ * sizeof(T) * Height();
   }
 
+  // Distance between the start of consecutive planes, in T's.
+  inline std::size_t PlaneStride() const { return plane_stride_; }
+
+  // Distance between the start of consecutive rows (of a single plane, for
+  // planar images), in T's and in bytes.  These are inclusive of padding.
+  inline std::size_t RowStride() const { return row_stride_; }
+  inline std::size_t RowPitchBytes() const { return row_stride_ * sizeof(T); }
+
+  // Byte alignment of each row, or PACKED_ROWS.
+  static constexpr std::size_t RowAlignment() { return RowAlignBytes; }
+
   // TODO(cbraley): Diff allocators and channel counts!
   // TODO(cbraley): Rename? and make private.
+  // Note that windows share the row stride of their parent, so a window whose
+  // x offset is not a multiple of the alignment will not have aligned rows.
   inline bool GetWin(int x, int y, int width, int height,
-                     ImageBuf<T, NumChannels, Allocator>& window) const {
-    // First, free any memory the image may own.  This invalidates all
+                     ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>& window) const {
+    // Take a reference on shared storage first, in case window currently holds
+    // the last reference to it.
+    if (shared_ != nullptr) {
+      shared_->AddRef();
+    }
+
+    // Free any memory the window may own.  This invalidates all unshared
     // windows into that data.
     window.FreeMemIfOwned();
 
+    window.shared_ = shared_;
     window.w_ = width;
     window.h_ = height;
     window.c_ = c_;
     window.buf_ = GetPointer(x, y, 0);
     window.owns_data_ = false;
     window.allocator_ = allocator_;
-    window.row_stride_ = row_stride_ + ((Width() - width) * Channels());
+    window.row_stride_ = row_stride_;
+    window.plane_stride_ = plane_stride_;
+    window.capacity_ = 0;
+    window.known_zero_.store(false, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Make this image a view of external memory that holds a width x height
+  // image with num_channels channels, whose rows start row_pitch_bytes apart
+  // (or PACKED_ROWS if rows are tightly packed).  The pitch may include any
+  // amount of padding, but must be a multiple of sizeof(T) (and of
+  // RowAlignBytes, if set).  Planar images must store their planes back to back,
+  // each Height() rows of row_pitch_bytes.  data must be aligned for T (and to
+  // RowAlignBytes, if set).
+  //
+  // Without a deleter the image does not own data, exactly like a window from
+  // GetWin, and the caller must keep it alive.  With a deleter, ownership is
+  // transferred: the image becomes shared (see Share()), and deleter(data) is
+  // called once the image and all of its windows have let go of the memory.
+  //
+  // Returns false, leaving this image and ownership of data untouched, if the
+  // arguments do not describe a valid image for this ImageBuf type.
+  bool WrapExternal(T* data, int width, int height, int num_channels,
+                    std::size_t row_pitch_bytes = PACKED_ROWS,
+                    std::function<void(T*)> deleter = nullptr) {
+    const int plane_c = SelfT::IsPlanar() ? 1 : num_channels;
+    const std::size_t min_pitch_bytes = sizeof(T) * width * plane_c;
+    if (row_pitch_bytes == PACKED_ROWS) {
+      row_pitch_bytes = min_pitch_bytes;
+    }
+    if (data == nullptr || width < 0 || height < 0 || num_channels <= 0 ||
+        (!SelfT::IsChannelCountDynamic() && num_channels != NumChannels) ||
+        row_pitch_bytes < min_pitch_bytes || row_pitch_bytes % sizeof(T) != 0) {
+      return false;
+    }
+    const std::size_t align_bytes = std::max<std::size_t>(
+        RowAlignBytes == PACKED_ROWS ? 1 : RowAlignBytes, alignof(T));
+    if (row_pitch_bytes % align_bytes != 0 ||
+        !mem_utils::IsPointerAligned(data, align_bytes)) {
+      return false;
+    }
+
+    SharedStorageT* new_shared =
+        deleter ? new SharedStorageT(data, std::move(deleter)) : nullptr;
+    FreeMemIfOwned();
+
+    w_ = width;
+    h_ = height;
+    c_ = num_channels;
+    buf_ = data;
+    owns_data_ = false;
+    shared_ = new_shared;
+    row_stride_ = row_pitch_bytes / sizeof(T);
+    plane_stride_ = row_stride_ * height;
+    capacity_ = 0;
+    known_zero_.store(false, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Like GetWin, but first converts this image to shared storage (see
+  // Share()), so that the window keeps the memory alive on its own.
+  inline bool GetSharedWin(int x, int y, int width, int height,
+                           ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>& window) {
+    if (!Share()) {
+      return false;
+    }
+    return GetWin(x, y, width, height, window);
+  }
+
+  // Move the memory owned by this image into reference counted storage, so
+  // that windows taken from now on share ownership of it.  Returns true if the
+  // image is (now) shared, or false if it is a non-owning window or empty.
+  bool Share() {
+    if (shared_ != nullptr) {
+      return true;
+    }
+    if (!owns_data_ || buf_ == nullptr) {
+      return false;
+    }
+    shared_ = new SharedStorageT(buf_, capacity_, allocator_);
+    owns_data_ = false;
+    capacity_ = 0;
     return true;
   }
 
-  bool Resize(int new_w, int new_h, int new_c) {
+  // True if this image's memory is held in reference counted storage.
+  inline bool IsShared() const { return shared_ != nullptr; }
+
+  // Number of images (including windows) referencing this image's shared
+  // storage, or 0 if the image is not shared.
+  inline long SharedUseCount() const {
+    return shared_ == nullptr ? 0 : shared_->UseCount();
+  }
+
+  // Resize the image.  No memory is allocated if the new image fits in the
+  // current Capacity().  Windows can only be "resized" to their current size,
+  // while shared images detach from their windows onto a private buffer.
+  bool Resize(int new_w, int new_h, int new_c,
+              ResizeContents contents = DISCARD_CONTENTS) {
     if (new_w < 0 || new_h < 0 || new_c < 0) {
       return false;
     } else if (!SelfT::IsChannelCountDynamic() && new_c != Channels()) {
       return false;
-    } else if (!owns_data_) {
+    } else if (new_w == Width() && new_h == Height() && new_c == Channels()) {
+      return true;  // Nothing to do; this also allows resizing windows in place.
+    } else if (!owns_data_ && shared_ == nullptr) {
       return false;
     } else {
-      AllocateHelper(new_w, new_h, new_c);
+      AllocateHelper(new_w, new_h, new_c, contents);
       return true;
     }
   }
 
+  // Number of T's that can be stored without reallocating, inclusive of row
+  // padding.  Windows and shared images have a capacity of 0.
+  inline std::size_t Capacity() const { return capacity_; }
+
+  // Number of T's needed to store a new_w x new_h image with new_c channels,
+  // inclusive of row padding.
+  static std::size_t RequiredNumel(int new_w, int new_h, int new_c) {
+    const int plane_c = SelfT::IsPlanar() ? 1 : new_c;
+    return ComputeRowStride(new_w, plane_c) * new_h *
+           (SelfT::IsPlanar() ? new_c : 1);
+  }
+
+  // Make sure the image can later be resized to new_w x new_h x new_c (or
+  // anything smaller) without allocating.  The image's dimensions and pixels
+  // are unchanged.  Returns false for windows and shared images.
+  bool Reserve(int new_w, int new_h, int new_c) {
+    if (new_w < 0 || new_h < 0 || new_c < 0 || !owns_data_) {
+      return false;
+    }
+    ReallocateCapacity(std::max(capacity_, RequiredNumel(new_w, new_h, new_c)));
+    return true;
+  }
+
+  // Release any capacity beyond what the current image needs.  Does nothing
+  // for windows and shared images.
+  void ShrinkToFit() {
+    if (owns_data_ && buf_ != nullptr) {
+      ReallocateCapacity(plane_stride_ * this->NumPlanes());
+    }
+  }
+
   // TODO(cbraley): Move Allocate functions into base class!
 
   void Allocate(int new_w, int new_h) {
@@ -337,18 +1000,145 @@ class ImageBuf : public ImageBase<ImageBuf<T, NumChannels, Allocator>> {
   }
 
  private:
-  typedef ImageBuf<T, NumChannels, Allocator> SelfT;
+  typedef ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout> SelfT;
+  typedef implementation_details::SharedImageStorage<T, Allocator> SharedStorageT;
   int w_, h_, c_;
   T* buf_;
   bool owns_data_;
   Allocator allocator_;
 
+  // Non-null if buf_ points into reference counted storage, in which case
+  // owns_data_ is false and the storage is released through shared_.
+  SharedStorageT* shared_;
+
   // Stride between rows in terms of T's.
   std::size_t row_stride_;
 
+  // Stride between planes in terms of T's.  Only meaningful for planar images.
+  std::size_t plane_stride_;
+
+  // Number of T's in the block owned by this image, or 0 if the image does not
+  // own its memory.  Always at least plane_stride_ * NumPlanes() if owned.
+  std::size_t capacity_;
+
+  // See IsKnownZero().  This is mutable since const accessors such as
+  // GetPointer(...) hand out mutable pointers, and atomic so that concurrent
+  // readers calling those accessors don't race on it.
+  mutable std::atomic<bool> known_zero_;
+
+  inline void ForgetKnownZero() const {
+    if (known_zero_.load(std::memory_order_relaxed)) {
+      known_zero_.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  inline T* PointerAt(int x, int y, int c) const {
+    return SelfT::IsPlanar()
+               ? buf_ + (plane_stride_ * c) + (row_stride_ * y) + x
+               : buf_ + (row_stride_ * y) + (x * Channels()) + c;
+  }
+
+  // Channel count and strides of a memory layout, used when moving pixels from
+  // one layout to another.
+  struct Geometry {
+    int c;
+    std::size_t row_stride;
+    std::size_t plane_stride;
+  };
+
+  static inline std::size_t Offset(const Geometry& g, int x, int y, int c) {
+    return SelfT::IsPlanar() ? g.plane_stride * c + g.row_stride * y + x
+                             : g.row_stride * y + static_cast<std::size_t>(x) * g.c + c;
+  }
+
+  // Copy the w x h x c region at the origin of src into dst.  src and dst may
+  // be the same block, in which case the copy must run backwards if the pixels
+  // are moving to higher addresses.
+  static void MovePixels(const T* src, const Geometry& src_geom, T* dst,
+                         const Geometry& dst_geom, int w, int h, int c,
+                         bool backwards) {
+    const int outer = SelfT::IsPlanar() ? c : h;
+    const int middle = SelfT::IsPlanar() ? h : w;
+    const int inner = SelfT::IsPlanar() ? w : c;
+    for (int i = 0; i < outer; ++i) {
+      const int o = backwards ? outer - 1 - i : i;
+      for (int j = 0; j < middle; ++j) {
+        const int m = backwards ? middle - 1 - j : j;
+        for (int k = 0; k < inner; ++k) {
+          const int n = backwards ? inner - 1 - k : k;
+          const int x = SelfT::IsPlanar() ? n : m;
+          const int y = SelfT::IsPlanar() ? m : o;
+          const int ch = SelfT::IsPlanar() ? o : n;
+          dst[Offset(dst_geom, x, y, ch)] = src[Offset(src_geom, x, y, ch)];
+        }
+      }
+    }
+  }
+
+  // Zero every element of a new_w x new_h x new_c image in dst that lies
+  // outside the keep_w x keep_h x keep_c region at its origin.
+  static void ZeroOutside(T* dst, const Geometry& geom, int new_w, int new_h,
+                          int new_c, int keep_w, int keep_h, int keep_c) {
+    for (int y = 0; y < new_h; ++y) {
+      for (int x = 0; x < new_w; ++x) {
+        for (int c = 0; c < new_c; ++c) {
+          if (x >= keep_w || y >= keep_h || c >= keep_c) {
+            dst[Offset(geom, x, y, c)] = static_cast<T>(0);
+          }
+        }
+      }
+    }
+  }
+
+  // Returns true if the pixels shared by the old and new layouts can be moved
+  // inside a single block, and sets *backwards to the direction to move them
+  // in.  This is possible whenever every stride shrinks (each pixel moves to a
+  // lower or equal address), or every stride grows.
+  static bool CanMoveInPlace(const Geometry& from, const Geometry& to,
+                             bool* backwards) {
+    const bool planar = SelfT::IsPlanar();
+    const bool shrinks = to.row_stride <= from.row_stride &&
+                         (planar ? to.plane_stride <= from.plane_stride : to.c <= from.c);
+    const bool grows = to.row_stride >= from.row_stride &&
+                       (planar ? to.plane_stride >= from.plane_stride : to.c >= from.c);
+    *backwards = !shrinks;
+    return shrinks || grows;
+  }
+
+  // Move the (owned) pixels into a new block of new_capacity T's, keeping the
+  // current dimensions and layout.
+  void ReallocateCapacity(std::size_t new_capacity) {
+    if (new_capacity == capacity_) {
+      return;
+    }
+    T* new_buf = allocator_.allocate(new_capacity);
+    if (buf_ != nullptr) {
+      const std::size_t used_numel = plane_stride_ * this->NumPlanes();
+      assert(used_numel <= new_capacity);
+      std::memcpy(new_buf, buf_, used_numel * sizeof(T));
+    }
+    FreeMemIfOwned();
+    buf_ = new_buf;
+    capacity_ = new_capacity;
+    known_zero_.store(IsKnownZero() && AllocatesZeroedMemory<Allocator>::value,
+                      std::memory_order_relaxed);
+  }
+
   void FreeMemIfOwned();
 
-  void AllocateHelper(int new_w, int new_h, int new_c) {
+  // Compute the row stride (in T's) for a row of new_w pixels with new_c
+  // channels each, rounding up to RowAlignBytes if necessary.
+  static std::size_t ComputeRowStride(int new_w, int new_c) {
+    const std::size_t row_data_bytes = new_w * new_c * sizeof(T);
+    if (RowAlignBytes == PACKED_ROWS) {
+      return new_w * new_c;
+    }
+    return math_utils::UpToNearestMultiple(row_data_bytes, RowAlignBytes) /
+           sizeof(T);
+  }
+
+  void AllocateHelper(int new_w, int new_h, int new_c,
+                      ResizeContents contents = DISCARD_CONTENTS) {
     assert(new_w >= 0);
     assert(new_h >= 0);
     AssertInvariants();
@@ -360,44 +1150,68 @@ class ImageBuf : public ImageBase<ImageBuf<T, NumChannels, Allocator>> {
       assert(new_c > 0);
     }
 
-    // Store size of old data.
-    const std::size_t old_data_numel = Width() * Height() * Channels();
-
-    // Compute size needed for new data.
-    const std::size_t row_data_bytes = new_w * new_c * sizeof(T);
-    const std::size_t total_bytes = row_data_bytes * new_h;
-    assert(total_bytes % sizeof(T) == 0);
-
-    const std::size_t data_numel = new_w * new_h * new_c;
-    assert(data_numel == total_bytes / sizeof(T));
-    const std::size_t new_row_stride = new_w * new_c;
-
-    // Allocate new memory.
-    T* new_buf = allocator_.allocate(data_numel);
-
-    // We are *required* to memset all the newly allocated memory to 0.  This
-    // is necessary since we memcmp buffers to compare images.  If we don't
-    // memset things to 0 here; the padding bytes end up affecting the
-    // comparison results.
-    //memset(static_cast<void*>(new_buf), 0, total_bytes);
+    // Compute size needed for new data, including any row padding.
+    const int new_plane_c = SelfT::IsPlanar() ? 1 : new_c;
+    const std::size_t new_row_stride = ComputeRowStride(new_w, new_plane_c);
+    assert(new_row_stride >= static_cast<std::size_t>(new_w * new_plane_c));
+    const std::size_t new_plane_stride = new_row_stride * new_h;
+    const std::size_t data_numel =
+        new_plane_stride * (SelfT::IsPlanar() ? new_c : 1);
+
+    const Geometry old_geom = {Channels(), row_stride_, plane_stride_};
+    const Geometry new_geom = {new_c, new_row_stride, new_plane_stride};
+    const bool preserve = contents == PRESERVE_CONTENTS && buf_ != nullptr;
+
+    // Reuse the current block if the new image fits, and (when preserving
+    // contents) the old pixels can be shuffled into place without clobbering
+    // each other.  Otherwise allocate new memory.
+    bool backwards = false;
+    const bool reuse =
+        owns_data_ && data_numel <= capacity_ &&
+        (!preserve || CanMoveInPlace(old_geom, new_geom, &backwards));
+    T* new_buf = reuse ? buf_ : allocator_.allocate(data_numel);
+
+    // Note that we do not need to zero the newly allocated memory.  Image
+    // comparisons only ever memcmp whole buffers when there is no row padding,
+    // and otherwise compare row by row, so padding never affects the result.
+
+    if (preserve) {
+      const int keep_w = std::min(Width(), new_w);
+      const int keep_h = std::min(Height(), new_h);
+      const int keep_c = std::min(Channels(), new_c);
+      MovePixels(buf_, old_geom, new_buf, new_geom, keep_w, keep_h, keep_c,
+                 backwards);
+      ZeroOutside(new_buf, new_geom, new_w, new_h, new_c, keep_w, keep_h,
+                  keep_c);
+    }
 
-    if (owns_data_) {
-      allocator_.deallocate(buf_, old_data_numel);
+    if (!reuse) {
+      // Release the old memory.  If it was shared this detaches us from it,
+      // and any windows still referencing it keep it alive.
+      FreeMemIfOwned();
+      buf_ = new_buf;
+      capacity_ = data_numel;
+      // A preserving resize has already copied the old pixels in.
+      known_zero_.store(AllocatesZeroedMemory<Allocator>::value && !preserve,
+                        std::memory_order_relaxed);
     }
-    buf_ = new_buf;
 
     w_ = new_w;
     h_ = new_h;
     c_ = new_c;
     row_stride_ = new_row_stride;
+    plane_stride_ = new_plane_stride;
     owns_data_ = true;
+    shared_ = nullptr;
   }
 
   inline void AssertInvariants() const {
-    if (buf_ != nullptr) {
-      assert(Width() > 0);
-      assert(Height() > 0);
+    // An empty image may still hold reserved capacity, so only check the
+    // dimensions of images that have been sized.
+    if (buf_ != nullptr && Width() >= 0) {
+      assert(Height() >= 0);
       assert(Channels() > 0);
+      assert(!owns_data_ || plane_stride_ * this->NumPlanes() <= capacity_);
     }
   }
 
@@ -406,10 +1220,61 @@ class ImageBuf : public ImageBase<ImageBuf<T, NumChannels, Allocator>> {
   ImageBuf& operator=(const ImageBuf& other) = delete;
 
   // We need to be friends with other template variants.
-  template <typename T_FRIEND, int ChannelsFriend, typename AllocatorFriend>
+  template <typename T_FRIEND, int ChannelsFriend, typename AllocatorFriend,
+            std::size_t RowAlignBytesFriend, typename LayoutFriend>
   friend class ImageBuf;
 };
 
+// Non-member swap, so that std::swap-style generic code (and std::sort, etc.)
+// picks up the O(1) ImageBuf::swap via argument dependent lookup.
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+inline void swap(ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>& lhs,
+                 ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>& rhs) noexcept {
+  lhs.swap(rhs);
+}
+
+/// An ImageBuf whose base pointer and every row are aligned to AlignBytes.
+template <typename T, int NumChannels = DYNAMIC_CHANNELS,
+          std::size_t AlignBytes = 64>
+using AlignedImageBuf =
+    ImageBuf<T, NumChannels, AlignedAllocator<T, AlignBytes>, AlignBytes>;
+
+/// An ImageBuf that stores each channel in its own plane.
+template <typename T, int NumChannels = DYNAMIC_CHANNELS,
+          typename Allocator = std::allocator<T>,
+          std::size_t RowAlignBytes = PACKED_ROWS>
+using PlanarImageBuf =
+    ImageBuf<T, NumChannels, Allocator, RowAlignBytes, PlanarLayout>;
+
+
+template<typename ImageImplT>
+void ParallelFirstTouch(ImageBase<ImageImplT>& image, int num_threads) {
+  static_assert(ImageBase<ImageImplT>::HasLinearRows(),
+                "ParallelFirstTouch requires an image with linear rows.");
+  typedef typename ImageTraits<ImageImplT>::ChannelT ChannelT;
+  const int height = image.Height();
+  num_threads = std::max(1, std::min(num_threads, height));
+  const std::size_t row_bytes = image.PlaneRowNumel() * sizeof(ChannelT);
+  auto touch_band = [&image, height, num_threads, row_bytes](int band) {
+    const int y_begin = static_cast<int>(static_cast<int64_t>(height) * band / num_threads);
+    const int y_end = static_cast<int>(static_cast<int64_t>(height) * (band + 1) / num_threads);
+    for (int p = 0; p < image.NumPlanes(); ++p) {
+      for (int y = y_begin; y < y_end; ++y) {
+        std::memset(image.GetPlaneRow(p, y), 0, row_bytes);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int band = 1; band < num_threads; ++band) {
+    threads.push_back(std::thread(touch_band, band));
+  }
+  touch_band(0);
+  for (std::size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+}
 
 template<typename ImageImplT>
 std::ostream& operator<<(std::ostream& os, const ImageBase<ImageImplT>& image) {
@@ -478,59 +1343,313 @@ bool operator==(const ImageBase<ImageImplLhsT> &lhs,
     return false;
   }
 
+  // If either side is known to be uniform, only the other side (if any) needs
+  // to be read.
+  typename ImageTraits<ImageImplLhsT>::ChannelT lhs_value;
+  typename ImageTraits<ImageImplRhsT>::ChannelT rhs_value;
+  const bool lhs_uniform = lhs.IsUniform(&lhs_value);
+  const bool rhs_uniform = rhs.IsUniform(&rhs_value);
+  if (lhs_uniform && rhs_uniform) {
+    return memcmp(&lhs_value, &rhs_value, sizeof(lhs_value)) == 0;
+  } else if (lhs_uniform) {
+    return AllValuesEqual(rhs, &lhs_value);
+  } else if (rhs_uniform) {
+    return AllValuesEqual(lhs, &rhs_value);
+  }
+
+  return PixelsEqual(lhs, rhs,
+                     std::integral_constant<bool,
+                         ImageBase<ImageImplLhsT>::HasLinearRows() &&
+                         ImageBase<ImageImplRhsT>::HasLinearRows()>());
+}
+
+
+template<typename ImageImplLhsT, typename ImageImplRhsT>
+bool PixelsEqual(const ImageBase<ImageImplLhsT>& lhs,
+                 const ImageBase<ImageImplRhsT>& rhs, std::true_type) {
+  // Images with different memory layouts must be compared element by element.
+  if (lhs.IsPlanar() != rhs.IsPlanar()) {
+    return lhs.IsPlanar() ? PlanarMatchesInterleaved(lhs, rhs)
+                          : PlanarMatchesInterleaved(rhs, lhs);
+  }
 
   // If both images are contiguous we can do a single memcmp, whereas if either
   // image is not we must compare rows individually.
   if (lhs.IsMemoryContiguous() && rhs.IsMemoryContiguous()) {
     assert(lhs.TotalByteCount() == rhs.TotalByteCount());
-    return memcmp(lhs.GetRow(0), rhs.GetRow(0), lhs.TotalByteCount()) == 0;
+    return memcmp(lhs.GetPlaneRow(0, 0), rhs.GetPlaneRow(0, 0),
+                  lhs.TotalByteCount()) == 0;
   } else {
-    assert(lhs.RowSizeBytes() == rhs.RowSizeBytes());
-    const std::size_t row_bytes = lhs.RowSizeBytes();
+    assert(lhs.PlaneRowNumel() == rhs.PlaneRowNumel());
+    const std::size_t row_bytes =
+        lhs.PlaneRowNumel() *
+        sizeof(typename ImageTraits<ImageImplLhsT>::ChannelT);
+    for (int p = 0; p < lhs.NumPlanes(); ++p) {
+      for (int y = 0; y < lhs.Height(); ++y) {
+        if (memcmp(lhs.GetPlaneRow(p, y), rhs.GetPlaneRow(p, y),
+                   row_bytes) != 0) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;  // If we made it this far, they must be the same.
+}
+
+
+template<typename ImageImplLhsT, typename ImageImplRhsT>
+bool PixelsEqual(const ImageBase<ImageImplLhsT>& lhs,
+                 const ImageBase<ImageImplRhsT>& rhs, std::false_type) {
+  // Tiled images are compared one run of contiguous pixels at a time.
+  if (lhs.IsPlanar() || rhs.IsPlanar()) {
+    const std::size_t channel_bytes =
+        sizeof(typename ImageTraits<ImageImplLhsT>::ChannelT);
     for (int y = 0; y < lhs.Height(); ++y) {
-      if (memcmp(lhs.GetRow(y), rhs.GetRow(y), row_bytes) != 0) {
+      for (int x = 0; x < lhs.Width(); ++x) {
+        for (int c = 0; c < lhs.Channels(); ++c) {
+          if (memcmp(lhs.GetPointer(x, y, c), rhs.GetPointer(x, y, c),
+                     channel_bytes) != 0) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+  const std::size_t pixel_bytes = lhs.PixelSizeBytes();
+  return ForEachMatchingRowSpan(lhs, rhs,
+      [pixel_bytes](const void* a, const void* b, int num_pixels) {
+        return memcmp(a, b, num_pixels * pixel_bytes) == 0;
+      });
+}
+
+
+namespace implementation_details {
+
+// GetConstRowSpan(...) for const images, and GetRowSpan(...) otherwise.
+template<typename ImageImplT>
+inline const typename ImageTraits<ImageImplT>::ChannelT* RowSpanOf(
+    const ImageBase<ImageImplT>& image, int x, int y, int* span_pixels) {
+  return image.GetConstRowSpan(x, y, span_pixels);
+}
+template<typename ImageImplT>
+inline typename ImageTraits<ImageImplT>::ChannelT* RowSpanOf(
+    ImageBase<ImageImplT>& image, int x, int y, int* span_pixels) {
+  return image.GetRowSpan(x, y, span_pixels);
+}
+
+}  // namespace implementation_details
+
+
+template<typename ImageImplAT, typename ImageBT, typename FuncT>
+bool ForEachMatchingRowSpan(const ImageBase<ImageImplAT>& a, ImageBT& b,
+                            FuncT func) {
+  using implementation_details::RowSpanOf;
+  assert(!a.IsPlanar() && !b.IsPlanar());
+  assert(jr::DimensionsMatch(a, b));
+  const int num_channels = a.Channels();
+  for (int y = 0; y < a.Height(); ++y) {
+    int a_span = 0, b_span = 0;
+    auto* a_pixels = a.GetConstRowSpan(0, y, &a_span);
+    auto* b_pixels = RowSpanOf(b, 0, y, &b_span);
+    int x = 0;
+    while (x < a.Width()) {
+      const int num_pixels = std::min(a_span, b_span);
+      if (!func(a_pixels, b_pixels, num_pixels)) {
         return false;
       }
+      x += num_pixels;
+      if (x >= a.Width()) {
+        break;
+      }
+      // Advance whichever side(s) ran out of contiguous pixels.
+      a_span -= num_pixels;
+      b_span -= num_pixels;
+      if (a_span == 0) {
+        a_pixels = a.GetConstRowSpan(x, y, &a_span);
+      } else {
+        a_pixels += num_pixels * num_channels;
+      }
+      if (b_span == 0) {
+        b_pixels = RowSpanOf(b, x, y, &b_span);
+      } else {
+        b_pixels += num_pixels * num_channels;
+      }
     }
   }
-  return true;  // If we made it this far, they must be the same.
+  return true;
+}
+
+
+template<typename ImageImplT>
+bool AllValuesEqual(const ImageBase<ImageImplT>& image, const void* value) {
+  return AllValuesEqual(image, value,
+                        std::integral_constant<bool,
+                            ImageBase<ImageImplT>::HasLinearRows()>());
+}
+
+
+template<typename ImageImplT>
+bool AllValuesEqual(const ImageBase<ImageImplT>& image, const void* value,
+                    std::true_type) {
+  typedef typename ImageTraits<ImageImplT>::ChannelT ChannelT;
+  const std::size_t row_numel = image.PlaneRowNumel();
+  for (int p = 0; p < image.NumPlanes(); ++p) {
+    for (int y = 0; y < image.Height(); ++y) {
+      const ChannelT* row = image.GetPlaneRow(p, y);
+      for (std::size_t i = 0; i < row_numel; ++i) {
+        if (memcmp(row + i, value, sizeof(ChannelT)) != 0) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+
+template<typename ImageImplT>
+bool AllValuesEqual(const ImageBase<ImageImplT>& image, const void* value,
+                    std::false_type) {
+  typedef typename ImageTraits<ImageImplT>::ChannelT ChannelT;
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      for (int c = 0; c < image.Channels(); ++c) {
+        const ChannelT v = image.Get(x, y, c);
+        if (memcmp(&v, value, sizeof(ChannelT)) != 0) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+
+template<typename ImageImplPlanarT, typename ImageImplInterleavedT>
+bool PlanarMatchesInterleaved(const ImageBase<ImageImplPlanarT>& planar,
+                              const ImageBase<ImageImplInterleavedT>& interleaved) {
+  assert(planar.IsPlanar() && !interleaved.IsPlanar());
+  assert(jr::DimensionsMatch(planar, interleaved));
+  typedef typename ImageTraits<ImageImplPlanarT>::ChannelT ChannelT;
+  const int num_channels = planar.Channels();
+  for (int y = 0; y < planar.Height(); ++y) {
+    const ChannelT* interleaved_row = interleaved.GetPlaneRow(0, y);
+    for (int c = 0; c < num_channels; ++c) {
+      const ChannelT* plane_row = planar.GetPlaneRow(c, y);
+      for (int x = 0; x < planar.Width(); ++x) {
+        // Compare bytes, to match the memcmp semantics used elsewhere.
+        if (memcmp(plane_row + x, interleaved_row + x * num_channels + c,
+                   sizeof(ChannelT)) != 0) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
 }
 
 
 // Inline member function definitions. ----------------------------------------
 
-template <typename T, int NumChannels, typename Allocator>
-ImageBuf<T, NumChannels, Allocator>::ImageBuf()
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>::ImageBuf()
+    : ImageBuf(Allocator()) {}
+
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>::ImageBuf(
+    const Allocator& allocator)
     : w_(-1),
       h_(-1),
       c_(-1),
       buf_(nullptr),
       owns_data_(true),
-      row_stride_(0) {}
+      allocator_(allocator),
+      shared_(nullptr),
+      row_stride_(0),
+      plane_stride_(0),
+      capacity_(0),
+      known_zero_(false) {}
+
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>::ImageBuf(
+    ImageBuf&& other) noexcept
+    : ImageBuf() {
+  swap(other);
+}
+
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>&
+ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>::operator=(
+    ImageBuf&& other) noexcept {
+  if (this != &other) {
+    // Move other into a temporary and swap with it; the temporary then frees
+    // whatever memory *this used to own.
+    ImageBuf tmp(std::move(other));
+    swap(tmp);
+  }
+  return *this;
+}
 
-template <typename T, int NumChannels, typename Allocator>
-ImageBuf<T, NumChannels, Allocator>::~ImageBuf() {
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+void ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>::swap(
+    ImageBuf& other) noexcept {
+  using std::swap;
+  swap(w_, other.w_);
+  swap(h_, other.h_);
+  swap(c_, other.c_);
+  swap(buf_, other.buf_);
+  swap(owns_data_, other.owns_data_);
+  swap(allocator_, other.allocator_);
+  swap(shared_, other.shared_);
+  swap(row_stride_, other.row_stride_);
+  swap(plane_stride_, other.plane_stride_);
+  swap(capacity_, other.capacity_);
+  const bool known_zero = IsKnownZero();
+  known_zero_.store(other.IsKnownZero(), std::memory_order_relaxed);
+  other.known_zero_.store(known_zero, std::memory_order_relaxed);
+}
+
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>::~ImageBuf() {
   FreeMemIfOwned();
 }
 
-template<typename T, int NumChannels, typename Allocator>
-void ImageBuf<T, NumChannels, Allocator>::FreeMemIfOwned() {
-  // TODO(cbraley): Make a thread safe version of this class that cleans up here in all
-  // subwindows.
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+void ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>::FreeMemIfOwned() {
   if (owns_data_) {
-    allocator_.deallocate(buf_, Width() * Height() * Channels());
+    // Empty images own no block.
+    if (buf_ != nullptr) {
+      allocator_.deallocate(buf_, capacity_);
+    }
+  } else if (shared_ != nullptr) {
+    shared_->Release();
+    shared_ = nullptr;
   }
 }
 
-template <typename T, int NumChannels, typename Allocator>
-ImageBuf<T, NumChannels, Allocator>::ImageBuf(int width, int height,
-                                              int num_channels)
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>::ImageBuf(
+    int width, int height, int num_channels, const Allocator& allocator)
     : w_(width),
       h_(height),
       c_(num_channels),
       buf_(nullptr),
       owns_data_(true),
-      row_stride_(0) {
+      allocator_(allocator),
+      shared_(nullptr),
+      row_stride_(0),
+      plane_stride_(0),
+      capacity_(0),
+      known_zero_(false) {
   static_assert(NumChannels == DYNAMIC_CHANNELS,
                 "The ImageBuf(width, height, num_channels) constructor can "
                 "only be called when the ImageBuf has a \"dynamic\" number "
@@ -540,14 +1659,21 @@ ImageBuf<T, NumChannels, Allocator>::ImageBuf(int width, int height,
   AllocateHelper(w_, h_, c_);
 }
 
-template <typename T, int NumChannels, typename Allocator>
-ImageBuf<T, NumChannels, Allocator>::ImageBuf(int width, int height)
+template <typename T, int NumChannels, typename Allocator, std::size_t RowAlignBytes,
+          typename Layout>
+ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>::ImageBuf(
+    int width, int height, const Allocator& allocator)
     : w_(width),
       h_(height),
       c_(NumChannels),
       buf_(nullptr),
       owns_data_(true),
-      row_stride_(0) {
+      allocator_(allocator),
+      shared_(nullptr),
+      row_stride_(0),
+      plane_stride_(0),
+      capacity_(0),
+      known_zero_(false) {
   static_assert(NumChannels != DYNAMIC_CHANNELS,
                 "The ImageBuf(width, height) constructor can "
                 "only be called when the ImageBuf has a \"static\" number "
@@ -1,9 +1,17 @@
 #ifndef JRIMAGE_ALLOCATORS_H_
 #define JRIMAGE_ALLOCATORS_H_
 
+#include <cstdlib>
 #include <memory>
+#include <new>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
 #include <type_traits>
+#include <vector>
 
 #include "mem_utils.h"
 
@@ -18,6 +26,10 @@ struct AlignedAllocator {
  public:
   // Public interface required by all C++ allocators.
   typedef Tp value_type;
+  template <typename TpOther>
+  struct rebind {
+    typedef AlignedAllocator<TpOther, AlignBytes> other;
+  };
   AlignedAllocator();
   template <typename TpOther, std::size_t AlignBytesOther>
   AlignedAllocator(const AlignedAllocator<TpOther, AlignBytesOther>& other);
@@ -74,6 +86,356 @@ bool operator!=(const AlignedAllocator<T, AlignBytesLHS>& lhs,
   return !(lhs == rhs);
 }
 
+// Allocator for large images that maps memory directly from the OS, aligned to
+// 2MB and backed by transparent huge pages where the kernel allows it, which
+// greatly reduces TLB misses on full frame passes.  Allocations are placed on
+// NUMA nodes according to a runtime policy (see mem_utils::NumaPolicy); with
+// the default NUMA_FIRST_TOUCH policy use ParallelFirstTouch(...) from
+// jrimage.h to make each worker thread's rows local to that worker.
+//
+// Every allocation is rounded up to a whole number of pages (of huge pages, for
+// allocations of 2MB or more), so this allocator is a poor fit for small
+// buffers.  Allocators compare equal regardless of policy, since memory from
+// any of them can be released by any other.
+template <typename Tp>
+struct HugePageAllocator {
+ public:
+  // Public interface required by all C++ allocators.
+  typedef Tp value_type;
+  template <typename TpOther>
+  struct rebind {
+    typedef HugePageAllocator<TpOther> other;
+  };
+  HugePageAllocator() : policy_(mem_utils::NUMA_FIRST_TOUCH), node_(0) {}
+  explicit HugePageAllocator(mem_utils::NumaPolicy policy, int node = 0)
+      : policy_(policy), node_(node) {}
+  template <typename TpOther>
+  HugePageAllocator(const HugePageAllocator<TpOther>& other)
+      : policy_(other.Policy()), node_(other.Node()) {}
+  Tp* allocate(std::size_t n);
+  void deallocate(Tp* p, std::size_t n);
+
+  // Details specific to HugePageAllocator.
+  mem_utils::NumaPolicy Policy() const { return policy_; }
+  int Node() const { return node_; }
+
+ private:
+  mem_utils::NumaPolicy policy_;
+  int node_;
+};
+
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T>& lhs, const HugePageAllocator<U>& rhs) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T>& lhs, const HugePageAllocator<U>& rhs) {
+  return false;
+}
+
+// Huge page allocator implementation. ----------------------------------------
+
+template <typename Tp>
+Tp* HugePageAllocator<Tp>::allocate(std::size_t n) {
+  void* mem = mem_utils::HugePageMap(n * sizeof(Tp), policy_, node_);
+  if (mem == nullptr) {
+    throw std::bad_alloc();
+  }
+  return static_cast<Tp*>(mem);
+}
+
+template <typename Tp>
+void HugePageAllocator<Tp>::deallocate(Tp* p, std::size_t n) {
+  mem_utils::HugePageUnmap(p, n * sizeof(Tp));
+}
+
+// Allocator that returns zero filled memory from calloc.  For large requests
+// the C library maps fresh pages straight from the OS, which are already zero,
+// so calloc does not write them and no page is touched until first use.  Only
+// guarantees alignof(std::max_align_t).
+template <typename Tp>
+struct ZeroedAllocator {
+ public:
+  // Public interface required by all C++ allocators.
+  typedef Tp value_type;
+  template <typename TpOther>
+  struct rebind {
+    typedef ZeroedAllocator<TpOther> other;
+  };
+  ZeroedAllocator() {}
+  template <typename TpOther>
+  ZeroedAllocator(const ZeroedAllocator<TpOther>& other) {}
+  Tp* allocate(std::size_t n) {
+    void* mem = std::calloc(n, sizeof(Tp));
+    if (mem == nullptr && n != 0) {
+      throw std::bad_alloc();
+    }
+    return static_cast<Tp*>(mem);
+  }
+  void deallocate(Tp* p, std::size_t n) { std::free(p); }
+};
+
+template <typename T, typename U>
+bool operator==(const ZeroedAllocator<T>& lhs, const ZeroedAllocator<U>& rhs) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const ZeroedAllocator<T>& lhs, const ZeroedAllocator<U>& rhs) {
+  return false;
+}
+
+// Monotonic (bump pointer) memory arena for short lived buffers, such as the
+// intermediate images of a per-frame pipeline.  Allocation just advances a
+// pointer, deallocation is a no-op, and Reset() releases everything at once.
+// If a frame needs more memory than the arena holds, the arena grows by adding
+// blocks from the heap; the next Reset() replaces those with one block large
+// enough for the whole frame, so steady state frames never touch the heap.
+//
+// A FrameArena is not thread safe; give each thread its own.
+class FrameArena {
+ public:
+  // Create an arena, preallocating initial_bytes (which may be 0).
+  explicit FrameArena(std::size_t initial_bytes = 0);
+  ~FrameArena();
+
+  // Return num_bytes of memory aligned to byte_alignment (a power of two).
+  // The memory is valid until the next Reset() or the arena's destruction.
+  void* Allocate(std::size_t num_bytes, std::size_t byte_alignment);
+
+  // Release everything allocated since the last Reset().
+  void Reset();
+
+  // Bytes handed out since the last Reset(), inclusive of alignment padding.
+  std::size_t BytesUsed() const { return bytes_used_; }
+  // Total size of the blocks held by the arena.
+  std::size_t Capacity() const;
+  // Number of times the arena has allocated a block from the heap.
+  std::size_t NumHeapAllocations() const { return num_heap_allocations_; }
+
+ private:
+  struct Block {
+    uint8_t* data;
+    std::size_t size;
+  };
+  std::vector<Block> blocks_;
+  std::size_t offset_;  // Offset of the first free byte in blocks_.back().
+  std::size_t bytes_used_;
+  std::size_t num_heap_allocations_;
+
+  void AddBlock(std::size_t num_bytes);
+  void FreeBlocks();
+
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+};
+
+// Stateful allocator that carves memory out of a FrameArena, aligned to
+// AlignBytes.  Pass an instance to the ImageBuf constructor:
+//   jr::FrameArena arena(64 << 20);
+//   jr::ImageBuf<float, 3, jr::ArenaAllocator<float>> tmp(
+//       w, h, jr::ArenaAllocator<float>(&arena));
+// Images must not be used after the arena is Reset().  A default constructed
+// ArenaAllocator has no arena and falls back to aligned heap allocations.
+template <typename Tp, std::size_t AlignBytes = 64>
+struct ArenaAllocator {
+ public:
+  // Public interface required by all C++ allocators.
+  typedef Tp value_type;
+  template <typename TpOther>
+  struct rebind {
+    typedef ArenaAllocator<TpOther, AlignBytes> other;
+  };
+  ArenaAllocator() : arena_(nullptr) {}
+  explicit ArenaAllocator(FrameArena* arena) : arena_(arena) {}
+  template <typename TpOther>
+  ArenaAllocator(const ArenaAllocator<TpOther, AlignBytes>& other)
+      : arena_(other.Arena()) {}
+  Tp* allocate(std::size_t n) {
+    if (arena_ == nullptr) {
+      return jr::mem_utils::AlignedNew<Tp>(n, AlignBytes);
+    }
+    return static_cast<Tp*>(arena_->Allocate(n * sizeof(Tp), AlignBytes));
+  }
+  void deallocate(Tp* p, std::size_t n) {
+    if (arena_ == nullptr) {
+      jr::mem_utils::AlignedDelete(p);
+    }
+  }
+
+  // Details specific to ArenaAllocator.
+  FrameArena* Arena() const { return arena_; }
+
+  static_assert(AlignBytes % alignof(Tp) == 0,
+                "ArenaAllocator alignment must be a multiple of the type "
+                "Tp's native alignment.");
+
+ private:
+  FrameArena* arena_;
+};
+
+template <typename T, typename U, std::size_t AlignBytes>
+bool operator==(const ArenaAllocator<T, AlignBytes>& lhs,
+                const ArenaAllocator<U, AlignBytes>& rhs) {
+  return lhs.Arena() == rhs.Arena();
+}
+template <typename T, typename U, std::size_t AlignBytes>
+bool operator!=(const ArenaAllocator<T, AlignBytes>& lhs,
+                const ArenaAllocator<U, AlignBytes>& rhs) {
+  return !(lhs == rhs);
+}
+
+// Point in time statistics for one tag of an AllocationTracker.
+struct AllocationStats {
+  // Number of buckets in size_histogram.
+  static constexpr int NUM_SIZE_BUCKETS = 64;
+
+  std::string tag;
+  std::size_t live_bytes;         // Currently allocated.
+  std::size_t peak_bytes;         // High water mark of live_bytes.
+  std::size_t live_allocations;   // Blocks currently allocated.
+  std::size_t total_allocations;  // Blocks ever allocated.
+  std::size_t total_bytes;        // Bytes ever allocated.
+  // size_histogram[i] counts allocations of [2^i, 2^(i+1)) bytes.  Zero byte
+  // allocations are counted in bucket 0.
+  std::vector<std::size_t> size_histogram;
+};
+
+// Counters for one tag.  Updates are lock free, so they are cheap enough to
+// leave on in production builds.
+class AllocationCounters {
+ public:
+  AllocationCounters();
+
+  void RecordAllocation(std::size_t num_bytes);
+  void RecordDeallocation(std::size_t num_bytes);
+
+  // Reads each counter atomically, but not all of them at the same instant.
+  AllocationStats Snapshot() const;
+
+ private:
+  std::atomic<std::size_t> live_bytes_;
+  std::atomic<std::size_t> peak_bytes_;
+  std::atomic<std::size_t> live_allocations_;
+  std::atomic<std::size_t> total_allocations_;
+  std::atomic<std::size_t> total_bytes_;
+  std::atomic<std::size_t> size_histogram_[AllocationStats::NUM_SIZE_BUCKETS];
+
+  AllocationCounters(const AllocationCounters&) = delete;
+  AllocationCounters& operator=(const AllocationCounters&) = delete;
+};
+
+// Thread safe registry of allocation counters, keyed by a user supplied tag
+// such as "pyramid" or "ui_thumbnails".  Use it through TrackingAllocator.
+class AllocationTracker {
+ public:
+  AllocationTracker() {}
+
+  // The process wide tracker used by default.  Never destroyed, so it can
+  // outlive static images.
+  static AllocationTracker& Global();
+
+  // Return the counters for tag, creating them if needed.  The pointer is
+  // valid for the lifetime of the tracker.
+  AllocationCounters* Counters(const std::string& tag);
+
+  // Statistics for every tag seen so far, sorted by tag.
+  std::vector<AllocationStats> Snapshot() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<AllocationCounters>> counters_;
+
+  AllocationTracker(const AllocationTracker&) = delete;
+  AllocationTracker& operator=(const AllocationTracker&) = delete;
+};
+
+// Allocator adapter that forwards to BaseAllocator and records every
+// allocation against a tag of an AllocationTracker:
+//   typedef jr::TrackingAllocator<float, jr::AlignedAllocator<float, 64>>
+//       TrackedAlloc;
+//   jr::ImageBuf<float, 3, TrackedAlloc> pyramid_level(
+//       w, h, TrackedAlloc("pyramid"));
+//   ...
+//   for (const jr::AllocationStats& s :
+//        jr::AllocationTracker::Global().Snapshot()) {
+//     ExportGauge(s.tag + ".live_bytes", s.live_bytes);
+//   }
+// Default constructed allocators record against the "untagged" tag of the
+// global tracker.  Only the bytes requested are counted, not the overhead of
+// BaseAllocator.
+template <typename Tp, typename BaseAllocator = std::allocator<Tp>>
+struct TrackingAllocator {
+ public:
+  // Public interface required by all C++ allocators.
+  typedef Tp value_type;
+  template <typename TpOther>
+  struct rebind {
+    typedef TrackingAllocator<TpOther,
+        typename std::allocator_traits<BaseAllocator>::template rebind_alloc<
+            TpOther>> other;
+  };
+  TrackingAllocator() : counters_(UntaggedCounters()) {}
+  explicit TrackingAllocator(const std::string& tag,
+                             AllocationTracker* tracker = nullptr,
+                             const BaseAllocator& base = BaseAllocator())
+      : counters_((tracker != nullptr ? tracker
+                                      : &AllocationTracker::Global())
+                      ->Counters(tag)),
+        base_(base) {}
+  template <typename TpOther, typename BaseOther>
+  TrackingAllocator(const TrackingAllocator<TpOther, BaseOther>& other)
+      : counters_(other.Counters()), base_(other.Base()) {}
+  Tp* allocate(std::size_t n) {
+    Tp* p = base_.allocate(n);
+    counters_->RecordAllocation(n * sizeof(Tp));
+    return p;
+  }
+  void deallocate(Tp* p, std::size_t n) {
+    counters_->RecordDeallocation(n * sizeof(Tp));
+    base_.deallocate(p, n);
+  }
+
+  // Details specific to TrackingAllocator.
+  AllocationCounters* Counters() const { return counters_; }
+  const BaseAllocator& Base() const { return base_; }
+
+ private:
+  static AllocationCounters* UntaggedCounters() {
+    static AllocationCounters* const counters =
+        AllocationTracker::Global().Counters("untagged");
+    return counters;
+  }
+
+  AllocationCounters* counters_;
+  BaseAllocator base_;
+};
+
+// Memory from one tracking allocator may only be freed by another if both the
+// tags and the underlying allocators agree.
+template <typename T, typename BaseT, typename U, typename BaseU>
+bool operator==(const TrackingAllocator<T, BaseT>& lhs,
+                const TrackingAllocator<U, BaseU>& rhs) {
+  return lhs.Counters() == rhs.Counters() && lhs.Base() == rhs.Base();
+}
+template <typename T, typename BaseT, typename U, typename BaseU>
+bool operator!=(const TrackingAllocator<T, BaseT>& lhs,
+                const TrackingAllocator<U, BaseU>& rhs) {
+  return !(lhs == rhs);
+}
+
+// AllocatesZeroedMemory<Allocator>::value is true if every block returned by
+// Allocator::allocate(...) is zero filled.  Specialize this for custom
+// allocators that give the same guarantee.
+template <typename Allocator>
+struct AllocatesZeroedMemory : std::false_type {};
+template <typename Tp>
+struct AllocatesZeroedMemory<ZeroedAllocator<Tp>> : std::true_type {};
+template <typename Tp>
+struct AllocatesZeroedMemory<HugePageAllocator<Tp>> : std::true_type {};
+template <typename Tp, typename BaseAllocator>
+struct AllocatesZeroedMemory<TrackingAllocator<Tp, BaseAllocator>>
+    : AllocatesZeroedMemory<BaseAllocator> {};
+
 }  // namespace jr
 
 #endif  // JRIMAGE_ALLOCATORS_H_
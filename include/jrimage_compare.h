@@ -0,0 +1,446 @@
+#ifndef JRIMAGE_COMPARE_H_
+#define JRIMAGE_COMPARE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "jrimage.h"
+#include "mem_utils.h"
+
+// Tolerance based image comparison for jrimage.
+
+namespace jr {
+
+/// How close two images must be for CompareImages(...) to accept them.
+///
+/// The error of a value is |a - b|, and the value is over tolerance if its
+/// error exceeds max(absolute, relative * max(|a|, |b|)).  Equal values and
+/// pairs of NaNs have no error, while a NaN or infinity against anything else
+/// is always over tolerance (see mem_utils::MeasureErrors(...)).  The images
+/// are within tolerance if at most max_values_over values are over it.  The
+/// defaults only accept images whose values are all equal.
+struct ImageTolerance {
+  double absolute;
+  double relative;
+  std::size_t max_values_over;
+  // Stop reading as soon as the images are known not to be within tolerance.
+  // Turn this off to get statistics for the whole image even when it fails.
+  bool stop_early;
+
+  explicit ImageTolerance(double absolute_tolerance = 0.0,
+                          double relative_tolerance = 0.0,
+                          std::size_t max_over = 0, bool stop = true)
+      : absolute(absolute_tolerance), relative(relative_tolerance),
+        max_values_over(max_over), stop_early(stop) {}
+};
+
+/// Result of CompareImages(...).
+struct ImageDifference {
+  bool dimensions_match;
+  bool within_tolerance;
+  // False if the comparison stopped early (or the dimensions don't match), in
+  // which case the statistics below only cover the values that were read.
+  bool complete;
+  std::size_t num_compared;  // Values compared.
+  std::size_t num_over;      // Values over tolerance.
+  double max_error;          // Largest error, and the first value with it in
+  int max_error_x;           // row major order (interleaved images) or plane
+  int max_error_y;           // order (planar ones).  The location is -1 if no
+  int max_error_channel;     // value differs.
+  double mean_error;         // Mean error of the values compared.
+};
+
+/// Compare two images value by value, within tolerance, in a single pass.
+/// The images must have the same channel type, but may have any layout:
+/// images are walked the same way operator== walks them, so contiguous images
+/// are measured in one go, windowed (or padded) ones a row at a time, and tiled
+/// ones a run of contiguous pixels at a time.  Images known to be uniform (see
+/// ImageBase::IsUniform) are not read.  Pixels are only read through const
+/// accessors (such as ImageBase::GetConstRowSpan), so comparing never detaches
+/// a CowImageBuf or allocates tiles of a SparseImageBuf.
+///
+/// Values are measured a vector at a time for the channel types that
+/// mem_utils::MeasureErrors(...) vectorizes.
+///
+/// Usage:
+///   const jr::ImageDifference diff =
+///       jr::CompareImages(result, golden, jr::ImageTolerance(1e-5, 1e-3));
+///   EXPECT_TRUE(diff.within_tolerance)
+///       << diff.num_over << " values differ, by up to " << diff.max_error
+///       << " at (" << diff.max_error_x << ", " << diff.max_error_y << ")";
+template<typename ImageImplAT, typename ImageImplBT>
+ImageDifference CompareImages(const ImageBase<ImageImplAT>& a,
+                              const ImageBase<ImageImplBT>& b,
+                              const ImageTolerance& tolerance =
+                                  ImageTolerance());
+
+/// CompareImages(a, b, tolerance).within_tolerance.
+template<typename ImageImplAT, typename ImageImplBT>
+bool ImagesAreClose(const ImageBase<ImageImplAT>& a,
+                    const ImageBase<ImageImplBT>& b,
+                    const ImageTolerance& tolerance = ImageTolerance());
+
+namespace implementation_details {
+
+// Running totals of a CompareImages(...) call, fed spans of values from both
+// images.  A span of n values starts at pixel (x, y) and channel c; for an
+// interleaved span the values run through every channel of consecutive pixels
+// (c is 0), and for a planar one through consecutive pixels of plane c.  Spans
+// may wrap onto the next row, and planar ones onto the next plane.
+template<typename T>
+class ErrorAccumulator {
+ public:
+  // Values measured at a time, between checks for stopping early.
+  static const std::size_t CHUNK_VALUES = 16384;
+
+  ErrorAccumulator(int width, int height, int num_channels,
+                   const ImageTolerance& tolerance)
+      : width_(width), height_(height), num_channels_(num_channels),
+        tolerance_(tolerance), num_compared_(0), num_over_(0),
+        sum_error_(0.0), max_error_(0.0), max_error_x_(-1), max_error_y_(-1),
+        max_error_channel_(-1) {}
+
+  // Measure a span of values from each image.  Return false once the
+  // comparison should stop.
+  bool Add(const T* a, const T* b, std::size_t n, int x, int y, int c,
+           bool planar) {
+    for (std::size_t offset = 0; offset < n; offset += CHUNK_VALUES) {
+      const std::size_t count = std::min(CHUNK_VALUES, n - offset);
+      const mem_utils::ErrorStats stats = mem_utils::MeasureErrors(
+          a + offset, b + offset, count, tolerance_.absolute,
+          tolerance_.relative);
+      Record(stats, count, offset, x, y, c, planar);
+      if (ShouldStop()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // As Add(...), for an image that is known to hold value everywhere.  Every
+  // call must pass the same value.
+  bool AddUniform(const T* a, const T& value, std::size_t n, int x, int y,
+                  int c, bool planar) {
+    if (uniform_.size() < std::min(CHUNK_VALUES, n)) {
+      uniform_.assign(std::min(CHUNK_VALUES, n), value);
+    }
+    for (std::size_t offset = 0; offset < n; offset += CHUNK_VALUES) {
+      const std::size_t count = std::min(CHUNK_VALUES, n - offset);
+      const mem_utils::ErrorStats stats = mem_utils::MeasureErrors(
+          a + offset, uniform_.data(), count, tolerance_.absolute,
+          tolerance_.relative);
+      Record(stats, count, offset, x, y, c, planar);
+      if (ShouldStop()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Measure n values that all hold value_a in one image and value_b in the
+  // other, starting from the first value of the image.
+  void AddRepeated(const T& value_a, const T& value_b, std::size_t n) {
+    if (n == 0) {
+      return;
+    }
+    mem_utils::ErrorStats stats = mem_utils::MeasureErrors(
+        &value_a, &value_b, 1, tolerance_.absolute, tolerance_.relative);
+    stats.num_over *= n;
+    stats.sum_error *= static_cast<double>(n);
+    Record(stats, n, 0, 0, 0, 0, false);
+  }
+
+  // Count n values known to be equal.
+  void AddEqual(std::size_t n) { num_compared_ += n; }
+
+  ImageDifference Result() const {
+    ImageDifference result;
+    result.dimensions_match = true;
+    result.within_tolerance = num_over_ <= tolerance_.max_values_over;
+    result.num_compared = num_compared_;
+    result.complete = num_compared_ ==
+                      static_cast<std::size_t>(width_) * height_ *
+                          num_channels_;
+    result.num_over = num_over_;
+    result.max_error = max_error_;
+    result.max_error_x = max_error_x_;
+    result.max_error_y = max_error_y_;
+    result.max_error_channel = max_error_channel_;
+    result.mean_error = num_compared_ == 0
+                            ? 0.0
+                            : sum_error_ / static_cast<double>(num_compared_);
+    return result;
+  }
+
+ private:
+  bool ShouldStop() const {
+    return tolerance_.stop_early && num_over_ > tolerance_.max_values_over;
+  }
+
+  // Add the stats of count values, the first of which is value offset of a
+  // span (see Add(...)).
+  void Record(const mem_utils::ErrorStats& stats, std::size_t count,
+              std::size_t offset, int x, int y, int c, bool planar) {
+    num_compared_ += count;
+    num_over_ += stats.num_over;
+    sum_error_ += stats.sum_error;
+    if (stats.max_error > max_error_) {
+      max_error_ = stats.max_error;
+      const std::size_t index = offset + stats.max_error_index;
+      const std::size_t plane_pixels =
+          static_cast<std::size_t>(width_) * height_;
+      std::size_t pixel = static_cast<std::size_t>(y) * width_ + x;
+      if (planar) {
+        pixel += index;
+        max_error_channel_ = c + static_cast<int>(pixel / plane_pixels);
+        pixel %= plane_pixels;
+      } else {
+        pixel += index / num_channels_;
+        max_error_channel_ = static_cast<int>(index % num_channels_);
+      }
+      max_error_x_ = static_cast<int>(pixel % width_);
+      max_error_y_ = static_cast<int>(pixel / width_);
+    }
+  }
+
+  const int width_, height_, num_channels_;
+  const ImageTolerance tolerance_;
+  std::size_t num_compared_;
+  std::size_t num_over_;
+  double sum_error_;
+  double max_error_;
+  int max_error_x_, max_error_y_, max_error_channel_;
+  // Copies of the value of a uniform image, for AddUniform(...).
+  std::vector<T> uniform_;
+};
+
+template<typename T>
+const std::size_t ErrorAccumulator<T>::CHUNK_VALUES;
+
+// Call func(values, n, x, y, c, planar) for each span of values stored
+// contiguously in image (see ErrorAccumulator), stopping early if it returns
+// false.  The last argument is true_type if the image has linear rows.
+template<typename ImageImplT, typename FuncT>
+void ForEachValueSpan(const ImageBase<ImageImplT>& image, FuncT func,
+                      std::true_type) {
+  if (image.IsMemoryContiguous()) {
+    func(image.GetPlaneRow(0, 0), static_cast<std::size_t>(image.Numel()), 0,
+         0, 0, image.IsPlanar());
+    return;
+  }
+  for (int p = 0; p < image.NumPlanes(); ++p) {
+    for (int y = 0; y < image.Height(); ++y) {
+      if (!func(image.GetPlaneRow(p, y), image.PlaneRowNumel(), 0, y, p,
+                image.IsPlanar())) {
+        return;
+      }
+    }
+  }
+}
+
+template<typename ImageImplT, typename FuncT>
+void ForEachValueSpan(const ImageBase<ImageImplT>& image, FuncT func,
+                      std::false_type) {
+  assert(!image.IsPlanar());
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width();) {
+      int span = 0;
+      const auto* values = image.GetConstRowSpan(x, y, &span);
+      if (!func(values, static_cast<std::size_t>(span) * image.Channels(), x,
+                y, 0, false)) {
+        return;
+      }
+      x += span;
+    }
+  }
+}
+
+// Row y of an interleaved image, copied into scratch (which must hold a row)
+// unless the image has linear rows.
+template<typename ImageImplT>
+const typename ImageTraits<ImageImplT>::ChannelT* InterleavedRow(
+    const ImageBase<ImageImplT>& image, int y,
+    typename ImageTraits<ImageImplT>::ChannelT* scratch, std::true_type) {
+  return image.GetPlaneRow(0, y);
+}
+
+template<typename ImageImplT>
+const typename ImageTraits<ImageImplT>::ChannelT* InterleavedRow(
+    const ImageBase<ImageImplT>& image, int y,
+    typename ImageTraits<ImageImplT>::ChannelT* scratch, std::false_type) {
+  for (int x = 0; x < image.Width();) {
+    int span = 0;
+    const auto* values = image.GetConstRowSpan(x, y, &span);
+    memcpy(static_cast<void*>(scratch + x * image.Channels()),
+           static_cast<const void*>(values), span * image.PixelSizeBytes());
+    x += span;
+  }
+  return scratch;
+}
+
+// Compare a planar image against an interleaved one, deinterleaving a row of
+// the latter at a time.
+template<typename ImageImplPlanarT, typename ImageImplInterleavedT>
+void MeasurePlanarAgainstInterleaved(
+    const ImageBase<ImageImplPlanarT>& planar,
+    const ImageBase<ImageImplInterleavedT>& interleaved,
+    ErrorAccumulator<typename ImageTraits<ImageImplPlanarT>::ChannelT>& acc) {
+  assert(planar.IsPlanar() && !interleaved.IsPlanar());
+  typedef typename ImageTraits<ImageImplPlanarT>::ChannelT ChannelT;
+  const int width = planar.Width();
+  const int num_channels = planar.Channels();
+  std::vector<ChannelT> row(static_cast<std::size_t>(width) * num_channels);
+  std::vector<ChannelT> planes(row.size());
+  for (int y = 0; y < planar.Height(); ++y) {
+    const ChannelT* values = InterleavedRow(
+        interleaved, y, row.data(),
+        std::integral_constant<bool,
+            ImageBase<ImageImplInterleavedT>::HasLinearRows()>());
+    mem_utils::Deinterleave(values, width, num_channels, planes.data(),
+                            width);
+    for (int c = 0; c < num_channels; ++c) {
+      if (!acc.Add(planar.GetPlaneRow(c, y), planes.data() + c * width, width,
+                   0, y, c, true)) {
+        return;
+      }
+    }
+  }
+}
+
+// Compare two images that are not known to be uniform.  The last argument is
+// true_type if both images have linear rows.
+template<typename ImageImplAT, typename ImageImplBT>
+void MeasureImageErrors(
+    const ImageBase<ImageImplAT>& a, const ImageBase<ImageImplBT>& b,
+    ErrorAccumulator<typename ImageTraits<ImageImplAT>::ChannelT>& acc,
+    std::true_type) {
+  if (a.IsPlanar() != b.IsPlanar()) {
+    if (a.IsPlanar()) {
+      MeasurePlanarAgainstInterleaved(a, b, acc);
+    } else {
+      MeasurePlanarAgainstInterleaved(b, a, acc);
+    }
+  } else if (a.IsMemoryContiguous() && b.IsMemoryContiguous()) {
+    acc.Add(a.GetPlaneRow(0, 0), b.GetPlaneRow(0, 0),
+            static_cast<std::size_t>(a.Numel()), 0, 0, 0, a.IsPlanar());
+  } else {
+    for (int p = 0; p < a.NumPlanes(); ++p) {
+      for (int y = 0; y < a.Height(); ++y) {
+        if (!acc.Add(a.GetPlaneRow(p, y), b.GetPlaneRow(p, y),
+                     a.PlaneRowNumel(), 0, y, p, a.IsPlanar())) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+template<typename ImageImplAT, typename ImageImplBT>
+void MeasureImageErrors(
+    const ImageBase<ImageImplAT>& a, const ImageBase<ImageImplBT>& b,
+    ErrorAccumulator<typename ImageTraits<ImageImplAT>::ChannelT>& acc,
+    std::false_type) {
+  if (a.IsPlanar()) {
+    MeasurePlanarAgainstInterleaved(a, b, acc);
+    return;
+  } else if (b.IsPlanar()) {
+    MeasurePlanarAgainstInterleaved(b, a, acc);
+    return;
+  }
+  typedef typename ImageTraits<ImageImplAT>::ChannelT ChannelT;
+  const int width = a.Width();
+  const std::size_t num_channels = a.Channels();
+  int x = 0, y = 0;
+  ForEachMatchingRowSpan(a, b,
+      [&acc, &x, &y, width, num_channels](const ChannelT* a_values,
+                                          const ChannelT* b_values,
+                                          int num_pixels) {
+        const bool go_on = acc.Add(a_values, b_values,
+                                   num_pixels * num_channels, x, y, 0, false);
+        x += num_pixels;
+        if (x == width) {
+          x = 0;
+          ++y;
+        }
+        return go_on;
+      });
+}
+
+}  // namespace implementation_details
+
+
+template<typename ImageImplAT, typename ImageImplBT>
+ImageDifference CompareImages(const ImageBase<ImageImplAT>& a,
+                              const ImageBase<ImageImplBT>& b,
+                              const ImageTolerance& tolerance) {
+  typedef typename ImageTraits<ImageImplAT>::ChannelT ChannelT;
+  static_assert(
+      std::is_same<ChannelT,
+                   typename ImageTraits<ImageImplBT>::ChannelT>::value,
+      "CompareImages(...) needs images with the same channel type.");
+  using implementation_details::ErrorAccumulator;
+
+  if (!jr::DimensionsMatch(a, b)) {
+    ImageDifference result = ErrorAccumulator<ChannelT>(
+        0, 0, 0, tolerance).Result();
+    result.dimensions_match = false;
+    result.within_tolerance = false;
+    result.complete = false;
+    return result;
+  }
+  ErrorAccumulator<ChannelT> acc(a.Width(), a.Height(), a.Channels(),
+                                 tolerance);
+  const std::size_t numel = static_cast<std::size_t>(a.Numel());
+  if (static_cast<const void*>(&a) == static_cast<const void*>(&b)) {
+    acc.AddEqual(numel);
+    return acc.Result();
+  }
+
+  // As in operator==, only read the images that aren't known to be uniform.
+  ChannelT a_value, b_value;
+  const bool a_uniform = a.IsUniform(&a_value);
+  const bool b_uniform = b.IsUniform(&b_value);
+  if (a_uniform && b_uniform) {
+    acc.AddRepeated(a_value, b_value, numel);
+  } else if (a_uniform || b_uniform) {
+    const ChannelT value = a_uniform ? a_value : b_value;
+    auto add_span = [&acc, &value](const ChannelT* values, std::size_t n,
+                                   int x, int y, int c, bool planar) {
+      return acc.AddUniform(values, value, n, x, y, c, planar);
+    };
+    if (a_uniform) {
+      implementation_details::ForEachValueSpan(
+          b, add_span,
+          std::integral_constant<bool,
+              ImageBase<ImageImplBT>::HasLinearRows()>());
+    } else {
+      implementation_details::ForEachValueSpan(
+          a, add_span,
+          std::integral_constant<bool,
+              ImageBase<ImageImplAT>::HasLinearRows()>());
+    }
+  } else {
+    implementation_details::MeasureImageErrors(
+        a, b, acc,
+        std::integral_constant<bool,
+            ImageBase<ImageImplAT>::HasLinearRows() &&
+            ImageBase<ImageImplBT>::HasLinearRows()>());
+  }
+  return acc.Result();
+}
+
+
+template<typename ImageImplAT, typename ImageImplBT>
+bool ImagesAreClose(const ImageBase<ImageImplAT>& a,
+                    const ImageBase<ImageImplBT>& b,
+                    const ImageTolerance& tolerance) {
+  return CompareImages(a, b, tolerance).within_tolerance;
+}
+
+}  // namespace jr
+
+#endif  // JRIMAGE_COMPARE_H_
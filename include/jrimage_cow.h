@@ -0,0 +1,457 @@
+#ifndef JRIMAGE_COW_H_
+#define JRIMAGE_COW_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "jrimage.h"
+
+// Copy-on-write images for jrimage.
+
+namespace jr {
+
+/// Row block height that makes a CowImageBuf detach the whole image at once.
+const constexpr int COW_WHOLE_IMAGE = 0;
+
+template<typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+class CowImageBuf;
+
+template<typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+struct ImageTraits<CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>> {
+  // Primitive type used for a single channel.
+  typedef T ChannelT;
+
+  // Memory layout tag; always InterleavedLayout.
+  typedef InterleavedLayout LayoutT;
+
+  // ChannelCountKnownAtCompileTime is true_type if we know the channel count
+  // at compile time, or false_type otherwise.
+  typedef typename std::conditional<NumChannels != DYNAMIC_CHANNELS,
+                                    std::true_type, std::false_type>::type
+                                    ChannelCountKnownAtCompileTime;
+};
+
+/// Copy-on-write 2D image buffer.
+///
+/// Copying a CowImageBuf is O(1): the copy shares the pixel memory of the
+/// original, which is only duplicated when one of the images is first written
+/// through.  This makes it cheap to fan a decoded frame out to several
+/// consumers when only some of them modify it.
+///
+/// The image is stored as a stack of blocks of RowsPerBlock rows each (or a
+/// single block, with COW_WHOLE_IMAGE), each reference counted separately.  A
+/// write detaches only the block it lands in, so a consumer that touches a
+/// small region of interest copies only the rows it needs.
+///
+/// Every accessor that hands out a mutable pointer detaches: the non-const
+/// GetRow(...) and GetPlaneRow(...), GetPointer(...), GetRowSpan(...), and
+/// through them Set(...), SetAllChannels(...) and CopyInto(...) destinations.
+/// Reads through Get(...), GetConstRowSpan(...) or the const row accessors
+/// never copy, so comparing a CowImageBuf or copying out of it (even into a
+/// tiled image, which is walked with GetConstRowSpan(...)) keeps its blocks
+/// shared.
+///
+/// Blocks are also allocated lazily.  SetAll(v) (like construction, with
+/// v = T()) does not allocate or write any memory; it just records that every
+/// value is v, which Get(...) returns.  A block is only materialized (filled
+/// with v) when a mutable pointer into it is first requested, so an image that
+/// is filled and then partly written only ever holds the blocks that were
+/// written.  Const row pointers into an unmaterialized block point at a single
+/// row of v, which stays valid until the next SetAll(...) or Resize(...).
+/// CopyInto(...) and operator== take shortcuts for uniform images (see
+/// ImageBase::IsUniform), and otherwise only read the other blocks.
+///
+/// Like ImageBuf, each CowImageBuf object must only be used by one thread at a
+/// time, but copies sharing memory may be used (and detached) concurrently.
+/// Windows are not supported.
+template <typename T,  // Primitive type stored in the array.
+          int NumChannels = DYNAMIC_CHANNELS,  // Channel count, or DYNAMIC_CHANNELS.
+          typename Allocator = std::allocator<T>,  // Allocator used for memory allocation.
+          int RowsPerBlock = COW_WHOLE_IMAGE>  // Rows detached at a time.
+class CowImageBuf
+    : public ImageBase<CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>> {
+ public:
+  static constexpr int ROWS_PER_BLOCK = RowsPerBlock;
+
+  // Static assertions that the template arguments are reasonable.
+  static_assert(std::is_trivial<T>::value,
+                "CowImageBuf template type T must be trivially copyable "
+                "and trivially constructable.");
+  static_assert(std::is_same<T, typename Allocator::value_type>::value,
+                "CowImageBuf allocator template argument needs to be an "
+                "allocator for the CowImageBuf's pixel type T.");
+  static_assert(
+      NumChannels == DYNAMIC_CHANNELS || NumChannels > 0,
+      "NumChannels must either be a positive integer, or be the special "
+      "DYNAMIC value.");
+  static_assert(RowsPerBlock >= 0,
+                "RowsPerBlock must be positive, or COW_WHOLE_IMAGE.");
+
+  // Constructors.
+
+  // Construct an image with a dynamic number of channels.
+  // This constructor can only be called if NumChannels == DYNAMIC_CHANNELS.
+  CowImageBuf(int width, int height, int num_channels);
+
+  // Construct an image with a static number of channels.
+  // This constructor can only be called if NumChannels != DYNAMIC_CHANNELS.
+  CowImageBuf(int width, int height);
+
+  // Construct an empty image.
+  CowImageBuf();
+
+  // Copies share memory with other until either image is written to.
+  CowImageBuf(const CowImageBuf& other);
+  CowImageBuf& operator=(const CowImageBuf& other);
+  CowImageBuf(CowImageBuf&& other) noexcept;
+  CowImageBuf& operator=(CowImageBuf&& other) noexcept;
+
+  // Exchange the contents of two images in O(1).
+  void swap(CowImageBuf& other) noexcept;
+
+  // Destructor.
+  ~CowImageBuf();
+
+  // Implementation of the interface required by the CRTP base class ImageBase.
+  inline int Width() const { return w_; }
+  inline int Height() const { return h_; }
+  inline int Channels() const {
+    return SelfT::IsChannelCountDynamic() ? c_ : NumChannels;
+  }
+  // An unmaterialized block has no memory to be contiguous in; its const rows
+  // all point at the same row of fill values.
+  inline bool IsMemoryContiguous() const {
+    return blocks_.empty() ||
+           (blocks_.size() == 1 && blocks_[0].storage != nullptr);
+  }
+  inline std::size_t PixelSizeBytes() const { return sizeof(T) * Channels(); }
+  inline std::size_t TotalByteCount() const {
+    return static_cast<std::size_t>(this->Numel()) * sizeof(T);
+  }
+  inline std::size_t PlaneStride() const { return this->Numel(); }
+
+  inline T* GetRow(int y) { return MutableRow(y); }
+  inline const T* GetRow(int y) const { return RowPointer(y); }
+  inline T* GetPlaneRow(int plane, int y) {
+    assert(plane == 0);
+    return MutableRow(y);
+  }
+  inline const T* GetPlaneRow(int plane, int y) const {
+    assert(plane == 0);
+    return RowPointer(y);
+  }
+  inline T Get(int x, int y, int c) const {
+    const Block& block = blocks_[y / RowsInBlock()];
+    return block.storage == nullptr ? block.value
+                                    : RowPointer(y)[x * Channels() + c];
+  }
+  inline T* GetPointer(int x, int y, int c) const {
+    return MutableRow(y) + x * Channels() + c;
+  }
+  inline T* GetRowSpan(int x, int y, int* span_pixels) const {
+    *span_pixels = Width() - x;
+    return GetPointer(x, y, 0);
+  }
+  inline const T* GetConstRowSpan(int x, int y, int* span_pixels) const {
+    *span_pixels = Width() - x;
+    return RowPointer(y) + x * Channels();
+  }
+  inline bool IsKnownZero() const {
+    T value;
+    return IsUniform(&value) && mem_utils::IsZeroBits(value);
+  }
+  bool IsUniform(T* value) const {
+    if (blocks_.empty()) {
+      return false;
+    }
+    for (const Block& block : blocks_) {
+      if (block.storage != nullptr ||
+          memcmp(&block.value, &blocks_[0].value, sizeof(T)) != 0) {
+        return false;
+      }
+    }
+    *value = blocks_[0].value;
+    return true;
+  }
+  // Drop every block; each one now reads as value.
+  bool SetUniform(const T& value) {
+    for (Block& block : blocks_) {
+      ReleaseBlock(block);
+      block.value = value;
+    }
+    return true;
+  }
+
+  // Resizing to the current dimensions is a no-op; otherwise the image gets
+  // fresh, unshared (and not yet allocated) blocks that read as T().
+  bool Resize(int new_w, int new_h, int new_c) {
+    if (new_w < 0 || new_h < 0 || new_c <= 0) {
+      return false;
+    } else if (!SelfT::IsChannelCountDynamic() && new_c != Channels()) {
+      return false;
+    } else if (new_w == Width() && new_h == Height() && new_c == Channels()) {
+      return true;
+    }
+    AllocateHelper(new_w, new_h, new_c);
+    return true;
+  }
+
+  // Copy-on-write state.
+
+  // Number of rows in each separately shared block.
+  inline int RowsInBlock() const {
+    return RowsPerBlock == COW_WHOLE_IMAGE ? h_ : RowsPerBlock;
+  }
+  inline int NumBlocks() const { return static_cast<int>(blocks_.size()); }
+  // Number of blocks whose memory is still shared with another image.
+  int NumSharedBlocks() const {
+    int num_shared = 0;
+    for (const Block& block : blocks_) {
+      num_shared += block.storage != nullptr && !block.storage->IsUnique();
+    }
+    return num_shared;
+  }
+  // Number of blocks that have memory allocated (shared or not).
+  int NumMaterializedBlocks() const {
+    int num_materialized = 0;
+    for (const Block& block : blocks_) {
+      num_materialized += block.storage != nullptr;
+    }
+    return num_materialized;
+  }
+  inline bool IsShared() const { return NumSharedBlocks() > 0; }
+
+  // Give this image a private copy of every block it still shares.
+  void Detach() {
+    for (std::size_t b = 0; b < blocks_.size(); ++b) {
+      Detach(b, true);
+    }
+  }
+
+ private:
+  typedef CowImageBuf<T, NumChannels, Allocator, RowsPerBlock> SelfT;
+  typedef implementation_details::SharedImageStorage<T, Allocator> StorageT;
+
+  // A block either has storage, or has none yet and reads as value.
+  struct Block {
+    T* data;
+    StorageT* storage;
+    T value;
+  };
+
+  int w_, h_, c_;
+  Allocator allocator_;
+  // Mutable since GetPointer(...) is const, yet must detach.
+  mutable std::vector<Block> blocks_;
+  // A row of the value of the unmaterialized blocks, which const row accessors
+  // point into; rebuilt when the value or row size changes.  Every such block
+  // has the same value, since only SetAll(...) and Resize(...) set it.
+  mutable std::vector<T> fill_row_;
+
+  inline std::size_t RowNumel() const {
+    return static_cast<std::size_t>(Width()) * Channels();
+  }
+  inline std::size_t BlockNumel(std::size_t b) const {
+    const int first_row = static_cast<int>(b) * RowsInBlock();
+    return std::min(RowsInBlock(), Height() - first_row) * RowNumel();
+  }
+
+  inline const T* RowPointer(int y) const {
+    const int rows = RowsInBlock();
+    const Block& block = blocks_[y / rows];
+    if (block.storage == nullptr) {
+      return FillRow(block.value);
+    }
+    return block.data + (y % rows) * RowNumel();
+  }
+  inline T* MutableRow(int y) const {
+    const int rows = RowsInBlock();
+    Detach(y / rows, true);
+    return blocks_[y / rows].data + (y % rows) * RowNumel();
+  }
+
+  const T* FillRow(const T& value) const {
+    const std::size_t numel = RowNumel();
+    if (fill_row_.size() != numel ||
+        (numel > 0 && memcmp(&fill_row_[0], &value, sizeof(T)) != 0)) {
+      fill_row_.assign(numel, value);
+    }
+    return fill_row_.data();
+  }
+
+  // Give block b memory of its own, filled with its uniform value.
+  void Materialize(std::size_t b) const {
+    Block& block = blocks_[b];
+    if (block.storage != nullptr) {
+      return;
+    }
+    const std::size_t numel = BlockNumel(b);
+    Allocator allocator(allocator_);
+    block.data = allocator.allocate(numel);
+    block.storage = new StorageT(block.data, numel, allocator_);
+    mem_utils::SetMemory(block.data, block.value, numel);
+  }
+
+  // Make sure block b has memory that is not shared, copying its pixels if
+  // preserve is true.
+  void Detach(std::size_t b, bool preserve) const {
+    Block& block = blocks_[b];
+    if (block.storage == nullptr) {
+      Materialize(b);
+      return;
+    } else if (block.storage->IsUnique()) {
+      return;
+    }
+    Block shared = block;
+    block.storage = nullptr;
+    if (preserve) {
+      const std::size_t numel = BlockNumel(b);
+      Allocator allocator(allocator_);
+      block.data = allocator.allocate(numel);
+      block.storage = new StorageT(block.data, numel, allocator_);
+      memcpy(static_cast<void*>(block.data),
+             static_cast<const void*>(shared.data), numel * sizeof(T));
+    } else {
+      Materialize(b);
+    }
+    shared.storage->Release();
+  }
+
+  static void ReleaseBlock(Block& block) {
+    if (block.storage != nullptr) {
+      block.storage->Release();
+      block.storage = nullptr;
+      block.data = nullptr;
+    }
+  }
+
+  void ReleaseBlocks() {
+    for (Block& block : blocks_) {
+      ReleaseBlock(block);
+    }
+    blocks_.clear();
+  }
+
+  void AllocateHelper(int new_w, int new_h, int new_c) {
+    ReleaseBlocks();
+    w_ = new_w;
+    h_ = new_h;
+    c_ = new_c;
+    if (new_h == 0) {
+      return;
+    }
+    const int rows = RowsInBlock();
+    const int num_blocks = (new_h + rows - 1) / rows;
+    Block block;
+    block.data = nullptr;
+    block.storage = nullptr;
+    block.value = T();
+    blocks_.assign(num_blocks, block);
+  }
+};
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+void swap(CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>& a,
+          CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>& b) noexcept {
+  a.swap(b);
+}
+
+
+// Inline member function definitions. ----------------------------------------
+
+// Definitions of the static constants (required since they may be odr-used).
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+constexpr int CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::ROWS_PER_BLOCK;
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::CowImageBuf()
+    : w_(-1), h_(-1), c_(-1) {}
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::CowImageBuf(
+    int width, int height, int num_channels)
+    : w_(-1), h_(-1), c_(-1) {
+  static_assert(NumChannels == DYNAMIC_CHANNELS,
+                "The CowImageBuf(width, height, num_channels) constructor "
+                "can only be called when the CowImageBuf has a \"dynamic\" "
+                "number of channels.");
+  AllocateHelper(width, height, num_channels);
+}
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::CowImageBuf(int width,
+                                                                  int height)
+    : w_(-1), h_(-1), c_(-1) {
+  static_assert(NumChannels != DYNAMIC_CHANNELS,
+                "The CowImageBuf(width, height) constructor can only be "
+                "called when the CowImageBuf has a \"static\" number of "
+                "channels.");
+  AllocateHelper(width, height, NumChannels);
+}
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::CowImageBuf(
+    const CowImageBuf& other)
+    : ImageBase<SelfT>(),
+      w_(other.w_),
+      h_(other.h_),
+      c_(other.c_),
+      allocator_(other.allocator_),
+      blocks_(other.blocks_) {
+  for (const Block& block : blocks_) {
+    if (block.storage != nullptr) {
+      block.storage->AddRef();
+    }
+  }
+}
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>&
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::operator=(
+    const CowImageBuf& other) {
+  CowImageBuf tmp(other);
+  swap(tmp);
+  return *this;
+}
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::CowImageBuf(
+    CowImageBuf&& other) noexcept
+    : CowImageBuf() {
+  swap(other);
+}
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>&
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::operator=(
+    CowImageBuf&& other) noexcept {
+  CowImageBuf tmp(std::move(other));
+  swap(tmp);
+  return *this;
+}
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+void CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::swap(
+    CowImageBuf& other) noexcept {
+  using std::swap;
+  swap(w_, other.w_);
+  swap(h_, other.h_);
+  swap(c_, other.c_);
+  swap(allocator_, other.allocator_);
+  blocks_.swap(other.blocks_);
+}
+
+template <typename T, int NumChannels, typename Allocator, int RowsPerBlock>
+CowImageBuf<T, NumChannels, Allocator, RowsPerBlock>::~CowImageBuf() {
+  ReleaseBlocks();
+}
+
+}  // namespace jr
+
+#endif  // JRIMAGE_COW_H_
@@ -0,0 +1,210 @@
+#ifndef JRIMAGE_FIXED_H_
+#define JRIMAGE_FIXED_H_
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "jrimage.h"
+#include "math_utils.h"
+
+// Fixed size images for jrimage.
+
+namespace jr {
+
+template<typename T, int W, int H, int NumChannels,
+         std::size_t AlignBytes>
+class FixedImageBuf;
+
+template<typename T, int W, int H, int NumChannels,
+         std::size_t AlignBytes>
+struct ImageTraits<FixedImageBuf<T, W, H, NumChannels, AlignBytes>> {
+  // Primitive type used for a single channel.
+  typedef T ChannelT;
+
+  // Memory layout tag; always InterleavedLayout.
+  typedef InterleavedLayout LayoutT;
+
+  // The channel count is always known at compile time.
+  typedef std::true_type ChannelCountKnownAtCompileTime;
+};
+
+/// Small image whose dimensions are fixed at compile time, with its pixels
+/// stored inline (interleaved, with packed rows) rather than on the heap.
+///
+/// This is meant for the many tiny patches (8x8 to 32x32) handled by feature
+/// extraction and matching: creating, copying, and destroying one never touches
+/// the allocator, and since every loop bound is a compile time constant the
+/// compiler can fully unroll and vectorize SetAll, CopyInto and operator==.
+/// Unlike the other image types, FixedImageBufs are copyable values, so they
+/// can be stored directly in containers.
+///
+/// The pixel array is aligned to AlignBytes.  Before C++17, operator new only
+/// guarantees alignof(std::max_align_t), so containers of FixedImageBufs with a
+/// stronger alignment should use AlignedAllocator.
+///
+/// Windows into a FixedImageBuf are non-owning ImageBuf views (see GetWin).
+/// Use CopyFrom(...) to extract a patch from a larger image.
+///
+/// Usage:
+///   jr::FixedImageBuf<float, 16, 16, 1> patch;
+///   for (const Keypoint& kp : keypoints) {
+///     if (patch.CopyFrom(image, kp.x - 8, kp.y - 8)) {
+///       descriptors.push_back(Describe(patch));
+///     }
+///   }
+template <typename T,  // Primitive type stored in the array.
+          int W,  // Width in pixels.
+          int H,  // Height in pixels.
+          int NumChannels,  // Channel count.
+          std::size_t AlignBytes = 32>  // Byte alignment of the pixel array.
+class FixedImageBuf
+    : public ImageBase<FixedImageBuf<T, W, H, NumChannels, AlignBytes>> {
+ public:
+  static constexpr int WIDTH = W;
+  static constexpr int HEIGHT = H;
+  static constexpr int CHANNELS = NumChannels;
+  static constexpr std::size_t NUMEL =
+      static_cast<std::size_t>(W) * H * NumChannels;
+
+  // Static assertions that the template arguments are reasonable.
+  static_assert(std::is_trivial<T>::value,
+                "FixedImageBuf template type T must be trivially copyable "
+                "and trivially constructable.");
+  static_assert(W > 0 && H > 0 && NumChannels > 0,
+                "FixedImageBuf dimensions must be positive.");
+  static_assert(math_utils::IsPowerOfTwo(AlignBytes) &&
+                AlignBytes % alignof(T) == 0,
+                "FixedImageBuf alignment must be a power of two, and a "
+                "multiple of the type T's native alignment.");
+
+  // Construct an image with uninitialized pixels.
+  FixedImageBuf() {}
+
+  // Copies are deep (and cheap, for small images).
+  FixedImageBuf(const FixedImageBuf& other)
+      : ImageBase<FixedImageBuf<T, W, H, NumChannels, AlignBytes>>() {
+    memcpy(pixels_, other.pixels_, sizeof(pixels_));
+  }
+  FixedImageBuf& operator=(const FixedImageBuf& other) {
+    memcpy(pixels_, other.pixels_, sizeof(pixels_));
+    return *this;
+  }
+
+  // Implementation of the interface required by the CRTP base class ImageBase.
+  inline int Width() const { return WIDTH; }
+  inline int Height() const { return HEIGHT; }
+  inline int Channels() const { return CHANNELS; }
+  inline bool IsMemoryContiguous() const { return true; }
+  inline std::size_t PixelSizeBytes() const { return sizeof(T) * CHANNELS; }
+  inline std::size_t TotalByteCount() const { return sizeof(pixels_); }
+  inline std::size_t PlaneStride() const { return NUMEL; }
+
+  inline T* GetRow(int y) { return pixels_ + y * WIDTH * CHANNELS; }
+  inline const T* GetRow(int y) const { return pixels_ + y * WIDTH * CHANNELS; }
+  inline T* GetPlaneRow(int plane, int y) {
+    assert(plane == 0);
+    return GetRow(y);
+  }
+  inline const T* GetPlaneRow(int plane, int y) const {
+    assert(plane == 0);
+    return GetRow(y);
+  }
+  inline T Get(int x, int y, int c) const {
+    return pixels_[(y * WIDTH + x) * CHANNELS + c];
+  }
+  inline T* GetPointer(int x, int y, int c) const {
+    return const_cast<T*>(pixels_) + (y * WIDTH + x) * CHANNELS + c;
+  }
+  inline T* GetRowSpan(int x, int y, int* span_pixels) const {
+    *span_pixels = WIDTH - x;
+    return GetPointer(x, y, 0);
+  }
+  inline const T* GetConstRowSpan(int x, int y, int* span_pixels) const {
+    return GetRowSpan(x, y, span_pixels);
+  }
+  inline bool IsKnownZero() const { return false; }
+  inline bool IsUniform(T* value) const { return false; }
+  inline bool SetUniform(const T& value) { return false; }
+
+  // The dimensions can't change; resizing only succeeds if they already match,
+  // which lets a FixedImageBuf be the destination of CopyInto(...).
+  inline bool Resize(int new_w, int new_h, int new_c) {
+    return new_w == WIDTH && new_h == HEIGHT && new_c == CHANNELS;
+  }
+
+  // Make window a non-owning ImageBuf view of the given region.  The window
+  // dangles once this image is destroyed.
+  template <typename Allocator>
+  inline bool GetWin(int x, int y, int width, int height,
+                     ImageBuf<T, NumChannels, Allocator>& window) const {
+    return window.WrapExternal(GetPointer(x, y, 0), width, height, CHANNELS,
+                               WIDTH * CHANNELS * sizeof(T));
+  }
+
+  // Copy the W x H patch of src whose top left pixel is (x, y) into this
+  // image.  Returns false if the patch does not lie inside src, or if src has a
+  // different channel count.
+  template <typename ImageImplSrcT>
+  bool CopyFrom(const ImageBase<ImageImplSrcT>& src, int x, int y) {
+    static_assert(
+        std::is_same<T, typename ImageTraits<ImageImplSrcT>::ChannelT>::value,
+        "Channel types must match!");
+    if (src.Channels() != CHANNELS || !src.InBounds(x, y) ||
+        !src.InBounds(x + WIDTH - 1, y + HEIGHT - 1)) {
+      return false;
+    }
+    CopyFromHelper(src, x, y,
+                   std::integral_constant<bool,
+                       ImageBase<ImageImplSrcT>::HasLinearRows() &&
+                       !ImageBase<ImageImplSrcT>::IsPlanar()>());
+    return true;
+  }
+
+ private:
+  // Source rows are contiguous; copy each one with a fixed size memcpy.
+  template <typename ImageImplSrcT>
+  void CopyFromHelper(const ImageBase<ImageImplSrcT>& src, int x, int y,
+                      std::true_type) {
+    const std::size_t row_bytes = WIDTH * CHANNELS * sizeof(T);
+    for (int row = 0; row < HEIGHT; ++row) {
+      memcpy(GetRow(row), src.GetRow(y + row) + x * CHANNELS, row_bytes);
+    }
+  }
+
+  // Planar or tiled sources are copied value by value.
+  template <typename ImageImplSrcT>
+  void CopyFromHelper(const ImageBase<ImageImplSrcT>& src, int x, int y,
+                      std::false_type) {
+    for (int row = 0; row < HEIGHT; ++row) {
+      for (int col = 0; col < WIDTH; ++col) {
+        for (int c = 0; c < CHANNELS; ++c) {
+          pixels_[(row * WIDTH + col) * CHANNELS + c] = src.Get(x + col, y + row, c);
+        }
+      }
+    }
+  }
+
+  alignas(AlignBytes) T pixels_[NUMEL];
+};
+
+
+// Definitions of the static constants (required since they may be odr-used).
+template <typename T, int W, int H, int NumChannels,
+          std::size_t AlignBytes>
+constexpr int FixedImageBuf<T, W, H, NumChannels, AlignBytes>::WIDTH;
+template <typename T, int W, int H, int NumChannels,
+          std::size_t AlignBytes>
+constexpr int FixedImageBuf<T, W, H, NumChannels, AlignBytes>::HEIGHT;
+template <typename T, int W, int H, int NumChannels,
+          std::size_t AlignBytes>
+constexpr int FixedImageBuf<T, W, H, NumChannels, AlignBytes>::CHANNELS;
+template <typename T, int W, int H, int NumChannels,
+          std::size_t AlignBytes>
+constexpr std::size_t
+    FixedImageBuf<T, W, H, NumChannels, AlignBytes>::NUMEL;
+
+}  // namespace jr
+
+#endif  // JRIMAGE_FIXED_H_
@@ -0,0 +1,125 @@
+#ifndef JRIMAGE_MMAP_H_
+#define JRIMAGE_MMAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "jrimage.h"
+
+// Memory mapped, file backed storage for jrimage ImageBufs (POSIX only).
+//
+// Raw pixel files are mapped straight into the address space instead of being
+// read into an allocator backed buffer, so pages are only read from disk when
+// they are first touched, and the kernel is free to evict them again under
+// memory pressure.  Writes to a read-write mapping go to the page cache and are
+// written back to the file by the OS, or immediately by calling Sync().
+//
+// Usage:
+//   std::shared_ptr<jr::MappedFile> file =
+//       jr::MappedFile::Open("mosaic.raw", jr::READ_ONLY_MAPPING);
+//   jr::ImageBuf<float, 3> mosaic;
+//   if (file && jr::MapImage(file, 40000, 30000, 3, mosaic)) {
+//     file->Advise(jr::ACCESS_SEQUENTIAL);
+//     ... scan mosaic row by row ...
+//   }
+
+namespace jr {
+
+enum FileMapMode { READ_ONLY_MAPPING, READ_WRITE_MAPPING };
+
+// Expected access patterns, passed on to the kernel through madvise.
+enum AccessPattern {
+  ACCESS_NORMAL,      // No special treatment.
+  ACCESS_SEQUENTIAL,  // Pages will be touched in order (e.g. row scans).
+  ACCESS_RANDOM,      // Pages will be touched in no particular order.
+  ACCESS_WILL_NEED,   // Pages will be needed soon; start reading them in.
+  ACCESS_DONT_NEED    // Pages will not be needed soon; they may be dropped.
+};
+
+// RAII wrapper around a memory mapped file.
+class MappedFile {
+ public:
+  // Map the whole of an existing file.  Returns nullptr on failure.
+  static std::shared_ptr<MappedFile> Open(const std::string& path,
+                                          FileMapMode mode);
+
+  // Create (or truncate) a file of size_bytes bytes and map it read-write.
+  // The file is zero filled.  Returns nullptr on failure.
+  static std::shared_ptr<MappedFile> Create(const std::string& path,
+                                            std::size_t size_bytes);
+
+  // Unmaps the file.  Changes to read-write mappings are not lost, but are
+  // only guaranteed to be on disk after a call to Sync().
+  ~MappedFile();
+
+  void* Data() const { return data_; }
+  std::size_t Size() const { return size_; }
+  bool IsWritable() const { return mode_ == READ_WRITE_MAPPING; }
+
+  // Hint how the byte range [offset, offset + length) will be accessed.  The
+  // default range is the whole file.  offset need not be page aligned.
+  bool Advise(AccessPattern pattern, std::size_t offset = 0,
+              std::size_t length = static_cast<std::size_t>(-1)) const;
+
+  // Flush changes made through a read-write mapping to the file.  If
+  // asynchronous is true the write back is only scheduled.
+  bool Sync(bool asynchronous = false) const;
+
+ private:
+  MappedFile(int fd, void* data, std::size_t size, FileMapMode mode)
+      : fd_(fd), data_(data), size_(size), mode_(mode) {}
+
+  static std::shared_ptr<MappedFile> Map(int fd, std::size_t size,
+                                         FileMapMode mode);
+
+  int fd_;
+  void* data_;
+  std::size_t size_;
+  FileMapMode mode_;
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Make image a zero-copy view of the raw pixels stored in file, starting
+// offset_bytes into it.  See ImageBuf::WrapExternal for the meaning of the
+// remaining arguments.  The image (and any of its windows) keeps the mapping
+// alive, so the caller may drop its own reference to file at any time.
+//
+// Writing to an image mapped from a READ_ONLY_MAPPING file is an error (and
+// will crash).  Returns false if file is too small to hold the image, or if
+// offset_bytes leaves the pixels misaligned for T.
+template <typename T, int NumChannels, typename Allocator,
+          std::size_t RowAlignBytes, typename Layout>
+bool MapImage(const std::shared_ptr<MappedFile>& file, int width, int height,
+              int num_channels,
+              ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>& image,
+              std::size_t row_pitch_bytes = PACKED_ROWS,
+              std::size_t offset_bytes = 0) {
+  if (file == nullptr || width < 0 || height < 0 || num_channels <= 0) {
+    return false;
+  }
+  const bool planar = std::is_same<Layout, PlanarLayout>::value;
+  const std::size_t pitch =
+      row_pitch_bytes != PACKED_ROWS
+          ? row_pitch_bytes
+          : sizeof(T) * width * (planar ? 1 : num_channels);
+  const std::size_t needed_bytes =
+      pitch * height * (planar ? num_channels : 1);
+  if (offset_bytes > file->Size() || file->Size() - offset_bytes < needed_bytes) {
+    return false;
+  }
+
+  std::shared_ptr<MappedFile> keep_alive = file;
+  T* data = reinterpret_cast<T*>(static_cast<uint8_t*>(file->Data()) +
+                                 offset_bytes);
+  return image.WrapExternal(data, width, height, num_channels, pitch,
+                            [keep_alive](T*) {});
+}
+
+}  // namespace jr
+
+#endif  // JRIMAGE_MMAP_H_
@@ -0,0 +1,214 @@
+#ifndef JRIMAGE_POOL_H_
+#define JRIMAGE_POOL_H_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+#include "jrimage.h"
+
+namespace jr {
+
+// Thread safe pool of recycled ImageBufs, for code that repeatedly creates and
+// destroys temporaries of the same few shapes.  Images are handed out through
+// an RAII Handle that returns the image to the pool when it goes out of scope.
+// Every ImageT has a fixed pixel type, alignment and layout, so cached images
+// are keyed by (width, height, channels).
+//
+// The pool keeps at most ByteBudget() bytes of idle images, evicting the least
+// recently returned ones first.  The pool must outlive all of its handles.
+//
+// Usage:
+//   jr::ImagePool<jr::ImageBuf<float, 3>> pool(256 << 20);
+//   {
+//     auto tmp = pool.Acquire(w, h, 3);
+//     input.CopyInto(*tmp);
+//     ...
+//   }  // tmp goes back to the pool here.
+template <typename ImageT>
+class ImagePool {
+ public:
+  // Counters describing how well the pool is working.
+  struct Stats {
+    std::size_t hits;       // Acquire calls satisfied from the pool.
+    std::size_t misses;     // Acquire calls that had to allocate.
+    std::size_t evictions;  // Idle images freed to stay within the budget.
+    std::size_t idle_images;
+    std::size_t idle_bytes;
+  };
+
+  // RAII handle to an image checked out of the pool.  Movable, not copyable.
+  class Handle {
+   public:
+    Handle() : pool_(nullptr) {}
+    Handle(Handle&& other) noexcept
+        : pool_(other.pool_), image_(std::move(other.image_)) {
+      other.pool_ = nullptr;
+    }
+    Handle& operator=(Handle&& other) noexcept {
+      if (this != &other) {
+        Release();
+        pool_ = other.pool_;
+        image_ = std::move(other.image_);
+        other.pool_ = nullptr;
+      }
+      return *this;
+    }
+    ~Handle() { Release(); }
+
+    ImageT& operator*() { return image_; }
+    ImageT* operator->() { return &image_; }
+    ImageT* Get() { return &image_; }
+    explicit operator bool() const { return pool_ != nullptr; }
+
+    // Give the image back to the pool now, leaving this handle empty.
+    void Release() {
+      if (pool_ != nullptr) {
+        pool_->Return(std::move(image_));
+        pool_ = nullptr;
+      }
+    }
+
+   private:
+    friend class ImagePool;
+    Handle(ImagePool* pool, ImageT&& image)
+        : pool_(pool), image_(std::move(image)) {}
+
+    ImagePool* pool_;
+    ImageT image_;
+
+    Handle(const Handle&) = delete;
+    Handle& operator=(const Handle&) = delete;
+  };
+
+  explicit ImagePool(std::size_t byte_budget)
+      : byte_budget_(byte_budget), idle_bytes_(0), stats_() {}
+
+  // Check out a width x height image with num_channels channels (which must
+  // match ImageT's channel count, if that is static), reusing an idle one of
+  // the same shape if possible.  The contents of recycled images are
+  // unspecified.
+  Handle Acquire(int width, int height, int num_channels) {
+    const Key key(width, height, num_channels);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      typename Index::iterator it = index_.find(key);
+      if (it != index_.end()) {
+        // Hand out the most recently returned image; it is the most likely to
+        // still be in cache.
+        typename Lru::iterator entry = it->second.back();
+        it->second.pop_back();
+        if (it->second.empty()) {
+          index_.erase(it);
+        }
+        ImageT image(std::move(entry->image));
+        idle_bytes_ -= entry->bytes;
+        lru_.erase(entry);
+        ++stats_.hits;
+        return Handle(this, std::move(image));
+      }
+      ++stats_.misses;
+    }
+
+    // Allocate outside the lock.
+    ImageT image;
+    const bool resized = image.Resize(width, height, num_channels);
+    assert(resized);
+    return Handle(this, std::move(image));
+  }
+
+  Stats GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.idle_images = lru_.size();
+    stats.idle_bytes = idle_bytes_;
+    return stats;
+  }
+
+  std::size_t ByteBudget() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return byte_budget_;
+  }
+
+  // Change the budget, evicting idle images if it shrank.
+  void SetByteBudget(std::size_t byte_budget) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    byte_budget_ = byte_budget;
+    EvictToBudget();
+  }
+
+  // Free all idle images.
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+    index_.clear();
+    idle_bytes_ = 0;
+  }
+
+ private:
+  typedef std::tuple<int, int, int> Key;
+  struct Entry {
+    Key key;
+    std::size_t bytes;
+    ImageT image;
+  };
+  // Idle images, most recently returned first.
+  typedef std::list<Entry> Lru;
+  // Idle images of each shape, oldest first.
+  typedef std::map<Key, std::deque<typename Lru::iterator>> Index;
+
+  void Return(ImageT&& image) {
+    // Only images that own a block (not windows or shared images) can be
+    // recycled.
+    const std::size_t bytes =
+        image.Capacity() * sizeof(typename ImageTraits<ImageT>::ChannelT);
+    if (bytes == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (bytes > byte_budget_) {
+      return;
+    }
+    const Key key(image.Width(), image.Height(), image.Channels());
+    lru_.push_front(Entry{key, bytes, std::move(image)});
+    index_[key].push_back(lru_.begin());
+    idle_bytes_ += bytes;
+    EvictToBudget();
+  }
+
+  // Requires mutex_ to be held.
+  void EvictToBudget() {
+    while (idle_bytes_ > byte_budget_) {
+      // The least recently returned image is also the oldest of its shape.
+      Entry& victim = lru_.back();
+      typename Index::iterator it = index_.find(victim.key);
+      it->second.pop_front();
+      if (it->second.empty()) {
+        index_.erase(it);
+      }
+      idle_bytes_ -= victim.bytes;
+      lru_.pop_back();
+      ++stats_.evictions;
+    }
+  }
+
+  mutable std::mutex mutex_;
+  std::size_t byte_budget_;
+  std::size_t idle_bytes_;
+  Lru lru_;
+  Index index_;
+  Stats stats_;
+
+  ImagePool(const ImagePool&) = delete;
+  ImagePool& operator=(const ImagePool&) = delete;
+};
+
+}  // namespace jr
+
+#endif  // JRIMAGE_POOL_H_
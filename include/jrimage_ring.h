@@ -0,0 +1,287 @@
+#ifndef JRIMAGE_RING_H_
+#define JRIMAGE_RING_H_
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "jrimage.h"
+
+namespace jr {
+
+// What FrameRing::AcquireWrite() does when every slot holds an unread frame.
+enum RingFullPolicy {
+  RING_BACKPRESSURE,  // Fail, so the producer can wait or skip the frame.
+  RING_DROP_OLDEST    // Discard the oldest unread frame and reuse its slot.
+};
+
+// Bounded single producer, single consumer queue of frames, for handing video
+// frames from a capture thread to a processing thread.
+//
+// All NumSlots() images are allocated up front with the same shape (using
+// ImageT's allocator, so slots can be aligned, huge page backed, ...), and
+// frames are written and read in place: the hot path never allocates or takes
+// a lock.  The producer calls AcquireWrite(), fills the image and calls
+// Publish(); the consumer calls AcquireRead(), uses the image and calls
+// Release().  Each side holds at most one slot at a time, and slots travel
+// between them by index: published slots through a queue, released ones back
+// through a free list.  With RING_DROP_OLDEST the producer takes its slot from
+// the head of the queue when the free list is empty, so it never waits for the
+// consumer (given at least two slots).
+//
+// Exactly one thread may act as the producer and one as the consumer (they
+// may change over time, given external synchronization); GetStats() may be
+// called from any thread.
+//
+// Usage:
+//   jr::FrameRing<jr::ImageBuf<uint8_t, 3>> ring(4, 1920, 1080, 3,
+//                                                jr::RING_DROP_OLDEST);
+//   // Capture thread.
+//   if (jr::ImageBuf<uint8_t, 3>* frame = ring.AcquireWrite()) {
+//     camera.Read(*frame);
+//     ring.Publish();
+//   }
+//   // Processing thread.
+//   if (const jr::ImageBuf<uint8_t, 3>* frame = ring.AcquireRead()) {
+//     Process(*frame);
+//     ring.Release();
+//   }
+template <typename ImageT>
+class FrameRing {
+ public:
+  typedef typename std::decay<decltype(
+      std::declval<const ImageT&>().GetAllocator())>::type AllocatorT;
+
+  // Queueing latency (from Publish() to AcquireRead()) of the frames that
+  // passed through one slot.
+  struct SlotStats {
+    uint64_t frames;
+    uint64_t total_latency_ns;
+    uint64_t max_latency_ns;
+  };
+
+  struct Stats {
+    uint64_t published;  // Frames published by the producer.
+    uint64_t consumed;   // Frames acquired by the consumer.
+    uint64_t dropped;    // Frames overwritten before being read.
+    uint64_t rejected;   // AcquireWrite() calls that failed.
+    std::vector<SlotStats> slots;
+  };
+
+  // Allocate num_slots (at least one) width x height images with
+  // num_channels channels.
+  FrameRing(std::size_t num_slots, int width, int height, int num_channels,
+            RingFullPolicy policy = RING_BACKPRESSURE,
+            const AllocatorT& allocator = AllocatorT())
+      : num_slots_(num_slots), policy_(policy), slots_(new Slot[num_slots]),
+        queue_(new std::atomic<uint32_t>[num_slots]),
+        free_(new std::atomic<uint32_t>[num_slots]), writing_(NO_SLOT),
+        reading_(NO_SLOT), write_(0), read_(0), free_write_(num_slots),
+        free_read_(0), published_(0), consumed_(0), dropped_(0),
+        rejected_(0) {
+    assert(num_slots > 0);
+    for (std::size_t i = 0; i < num_slots_; ++i) {
+      ImageT image(allocator);
+      const bool resized = image.Resize(width, height, num_channels);
+      assert(resized);
+      slots_[i].image = std::move(image);
+      queue_[i].store(NO_SLOT, std::memory_order_relaxed);
+      free_[i].store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+    }
+  }
+
+  std::size_t NumSlots() const { return num_slots_; }
+  RingFullPolicy Policy() const { return policy_; }
+
+  // Number of published frames that have not been acquired (or dropped).
+  // Only a snapshot, since either side may change it concurrently.
+  std::size_t Size() const {
+    // Load read_ first: it never passes write_, so the difference can't wrap
+    // even if the consumer (or a drop) advances read_ in between.
+    const auto read = read_.load(std::memory_order_acquire);
+    const auto write = write_.load(std::memory_order_acquire);
+    return static_cast<std::size_t>(write - read);
+  }
+
+  // Producer side.
+
+  // Return the slot to write the next frame into, or nullptr if the ring is
+  // full (see RingFullPolicy).  Must be followed by Publish() before the next
+  // call.  The image holds whatever frame the slot held before.
+  ImageT* AcquireWrite() {
+    if (writing_ == NO_SLOT) {
+      writing_ = PopFree();
+    }
+    if (writing_ == NO_SLOT && policy_ == RING_DROP_OLDEST) {
+      writing_ = PopQueued();
+      if (writing_ != NO_SLOT) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    if (writing_ == NO_SLOT) {
+      rejected_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return &slots_[writing_].image;
+  }
+
+  // Make the frame written since AcquireWrite() available to the consumer.
+  void Publish() {
+    assert(writing_ != NO_SLOT);
+    const uint64_t write = write_.load(std::memory_order_relaxed);
+    slots_[writing_].publish_ns = NowNanoseconds();
+    queue_[write % num_slots_].store(writing_, std::memory_order_relaxed);
+    writing_ = NO_SLOT;
+    published_.fetch_add(1, std::memory_order_relaxed);
+    write_.store(write + 1, std::memory_order_release);
+  }
+
+  // Consumer side.
+
+  // Return the oldest published frame, or nullptr if there is none.  Must be
+  // followed by Release() before the next call.
+  ImageT* AcquireRead() {
+    assert(reading_ == NO_SLOT);
+    reading_ = PopQueued();
+    if (reading_ == NO_SLOT) {
+      return nullptr;
+    }
+    Slot& slot = slots_[reading_];
+    RecordLatency(slot, NowNanoseconds() - slot.publish_ns);
+    consumed_.fetch_add(1, std::memory_order_relaxed);
+    return &slot.image;
+  }
+
+  // Give the slot from AcquireRead() back to the producer.
+  void Release() {
+    assert(reading_ != NO_SLOT);
+    const uint64_t free_write = free_write_.load(std::memory_order_relaxed);
+    free_[free_write % num_slots_].store(reading_, std::memory_order_relaxed);
+    reading_ = NO_SLOT;
+    free_write_.store(free_write + 1, std::memory_order_release);
+  }
+
+  Stats GetStats() const {
+    Stats stats;
+    stats.published = published_.load(std::memory_order_relaxed);
+    stats.consumed = consumed_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.rejected = rejected_.load(std::memory_order_relaxed);
+    stats.slots.resize(num_slots_);
+    for (std::size_t i = 0; i < num_slots_; ++i) {
+      stats.slots[i].frames = slots_[i].frames.load(std::memory_order_relaxed);
+      stats.slots[i].total_latency_ns =
+          slots_[i].total_latency_ns.load(std::memory_order_relaxed);
+      stats.slots[i].max_latency_ns =
+          slots_[i].max_latency_ns.load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+ private:
+  static constexpr uint32_t NO_SLOT = ~static_cast<uint32_t>(0);
+
+  struct Slot {
+    ImageT image;
+    // Written by the producer before publishing, read by the consumer.
+    uint64_t publish_ns;
+    // Written by the consumer only; atomic so GetStats() can read them.
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> total_latency_ns;
+    std::atomic<uint64_t> max_latency_ns;
+
+    Slot() : publish_ns(0), frames(0), total_latency_ns(0), max_latency_ns(0) {}
+  };
+
+  // Take the oldest published slot off the queue, or return NO_SLOT if there
+  // is none.  Both sides call this (the producer only to drop frames), so
+  // the head is claimed with a compare and swap.
+  uint32_t PopQueued() {
+    uint64_t read = read_.load(std::memory_order_relaxed);
+    while (read < write_.load(std::memory_order_acquire)) {
+      // The entry may be stale if the other side claims it first, in which
+      // case the compare and swap fails.
+      const uint32_t slot =
+          queue_[read % num_slots_].load(std::memory_order_relaxed);
+      if (read_.compare_exchange_weak(read, read + 1,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_relaxed)) {
+        return slot;
+      }
+    }
+    return NO_SLOT;
+  }
+
+  // Take a slot the consumer released, or return NO_SLOT if there is none.
+  // Only called by the producer.
+  uint32_t PopFree() {
+    const uint64_t free_read = free_read_.load(std::memory_order_relaxed);
+    if (free_read == free_write_.load(std::memory_order_acquire)) {
+      return NO_SLOT;
+    }
+    const uint32_t slot =
+        free_[free_read % num_slots_].load(std::memory_order_relaxed);
+    free_read_.store(free_read + 1, std::memory_order_relaxed);
+    return slot;
+  }
+
+  static uint64_t NowNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Only called by the consumer, so plain loads and stores suffice.
+  static void RecordLatency(Slot& slot, uint64_t latency_ns) {
+    slot.frames.store(slot.frames.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+    slot.total_latency_ns.store(
+        slot.total_latency_ns.load(std::memory_order_relaxed) + latency_ns,
+        std::memory_order_relaxed);
+    if (latency_ns > slot.max_latency_ns.load(std::memory_order_relaxed)) {
+      slot.max_latency_ns.store(latency_ns, std::memory_order_relaxed);
+    }
+  }
+
+  const std::size_t num_slots_;
+  const RingFullPolicy policy_;
+  std::unique_ptr<Slot[]> slots_;
+  // Indices of published slots, in publication order.
+  std::unique_ptr<std::atomic<uint32_t>[]> queue_;
+  // Indices of released slots, in release order.
+  std::unique_ptr<std::atomic<uint32_t>[]> free_;
+
+  // Slot held by the producer (only touched by the producer).
+  uint32_t writing_;
+  // Slot held by the consumer (only touched by the consumer).
+  uint32_t reading_;
+
+  // Frames published so far; only written by the producer.
+  alignas(64) std::atomic<uint64_t> write_;
+  // Frames taken off the queue (read or dropped) so far.
+  alignas(64) std::atomic<uint64_t> read_;
+  // Slots ever released by the consumer (initially all of them)...
+  alignas(64) std::atomic<uint64_t> free_write_;
+  // ...and reused by the producer.
+  alignas(64) std::atomic<uint64_t> free_read_;
+
+  alignas(64) std::atomic<uint64_t> published_;
+  std::atomic<uint64_t> consumed_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> rejected_;
+
+  FrameRing(const FrameRing&) = delete;
+  FrameRing& operator=(const FrameRing&) = delete;
+};
+
+template <typename ImageT>
+constexpr uint32_t FrameRing<ImageT>::NO_SLOT;
+
+}  // namespace jr
+
+#endif  // JRIMAGE_RING_H_
@@ -0,0 +1,206 @@
+#ifndef JRIMAGE_SHM_H_
+#define JRIMAGE_SHM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include "jrimage.h"
+#include "jrimage_mmap.h"
+
+// Images in named POSIX shared memory segments, for handing frames between
+// processes on one host without copying (POSIX only).
+//
+// A segment holds a small SharedImageHeader describing the image, followed by
+// the pixels.  The producer creates the segment, maps it as an ImageBuf, and
+// writes frames into it; consumers open the segment by name and map it as a
+// (usually read-only) ImageBuf view of the same memory.  Handing over a frame
+// then only takes a notification: the producer calls Publish(), which bumps
+// the header's generation counter, and consumers either poll Generation() or
+// are told the new generation through whatever channel the processes already
+// share (a pipe, a socket, ...).
+//
+// The segment does not synchronize access to the pixels themselves; a
+// producer that rewrites a frame while consumers still read it should use
+// several segments (e.g. a ring of them, indexed by generation).
+//
+// Usage:
+//   // Producer.
+//   std::shared_ptr<jr::SharedImageSegment> segment =
+//       jr::SharedImageSegment::Create(
+//           "/camera0", jr::SharedImageFormatFor<jr::ImageBuf<uint8_t, 3>>(
+//                           1920, 1080, 3));
+//   jr::ImageBuf<uint8_t, 3> frame;
+//   jr::MapImage(segment, frame);
+//   ... capture into frame ...
+//   segment->Publish();
+//
+//   // Consumer, in another process.
+//   std::shared_ptr<jr::SharedImageSegment> segment =
+//       jr::SharedImageSegment::Open("/camera0", jr::READ_ONLY_MAPPING);
+//   jr::ImageBuf<uint8_t, 3> frame;
+//   if (segment && jr::MapImage(segment, frame)) {
+//     ... read frame whenever segment->Generation() changes ...
+//   }
+
+namespace jr {
+
+// Identifies a channel type in a segment header: the size in bytes in the low
+// byte, plus one of the kind flags below.
+enum SharedChannelKind : uint32_t {
+  SHARED_CHANNEL_UNSIGNED = 0x100,
+  SHARED_CHANNEL_SIGNED = 0x200,
+  SHARED_CHANNEL_FLOAT = 0x400
+};
+
+template <typename T>
+constexpr uint32_t SharedChannelType() {
+  return static_cast<uint32_t>(sizeof(T)) |
+         (std::is_floating_point<T>::value
+              ? SHARED_CHANNEL_FLOAT
+              : (std::is_signed<T>::value ? SHARED_CHANNEL_SIGNED
+                                          : SHARED_CHANNEL_UNSIGNED));
+}
+
+// Description of the image stored in a segment.
+struct SharedImageFormat {
+  int width;
+  int height;
+  int channels;
+  uint32_t channel_type;  // SharedChannelType<T>() of the pixel type T.
+  bool planar;
+  // Distance between the starts of consecutive rows, or PACKED_ROWS.
+  std::size_t row_pitch_bytes;
+};
+
+// Format of a width x height image with num_channels channels, suitable for
+// mapping as an ImageT.
+template <typename ImageT>
+SharedImageFormat SharedImageFormatFor(int width, int height, int num_channels,
+                                       std::size_t row_pitch_bytes = PACKED_ROWS) {
+  SharedImageFormat format;
+  format.width = width;
+  format.height = height;
+  format.channels = num_channels;
+  format.channel_type =
+      SharedChannelType<typename ImageTraits<ImageT>::ChannelT>();
+  format.planar = ImageBase<ImageT>::IsPlanar();
+  format.row_pitch_bytes = row_pitch_bytes;
+  return format;
+}
+
+// Header at the start of every segment.  Its layout is shared by every
+// process mapping the segment, so it only holds fixed size fields.
+struct SharedImageHeader {
+  static constexpr uint32_t MAGIC = 0x4A525348;  // "JRSH"
+  static constexpr uint32_t VERSION = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  int32_t width;
+  int32_t height;
+  int32_t channels;
+  uint32_t channel_type;
+  uint32_t planar;
+  uint32_t reserved;
+  uint64_t row_pitch_bytes;  // Never PACKED_ROWS.
+  uint64_t data_offset;      // Offset of the pixels from the segment start.
+  std::atomic<uint64_t> generation;
+};
+
+// The generation counter must work across processes.
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "SharedImageHeader needs lock free 64 bit atomics.");
+
+// RAII wrapper around a mapped POSIX shared memory image segment.  Segments
+// outlive the processes that use them until Unlink(...) is called.
+class SharedImageSegment {
+ public:
+  // Create (or replace) the segment called name, which must start with a
+  // slash, sized for an image of the given format, and map it read-write.
+  // The pixels are zero filled and the generation is 0.  Returns nullptr on
+  // failure.
+  static std::shared_ptr<SharedImageSegment> Create(
+      const std::string& name, const SharedImageFormat& format);
+
+  // Map an existing segment.  Returns nullptr on failure, or if the segment
+  // does not hold a valid header.
+  static std::shared_ptr<SharedImageSegment> Open(const std::string& name,
+                                                  FileMapMode mode);
+
+  // Remove the segment's name.  Processes that have it mapped keep using it.
+  static bool Unlink(const std::string& name);
+
+  // Unmaps the segment (but does not unlink it).
+  ~SharedImageSegment();
+
+  const std::string& Name() const { return name_; }
+  const SharedImageHeader& Header() const { return *header_; }
+  void* PixelData() const {
+    return static_cast<uint8_t*>(data_) + header_->data_offset;
+  }
+  std::size_t Size() const { return size_; }
+  bool IsWritable() const { return mode_ == READ_WRITE_MAPPING; }
+
+  // Number of frames published so far.  Pixels written before the matching
+  // Publish() are visible once this returns its generation.
+  uint64_t Generation() const {
+    return header_->generation.load(std::memory_order_acquire);
+  }
+
+  // Mark the pixels written so far as a new frame, and return its generation.
+  // Only valid for writable segments.
+  uint64_t Publish() {
+    return header_->generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+  }
+
+ private:
+  SharedImageSegment(const std::string& name, int fd, void* data,
+                     std::size_t size, FileMapMode mode)
+      : name_(name), fd_(fd), data_(data), size_(size), mode_(mode),
+        header_(static_cast<SharedImageHeader*>(data)) {}
+
+  std::string name_;
+  int fd_;
+  void* data_;
+  std::size_t size_;
+  FileMapMode mode_;
+  SharedImageHeader* header_;
+
+  SharedImageSegment(const SharedImageSegment&) = delete;
+  SharedImageSegment& operator=(const SharedImageSegment&) = delete;
+};
+
+// Make image a zero-copy view of the pixels in segment.  The image (and any of
+// its windows) keeps the mapping alive, so the caller may drop its own
+// reference to segment at any time.
+//
+// Writing to an image mapped from a READ_ONLY_MAPPING segment is an error (and
+// will crash).  Returns false if the segment's pixel type, layout or channel
+// count don't fit the image type.
+template <typename T, int NumChannels, typename Allocator,
+          std::size_t RowAlignBytes, typename Layout>
+bool MapImage(const std::shared_ptr<SharedImageSegment>& segment,
+              ImageBuf<T, NumChannels, Allocator, RowAlignBytes, Layout>& image) {
+  if (segment == nullptr) {
+    return false;
+  }
+  const SharedImageHeader& header = segment->Header();
+  if (header.channel_type != SharedChannelType<T>() ||
+      (header.planar != 0) != std::is_same<Layout, PlanarLayout>::value) {
+    return false;
+  }
+
+  std::shared_ptr<SharedImageSegment> keep_alive = segment;
+  return image.WrapExternal(static_cast<T*>(segment->PixelData()),
+                            header.width, header.height, header.channels,
+                            static_cast<std::size_t>(header.row_pitch_bytes),
+                            [keep_alive](T*) {});
+}
+
+}  // namespace jr
+
+#endif  // JRIMAGE_SHM_H_
@@ -0,0 +1,633 @@
+#ifndef JRIMAGE_SPARSE_H_
+#define JRIMAGE_SPARSE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "jrimage.h"
+#include "math_utils.h"
+
+// Sparse tiled image storage for jrimage.
+
+namespace jr {
+
+template<typename T, int NumChannels, typename Allocator, typename Layout>
+class SparseImageBuf;
+
+template<typename T, int NumChannels, typename Allocator, typename Layout>
+struct ImageTraits<SparseImageBuf<T, NumChannels, Allocator, Layout>> {
+  // Primitive type used for a single channel.
+  typedef T ChannelT;
+
+  // Memory layout tag; always a TiledLayout.
+  typedef Layout LayoutT;
+
+  // ChannelCountKnownAtCompileTime is true_type if we know the channel count
+  // at compile time, or false_type otherwise.
+  typedef typename std::conditional<NumChannels != DYNAMIC_CHANNELS,
+                                    std::true_type, std::false_type>::type
+                                    ChannelCountKnownAtCompileTime;
+};
+
+/// 2D image buffer that only stores the tiles that have been written to.
+///
+/// The image is a grid of tiles, laid out like a TiledImageBuf's, but each
+/// tile is allocated separately and only once something writes to it.  Every
+/// value of an absent tile reads as FillValue().  An occupancy bitmap (one bit
+/// per tile) tracks which tiles are present, so that ForEachOccupiedTile(...)
+/// can skip empty regions 64 tiles at a time.  This suits mask and label
+/// images that are mostly background.
+///
+/// Any accessor that hands out a pointer allocates the tile it points into
+/// (filled with FillValue()): GetPointer(...), GetRowSpan(...), GetTile(...),
+/// GetTileRow(...), and through them Set(...) and SetAllChannels(...).  Use
+/// Get(...), GetConstRowSpan(...) or FindTile(...) to read without allocating.
+///
+/// SetAll(v) frees every tile and makes v the fill value.  CopyInto(...) and
+/// operator== (when at least one side is a SparseImageBuf) only visit the
+/// occupied tiles of sparse images, and fill the rest of a dense destination
+/// with SetAll(...).  Note that these are only picked over the ImageBase
+/// versions when called on a SparseImageBuf, rather than an ImageBase
+/// reference to one, in which case they still work, and read absent tiles
+/// through GetConstRowSpan(...) without allocating them, but visit every tile.
+/// Windows are not supported.
+template <typename T,  // Primitive type stored in the array.
+          int NumChannels = DYNAMIC_CHANNELS,  // Channel count, or DYNAMIC_CHANNELS.
+          typename Allocator = std::allocator<T>,  // Allocator used for each tile.
+          typename Layout = TiledLayout<>>  // Tile dimensions and ordering.
+class SparseImageBuf
+    : public ImageBase<SparseImageBuf<T, NumChannels, Allocator, Layout>> {
+ public:
+  static constexpr int TILE_WIDTH = Layout::TILE_WIDTH;
+  static constexpr int TILE_HEIGHT = Layout::TILE_HEIGHT;
+  static constexpr bool Z_ORDER = Layout::Z_ORDER;
+
+  // Static assertions that the template arguments are reasonable.
+  static_assert(std::is_trivial<T>::value,
+                "SparseImageBuf template type T must be trivially copyable "
+                "and trivially constructable.");
+  static_assert(std::is_same<T, typename Allocator::value_type>::value,
+                "SparseImageBuf allocator template argument needs to be an "
+                "allocator for the SparseImageBuf's pixel type T.");
+  static_assert(
+      NumChannels == DYNAMIC_CHANNELS || NumChannels > 0,
+      "NumChannels must either be a positive integer, or be the special "
+      "DYNAMIC value.");
+  static_assert(IsTiledLayout<Layout>::value,
+                "SparseImageBuf Layout must be a TiledLayout.");
+  static_assert(math_utils::IsPowerOfTwo(TILE_WIDTH) &&
+                math_utils::IsPowerOfTwo(TILE_HEIGHT),
+                "Tile dimensions must be powers of two.");
+  static_assert(!Z_ORDER || (TILE_WIDTH == TILE_HEIGHT &&
+                             TILE_WIDTH <= (1 << 16)),
+                "Z-ordered tiles must be square.");
+
+  // Constructors.  New images have no tiles, and a fill value of T().
+
+  // Construct an image with a dynamic number of channels.
+  // This constructor can only be called if NumChannels == DYNAMIC_CHANNELS.
+  SparseImageBuf(int width, int height, int num_channels);
+
+  // Construct an image with a static number of channels.
+  // This constructor can only be called if NumChannels != DYNAMIC_CHANNELS.
+  SparseImageBuf(int width, int height);
+
+  // Construct an empty image.
+  SparseImageBuf();
+
+  // Destructor.
+  ~SparseImageBuf();
+
+  // Implementation of the interface required by the CRTP base class ImageBase.
+  inline int Width() const { return w_; }
+  inline int Height() const { return h_; }
+  inline int Channels() const {
+    return SelfT::IsChannelCountDynamic() ? c_ : NumChannels;
+  }
+  inline bool IsMemoryContiguous() const { return false; }
+  inline std::size_t PixelSizeBytes() const { return sizeof(T) * Channels(); }
+
+  // Only counts the occupied tiles (inclusive of their padding).
+  inline std::size_t TotalByteCount() const {
+    return NumOccupiedTiles() * TileNumel() * sizeof(T);
+  }
+
+  inline T Get(int x, int y, int c) const {
+    const T* tile = FindTile(x / TILE_WIDTH, y / TILE_HEIGHT);
+    return tile == nullptr
+               ? fill_
+               : tile[TileOffset(x % TILE_WIDTH, y % TILE_HEIGHT) * Channels() + c];
+  }
+  inline T* GetPointer(int x, int y, int c) const {
+    return GetTile(x / TILE_WIDTH, y / TILE_HEIGHT) +
+           TileOffset(x % TILE_WIDTH, y % TILE_HEIGHT) * Channels() + c;
+  }
+  inline T* GetRowSpan(int x, int y, int* span_pixels) const {
+    // In a Z-ordered tile only pixel pairs (2k, y) and (2k + 1, y) are
+    // adjacent in memory.
+    const int run = Z_ORDER ? std::min(TILE_WIDTH, 2 - (x & 1))
+                            : TILE_WIDTH - (x % TILE_WIDTH);
+    *span_pixels = std::min(run, Width() - x);
+    return GetPointer(x, y, 0);
+  }
+  // Spans of absent tiles point into a single row of fill values, so this
+  // never allocates a tile.
+  inline const T* GetConstRowSpan(int x, int y, int* span_pixels) const {
+    if (FindTile(x / TILE_WIDTH, y / TILE_HEIGHT) == nullptr) {
+      *span_pixels = std::min(TILE_WIDTH - (x % TILE_WIDTH), Width() - x);
+      return FillRow();
+    }
+    return GetRowSpan(x, y, span_pixels);
+  }
+  inline bool IsKnownZero() const {
+    return num_occupied_ == 0 && mem_utils::IsZeroBits(fill_);
+  }
+  inline bool IsUniform(T* value) const {
+    if (num_occupied_ != 0 || tiles_.empty()) {
+      return false;
+    }
+    *value = fill_;
+    return true;
+  }
+  // Free every tile; each one now reads as value.
+  bool SetUniform(const T& value) {
+    FreeTiles();
+    fill_ = value;
+    return true;
+  }
+
+  // Value of every channel of every pixel in an absent tile.
+  inline T FillValue() const { return fill_; }
+
+  // Tile access.
+
+  // Number of tiles needed to cover the image horizontally and vertically.
+  inline int TilesAcross() const {
+    return (Width() + TILE_WIDTH - 1) / TILE_WIDTH;
+  }
+  inline int TilesDown() const {
+    return (Height() + TILE_HEIGHT - 1) / TILE_HEIGHT;
+  }
+
+  // Number of T's in a single tile (inclusive of padding).
+  inline std::size_t TileNumel() const {
+    return TILE_WIDTH * TILE_HEIGHT * Channels();
+  }
+
+  // Index of pixel (x, y) of a tile, relative to the start of the tile, in
+  // units of pixels.
+  static inline std::size_t TileOffset(int x_in_tile, int y_in_tile) {
+    return Z_ORDER ? math_utils::MortonEncode2D(x_in_tile, y_in_tile)
+                   : y_in_tile * TILE_WIDTH + x_in_tile;
+  }
+
+  // Number of tiles currently allocated.
+  inline std::size_t NumOccupiedTiles() const { return num_occupied_; }
+
+  inline bool IsTileOccupied(int tile_x, int tile_y) const {
+    const std::size_t index = TileIndex(tile_x, tile_y);
+    return (occupied_[index / 64] >> (index % 64)) & 1;
+  }
+
+  // Pointer to the first element of tile (tile_x, tile_y), or nullptr if the
+  // tile is absent.
+  inline const T* FindTile(int tile_x, int tile_y) const {
+    return tiles_[TileIndex(tile_x, tile_y)];
+  }
+
+  // Pointer to the first element of tile (tile_x, tile_y), which is allocated
+  // if it was absent.
+  inline T* GetTile(int tile_x, int tile_y) const {
+    T*& tile = tiles_[TileIndex(tile_x, tile_y)];
+    return tile != nullptr ? tile : AllocateTile(tile_x, tile_y);
+  }
+
+  // Pointer to row row_in_tile of tile (tile_x, tile_y), which is allocated if
+  // it was absent.  Each tile row holds TILE_WIDTH contiguous pixels, some of
+  // which may be padding.
+  inline T* GetTileRow(int tile_x, int tile_y, int row_in_tile) const {
+    static_assert(!Z_ORDER,
+                  "Rows of Z-ordered tiles are not stored contiguously.");
+    return GetTile(tile_x, tile_y) + row_in_tile * TILE_WIDTH * Channels();
+  }
+
+  // Free tile (tile_x, tile_y), so that it reads as FillValue() again.
+  void ReleaseTile(int tile_x, int tile_y) {
+    const std::size_t index = TileIndex(tile_x, tile_y);
+    if (tiles_[index] != nullptr) {
+      allocator_.deallocate(tiles_[index], TileNumel());
+      tiles_[index] = nullptr;
+      occupied_[index / 64] &= ~(uint64_t(1) << (index % 64));
+      --num_occupied_;
+    }
+  }
+
+  // Free every occupied tile whose values all equal FillValue().  Returns the
+  // number of tiles freed.
+  std::size_t Compact() {
+    std::size_t num_freed = 0;
+    ForEachOccupiedTile([this, &num_freed](int x0, int y0, int width,
+                                           int height, const T* tile) {
+      if (TileMatches(tile, width, height, nullptr, fill_)) {
+        ReleaseTile(x0 / TILE_WIDTH, y0 / TILE_HEIGHT);
+        ++num_freed;
+      }
+    });
+    return num_freed;
+  }
+
+  // Call func(x0, y0, width, height, tile) for each occupied tile in storage
+  // order, with the same arguments as TiledImageBuf::ForEachTile(...).  Absent
+  // tiles are skipped 64 at a time.  func may release the tile it is given.
+  template <typename FuncT>
+  void ForEachOccupiedTile(FuncT func) const {
+    const int tiles_across = TilesAcross();
+    for (std::size_t word = 0; word < occupied_.size(); ++word) {
+      uint64_t bits = occupied_[word];
+      while (bits != 0) {
+        const std::size_t index =
+            word * 64 + math_utils::CountTrailingZeros(bits);
+        bits &= bits - 1;
+        const int x0 = static_cast<int>(index % tiles_across) * TILE_WIDTH;
+        const int y0 = static_cast<int>(index / tiles_across) * TILE_HEIGHT;
+        func(x0, y0, std::min(TILE_WIDTH, Width() - x0),
+             std::min(TILE_HEIGHT, Height() - y0), tiles_[index]);
+      }
+    }
+  }
+
+  // Like ImageBase::CopyInto(...), but only reads the occupied tiles: dest is
+  // filled with SetAll(FillValue(), hint), and then each occupied tile is
+  // copied.
+  template<typename ImageImplOtherT>
+  bool CopyInto(
+      ImageBase<ImageImplOtherT>& dest,
+      mem_utils::CacheHint hint = mem_utils::CACHE_HINT_AUTO) const;
+
+  // Deep comparison against any image, visiting only the occupied tiles of
+  // this image (and of other, if it is a SparseImageBuf with the same tile
+  // size).  Used by operator== for SparseImageBufs.
+  template<typename ImageImplOtherT>
+  bool Equals(const ImageBase<ImageImplOtherT>& other) const;
+  template<typename OtherAllocator>
+  bool Equals(const SparseImageBuf<T, NumChannels, OtherAllocator, Layout>&
+                  other) const;
+
+  // Resizing to the current dimensions is a no-op; otherwise every tile is
+  // freed, and the fill value is reset to T().
+  bool Resize(int new_w, int new_h, int new_c) {
+    if (new_w < 0 || new_h < 0 || new_c <= 0) {
+      return false;
+    } else if (!SelfT::IsChannelCountDynamic() && new_c != Channels()) {
+      return false;
+    } else if (new_w == Width() && new_h == Height() && new_c == Channels()) {
+      return true;
+    }
+    AllocateHelper(new_w, new_h, new_c);
+    return true;
+  }
+
+  void Allocate(int new_w, int new_h) {
+    return AllocateHelper(new_w, new_h, Channels());
+  }
+
+  void Allocate(int new_w, int new_h, int new_c) {
+    static_assert(SelfT::IsChannelCountDynamic(),
+                  "The 3 argument form of Allocate, "
+                  "Allocate(width, height, channels), "
+                  "can only be called using images that have a dynamic "
+                  "channel count.  This image has a static channel count.  "
+                  "Maybe you want to call Allocate(width, height) instead?");
+    return AllocateHelper(new_w, new_h, new_c);
+  }
+
+ private:
+  template <typename, int, typename, typename> friend class SparseImageBuf;
+  typedef SparseImageBuf<T, NumChannels, Allocator, Layout> SelfT;
+  int w_, h_, c_;
+  T fill_;
+  // Mutable since GetPointer(...) is const, yet must allocate.
+  mutable Allocator allocator_;
+  // TILE_WIDTH pixels of fill_, for GetConstRowSpan(...); built on first use.
+  mutable std::vector<T> fill_row_;
+  // One pointer per tile (nullptr if absent), in row major tile order.
+  mutable std::vector<T*> tiles_;
+  // Bit i of word i / 64 is set if tiles_[i] is present.
+  mutable std::vector<uint64_t> occupied_;
+  mutable std::size_t num_occupied_;
+
+  inline std::size_t TileIndex(int tile_x, int tile_y) const {
+    return static_cast<std::size_t>(tile_y) * TilesAcross() + tile_x;
+  }
+
+  const T* FillRow() const {
+    const std::size_t numel = TILE_WIDTH * Channels();
+    if (fill_row_.size() != numel ||
+        memcmp(&fill_row_[0], &fill_, sizeof(T)) != 0) {
+      fill_row_.assign(numel, fill_);
+    }
+    return fill_row_.data();
+  }
+
+  T* AllocateTile(int tile_x, int tile_y) const {
+    const std::size_t index = TileIndex(tile_x, tile_y);
+    T* tile = allocator_.allocate(TileNumel());
+    mem_utils::SetMemory(tile, fill_, TileNumel());
+    tiles_[index] = tile;
+    occupied_[index / 64] |= uint64_t(1) << (index % 64);
+    ++num_occupied_;
+    return tile;
+  }
+
+  // True if the width x height pixels at the start of tile equal the
+  // matching pixels of other_tile, or are all fill if other_tile is nullptr.
+  // other_tile must have the same layout and channel count as this image.
+  bool TileMatches(const T* tile, int width, int height, const T* other_tile,
+                   const T& fill) const {
+    const int num_channels = Channels();
+    const std::size_t pixel_bytes = PixelSizeBytes();
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        const std::size_t offset = TileOffset(x, y) * num_channels;
+        if (other_tile != nullptr) {
+          if (memcmp(tile + offset, other_tile + offset, pixel_bytes) != 0) {
+            return false;
+          }
+          continue;
+        }
+        for (int c = 0; c < num_channels; ++c) {
+          if (memcmp(tile + offset + c, &fill, sizeof(T)) != 0) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  void FreeTiles() {
+    if (num_occupied_ == 0) {
+      return;
+    }
+    ForEachOccupiedTile([this](int x0, int y0, int, int, const T*) {
+      ReleaseTile(x0 / TILE_WIDTH, y0 / TILE_HEIGHT);
+    });
+  }
+
+  void AllocateHelper(int new_w, int new_h, int new_c) {
+    assert(new_w >= 0);
+    assert(new_h >= 0);
+    if (ImageTraits<SelfT>::ChannelCountKnownAtCompileTime::value) {
+      assert(new_c == Channels());
+      new_c = Channels();
+    } else {
+      assert(new_c > 0);
+    }
+
+    FreeTiles();
+    w_ = new_w;
+    h_ = new_h;
+    c_ = new_c;
+    fill_ = T();
+    const std::size_t num_tiles =
+        static_cast<std::size_t>(TilesAcross()) * TilesDown();
+    tiles_.assign(num_tiles, nullptr);
+    occupied_.assign((num_tiles + 63) / 64, 0);
+  }
+
+  // No copying of jr::SparseImageBuf objects.
+  SparseImageBuf(const SparseImageBuf& other) = delete;
+  SparseImageBuf& operator=(const SparseImageBuf& other) = delete;
+};
+
+// Comparisons that involve a SparseImageBuf only visit its occupied tiles; see
+// SparseImageBuf::Equals(...).
+template<typename T, int NumChannels, typename Allocator, typename Layout,
+         typename ImageImplRhsT>
+bool operator==(const SparseImageBuf<T, NumChannels, Allocator, Layout>& lhs,
+                const ImageBase<ImageImplRhsT>& rhs) {
+  return lhs.Equals(rhs);
+}
+template<typename ImageImplLhsT, typename T, int NumChannels,
+         typename Allocator, typename Layout>
+bool operator==(const ImageBase<ImageImplLhsT>& lhs,
+                const SparseImageBuf<T, NumChannels, Allocator, Layout>& rhs) {
+  return rhs.Equals(lhs);
+}
+template<typename T, int NumChannels, typename Allocator, typename Layout,
+         typename U, int OtherChannels, typename OtherAllocator,
+         typename OtherLayout>
+bool operator==(
+    const SparseImageBuf<T, NumChannels, Allocator, Layout>& lhs,
+    const SparseImageBuf<U, OtherChannels, OtherAllocator, OtherLayout>& rhs) {
+  return lhs.Equals(rhs);
+}
+template<typename T, int NumChannels, typename Allocator, typename Layout,
+         typename ImageImplRhsT>
+bool operator!=(const SparseImageBuf<T, NumChannels, Allocator, Layout>& lhs,
+                const ImageBase<ImageImplRhsT>& rhs) {
+  return !(lhs == rhs);
+}
+template<typename ImageImplLhsT, typename T, int NumChannels,
+         typename Allocator, typename Layout>
+bool operator!=(const ImageBase<ImageImplLhsT>& lhs,
+                const SparseImageBuf<T, NumChannels, Allocator, Layout>& rhs) {
+  return !(lhs == rhs);
+}
+template<typename T, int NumChannels, typename Allocator, typename Layout,
+         typename U, int OtherChannels, typename OtherAllocator,
+         typename OtherLayout>
+bool operator!=(
+    const SparseImageBuf<T, NumChannels, Allocator, Layout>& lhs,
+    const SparseImageBuf<U, OtherChannels, OtherAllocator, OtherLayout>& rhs) {
+  return !(lhs == rhs);
+}
+
+
+// Inline member function definitions. ----------------------------------------
+
+// Definitions of the static constants (required since they may be odr-used).
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+constexpr int SparseImageBuf<T, NumChannels, Allocator, Layout>::TILE_WIDTH;
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+constexpr int SparseImageBuf<T, NumChannels, Allocator, Layout>::TILE_HEIGHT;
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+constexpr bool SparseImageBuf<T, NumChannels, Allocator, Layout>::Z_ORDER;
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+SparseImageBuf<T, NumChannels, Allocator, Layout>::SparseImageBuf()
+    : w_(0), h_(0), c_(NumChannels == DYNAMIC_CHANNELS ? 1 : NumChannels),
+      fill_(), num_occupied_(0) {}
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+SparseImageBuf<T, NumChannels, Allocator, Layout>::~SparseImageBuf() {
+  FreeTiles();
+}
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+SparseImageBuf<T, NumChannels, Allocator, Layout>::SparseImageBuf(
+    int width, int height, int num_channels)
+    : SparseImageBuf() {
+  static_assert(NumChannels == DYNAMIC_CHANNELS,
+                "The SparseImageBuf(width, height, num_channels) constructor "
+                "can only be called when the SparseImageBuf has a \"dynamic\" "
+                "number of channels.");
+  AllocateHelper(width, height, num_channels);
+}
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+SparseImageBuf<T, NumChannels, Allocator, Layout>::SparseImageBuf(int width,
+                                                                  int height)
+    : SparseImageBuf() {
+  static_assert(NumChannels != DYNAMIC_CHANNELS,
+                "The SparseImageBuf(width, height) constructor can only be "
+                "called when the SparseImageBuf has a \"static\" number of "
+                "channels.");
+  AllocateHelper(width, height, NumChannels);
+}
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+template <typename ImageImplOtherT>
+bool SparseImageBuf<T, NumChannels, Allocator, Layout>::CopyInto(
+    ImageBase<ImageImplOtherT>& dest, mem_utils::CacheHint hint) const {
+  static_assert(
+      std::is_same<T, typename ImageTraits<ImageImplOtherT>::ChannelT>::value,
+      "Channel types must match!");
+  if (static_cast<const void*>(&dest) == static_cast<const void*>(this)) {
+    return true;
+  }
+  if ((!dest.IsChannelCountDynamic()) && Channels() != dest.Channels()) {
+    return false;
+  }
+  if (!dest.Resize(Width(), Height(), Channels())) {
+    return false;
+  }
+  dest.SetAll(fill_, hint);
+
+  const int num_channels = Channels();
+  const bool runs = !dest.IsPlanar();
+  ForEachOccupiedTile([&dest, num_channels, runs](int x0, int y0, int width,
+                                                  int height, const T* tile) {
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width;) {
+        const T* src = tile + TileOffset(x, y) * num_channels;
+        if (!runs) {
+          for (int c = 0; c < num_channels; ++c) {
+            dest.Set(x0 + x, y0 + y, c, src[c]);
+          }
+          ++x;
+          continue;
+        }
+        // Copy the longest run that is contiguous in both images.
+        int span = 0;
+        T* dst = dest.GetRowSpan(x0 + x, y0 + y, &span);
+        const int src_run = Z_ORDER ? 2 - (x & 1) : width - x;
+        const int num_pixels = std::min(std::min(span, src_run), width - x);
+        memcpy(static_cast<void*>(dst), static_cast<const void*>(src),
+               num_pixels * num_channels * sizeof(T));
+        x += num_pixels;
+      }
+    }
+  });
+  return true;
+}
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+template <typename ImageImplOtherT>
+bool SparseImageBuf<T, NumChannels, Allocator, Layout>::Equals(
+    const ImageBase<ImageImplOtherT>& other) const {
+  if (static_cast<const void*>(&other) == static_cast<const void*>(this)) {
+    return true;
+  }
+  if (!jr::DimensionsMatch(*this, other) ||
+      !std::is_same<T, typename ImageTraits<ImageImplOtherT>::ChannelT>::value) {
+    return false;
+  }
+
+  // Walk the image tile by tile, comparing other against the tile (if
+  // present) or the fill value.
+  const int num_channels = Channels();
+  for (int ty = 0; ty < TilesDown(); ++ty) {
+    const int y0 = ty * TILE_HEIGHT;
+    const int height = std::min(TILE_HEIGHT, Height() - y0);
+    for (int tx = 0; tx < TilesAcross(); ++tx) {
+      const int x0 = tx * TILE_WIDTH;
+      const int width = std::min(TILE_WIDTH, Width() - x0);
+      const T* tile = FindTile(tx, ty);
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          for (int c = 0; c < num_channels; ++c) {
+            const T value =
+                tile == nullptr ? fill_
+                                : tile[TileOffset(x, y) * num_channels + c];
+            const auto other_value = other.Get(x0 + x, y0 + y, c);
+            if (memcmp(&value, &other_value, sizeof(T)) != 0) {
+              return false;
+            }
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+template <typename OtherAllocator>
+bool SparseImageBuf<T, NumChannels, Allocator, Layout>::Equals(
+    const SparseImageBuf<T, NumChannels, OtherAllocator, Layout>& other) const {
+  if (static_cast<const void*>(&other) == static_cast<const void*>(this)) {
+    return true;
+  }
+  if (!jr::DimensionsMatch(*this, other)) {
+    return false;
+  }
+  // Tiles absent in both images hold the fill values.
+  if (memcmp(&fill_, &other.fill_, sizeof(T)) != 0) {
+    const std::size_t num_tiles = tiles_.size();
+    for (std::size_t word = 0; word < occupied_.size(); ++word) {
+      const uint64_t valid_bits =
+          (word + 1) * 64 <= num_tiles
+              ? ~uint64_t(0)
+              : (uint64_t(1) << (num_tiles % 64)) - 1;
+      if ((~(occupied_[word] | other.occupied_[word]) & valid_bits) != 0) {
+        return false;
+      }
+    }
+  }
+
+  // Compare every tile occupied in at least one image, against the other
+  // image's tile or fill value.
+  const int tiles_across = TilesAcross();
+  for (std::size_t word = 0; word < occupied_.size(); ++word) {
+    uint64_t bits = occupied_[word] | other.occupied_[word];
+    while (bits != 0) {
+      const std::size_t index =
+          word * 64 + math_utils::CountTrailingZeros(bits);
+      bits &= bits - 1;
+      const int x0 = static_cast<int>(index % tiles_across) * TILE_WIDTH;
+      const int y0 = static_cast<int>(index / tiles_across) * TILE_HEIGHT;
+      const int width = std::min(TILE_WIDTH, Width() - x0);
+      const int height = std::min(TILE_HEIGHT, Height() - y0);
+      const T* tile = tiles_[index];
+      const T* other_tile = other.tiles_[index];
+      const bool match =
+          tile == nullptr
+              ? TileMatches(other_tile, width, height, nullptr, fill_)
+              : TileMatches(tile, width, height, other_tile, other.fill_);
+      if (!match) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace jr
+
+#endif  // JRIMAGE_SPARSE_H_
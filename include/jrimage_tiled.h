@@ -0,0 +1,353 @@
+#ifndef JRIMAGE_TILED_H_
+#define JRIMAGE_TILED_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+#include "jrimage.h"
+#include "math_utils.h"
+
+// Tiled image storage for jrimage.
+
+namespace jr {
+
+template<typename T, int NumChannels, typename Allocator, typename Layout>
+class TiledImageBuf;
+
+template<typename T, int NumChannels, typename Allocator, typename Layout>
+struct ImageTraits<TiledImageBuf<T, NumChannels, Allocator, Layout>> {
+  // Primitive type used for a single channel.
+  typedef T ChannelT;
+
+  // Memory layout tag; always a TiledLayout.
+  typedef Layout LayoutT;
+
+  // ChannelCountKnownAtCompileTime is true_type if we know the channel count
+  // at compile time, or false_type otherwise.
+  typedef typename std::conditional<NumChannels != DYNAMIC_CHANNELS,
+                                    std::true_type, std::false_type>::type
+                                    ChannelCountKnownAtCompileTime;
+};
+
+/// 2D image buffer stored as a grid of fixed size tiles.
+///
+/// Each tile holds TILE_WIDTH x TILE_HEIGHT pixels (with interleaved channels)
+/// in one contiguous block, so walking down a column touches a new block only
+/// once every TILE_HEIGHT rows instead of once per row.  This keeps vertical
+/// filters, rotations and random access samplers within a handful of pages.
+/// Tiles along the right and bottom edges are padded out to full size; the
+/// padding is never read, copied, or compared.
+///
+/// Rows are not stored contiguously, so there is no GetRow(...).  Use
+/// GetRowSpan(...) or GetTileRow(...) for row access, and ForEachTile(...) to
+/// visit the image one tile at a time.
+template <typename T,  // Primitive type stored in the array.
+          int NumChannels = DYNAMIC_CHANNELS,  // Channel count, or DYNAMIC_CHANNELS.
+          typename Allocator = std::allocator<T>,  // Allocator used for memory allocation.
+          typename Layout = TiledLayout<>>  // Tile dimensions and ordering.
+class TiledImageBuf
+    : public ImageBase<TiledImageBuf<T, NumChannels, Allocator, Layout>> {
+ public:
+  static constexpr int TILE_WIDTH = Layout::TILE_WIDTH;
+  static constexpr int TILE_HEIGHT = Layout::TILE_HEIGHT;
+  static constexpr bool Z_ORDER = Layout::Z_ORDER;
+
+  // Static assertions that the template arguments are reasonable.
+  static_assert(std::is_trivial<T>::value,
+                "TiledImageBuf template type T must be trivially copyable "
+                "and trivially constructable.");
+  static_assert(std::is_same<T, typename Allocator::value_type>::value,
+                "TiledImageBuf allocator template argument needs to be an "
+                "allocator for the TiledImageBuf's pixel type T.");
+  static_assert(
+      NumChannels == DYNAMIC_CHANNELS || NumChannels > 0,
+      "NumChannels must either be a positive integer, or be the special "
+      "DYNAMIC value.");
+  static_assert(IsTiledLayout<Layout>::value,
+                "TiledImageBuf Layout must be a TiledLayout.");
+  static_assert(math_utils::IsPowerOfTwo(TILE_WIDTH) &&
+                math_utils::IsPowerOfTwo(TILE_HEIGHT),
+                "Tile dimensions must be powers of two.");
+  static_assert(!Z_ORDER || (TILE_WIDTH == TILE_HEIGHT &&
+                             TILE_WIDTH <= (1 << 16)),
+                "Z-ordered tiles must be square.");
+
+  // Constructors.
+
+  // Construct an image with a dynamic number of channels.
+  // This constructor can only be called if NumChannels == DYNAMIC_CHANNELS.
+  TiledImageBuf(int width, int height, int num_channels);
+
+  // Construct an image with a static number of channels.
+  // This constructor can only be called if NumChannels != DYNAMIC_CHANNELS.
+  TiledImageBuf(int width, int height);
+
+  // Construct an empty image.
+  TiledImageBuf();
+
+  // Destructor.
+  ~TiledImageBuf();
+
+  // Implementation of the interface required by the CRTP base class ImageBase.
+  inline int Width() const { return w_; }
+  inline int Height() const { return h_; }
+  inline int Channels() const {
+    return SelfT::IsChannelCountDynamic() ? c_ : NumChannels;
+  }
+  inline bool IsMemoryContiguous() const { return false; }
+  inline std::size_t PixelSizeBytes() const { return sizeof(T) * Channels(); }
+
+  // Inclusive of tile padding.
+  inline std::size_t TotalByteCount() const {
+    return TilesAcross() * TilesDown() * TileNumel() * sizeof(T);
+  }
+
+  inline T Get(int x, int y, int c) const { return *GetPointer(x, y, c); }
+  inline T* GetPointer(int x, int y, int c) const {
+    return GetTile(x / TILE_WIDTH, y / TILE_HEIGHT) +
+           TileOffset(x % TILE_WIDTH, y % TILE_HEIGHT) * Channels() + c;
+  }
+  inline T* GetRowSpan(int x, int y, int* span_pixels) const {
+    // In a Z-ordered tile only pixel pairs (2k, y) and (2k + 1, y) are
+    // adjacent in memory.
+    const int run = Z_ORDER ? std::min(TILE_WIDTH, 2 - (x & 1))
+                            : TILE_WIDTH - (x % TILE_WIDTH);
+    *span_pixels = std::min(run, Width() - x);
+    return GetPointer(x, y, 0);
+  }
+  inline const T* GetConstRowSpan(int x, int y, int* span_pixels) const {
+    return GetRowSpan(x, y, span_pixels);
+  }
+  inline bool IsKnownZero() const { return false; }
+  inline bool IsUniform(T* value) const { return false; }
+  inline bool SetUniform(const T& value) { return false; }
+
+  // Tile access.
+
+  // Number of tiles needed to cover the image horizontally and vertically.
+  inline int TilesAcross() const {
+    return (Width() + TILE_WIDTH - 1) / TILE_WIDTH;
+  }
+  inline int TilesDown() const {
+    return (Height() + TILE_HEIGHT - 1) / TILE_HEIGHT;
+  }
+
+  // Number of T's in a single tile (inclusive of padding).
+  inline std::size_t TileNumel() const {
+    return TILE_WIDTH * TILE_HEIGHT * Channels();
+  }
+
+  // Index of pixel (x, y) of a tile, relative to the start of the tile, in
+  // units of pixels.
+  static inline std::size_t TileOffset(int x_in_tile, int y_in_tile) {
+    return Z_ORDER ? math_utils::MortonEncode2D(x_in_tile, y_in_tile)
+                   : y_in_tile * TILE_WIDTH + x_in_tile;
+  }
+
+  // Pointer to the first element of tile (tile_x, tile_y).
+  inline T* GetTile(int tile_x, int tile_y) const {
+    return buf_ + (tile_y * tile_stride_ + tile_x) * TileNumel();
+  }
+
+  // Pointer to row row_in_tile of tile (tile_x, tile_y).  Each tile row holds
+  // TILE_WIDTH contiguous pixels, some of which may be padding.
+  inline T* GetTileRow(int tile_x, int tile_y, int row_in_tile) const {
+    static_assert(!Z_ORDER,
+                  "Rows of Z-ordered tiles are not stored contiguously.");
+    return GetTile(tile_x, tile_y) + row_in_tile * TILE_WIDTH * Channels();
+  }
+
+  // Call func(x0, y0, width, height, tile) for each tile in storage order.
+  // (x0, y0) is the image location of the top left pixel of the tile, width
+  // and height give the part of the tile that lies inside the image, and tile
+  // points to the tile's storage.  Use TileOffset(...) to index into a tile.
+  template <typename FuncT>
+  void ForEachTile(FuncT func) const {
+    for (int ty = 0; ty < TilesDown(); ++ty) {
+      const int y0 = ty * TILE_HEIGHT;
+      const int tile_h = std::min(TILE_HEIGHT, Height() - y0);
+      for (int tx = 0; tx < TilesAcross(); ++tx) {
+        const int x0 = tx * TILE_WIDTH;
+        const int tile_w = std::min(TILE_WIDTH, Width() - x0);
+        func(x0, y0, tile_w, tile_h, GetTile(tx, ty));
+      }
+    }
+  }
+
+  // Windows must start on a tile boundary; they may have any size.
+  inline bool GetWin(int x, int y, int width, int height,
+                     TiledImageBuf<T, NumChannels, Allocator, Layout>& window) const {
+    if (x % TILE_WIDTH != 0 || y % TILE_HEIGHT != 0) {
+      return false;
+    }
+
+    // First, free any memory the image may own.  This invalidates all
+    // windows into that data.
+    window.FreeMemIfOwned();
+
+    window.w_ = width;
+    window.h_ = height;
+    window.c_ = c_;
+    window.buf_ = GetTile(x / TILE_WIDTH, y / TILE_HEIGHT);
+    window.owns_data_ = false;
+    window.allocator_ = allocator_;
+    window.tile_stride_ = tile_stride_;
+    return true;
+  }
+
+  bool Resize(int new_w, int new_h, int new_c) {
+    if (new_w < 0 || new_h < 0 || new_c < 0) {
+      return false;
+    } else if (!SelfT::IsChannelCountDynamic() && new_c != Channels()) {
+      return false;
+    } else if (new_w == Width() && new_h == Height() && new_c == Channels()) {
+      return true;  // Nothing to do; this also allows resizing windows in place.
+    } else if (!owns_data_) {
+      return false;
+    } else {
+      AllocateHelper(new_w, new_h, new_c);
+      return true;
+    }
+  }
+
+  void Allocate(int new_w, int new_h) {
+    return AllocateHelper(new_w, new_h, Channels());
+  }
+
+  void Allocate(int new_w, int new_h, int new_c) {
+    static_assert(SelfT::IsChannelCountDynamic(),
+                  "The 3 argument form of Allocate, "
+                  "Allocate(width, height, channels), "
+                  "can only be called using images that have a dynamic "
+                  "channel count.  This image has a static channel count.  "
+                  "Maybe you want to call Allocate(width, height) instead?");
+    return AllocateHelper(new_w, new_h, new_c);
+  }
+
+ private:
+  typedef TiledImageBuf<T, NumChannels, Allocator, Layout> SelfT;
+  int w_, h_, c_;
+  T* buf_;
+  bool owns_data_;
+  Allocator allocator_;
+
+  // Stride between rows of tiles, in tiles.
+  int tile_stride_;
+
+  void FreeMemIfOwned() {
+    if (owns_data_) {
+      allocator_.deallocate(buf_, AllocatedNumel());
+    }
+  }
+
+  // Number of T's in the block owned by this image (inclusive of padding).
+  inline std::size_t AllocatedNumel() const {
+    return buf_ == nullptr ? 0 : TilesAcross() * TilesDown() * TileNumel();
+  }
+
+  void AllocateHelper(int new_w, int new_h, int new_c) {
+    assert(new_w >= 0);
+    assert(new_h >= 0);
+    if (ImageTraits<SelfT>::ChannelCountKnownAtCompileTime::value) {
+      assert(new_c == Channels());
+      new_c = Channels();
+    } else {
+      assert(new_c > 0);
+    }
+
+    const std::size_t old_data_numel = AllocatedNumel();
+
+    const int tiles_across = (new_w + TILE_WIDTH - 1) / TILE_WIDTH;
+    const int tiles_down = (new_h + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    const std::size_t data_numel = static_cast<std::size_t>(tiles_across) *
+                                   tiles_down * TILE_WIDTH * TILE_HEIGHT *
+                                   new_c;
+    T* new_buf = allocator_.allocate(data_numel);
+
+    if (owns_data_) {
+      allocator_.deallocate(buf_, old_data_numel);
+    }
+    buf_ = new_buf;
+
+    w_ = new_w;
+    h_ = new_h;
+    c_ = new_c;
+    tile_stride_ = tiles_across;
+    owns_data_ = true;
+  }
+
+  // No copying of jr::TiledImageBuf objects.
+  TiledImageBuf(const TiledImageBuf& other) = delete;
+  TiledImageBuf& operator=(const TiledImageBuf& other) = delete;
+};
+
+/// A TiledImageBuf whose tiles are stored in Morton (Z) order internally.
+template <typename T, int NumChannels = DYNAMIC_CHANNELS, int TileSize = 64,
+          typename Allocator = std::allocator<T>>
+using ZOrderImageBuf =
+    TiledImageBuf<T, NumChannels, Allocator,
+                  TiledLayout<TileSize, TileSize, true>>;
+
+
+// Inline member function definitions. ----------------------------------------
+
+// Definitions of the static constants (required since they may be odr-used).
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+constexpr int TiledImageBuf<T, NumChannels, Allocator, Layout>::TILE_WIDTH;
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+constexpr int TiledImageBuf<T, NumChannels, Allocator, Layout>::TILE_HEIGHT;
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+constexpr bool TiledImageBuf<T, NumChannels, Allocator, Layout>::Z_ORDER;
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+TiledImageBuf<T, NumChannels, Allocator, Layout>::TiledImageBuf()
+    : w_(-1),
+      h_(-1),
+      c_(-1),
+      buf_(nullptr),
+      owns_data_(true),
+      tile_stride_(0) {}
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+TiledImageBuf<T, NumChannels, Allocator, Layout>::~TiledImageBuf() {
+  FreeMemIfOwned();
+}
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+TiledImageBuf<T, NumChannels, Allocator, Layout>::TiledImageBuf(
+    int width, int height, int num_channels)
+    : w_(width),
+      h_(height),
+      c_(num_channels),
+      buf_(nullptr),
+      owns_data_(true),
+      tile_stride_(0) {
+  static_assert(NumChannels == DYNAMIC_CHANNELS,
+                "The TiledImageBuf(width, height, num_channels) constructor "
+                "can only be called when the TiledImageBuf has a \"dynamic\" "
+                "number of channels.");
+  AllocateHelper(w_, h_, c_);
+}
+
+template <typename T, int NumChannels, typename Allocator, typename Layout>
+TiledImageBuf<T, NumChannels, Allocator, Layout>::TiledImageBuf(int width,
+                                                                int height)
+    : w_(width),
+      h_(height),
+      c_(NumChannels),
+      buf_(nullptr),
+      owns_data_(true),
+      tile_stride_(0) {
+  static_assert(NumChannels != DYNAMIC_CHANNELS,
+                "The TiledImageBuf(width, height) constructor can only be "
+                "called when the TiledImageBuf has a \"static\" number of "
+                "channels.");
+  AllocateHelper(w_, h_, NumChannels);
+}
+
+}  // namespace jr
+
+#endif  // JRIMAGE_TILED_H_
@@ -0,0 +1,167 @@
+#include "jrimage_allocators.h"
+
+#include <algorithm>
+
+#include "math_utils.h"
+
+namespace jr {
+
+namespace {
+
+// Alignment of each arena block; requests for stronger alignment are padded.
+const std::size_t ARENA_BLOCK_ALIGNMENT = 64;
+
+// Size of the first block of an arena created without any preallocation.
+const std::size_t ARENA_MIN_BLOCK_BYTES = 1 << 20;
+
+// Index of the power of two size class holding num_bytes.
+int SizeBucket(std::size_t num_bytes) {
+  int bucket = 0;
+  while (num_bytes > 1) {
+    num_bytes >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+}  // namespace
+
+FrameArena::FrameArena(std::size_t initial_bytes)
+    : offset_(0), bytes_used_(0), num_heap_allocations_(0) {
+  if (initial_bytes > 0) {
+    AddBlock(initial_bytes);
+  }
+}
+
+FrameArena::~FrameArena() { FreeBlocks(); }
+
+void* FrameArena::Allocate(std::size_t num_bytes, std::size_t byte_alignment) {
+  assert(math_utils::IsPowerOfTwo(byte_alignment));
+  if (!blocks_.empty()) {
+    const Block& block = blocks_.back();
+    const std::size_t base = reinterpret_cast<uintptr_t>(block.data);
+    const std::size_t start =
+        math_utils::UpToNearestMultiple(base + offset_, byte_alignment) - base;
+    if (start <= block.size && num_bytes <= block.size - start) {
+      bytes_used_ += start - offset_ + num_bytes;
+      offset_ = start + num_bytes;
+      return block.data + start;
+    }
+  }
+
+  // Out of space; add a block that is at least twice as big as the last one,
+  // and large enough for this request whatever its alignment.
+  const std::size_t padding =
+      byte_alignment > ARENA_BLOCK_ALIGNMENT ? byte_alignment : 0;
+  const std::size_t min_size =
+      blocks_.empty() ? ARENA_MIN_BLOCK_BYTES : 2 * blocks_.back().size;
+  AddBlock(std::max(min_size, num_bytes + padding));
+  return Allocate(num_bytes, byte_alignment);
+}
+
+void FrameArena::Reset() {
+  if (blocks_.size() > 1) {
+    // This frame overflowed the first block.  Replace all blocks with a single
+    // one that can hold everything, so that the next frame fits.
+    const std::size_t total = Capacity();
+    FreeBlocks();
+    AddBlock(total);
+  }
+  offset_ = 0;
+  bytes_used_ = 0;
+}
+
+std::size_t FrameArena::Capacity() const {
+  std::size_t total = 0;
+  for (const Block& block : blocks_) {
+    total += block.size;
+  }
+  return total;
+}
+
+void FrameArena::AddBlock(std::size_t num_bytes) {
+  Block block;
+  block.data = mem_utils::AlignedNew<uint8_t>(num_bytes, ARENA_BLOCK_ALIGNMENT);
+  block.size = num_bytes;
+  blocks_.push_back(block);
+  offset_ = 0;
+  ++num_heap_allocations_;
+}
+
+void FrameArena::FreeBlocks() {
+  for (const Block& block : blocks_) {
+    mem_utils::AlignedDelete(block.data);
+  }
+  blocks_.clear();
+}
+
+constexpr int AllocationStats::NUM_SIZE_BUCKETS;
+
+AllocationCounters::AllocationCounters()
+    : live_bytes_(0), peak_bytes_(0), live_allocations_(0),
+      total_allocations_(0), total_bytes_(0) {
+  for (int i = 0; i < AllocationStats::NUM_SIZE_BUCKETS; ++i) {
+    size_histogram_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void AllocationCounters::RecordAllocation(std::size_t num_bytes) {
+  const std::size_t live =
+      live_bytes_.fetch_add(num_bytes, std::memory_order_relaxed) + num_bytes;
+  std::size_t peak = peak_bytes_.load(std::memory_order_relaxed);
+  while (live > peak &&
+         !peak_bytes_.compare_exchange_weak(peak, live,
+                                            std::memory_order_relaxed)) {
+  }
+  live_allocations_.fetch_add(1, std::memory_order_relaxed);
+  total_allocations_.fetch_add(1, std::memory_order_relaxed);
+  total_bytes_.fetch_add(num_bytes, std::memory_order_relaxed);
+  size_histogram_[SizeBucket(num_bytes)].fetch_add(1,
+                                                   std::memory_order_relaxed);
+}
+
+void AllocationCounters::RecordDeallocation(std::size_t num_bytes) {
+  live_bytes_.fetch_sub(num_bytes, std::memory_order_relaxed);
+  live_allocations_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+AllocationStats AllocationCounters::Snapshot() const {
+  AllocationStats stats;
+  stats.live_bytes = live_bytes_.load(std::memory_order_relaxed);
+  stats.peak_bytes = peak_bytes_.load(std::memory_order_relaxed);
+  stats.live_allocations = live_allocations_.load(std::memory_order_relaxed);
+  stats.total_allocations = total_allocations_.load(std::memory_order_relaxed);
+  stats.total_bytes = total_bytes_.load(std::memory_order_relaxed);
+  stats.size_histogram.resize(AllocationStats::NUM_SIZE_BUCKETS);
+  for (int i = 0; i < AllocationStats::NUM_SIZE_BUCKETS; ++i) {
+    stats.size_histogram[i] = size_histogram_[i].load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+AllocationTracker& AllocationTracker::Global() {
+  static AllocationTracker* const tracker = new AllocationTracker();
+  return *tracker;
+}
+
+AllocationCounters* AllocationTracker::Counters(const std::string& tag) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<AllocationCounters>& counters = counters_[tag];
+  if (counters == nullptr) {
+    counters.reset(new AllocationCounters());
+  }
+  return counters.get();
+}
+
+std::vector<AllocationStats> AllocationTracker::Snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<AllocationStats> snapshot;
+  snapshot.reserve(counters_.size());
+  for (const auto& entry : counters_) {
+    snapshot.push_back(entry.second->Snapshot());
+    snapshot.back().tag = entry.first;
+  }
+  return snapshot;
+}
+
+}  // namespace jr
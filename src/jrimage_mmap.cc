@@ -0,0 +1,101 @@
+#include "jrimage_mmap.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace jr {
+
+namespace {
+
+int ToMadviseAdvice(AccessPattern pattern) {
+  switch (pattern) {
+    case ACCESS_SEQUENTIAL: return MADV_SEQUENTIAL;
+    case ACCESS_RANDOM:     return MADV_RANDOM;
+    case ACCESS_WILL_NEED:  return MADV_WILLNEED;
+    case ACCESS_DONT_NEED:  return MADV_DONTNEED;
+    case ACCESS_NORMAL:
+    default:                return MADV_NORMAL;
+  }
+}
+
+}  // namespace
+
+std::shared_ptr<MappedFile> MappedFile::Open(const std::string& path,
+                                             FileMapMode mode) {
+  const int fd =
+      open(path.c_str(), mode == READ_WRITE_MAPPING ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  return Map(fd, static_cast<std::size_t>(info.st_size), mode);
+}
+
+std::shared_ptr<MappedFile> MappedFile::Create(const std::string& path,
+                                               std::size_t size_bytes) {
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return nullptr;
+  }
+  if (ftruncate(fd, static_cast<off_t>(size_bytes)) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  return Map(fd, size_bytes, READ_WRITE_MAPPING);
+}
+
+std::shared_ptr<MappedFile> MappedFile::Map(int fd, std::size_t size,
+                                            FileMapMode mode) {
+  // mmap refuses empty mappings, but an empty file is a valid (empty) image.
+  void* data = nullptr;
+  if (size > 0) {
+    const int prot =
+        mode == READ_WRITE_MAPPING ? PROT_READ | PROT_WRITE : PROT_READ;
+    data = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return nullptr;
+    }
+  }
+  return std::shared_ptr<MappedFile>(new MappedFile(fd, data, size, mode));
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+  close(fd_);
+}
+
+bool MappedFile::Advise(AccessPattern pattern, std::size_t offset,
+                        std::size_t length) const {
+  if (data_ == nullptr || offset >= size_) {
+    return false;
+  }
+  length = std::min(length, size_ - offset);
+
+  // madvise needs a page aligned start address.
+  const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  const std::size_t aligned_offset = offset - offset % page;
+  length += offset - aligned_offset;
+  return madvise(static_cast<uint8_t*>(data_) + aligned_offset, length,
+                 ToMadviseAdvice(pattern)) == 0;
+}
+
+bool MappedFile::Sync(bool asynchronous) const {
+  if (data_ == nullptr) {
+    return true;
+  }
+  return msync(data_, size_, asynchronous ? MS_ASYNC : MS_SYNC) == 0;
+}
+
+}  // namespace jr
@@ -0,0 +1,141 @@
+#include "jrimage_shm.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <new>
+
+namespace jr {
+
+namespace {
+
+// The pixels start on their own page, so that any row alignment an ImageBuf
+// may ask for is satisfied.
+const std::size_t SHARED_IMAGE_DATA_OFFSET = 4096;
+
+static_assert(sizeof(SharedImageHeader) <= SHARED_IMAGE_DATA_OFFSET,
+              "SharedImageHeader must fit before the pixels.");
+
+// Compute the row pitch and bytes of pixel data needed for format.  Returns
+// false if format is invalid.
+bool PixelBytes(const SharedImageFormat& format, std::size_t* row_pitch_bytes,
+                std::size_t* pixel_bytes) {
+  const std::size_t channel_bytes = format.channel_type & 0xFF;
+  if (format.width < 0 || format.height < 0 || format.channels <= 0 ||
+      channel_bytes == 0) {
+    return false;
+  }
+  const std::size_t min_pitch =
+      channel_bytes * format.width * (format.planar ? 1 : format.channels);
+  *row_pitch_bytes = format.row_pitch_bytes != PACKED_ROWS
+                         ? format.row_pitch_bytes
+                         : min_pitch;
+  if (*row_pitch_bytes < min_pitch || *row_pitch_bytes % channel_bytes != 0) {
+    return false;
+  }
+  *pixel_bytes =
+      *row_pitch_bytes * format.height * (format.planar ? format.channels : 1);
+  return true;
+}
+
+}  // namespace
+
+constexpr uint32_t SharedImageHeader::MAGIC;
+constexpr uint32_t SharedImageHeader::VERSION;
+
+std::shared_ptr<SharedImageSegment> SharedImageSegment::Create(
+    const std::string& name, const SharedImageFormat& format) {
+  std::size_t row_pitch_bytes = 0, pixel_bytes = 0;
+  if (!PixelBytes(format, &row_pitch_bytes, &pixel_bytes)) {
+    return nullptr;
+  }
+  const std::size_t size = SHARED_IMAGE_DATA_OFFSET + pixel_bytes;
+
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    return nullptr;
+  }
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+
+  // ftruncate zero fills, so only the header needs writing.
+  SharedImageHeader* header = new (data) SharedImageHeader();
+  header->magic = SharedImageHeader::MAGIC;
+  header->version = SharedImageHeader::VERSION;
+  header->width = format.width;
+  header->height = format.height;
+  header->channels = format.channels;
+  header->channel_type = format.channel_type;
+  header->planar = format.planar ? 1 : 0;
+  header->row_pitch_bytes = row_pitch_bytes;
+  header->data_offset = SHARED_IMAGE_DATA_OFFSET;
+  header->generation.store(0, std::memory_order_release);
+  return std::shared_ptr<SharedImageSegment>(
+      new SharedImageSegment(name, fd, data, size, READ_WRITE_MAPPING));
+}
+
+std::shared_ptr<SharedImageSegment> SharedImageSegment::Open(
+    const std::string& name, FileMapMode mode) {
+  const int fd =
+      shm_open(name.c_str(), mode == READ_WRITE_MAPPING ? O_RDWR : O_RDONLY, 0);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      static_cast<std::size_t>(info.st_size) < SHARED_IMAGE_DATA_OFFSET) {
+    close(fd);
+    return nullptr;
+  }
+  const std::size_t size = static_cast<std::size_t>(info.st_size);
+  const int prot =
+      mode == READ_WRITE_MAPPING ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* data = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return nullptr;
+  }
+  std::shared_ptr<SharedImageSegment> segment(
+      new SharedImageSegment(name, fd, data, size, mode));
+
+  // Don't trust a header that doesn't describe an image fitting the segment.
+  const SharedImageHeader& header = segment->Header();
+  SharedImageFormat format;
+  format.width = header.width;
+  format.height = header.height;
+  format.channels = header.channels;
+  format.channel_type = header.channel_type;
+  format.planar = header.planar != 0;
+  format.row_pitch_bytes = static_cast<std::size_t>(header.row_pitch_bytes);
+  std::size_t row_pitch_bytes = 0, pixel_bytes = 0;
+  if (header.magic != SharedImageHeader::MAGIC ||
+      header.version != SharedImageHeader::VERSION ||
+      !PixelBytes(format, &row_pitch_bytes, &pixel_bytes) ||
+      header.data_offset < sizeof(SharedImageHeader) ||
+      header.data_offset > size || size - header.data_offset < pixel_bytes) {
+    return nullptr;
+  }
+  return segment;
+}
+
+bool SharedImageSegment::Unlink(const std::string& name) {
+  return shm_unlink(name.c_str()) == 0;
+}
+
+SharedImageSegment::~SharedImageSegment() {
+  munmap(data_, size_);
+  close(fd_);
+}
+
+}  // namespace jr
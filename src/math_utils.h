@@ -2,6 +2,7 @@
 #define JRIMAGE_MATH_UTILS_H_
 
 #include <algorithm>
+#include <cstdint>
 #include <type_traits>
 #include <limits>
 #include <iostream>
@@ -26,6 +27,25 @@ constexpr OutT ConvertWithSaturation(const InT& in_val);
 // "min_value".
 std::size_t UpToNearestMultiple(std::size_t min_value, std::size_t multiple_of);
 
+// Return the Morton (Z-order) index of the 2D point (x, y) by interleaving
+// the bits of x and y; bit i of x ends up in bit 2i of the result and bit i of
+// y in bit 2i+1.  Only the low 16 bits of x and y are used.
+constexpr uint32_t MortonEncode2D(uint32_t x, uint32_t y);
+
+// Return true if value is a positive power of two.
+constexpr bool IsPowerOfTwo(std::size_t value);
+
+// Return the index of the lowest set bit of value, which must not be zero.
+int CountTrailingZeros(uint64_t value);
+
+// Return the number of set bits in value.
+int CountSetBits(uint64_t value);
+
+// Return the greatest common divisor and least common multiple of a and b,
+// which must both be positive.
+std::size_t GreatestCommonDivisor(std::size_t a, std::size_t b);
+std::size_t LeastCommonMultiple(std::size_t a, std::size_t b);
+
 // Clamp the value in to the range [min_val, max_val]
 template<typename T>
 constexpr T Clamp(const T& in, const T& min_val, const T& max_val);
@@ -62,6 +82,71 @@ inline std::size_t UpToNearestMultiple(std::size_t min_value,
   }
 }
 
+namespace implementation_details {
+// One step of spreading bits apart: OR v with itself shifted, then mask.
+constexpr uint32_t SpreadBitsStep(uint32_t v, int shift, uint32_t mask) {
+  return (v | (v << shift)) & mask;
+}
+// Spread the low 16 bits of v out so that there is a zero bit between each.
+constexpr uint32_t SpreadBits(uint32_t v) {
+  return SpreadBitsStep(
+      SpreadBitsStep(
+          SpreadBitsStep(SpreadBitsStep(v & 0xFFFF, 8, 0x00FF00FF),
+                         4, 0x0F0F0F0F),
+          2, 0x33333333),
+      1, 0x55555555);
+}
+}  // namespace implementation_details
+
+inline constexpr uint32_t MortonEncode2D(uint32_t x, uint32_t y) {
+  return implementation_details::SpreadBits(x) |
+         (implementation_details::SpreadBits(y) << 1);
+}
+
+inline constexpr bool IsPowerOfTwo(std::size_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+inline int CountTrailingZeros(uint64_t value) {
+  assert(value != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(value);
+#else
+  int index = 0;
+  while ((value & 1) == 0) {
+    value >>= 1;
+    ++index;
+  }
+  return index;
+#endif
+}
+
+inline int CountSetBits(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(value);
+#else
+  int count = 0;
+  for (; value != 0; value &= value - 1) {
+    ++count;
+  }
+  return count;
+#endif
+}
+
+inline std::size_t GreatestCommonDivisor(std::size_t a, std::size_t b) {
+  assert(a > 0 && b > 0);
+  while (b != 0) {
+    const std::size_t remainder = a % b;
+    a = b;
+    b = remainder;
+  }
+  return a;
+}
+
+inline std::size_t LeastCommonMultiple(std::size_t a, std::size_t b) {
+  return a / GreatestCommonDivisor(a, b) * b;
+}
+
 template <typename T>
 inline constexpr T Clamp(const T& in, const T& min_val, const T& max_val) {
   return std::max<T>(std::min<T>(in, max_val), min_val);
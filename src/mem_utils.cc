@@ -1,5 +1,27 @@
 #include "mem_utils.h"
 
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "math_utils.h"
+
 namespace jr {
 namespace mem_utils {
 namespace implementation_details {
@@ -15,6 +37,44 @@ void SetMem<1>(uint8_t* ptr,
 
 }  // namespace implementation_details
 
+namespace {
+
+// The table MemFill(...) dispatches through.  Cells are atomic so that
+// SetMemFillDispatchTable(...) may race with MemFill(...) calls.
+std::once_flag mem_fill_table_once;
+std::atomic<bool> mem_fill_table_ready(false);
+std::atomic<uint8_t> mem_fill_table[MemFillDispatchTable::NUM_BUFFER_BUCKETS]
+                                   [MemFillDispatchTable::NUM_PATTERN_BUCKETS];
+
+void StoreMemFillTable(const MemFillDispatchTable& table) {
+  for (int b = 0; b < MemFillDispatchTable::NUM_BUFFER_BUCKETS; ++b) {
+    for (int p = 0; p < MemFillDispatchTable::NUM_PATTERN_BUCKETS; ++p) {
+      mem_fill_table[b][p].store(static_cast<uint8_t>(table.Get(b, p)),
+                                 std::memory_order_relaxed);
+    }
+  }
+  mem_fill_table_ready.store(true, std::memory_order_release);
+}
+
+// Never calibrates, so that no MemFill(...) call ever waits on timings; see
+// CalibrateMemFill().
+void InitializeMemFillTable() {
+  MemFillDispatchTable table;
+  const char* profile = getenv("JR_MEMFILL_PROFILE");
+  if (profile != nullptr) {
+    table.Load(profile);  // Keeps the defaults if the profile is invalid.
+  }
+  StoreMemFillTable(table);
+}
+
+void EnsureMemFillTable() {
+  if (!mem_fill_table_ready.load(std::memory_order_acquire)) {
+    std::call_once(mem_fill_table_once, InitializeMemFillTable);
+  }
+}
+
+}  // namespace
+
 void* MemFill(void* buffer, std::size_t buffer_size_bytes,
               const void* pattern, std::size_t pattern_size_bytes) {
   assert(buffer != nullptr);
@@ -26,9 +86,27 @@ void* MemFill(void* buffer, std::size_t buffer_size_bytes,
                   buffer_size_bytes);
   } else if (pattern_size_bytes == 0 || buffer_size_bytes == 0) {
     return buffer;  // This is required to prevent division by 0.
-  } else {
-    // TODO(cbraley): For small parameter sizes; MemFillSimple is faster.
-    return MemFillChunks(buffer, buffer_size_bytes, pattern, pattern_size_bytes);
+  }
+
+  EnsureMemFillTable();
+  const MemFillStrategy strategy = static_cast<MemFillStrategy>(
+      mem_fill_table[MemFillDispatchTable::BufferBucket(buffer_size_bytes)]
+                    [MemFillDispatchTable::PatternBucket(pattern_size_bytes)]
+          .load(std::memory_order_relaxed));
+  switch (strategy) {
+    case MEM_FILL_SIMPLE:
+      return MemFillSimple(buffer, buffer_size_bytes, pattern,
+                           pattern_size_bytes);
+    case MEM_FILL_VECTOR:
+      return MemFillPattern(buffer, buffer_size_bytes, pattern,
+                            pattern_size_bytes);
+    case MEM_FILL_NON_TEMPORAL:
+      return MemFillPatternNonTemporal(buffer, buffer_size_bytes, pattern,
+                                       pattern_size_bytes);
+    case MEM_FILL_CHUNKS:
+    default:
+      return MemFillChunks(buffer, buffer_size_bytes, pattern,
+                           pattern_size_bytes);
   }
 }
 
@@ -104,6 +182,1176 @@ void* MemFillChunks(void* buffer, std::size_t buffer_size_bytes,
   return buffer;
 }
 
+namespace {
+
+// The widest vector type available; PatternFiller streams these out, either
+// with ordinary stores or with non-temporal ones that bypass the cache.
+#if defined(__AVX__)
+typedef __m256i PatternVecT;
+inline PatternVecT LoadPatternVec(const uint8_t* src) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+}
+inline void StoreAlignedPatternVec(uint8_t* dst, PatternVecT value) {
+  _mm256_store_si256(reinterpret_cast<__m256i*>(dst), value);
+}
+inline void StreamAlignedPatternVec(uint8_t* dst, PatternVecT value) {
+  _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), value);
+}
+inline void StreamingStoreFence() { _mm_sfence(); }
+#elif defined(__SSE2__)
+typedef __m128i PatternVecT;
+inline PatternVecT LoadPatternVec(const uint8_t* src) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+}
+inline void StoreAlignedPatternVec(uint8_t* dst, PatternVecT value) {
+  _mm_store_si128(reinterpret_cast<__m128i*>(dst), value);
+}
+inline void StreamAlignedPatternVec(uint8_t* dst, PatternVecT value) {
+  _mm_stream_si128(reinterpret_cast<__m128i*>(dst), value);
+}
+inline void StreamingStoreFence() { _mm_sfence(); }
+#else
+// No intrinsics; fixed size memcpy calls still compile to vector moves on
+// most targets.  There are no non-temporal stores.
+struct PatternVecT {
+  uint8_t bytes[16];
+};
+inline PatternVecT LoadPatternVec(const uint8_t* src) {
+  PatternVecT value;
+  memcpy(&value, src, sizeof(value));
+  return value;
+}
+inline void StoreAlignedPatternVec(uint8_t* dst, PatternVecT value) {
+  memcpy(dst, &value, sizeof(value));
+}
+inline void StreamAlignedPatternVec(uint8_t* dst, PatternVecT value) {
+  memcpy(dst, &value, sizeof(value));
+}
+inline void StreamingStoreFence() {}
+#endif
+
+const std::size_t PATTERN_VECTOR_BYTES = sizeof(PatternVecT);
+static_assert(PATTERN_VECTOR_BYTES <= PatternFiller::MAX_VECTOR_BYTES,
+              "PatternFiller::block_ is too small for the vector type.");
+
+template <bool NON_TEMPORAL>
+inline void StorePatternVec(uint8_t* dst, PatternVecT value) {
+  if (NON_TEMPORAL) {
+    StreamAlignedPatternVec(dst, value);
+  } else {
+    StoreAlignedPatternVec(dst, value);
+  }
+}
+
+// Write num_blocks copies of the NUM_VECTORS vectors starting at block to the
+// vector aligned dst.  The block is held in registers for the whole loop.
+template <int NUM_VECTORS, bool NON_TEMPORAL>
+uint8_t* StorePatternBlocks(uint8_t* dst, std::size_t num_blocks,
+                            const uint8_t* block) {
+  PatternVecT registers[NUM_VECTORS];
+  for (int i = 0; i < NUM_VECTORS; ++i) {
+    registers[i] = LoadPatternVec(block + i * PATTERN_VECTOR_BYTES);
+  }
+  for (std::size_t b = 0; b < num_blocks; ++b) {
+    for (int i = 0; i < NUM_VECTORS; ++i) {
+      StorePatternVec<NON_TEMPORAL>(dst + i * PATTERN_VECTOR_BYTES,
+                                    registers[i]);
+    }
+    dst += NUM_VECTORS * PATTERN_VECTOR_BYTES;
+  }
+  return dst;
+}
+
+// As above, for blocks too long to keep in registers.  The block stays in
+// L1 cache instead.
+template <bool NON_TEMPORAL>
+uint8_t* StorePatternBlocks(uint8_t* dst, std::size_t num_blocks,
+                            const uint8_t* block, std::size_t num_vectors) {
+  for (std::size_t b = 0; b < num_blocks; ++b) {
+    for (std::size_t i = 0; i < num_vectors; ++i) {
+      StorePatternVec<NON_TEMPORAL>(
+          dst + i * PATTERN_VECTOR_BYTES,
+          LoadPatternVec(block + i * PATTERN_VECTOR_BYTES));
+    }
+    dst += num_vectors * PATTERN_VECTOR_BYTES;
+  }
+  return dst;
+}
+
+// Fill buffer_size_bytes (more than block_size_bytes + one vector) at dst from
+// the pattern block; see PatternFiller.
+template <bool NON_TEMPORAL>
+void FillFromPatternBlock(uint8_t* dst, std::size_t buffer_size_bytes,
+                          const uint8_t* block, std::size_t block_size_bytes) {
+  // Scalar head up to the first vector aligned byte.  The rest of the buffer
+  // then starts head bytes into the pattern, so the block is rotated by head.
+  const std::size_t head =
+      (PATTERN_VECTOR_BYTES -
+       reinterpret_cast<uintptr_t>(dst) % PATTERN_VECTOR_BYTES) %
+      PATTERN_VECTOR_BYTES;
+  memcpy(dst, block, head);
+  dst += head;
+  const uint8_t* rotated = block + head;
+  const std::size_t body_bytes = buffer_size_bytes - head;
+  const std::size_t num_blocks = body_bytes / block_size_bytes;
+  const std::size_t num_vectors = block_size_bytes / PATTERN_VECTOR_BYTES;
+  switch (num_vectors) {
+#define JR_STORE_PATTERN_BLOCKS_CASE(N) \
+    case N: \
+      dst = StorePatternBlocks<N, NON_TEMPORAL>(dst, num_blocks, rotated); \
+      break;
+    JR_STORE_PATTERN_BLOCKS_CASE(1)
+    JR_STORE_PATTERN_BLOCKS_CASE(2)
+    JR_STORE_PATTERN_BLOCKS_CASE(3)
+    JR_STORE_PATTERN_BLOCKS_CASE(4)
+    JR_STORE_PATTERN_BLOCKS_CASE(5)
+    JR_STORE_PATTERN_BLOCKS_CASE(6)
+    JR_STORE_PATTERN_BLOCKS_CASE(7)
+    JR_STORE_PATTERN_BLOCKS_CASE(8)
+#undef JR_STORE_PATTERN_BLOCKS_CASE
+    default:
+      dst = StorePatternBlocks<NON_TEMPORAL>(dst, num_blocks, rotated,
+                                             num_vectors);
+      break;
+  }
+
+  // Whole vectors of the last partial block, then the scalar tail.  Both
+  // continue from the start of the rotated block.
+  const std::size_t remaining_bytes = body_bytes % block_size_bytes;
+  const std::size_t remaining_vectors = remaining_bytes / PATTERN_VECTOR_BYTES;
+  StorePatternBlocks<NON_TEMPORAL>(dst, 1, rotated, remaining_vectors);
+  if (NON_TEMPORAL) {
+    // Order the streaming stores before anything the caller does next (such
+    // as publishing the buffer to another thread).
+    StreamingStoreFence();
+  }
+  const std::size_t tail_offset = remaining_vectors * PATTERN_VECTOR_BYTES;
+  memcpy(dst + tail_offset, rotated + tail_offset,
+         remaining_bytes - tail_offset);
+}
+
+// Linux memory policy modes (see <linux/mempolicy.h>).  We issue the mbind
+// system call directly so that we don't need to link against libnuma.
+const int JR_MPOL_BIND = 2;
+const int JR_MPOL_INTERLEAVE = 3;
+
+std::size_t HugePageMappingBytes(std::size_t num_bytes) {
+  const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  return num_bytes >= HUGE_PAGE_BYTES
+             ? math_utils::UpToNearestMultiple(num_bytes, HUGE_PAGE_BYTES)
+             : math_utils::UpToNearestMultiple(std::max<std::size_t>(num_bytes, 1), page);
+}
+
+void ApplyNumaPolicy(void* ptr, std::size_t num_bytes, NumaPolicy policy,
+                     int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  if (policy == NUMA_FIRST_TOUCH) {
+    return;
+  }
+  const int max_nodes = 64;
+  unsigned long node_mask = 0;
+  if (policy == NUMA_BIND) {
+    if (node < 0 || node >= max_nodes) {
+      return;
+    }
+    node_mask = 1UL << node;
+  } else {
+    node_mask = ~0UL;
+  }
+  const int mode = policy == NUMA_BIND ? JR_MPOL_BIND : JR_MPOL_INTERLEAVE;
+  // Failure (e.g. no NUMA support, or nodes in the mask that don't exist) just
+  // leaves the default first touch policy in place.
+  syscall(SYS_mbind, ptr, num_bytes, mode, &node_mask, max_nodes + 1, 0);
+#endif
+}
+
+}  // namespace
+
+void* HugePageMap(std::size_t num_bytes, NumaPolicy policy, int node) {
+  const std::size_t map_bytes = HugePageMappingBytes(num_bytes);
+  const bool huge = map_bytes >= HUGE_PAGE_BYTES;
+
+  // Over-allocate by a huge page so we can trim the mapping to an aligned one.
+  const std::size_t raw_bytes = huge ? map_bytes + HUGE_PAGE_BYTES : map_bytes;
+  void* raw = mmap(nullptr, raw_bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return nullptr;
+  }
+
+  uint8_t* aligned = static_cast<uint8_t*>(raw);
+  if (huge) {
+    const std::size_t addr = reinterpret_cast<uintptr_t>(raw);
+    const std::size_t head =
+        math_utils::UpToNearestMultiple(addr, HUGE_PAGE_BYTES) - addr;
+    const std::size_t tail = raw_bytes - head - map_bytes;
+    aligned += head;
+    if (head != 0) {
+      munmap(raw, head);
+    }
+    if (tail != 0) {
+      munmap(aligned + map_bytes, tail);
+    }
+#if defined(MADV_HUGEPAGE)
+    madvise(aligned, map_bytes, MADV_HUGEPAGE);
+#endif
+  }
+
+  // The policy has to be in place before any page is touched.
+  ApplyNumaPolicy(aligned, map_bytes, policy, node);
+  return aligned;
+}
+
+void HugePageUnmap(void* ptr, std::size_t num_bytes) {
+  if (ptr != nullptr) {
+    munmap(ptr, HugePageMappingBytes(num_bytes));
+  }
+}
+
+constexpr std::size_t PatternFiller::MAX_VECTOR_BYTES;
+constexpr std::size_t PatternFiller::MAX_BLOCK_BYTES;
+
+PatternFiller::PatternFiller(const void* pattern,
+                             std::size_t pattern_size_bytes)
+    : pattern_(pattern), pattern_size_bytes_(pattern_size_bytes),
+      block_size_bytes_(0) {
+  assert(pattern != nullptr);
+  if (pattern_size_bytes == 0) {
+    return;  // Fill(...) does nothing.
+  }
+  const std::size_t block_size_bytes =
+      math_utils::LeastCommonMultiple(pattern_size_bytes, PATTERN_VECTOR_BYTES);
+  if (block_size_bytes > MAX_BLOCK_BYTES) {
+    return;  // Fill(...) uses MemFillChunks(...).
+  }
+  block_size_bytes_ = block_size_bytes;
+  MemFillChunks(block_, block_size_bytes + PATTERN_VECTOR_BYTES, pattern,
+                pattern_size_bytes);
+}
+
+void PatternFiller::Fill(void* buffer, std::size_t buffer_size_bytes) const {
+  assert(buffer != nullptr);
+  if (pattern_size_bytes_ == 1) {
+    memset(buffer, *static_cast<const unsigned char*>(pattern_),
+           buffer_size_bytes);
+  } else if (block_size_bytes_ == 0) {
+    MemFillChunks(buffer, buffer_size_bytes, pattern_, pattern_size_bytes_);
+  } else if (buffer_size_bytes <= block_size_bytes_ + PATTERN_VECTOR_BYTES) {
+    // Short buffers are a prefix of the block.
+    memcpy(buffer, block_, buffer_size_bytes);
+  } else {
+    FillFromPatternBlock<false>(static_cast<uint8_t*>(buffer),
+                                buffer_size_bytes, block_, block_size_bytes_);
+  }
+}
+
+void PatternFiller::FillNonTemporal(void* buffer,
+                                    std::size_t buffer_size_bytes) const {
+  assert(buffer != nullptr);
+  if (block_size_bytes_ == 0 ||
+      buffer_size_bytes <= block_size_bytes_ + PATTERN_VECTOR_BYTES) {
+    Fill(buffer, buffer_size_bytes);
+  } else {
+    FillFromPatternBlock<true>(static_cast<uint8_t*>(buffer),
+                               buffer_size_bytes, block_, block_size_bytes_);
+  }
+}
+
+void* MemFillPattern(void* buffer, std::size_t buffer_size_bytes,
+                     const void* pattern, std::size_t pattern_size_bytes) {
+  assert(buffer != nullptr);
+  assert(pattern != nullptr);
+  if (pattern_size_bytes == 0 || buffer_size_bytes == 0) {
+    return buffer;
+  }
+  PatternFiller(pattern, pattern_size_bytes).Fill(buffer, buffer_size_bytes);
+  return buffer;
+}
+
+void* MemFillPatternRows(void* buffer, std::size_t row_size_bytes,
+                         std::size_t num_rows, std::size_t row_stride_bytes,
+                         const void* pattern, std::size_t pattern_size_bytes) {
+  assert(buffer != nullptr);
+  assert(pattern != nullptr);
+  assert(num_rows <= 1 || row_stride_bytes >= row_size_bytes);
+  if (pattern_size_bytes == 0 || row_size_bytes == 0) {
+    return buffer;
+  }
+  const PatternFiller filler(pattern, pattern_size_bytes);
+  uint8_t* row = static_cast<uint8_t*>(buffer);
+  for (std::size_t y = 0; y < num_rows; ++y, row += row_stride_bytes) {
+    filler.Fill(row, row_size_bytes);
+  }
+  return buffer;
+}
+
+void* MemFillPatternNonTemporal(void* buffer, std::size_t buffer_size_bytes,
+                                const void* pattern,
+                                std::size_t pattern_size_bytes) {
+  assert(buffer != nullptr);
+  assert(pattern != nullptr);
+  if (pattern_size_bytes == 0 || buffer_size_bytes == 0) {
+    return buffer;
+  }
+  PatternFiller(pattern, pattern_size_bytes)
+      .FillNonTemporal(buffer, buffer_size_bytes);
+  return buffer;
+}
+
+namespace {
+
+// 0 until first needed (or set).
+std::atomic<std::size_t> non_temporal_threshold_bytes(0);
+
+std::size_t LastLevelCacheBytes() {
+  long bytes = -1;
+#if defined(_SC_LEVEL3_CACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+  bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (bytes <= 0) {
+    bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  }
+#endif
+  return bytes > 0 ? static_cast<std::size_t>(bytes) : std::size_t(8) << 20;
+}
+
+}  // namespace
+
+std::size_t NonTemporalThresholdBytes() {
+  std::size_t threshold =
+      non_temporal_threshold_bytes.load(std::memory_order_relaxed);
+  if (threshold == 0) {
+    threshold = LastLevelCacheBytes();
+    non_temporal_threshold_bytes.store(threshold, std::memory_order_relaxed);
+  }
+  return threshold;
+}
+
+void SetNonTemporalThresholdBytes(std::size_t threshold_bytes) {
+  non_temporal_threshold_bytes.store(std::max<std::size_t>(threshold_bytes, 1),
+                                     std::memory_order_relaxed);
+}
+
+bool UseNonTemporalStores(std::size_t destination_size_bytes, CacheHint hint) {
+  switch (hint) {
+    case CACHE_HINT_CACHED: return false;
+    case CACHE_HINT_NON_TEMPORAL: return true;
+    case CACHE_HINT_AUTO:
+    default:
+      return destination_size_bytes >= NonTemporalThresholdBytes();
+  }
+}
+
+void* CopyNonTemporal(void* dst, const void* src, std::size_t num_bytes) {
+  assert(num_bytes == 0 || (dst != nullptr && src != nullptr));
+  const std::size_t kUnrollBytes = 4 * PATTERN_VECTOR_BYTES;
+  if (num_bytes < 2 * kUnrollBytes) {
+    return memcpy(dst, src, num_bytes);
+  }
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  const uint8_t* in = static_cast<const uint8_t*>(src);
+  // Ordinary stores up to the first vector aligned destination byte.
+  const std::size_t head =
+      (PATTERN_VECTOR_BYTES -
+       reinterpret_cast<uintptr_t>(out) % PATTERN_VECTOR_BYTES) %
+      PATTERN_VECTOR_BYTES;
+  memcpy(out, in, head);
+  out += head;
+  in += head;
+  std::size_t remaining = num_bytes - head;
+  for (; remaining >= kUnrollBytes; remaining -= kUnrollBytes) {
+    const PatternVecT v0 = LoadPatternVec(in);
+    const PatternVecT v1 = LoadPatternVec(in + PATTERN_VECTOR_BYTES);
+    const PatternVecT v2 = LoadPatternVec(in + 2 * PATTERN_VECTOR_BYTES);
+    const PatternVecT v3 = LoadPatternVec(in + 3 * PATTERN_VECTOR_BYTES);
+    StreamAlignedPatternVec(out, v0);
+    StreamAlignedPatternVec(out + PATTERN_VECTOR_BYTES, v1);
+    StreamAlignedPatternVec(out + 2 * PATTERN_VECTOR_BYTES, v2);
+    StreamAlignedPatternVec(out + 3 * PATTERN_VECTOR_BYTES, v3);
+    in += kUnrollBytes;
+    out += kUnrollBytes;
+  }
+  StreamingStoreFence();
+  memcpy(out, in, remaining);
+  return dst;
+}
+
+const char* MemFillStrategyName(MemFillStrategy strategy) {
+  switch (strategy) {
+    case MEM_FILL_SIMPLE: return "simple";
+    case MEM_FILL_CHUNKS: return "chunks";
+    case MEM_FILL_VECTOR: return "vector";
+    case MEM_FILL_NON_TEMPORAL: return "non_temporal";
+    default: return "unknown";
+  }
+}
+
+constexpr int MemFillDispatchTable::NUM_BUFFER_BUCKETS;
+constexpr int MemFillDispatchTable::NUM_PATTERN_BUCKETS;
+
+MemFillDispatchTable::MemFillDispatchTable() {
+  // Rules of thumb: vector stores for short patterns, memcpy for long ones,
+  // and bypass the cache for buffers that can't fit in it anyway.
+  for (int b = 0; b < NUM_BUFFER_BUCKETS; ++b) {
+    for (int p = 0; p < NUM_PATTERN_BUCKETS; ++p) {
+      MemFillStrategy strategy = MEM_FILL_VECTOR;
+      if (p == NUM_PATTERN_BUCKETS - 1) {
+        strategy = MEM_FILL_CHUNKS;
+      } else if (b == NUM_BUFFER_BUCKETS - 1) {
+        strategy = MEM_FILL_NON_TEMPORAL;
+      }
+      Set(b, p, strategy);
+    }
+  }
+}
+
+std::size_t MemFillDispatchTable::BufferBucketLimit(int bucket) {
+  assert(bucket >= 0 && bucket < NUM_BUFFER_BUCKETS);
+  return bucket == NUM_BUFFER_BUCKETS - 1 ? SIZE_MAX
+                                          : std::size_t(64) << (3 * bucket);
+}
+
+std::size_t MemFillDispatchTable::PatternBucketLimit(int bucket) {
+  static const std::size_t limits[NUM_PATTERN_BUCKETS] = {2, 4, 8, 16, 64,
+                                                          SIZE_MAX};
+  assert(bucket >= 0 && bucket < NUM_PATTERN_BUCKETS);
+  return limits[bucket];
+}
+
+int MemFillDispatchTable::BufferBucket(std::size_t buffer_size_bytes) {
+  int bucket = 0;
+  while (buffer_size_bytes > BufferBucketLimit(bucket)) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+int MemFillDispatchTable::PatternBucket(std::size_t pattern_size_bytes) {
+  int bucket = 0;
+  while (pattern_size_bytes > PatternBucketLimit(bucket)) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+MemFillStrategy MemFillDispatchTable::Get(int buffer_bucket,
+                                          int pattern_bucket) const {
+  assert(buffer_bucket >= 0 && buffer_bucket < NUM_BUFFER_BUCKETS);
+  assert(pattern_bucket >= 0 && pattern_bucket < NUM_PATTERN_BUCKETS);
+  return static_cast<MemFillStrategy>(
+      strategies_[buffer_bucket][pattern_bucket]);
+}
+
+void MemFillDispatchTable::Set(int buffer_bucket, int pattern_bucket,
+                               MemFillStrategy strategy) {
+  assert(buffer_bucket >= 0 && buffer_bucket < NUM_BUFFER_BUCKETS);
+  assert(pattern_bucket >= 0 && pattern_bucket < NUM_PATTERN_BUCKETS);
+  assert(strategy >= 0 && strategy < NUM_MEM_FILL_STRATEGIES);
+  strategies_[buffer_bucket][pattern_bucket] = static_cast<uint8_t>(strategy);
+}
+
+namespace {
+
+std::string BucketLimitName(std::size_t limit) {
+  return limit == SIZE_MAX ? "max" : std::to_string(limit);
+}
+
+// Return the bucket whose limit is named name, or -1.
+int ParseBucketLimit(const std::string& name, int num_buckets,
+                     std::size_t (*limit)(int)) {
+  for (int bucket = 0; bucket < num_buckets; ++bucket) {
+    if (name == BucketLimitName(limit(bucket))) {
+      return bucket;
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+std::string MemFillDispatchTable::Serialize() const {
+  std::ostringstream out;
+  out << "# buffer_bytes pattern_bytes strategy\n";
+  for (int b = 0; b < NUM_BUFFER_BUCKETS; ++b) {
+    for (int p = 0; p < NUM_PATTERN_BUCKETS; ++p) {
+      out << BucketLimitName(BufferBucketLimit(b)) << " "
+          << BucketLimitName(PatternBucketLimit(p)) << " "
+          << MemFillStrategyName(Get(b, p)) << "\n";
+    }
+  }
+  return out.str();
+}
+
+bool MemFillDispatchTable::Parse(const std::string& profile) {
+  MemFillDispatchTable parsed;
+  bool seen[NUM_BUFFER_BUCKETS][NUM_PATTERN_BUCKETS] = {};
+  int num_seen = 0;
+  std::istringstream in(profile);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string buffer_limit, pattern_limit, strategy_name, extra;
+    if (!(fields >> buffer_limit) || buffer_limit[0] == '#') {
+      continue;  // Blank line or comment.
+    }
+    if (!(fields >> pattern_limit >> strategy_name) || (fields >> extra)) {
+      return false;
+    }
+    const int b = ParseBucketLimit(buffer_limit, NUM_BUFFER_BUCKETS,
+                                   BufferBucketLimit);
+    const int p = ParseBucketLimit(pattern_limit, NUM_PATTERN_BUCKETS,
+                                   PatternBucketLimit);
+    int strategy = 0;
+    while (strategy < NUM_MEM_FILL_STRATEGIES &&
+           strategy_name != MemFillStrategyName(
+                                static_cast<MemFillStrategy>(strategy))) {
+      ++strategy;
+    }
+    if (b < 0 || p < 0 || strategy == NUM_MEM_FILL_STRATEGIES) {
+      return false;
+    }
+    parsed.Set(b, p, static_cast<MemFillStrategy>(strategy));
+    num_seen += !seen[b][p];
+    seen[b][p] = true;
+  }
+  if (num_seen != NUM_BUFFER_BUCKETS * NUM_PATTERN_BUCKETS) {
+    return false;
+  }
+  *this = parsed;
+  return true;
+}
+
+bool MemFillDispatchTable::Save(const std::string& path) const {
+  std::ofstream out(path.c_str());
+  out << Serialize();
+  return static_cast<bool>(out);
+}
+
+bool MemFillDispatchTable::Load(const std::string& path) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    return false;
+  }
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  return Parse(contents.str());
+}
+
+MemFillDispatchTable MemFillDispatchTable::Calibrate() {
+  typedef void* (*FillFunctionT)(void*, std::size_t, const void*, std::size_t);
+  const FillFunctionT fill_functions[NUM_MEM_FILL_STRATEGIES] = {
+      MemFillSimple, MemFillChunks, MemFillPattern, MemFillPatternNonTemporal};
+  // Sizes timed for each bucket: most of the way to the bucket's limit, and
+  // 32MB (larger than most last level caches) for the unbounded buckets.
+  const std::size_t kMaxBufferBytes = std::size_t(32) << 20;
+  const std::size_t kPatternSizes[NUM_PATTERN_BUCKETS] = {2, 3, 6, 12, 48, 96};
+  // Time at least this many bytes of filling per measurement, so that small
+  // buffers are filled many times.
+  const std::size_t kMinBytesPerTrial = std::size_t(1) << 20;
+  // Strategies this much slower than the best are not timed again for larger
+  // buffers with the same pattern size, which keeps calibration fast.
+  const double kDropRatio = 4.0;
+
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[kMaxBufferBytes]);
+  memset(buffer.get(), 0, kMaxBufferBytes);  // Fault the pages in up front.
+  uint8_t pattern[96];
+  for (std::size_t i = 0; i < sizeof(pattern); ++i) {
+    pattern[i] = static_cast<uint8_t>(i * 37 + 1);
+  }
+
+  MemFillDispatchTable table;
+  for (int p = 0; p < NUM_PATTERN_BUCKETS; ++p) {
+    bool candidates[NUM_MEM_FILL_STRATEGIES];
+    std::fill(candidates, candidates + NUM_MEM_FILL_STRATEGIES, true);
+    for (int b = 0; b < NUM_BUFFER_BUCKETS; ++b) {
+      const std::size_t buffer_bytes =
+          b == NUM_BUFFER_BUCKETS - 1 ? kMaxBufferBytes
+                                      : BufferBucketLimit(b) / 4 * 3;
+      const std::size_t fills_per_trial =
+          std::max<std::size_t>(1, kMinBytesPerTrial / buffer_bytes);
+      const int num_trials = buffer_bytes >= kMinBytesPerTrial ? 1 : 5;
+
+      double seconds[NUM_MEM_FILL_STRATEGIES];
+      int best = -1;
+      for (int s = 0; s < NUM_MEM_FILL_STRATEGIES; ++s) {
+        if (!candidates[s]) {
+          continue;
+        }
+        seconds[s] = std::numeric_limits<double>::max();
+        for (int trial = 0; trial < num_trials; ++trial) {
+          const std::chrono::steady_clock::time_point start =
+              std::chrono::steady_clock::now();
+          for (std::size_t i = 0; i < fills_per_trial; ++i) {
+            fill_functions[s](buffer.get(), buffer_bytes, pattern,
+                              kPatternSizes[p]);
+          }
+          const std::chrono::duration<double> elapsed =
+              std::chrono::steady_clock::now() - start;
+          seconds[s] = std::min(seconds[s], elapsed.count());
+        }
+        if (best < 0 || seconds[s] < seconds[best]) {
+          best = s;
+        }
+      }
+      table.Set(b, p, static_cast<MemFillStrategy>(best));
+      for (int s = 0; s < NUM_MEM_FILL_STRATEGIES; ++s) {
+        candidates[s] =
+            candidates[s] && seconds[s] <= seconds[best] * kDropRatio;
+      }
+    }
+  }
+  return table;
+}
+
+MemFillDispatchTable GetMemFillDispatchTable() {
+  EnsureMemFillTable();
+  MemFillDispatchTable table;
+  for (int b = 0; b < MemFillDispatchTable::NUM_BUFFER_BUCKETS; ++b) {
+    for (int p = 0; p < MemFillDispatchTable::NUM_PATTERN_BUCKETS; ++p) {
+      table.Set(b, p, static_cast<MemFillStrategy>(
+                          mem_fill_table[b][p].load(std::memory_order_relaxed)));
+    }
+  }
+  return table;
+}
+
+void SetMemFillDispatchTable(const MemFillDispatchTable& table) {
+  // Don't let a first use initialization that is still running overwrite
+  // table, and skip it entirely if it hasn't started.
+  std::call_once(mem_fill_table_once, []() {});
+  StoreMemFillTable(table);
+}
+
+MemFillDispatchTable CalibrateMemFill() {
+  const MemFillDispatchTable table = MemFillDispatchTable::Calibrate();
+  SetMemFillDispatchTable(table);
+  return table;
+}
+
+namespace implementation_details {
+
+namespace {
+
+// Vectors for the ArraysAreDifferent(...) kernels.  Byte compares need AVX2
+// for 32 byte vectors; floating point compares only need AVX.
+#if defined(__AVX2__)
+#define JR_HAVE_COMPARE_VECTORS 1
+typedef __m256i ByteCompareVecT;
+const uint32_t ALL_BYTES_EQUAL = 0xFFFFFFFFu;
+inline ByteCompareVecT EqualBytes(const uint8_t* a, const uint8_t* b) {
+  return _mm256_cmpeq_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)),
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)));
+}
+inline ByteCompareVecT BothEqual(ByteCompareVecT x, ByteCompareVecT y) {
+  return _mm256_and_si256(x, y);
+}
+inline uint32_t ByteMask(ByteCompareVecT v) {
+  return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+}
+#elif defined(__SSE2__)
+#define JR_HAVE_COMPARE_VECTORS 1
+typedef __m128i ByteCompareVecT;
+const uint32_t ALL_BYTES_EQUAL = 0xFFFFu;
+inline ByteCompareVecT EqualBytes(const uint8_t* a, const uint8_t* b) {
+  return _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+}
+inline ByteCompareVecT BothEqual(ByteCompareVecT x, ByteCompareVecT y) {
+  return _mm_and_si128(x, y);
+}
+inline uint32_t ByteMask(ByteCompareVecT v) {
+  return static_cast<uint32_t>(_mm_movemask_epi8(v));
+}
+#else
+#define JR_HAVE_COMPARE_VECTORS 0
+#endif
+
+#if JR_HAVE_COMPARE_VECTORS
+const std::size_t COMPARE_VECTOR_BYTES = sizeof(ByteCompareVecT);
+
+// Collapse a mask with one bit per byte into one with the lowest bit of each
+// element_size group set if any bit in the group is.
+inline uint32_t ElementMask(uint32_t byte_mask, std::size_t element_size) {
+  switch (element_size) {
+    case 2:
+      return (byte_mask | byte_mask >> 1) & 0x55555555u;
+    case 4:
+      byte_mask |= byte_mask >> 1;
+      byte_mask |= byte_mask >> 2;
+      return byte_mask & 0x11111111u;
+    case 8:
+      byte_mask |= byte_mask >> 1;
+      byte_mask |= byte_mask >> 2;
+      byte_mask |= byte_mask >> 4;
+      return byte_mask & 0x01010101u;
+    default:
+      return byte_mask;
+  }
+}
+
+// Per type access to "not equal" compares of floating point vectors.  The
+// compares are unordered, so NaN lanes always count as different, matching
+// operator!=.
+template<typename T>
+struct FloatingCompare;
+
+#if defined(__AVX__)
+template<>
+struct FloatingCompare<float> {
+  typedef __m256 VecT;
+  static const std::size_t LANES = 8;
+  static VecT NotEqual(const float* a, const float* b) {
+    return _mm256_cmp_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b), _CMP_NEQ_UQ);
+  }
+  static VecT Either(VecT x, VecT y) { return _mm256_or_ps(x, y); }
+  static uint32_t Mask(VecT v) {
+    return static_cast<uint32_t>(_mm256_movemask_ps(v));
+  }
+};
+template<>
+struct FloatingCompare<double> {
+  typedef __m256d VecT;
+  static const std::size_t LANES = 4;
+  static VecT NotEqual(const double* a, const double* b) {
+    return _mm256_cmp_pd(_mm256_loadu_pd(a), _mm256_loadu_pd(b), _CMP_NEQ_UQ);
+  }
+  static VecT Either(VecT x, VecT y) { return _mm256_or_pd(x, y); }
+  static uint32_t Mask(VecT v) {
+    return static_cast<uint32_t>(_mm256_movemask_pd(v));
+  }
+};
+#else
+template<>
+struct FloatingCompare<float> {
+  typedef __m128 VecT;
+  static const std::size_t LANES = 4;
+  static VecT NotEqual(const float* a, const float* b) {
+    return _mm_cmpneq_ps(_mm_loadu_ps(a), _mm_loadu_ps(b));
+  }
+  static VecT Either(VecT x, VecT y) { return _mm_or_ps(x, y); }
+  static uint32_t Mask(VecT v) {
+    return static_cast<uint32_t>(_mm_movemask_ps(v));
+  }
+};
+template<>
+struct FloatingCompare<double> {
+  typedef __m128d VecT;
+  static const std::size_t LANES = 2;
+  static VecT NotEqual(const double* a, const double* b) {
+    return _mm_cmpneq_pd(_mm_loadu_pd(a), _mm_loadu_pd(b));
+  }
+  static VecT Either(VecT x, VecT y) { return _mm_or_pd(x, y); }
+  static uint32_t Mask(VecT v) {
+    return static_cast<uint32_t>(_mm_movemask_pd(v));
+  }
+};
+#endif  // __AVX__
+#endif  // JR_HAVE_COMPARE_VECTORS
+
+template<typename T>
+std::size_t FindFirstDifferentFloating(const T* buffer_a, const T* buffer_b,
+                                       std::size_t num_elements) {
+  std::size_t i = 0;
+#if JR_HAVE_COMPARE_VECTORS
+  typedef FloatingCompare<T> CompareT;
+  const std::size_t kLanes = CompareT::LANES;
+  // Four vectors per test while everything matches...
+  for (; i + 4 * kLanes <= num_elements; i += 4 * kLanes) {
+    const typename CompareT::VecT any = CompareT::Either(
+        CompareT::Either(CompareT::NotEqual(buffer_a + i, buffer_b + i),
+                         CompareT::NotEqual(buffer_a + i + kLanes,
+                                            buffer_b + i + kLanes)),
+        CompareT::Either(CompareT::NotEqual(buffer_a + i + 2 * kLanes,
+                                            buffer_b + i + 2 * kLanes),
+                         CompareT::NotEqual(buffer_a + i + 3 * kLanes,
+                                            buffer_b + i + 3 * kLanes)));
+    if (CompareT::Mask(any) != 0) {
+      break;
+    }
+  }
+  // ...then one at a time to find the lane.
+  for (; i + kLanes <= num_elements; i += kLanes) {
+    const uint32_t mask =
+        CompareT::Mask(CompareT::NotEqual(buffer_a + i, buffer_b + i));
+    if (mask != 0) {
+      return i + math_utils::CountTrailingZeros(mask);
+    }
+  }
+#endif
+  for (; i < num_elements; ++i) {
+    if (buffer_a[i] != buffer_b[i]) {
+      return i;
+    }
+  }
+  return num_elements;
+}
+
+template<typename T>
+std::size_t CountDifferentFloating(const T* buffer_a, const T* buffer_b,
+                                   std::size_t num_elements) {
+  std::size_t count = 0;
+  std::size_t i = 0;
+#if JR_HAVE_COMPARE_VECTORS
+  typedef FloatingCompare<T> CompareT;
+  for (; i + CompareT::LANES <= num_elements; i += CompareT::LANES) {
+    count += math_utils::CountSetBits(
+        CompareT::Mask(CompareT::NotEqual(buffer_a + i, buffer_b + i)));
+  }
+#endif
+  for (; i < num_elements; ++i) {
+    count += buffer_a[i] != buffer_b[i];
+  }
+  return count;
+}
+
+}  // namespace
+
+std::size_t FindFirstDifferentBits(const void* buffer_a, const void* buffer_b,
+                                   std::size_t num_elements,
+                                   std::size_t element_size) {
+  const uint8_t* a = static_cast<const uint8_t*>(buffer_a);
+  const uint8_t* b = static_cast<const uint8_t*>(buffer_b);
+  const std::size_t num_bytes = num_elements * element_size;
+  std::size_t i = 0;
+#if JR_HAVE_COMPARE_VECTORS
+  const std::size_t kVec = COMPARE_VECTOR_BYTES;
+  // Four vectors per test while everything matches...
+  for (; i + 4 * kVec <= num_bytes; i += 4 * kVec) {
+    const ByteCompareVecT all = BothEqual(
+        BothEqual(EqualBytes(a + i, b + i),
+                  EqualBytes(a + i + kVec, b + i + kVec)),
+        BothEqual(EqualBytes(a + i + 2 * kVec, b + i + 2 * kVec),
+                  EqualBytes(a + i + 3 * kVec, b + i + 3 * kVec)));
+    if (ByteMask(all) != ALL_BYTES_EQUAL) {
+      break;
+    }
+  }
+  // ...then one at a time to find the byte.  Vectors hold whole elements.
+  for (; i + kVec <= num_bytes; i += kVec) {
+    const uint32_t mask = ByteMask(EqualBytes(a + i, b + i));
+    if (mask != ALL_BYTES_EQUAL) {
+      return (i + math_utils::CountTrailingZeros(~mask & ALL_BYTES_EQUAL)) /
+             element_size;
+    }
+  }
+#endif
+  for (; i < num_bytes; ++i) {
+    if (a[i] != b[i]) {
+      return i / element_size;
+    }
+  }
+  return num_elements;
+}
+
+std::size_t CountDifferentBits(const void* buffer_a, const void* buffer_b,
+                               std::size_t num_elements,
+                               std::size_t element_size) {
+  const uint8_t* a = static_cast<const uint8_t*>(buffer_a);
+  const uint8_t* b = static_cast<const uint8_t*>(buffer_b);
+  const std::size_t num_bytes = num_elements * element_size;
+  std::size_t count = 0;
+  std::size_t i = 0;
+#if JR_HAVE_COMPARE_VECTORS
+  for (; i + COMPARE_VECTOR_BYTES <= num_bytes; i += COMPARE_VECTOR_BYTES) {
+    const uint32_t differ = ~ByteMask(EqualBytes(a + i, b + i)) &
+                            ALL_BYTES_EQUAL;
+    if (differ != 0) {
+      count += math_utils::CountSetBits(ElementMask(differ, element_size));
+    }
+  }
+#endif
+  for (; i < num_bytes; i += element_size) {
+    count += memcmp(a + i, b + i, element_size) != 0;
+  }
+  return count;
+}
+
+std::size_t FindFirstDifferent(const float* buffer_a, const float* buffer_b,
+                               std::size_t num_elements) {
+  return FindFirstDifferentFloating(buffer_a, buffer_b, num_elements);
+}
+
+std::size_t FindFirstDifferent(const double* buffer_a, const double* buffer_b,
+                               std::size_t num_elements) {
+  return FindFirstDifferentFloating(buffer_a, buffer_b, num_elements);
+}
+
+std::size_t CountDifferent(const float* buffer_a, const float* buffer_b,
+                           std::size_t num_elements) {
+  return CountDifferentFloating(buffer_a, buffer_b, num_elements);
+}
+
+std::size_t CountDifferent(const double* buffer_a, const double* buffer_b,
+                           std::size_t num_elements) {
+  return CountDifferentFloating(buffer_a, buffer_b, num_elements);
+}
+
+namespace {
+
+#if JR_HAVE_COMPARE_VECTORS
+// Per type access to the vector operations of the MeasureErrors(...) kernels,
+// which compute errors in ErrorT (float or double).  Integer elements are
+// loaded widened to float.
+template<typename ErrorT>
+struct ErrorVectors;
+
+#if defined(__AVX__)
+template<>
+struct ErrorVectors<float> {
+  typedef __m256 VecT;
+  static const std::size_t LANES = 8;
+  static VecT Set(float x) { return _mm256_set1_ps(x); }
+  static VecT Iota() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+  static VecT Load(const float* p) { return _mm256_loadu_ps(p); }
+  static VecT Load(const uint8_t* p) {
+    return Widen(_mm_unpacklo_epi8(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+        _mm_setzero_si128()));
+  }
+  static VecT Load(const uint16_t* p) {
+    return Widen(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  }
+  static void Store(float* p, VecT v) { _mm256_storeu_ps(p, v); }
+  static VecT Add(VecT x, VecT y) { return _mm256_add_ps(x, y); }
+  static VecT Sub(VecT x, VecT y) { return _mm256_sub_ps(x, y); }
+  static VecT Mul(VecT x, VecT y) { return _mm256_mul_ps(x, y); }
+  static VecT Max(VecT x, VecT y) { return _mm256_max_ps(x, y); }
+  static VecT Abs(VecT x) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x); }
+  static VecT And(VecT x, VecT y) { return _mm256_and_ps(x, y); }
+  static VecT AndNot(VecT x, VecT y) { return _mm256_andnot_ps(x, y); }
+  static VecT Or(VecT x, VecT y) { return _mm256_or_ps(x, y); }
+  static VecT Equal(VecT x, VecT y) { return _mm256_cmp_ps(x, y, _CMP_EQ_OQ); }
+  static VecT Greater(VecT x, VecT y) {
+    return _mm256_cmp_ps(x, y, _CMP_GT_OQ);
+  }
+  static VecT Unordered(VecT x, VecT y) {
+    return _mm256_cmp_ps(x, y, _CMP_UNORD_Q);
+  }
+  static uint32_t Mask(VecT v) {
+    return static_cast<uint32_t>(_mm256_movemask_ps(v));
+  }
+
+ private:
+  // Eight 16 bit unsigned integers to floats.
+  static VecT Widen(__m128i words) {
+    const __m128i zero = _mm_setzero_si128();
+    return _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero))),
+        _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero)), 1);
+  }
+};
+template<>
+struct ErrorVectors<double> {
+  typedef __m256d VecT;
+  static const std::size_t LANES = 4;
+  static VecT Set(double x) { return _mm256_set1_pd(x); }
+  static VecT Iota() { return _mm256_setr_pd(0, 1, 2, 3); }
+  static VecT Load(const double* p) { return _mm256_loadu_pd(p); }
+  static void Store(double* p, VecT v) { _mm256_storeu_pd(p, v); }
+  static VecT Add(VecT x, VecT y) { return _mm256_add_pd(x, y); }
+  static VecT Sub(VecT x, VecT y) { return _mm256_sub_pd(x, y); }
+  static VecT Mul(VecT x, VecT y) { return _mm256_mul_pd(x, y); }
+  static VecT Max(VecT x, VecT y) { return _mm256_max_pd(x, y); }
+  static VecT Abs(VecT x) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), x); }
+  static VecT And(VecT x, VecT y) { return _mm256_and_pd(x, y); }
+  static VecT AndNot(VecT x, VecT y) { return _mm256_andnot_pd(x, y); }
+  static VecT Or(VecT x, VecT y) { return _mm256_or_pd(x, y); }
+  static VecT Equal(VecT x, VecT y) { return _mm256_cmp_pd(x, y, _CMP_EQ_OQ); }
+  static VecT Greater(VecT x, VecT y) {
+    return _mm256_cmp_pd(x, y, _CMP_GT_OQ);
+  }
+  static VecT Unordered(VecT x, VecT y) {
+    return _mm256_cmp_pd(x, y, _CMP_UNORD_Q);
+  }
+  static uint32_t Mask(VecT v) {
+    return static_cast<uint32_t>(_mm256_movemask_pd(v));
+  }
+};
+#else
+template<>
+struct ErrorVectors<float> {
+  typedef __m128 VecT;
+  static const std::size_t LANES = 4;
+  static VecT Set(float x) { return _mm_set1_ps(x); }
+  static VecT Iota() { return _mm_setr_ps(0, 1, 2, 3); }
+  static VecT Load(const float* p) { return _mm_loadu_ps(p); }
+  static VecT Load(const uint8_t* p) {
+    int32_t bytes;
+    memcpy(&bytes, p, sizeof(bytes));
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+        _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero));
+  }
+  static VecT Load(const uint16_t* p) {
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+        _mm_setzero_si128()));
+  }
+  static void Store(float* p, VecT v) { _mm_storeu_ps(p, v); }
+  static VecT Add(VecT x, VecT y) { return _mm_add_ps(x, y); }
+  static VecT Sub(VecT x, VecT y) { return _mm_sub_ps(x, y); }
+  static VecT Mul(VecT x, VecT y) { return _mm_mul_ps(x, y); }
+  static VecT Max(VecT x, VecT y) { return _mm_max_ps(x, y); }
+  static VecT Abs(VecT x) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), x); }
+  static VecT And(VecT x, VecT y) { return _mm_and_ps(x, y); }
+  static VecT AndNot(VecT x, VecT y) { return _mm_andnot_ps(x, y); }
+  static VecT Or(VecT x, VecT y) { return _mm_or_ps(x, y); }
+  static VecT Equal(VecT x, VecT y) { return _mm_cmpeq_ps(x, y); }
+  static VecT Greater(VecT x, VecT y) { return _mm_cmpgt_ps(x, y); }
+  static VecT Unordered(VecT x, VecT y) { return _mm_cmpunord_ps(x, y); }
+  static uint32_t Mask(VecT v) {
+    return static_cast<uint32_t>(_mm_movemask_ps(v));
+  }
+};
+template<>
+struct ErrorVectors<double> {
+  typedef __m128d VecT;
+  static const std::size_t LANES = 2;
+  static VecT Set(double x) { return _mm_set1_pd(x); }
+  static VecT Iota() { return _mm_setr_pd(0, 1); }
+  static VecT Load(const double* p) { return _mm_loadu_pd(p); }
+  static void Store(double* p, VecT v) { _mm_storeu_pd(p, v); }
+  static VecT Add(VecT x, VecT y) { return _mm_add_pd(x, y); }
+  static VecT Sub(VecT x, VecT y) { return _mm_sub_pd(x, y); }
+  static VecT Mul(VecT x, VecT y) { return _mm_mul_pd(x, y); }
+  static VecT Max(VecT x, VecT y) { return _mm_max_pd(x, y); }
+  static VecT Abs(VecT x) { return _mm_andnot_pd(_mm_set1_pd(-0.0), x); }
+  static VecT And(VecT x, VecT y) { return _mm_and_pd(x, y); }
+  static VecT AndNot(VecT x, VecT y) { return _mm_andnot_pd(x, y); }
+  static VecT Or(VecT x, VecT y) { return _mm_or_pd(x, y); }
+  static VecT Equal(VecT x, VecT y) { return _mm_cmpeq_pd(x, y); }
+  static VecT Greater(VecT x, VecT y) { return _mm_cmpgt_pd(x, y); }
+  static VecT Unordered(VecT x, VecT y) { return _mm_cmpunord_pd(x, y); }
+  static uint32_t Mask(VecT v) {
+    return static_cast<uint32_t>(_mm_movemask_pd(v));
+  }
+};
+#endif  // __AVX__
+#endif  // JR_HAVE_COMPARE_VECTORS
+
+// Elements measured per block by MeasureErrorsBlocked(...).  Sums are kept per
+// lane (in ErrorT) over a block, which is short enough for them to stay
+// accurate, and added up in double.  Lanes also track where their maximum is,
+// as an offset into the block, which ErrorT holds exactly.
+const std::size_t ERROR_BLOCK_ELEMENTS = 1024;
+
+template<typename ErrorT, typename T>
+ErrorStats MeasureErrorsBlocked(const T* buffer_a, const T* buffer_b,
+                                std::size_t num_elements, double absolute,
+                                double relative) {
+  const ErrorT kInfinity = std::numeric_limits<ErrorT>::infinity();
+  const ErrorT absolute_tolerance = static_cast<ErrorT>(absolute);
+  const ErrorT relative_tolerance = static_cast<ErrorT>(relative);
+  ErrorStats stats = {0, 0.0, 0.0, 0};
+  for (std::size_t begin = 0; begin < num_elements;
+       begin += ERROR_BLOCK_ELEMENTS) {
+    const std::size_t end =
+        std::min(num_elements, begin + ERROR_BLOCK_ELEMENTS);
+    std::size_t i = begin;
+    ErrorT block_max = 0;
+    std::size_t block_max_index = begin;
+#if JR_HAVE_COMPARE_VECTORS
+    typedef ErrorVectors<ErrorT> V;
+    typedef typename V::VecT VecT;
+    const VecT infinity = V::Set(kInfinity);
+    const VecT absolute_v = V::Set(absolute_tolerance);
+    const VecT relative_v = V::Set(relative_tolerance);
+    const VecT step = V::Set(static_cast<ErrorT>(V::LANES));
+    VecT sum = V::Set(0), max = V::Set(0);
+    VecT offset = V::Iota(), max_offset = offset;
+    for (; i + V::LANES <= end; i += V::LANES, offset = V::Add(offset, step)) {
+      const VecT a = V::Load(buffer_a + i);
+      const VecT b = V::Load(buffer_b + i);
+      // |a - b|, except for equal lanes (which may be equal infinities) and
+      // lanes with a NaN...
+      const VecT unordered = V::Unordered(a, b);
+      VecT error = V::AndNot(V::Or(V::Equal(a, b), unordered),
+                             V::Abs(V::Sub(a, b)));
+      // ...which are infinite unless both are NaN.
+      const VecT both_nan = V::And(V::Unordered(a, a), V::Unordered(b, b));
+      error = V::Or(error, V::AndNot(both_nan, V::And(unordered, infinity)));
+      const VecT tolerance = V::Max(
+          absolute_v, V::Mul(relative_v, V::Max(V::Abs(a), V::Abs(b))));
+      stats.num_over += math_utils::CountSetBits(V::Mask(V::Or(
+          V::Greater(error, tolerance), V::Equal(error, infinity))));
+      sum = V::Add(sum, error);
+      // Only a strictly larger error moves a lane's maximum, so each lane
+      // keeps the first one.
+      const VecT grew = V::Greater(error, max);
+      max = V::Or(V::And(grew, error), V::AndNot(grew, max));
+      max_offset = V::Or(V::And(grew, offset), V::AndNot(grew, max_offset));
+    }
+    ErrorT lanes[V::LANES], lane_offsets[V::LANES];
+    V::Store(lanes, sum);
+    for (std::size_t lane = 0; lane < V::LANES; ++lane) {
+      stats.sum_error += lanes[lane];
+    }
+    V::Store(lanes, max);
+    V::Store(lane_offsets, max_offset);
+    for (std::size_t lane = 0; lane < V::LANES; ++lane) {
+      const std::size_t index =
+          begin + static_cast<std::size_t>(lane_offsets[lane]);
+      if (lanes[lane] > block_max ||
+          (lanes[lane] == block_max && index < block_max_index)) {
+        block_max = lanes[lane];
+        block_max_index = index;
+      }
+    }
+#endif
+    for (; i < end; ++i) {
+      const ErrorT a = static_cast<ErrorT>(buffer_a[i]);
+      const ErrorT b = static_cast<ErrorT>(buffer_b[i]);
+      const ErrorT error = ValueError(a, b);
+      stats.num_over += ErrorExceeds(error, a, b, absolute_tolerance,
+                                     relative_tolerance);
+      stats.sum_error += error;
+      if (error > block_max) {
+        block_max = error;
+        block_max_index = i;
+      }
+    }
+    if (block_max > stats.max_error) {
+      assert(block_max_index < end);
+      stats.max_error = block_max;
+      stats.max_error_index = block_max_index;
+    }
+  }
+  return stats;
+}
+
+}  // namespace
+
+ErrorStats MeasureErrorsKernel(const float* buffer_a, const float* buffer_b,
+                               std::size_t num_elements, double absolute,
+                               double relative) {
+  return MeasureErrorsBlocked<float>(buffer_a, buffer_b, num_elements,
+                                     absolute, relative);
+}
+
+ErrorStats MeasureErrorsKernel(const double* buffer_a, const double* buffer_b,
+                               std::size_t num_elements, double absolute,
+                               double relative) {
+  return MeasureErrorsBlocked<double>(buffer_a, buffer_b, num_elements,
+                                      absolute, relative);
+}
+
+ErrorStats MeasureErrorsKernel(const uint8_t* buffer_a, const uint8_t* buffer_b,
+                               std::size_t num_elements, double absolute,
+                               double relative) {
+  return MeasureErrorsBlocked<float>(buffer_a, buffer_b, num_elements,
+                                     absolute, relative);
+}
+
+ErrorStats MeasureErrorsKernel(const uint16_t* buffer_a,
+                               const uint16_t* buffer_b,
+                               std::size_t num_elements, double absolute,
+                               double relative) {
+  return MeasureErrorsBlocked<float>(buffer_a, buffer_b, num_elements,
+                                     absolute, relative);
+}
+
+}  // namespace implementation_details
+
 }  // namespace mem_utils
 }  // namespace jr
 
@@ -2,15 +2,31 @@
 #define JRIMAGE_MEMUTILS_H_
 
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <cstdint>
 #include <memory>
+#include <new>
+#include <string>
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <type_traits>
 
+// Whether the C library provides posix_memalign, which AlignedNew(...) uses
+// when it can.  May be defined to 0 on the command line to force the portable
+// fallback.
+#if !defined(JR_HAVE_POSIX_MEMALIGN)
+#if defined(__unix__) || defined(__APPLE__)
+#define JR_HAVE_POSIX_MEMALIGN 1
+#else
+#define JR_HAVE_POSIX_MEMALIGN 0
+#endif
+#endif
+
 namespace jr {
 
 /// Utility functions for working with memory.
@@ -18,12 +34,44 @@ namespace mem_utils {
 
 /// Return true if the two arrays are different.  Optionally, we can return the
 /// index of the first difference via the diff_index parameter.  If the arrays
-/// differ, the output value of diff_index is undefined.
+/// are the same, diff_index is not written.
+///
+/// Elements are compared with operator!=, so for floating point types -0.0
+/// equals 0.0 and NaN differs from everything (itself included).  Integer,
+/// float and double arrays are compared a vector at a time.
 template<typename T>
 bool ArraysAreDifferent(const T* const buffer_a, const T* const buffer_b,
                         std::size_t num_elements,
                         std::size_t* diff_index = nullptr);
 
+/// Return the number of indices i where buffer_a[i] != buffer_b[i], comparing
+/// as ArraysAreDifferent(...) does.
+template<typename T>
+std::size_t CountDifferences(const T* const buffer_a, const T* const buffer_b,
+                             std::size_t num_elements);
+
+/// Errors between two arrays, as returned by MeasureErrors(...).
+struct ErrorStats {
+  std::size_t num_over;          // Elements whose error exceeds the tolerance.
+  double sum_error;              // Sum of the errors of all elements.
+  double max_error;              // Largest error, and the index of the first
+  std::size_t max_error_index;   // element with it (0 if max_error is 0).
+};
+
+/// Measure the error |a[i] - b[i]| of every element of two arrays, counting
+/// the elements whose error exceeds max(absolute, relative * max(|a[i]|,
+/// |b[i]|)).  Equal values (infinities included) and pairs of NaNs have no
+/// error; a NaN or infinity against anything else has an infinite error, which
+/// always exceeds the tolerance.
+///
+/// float and double arrays are measured a vector at a time, as are uint8_t and
+/// uint16_t arrays (in float, which is exact for them).  Other types are
+/// measured one element at a time, in double.
+template<typename T>
+ErrorStats MeasureErrors(const T* const buffer_a, const T* const buffer_b,
+                         std::size_t num_elements, double absolute,
+                         double relative);
+
 
 // TODO(cbraley): Rename to memfill and make similar to memset?
 
@@ -37,6 +85,8 @@ bool ArraysAreDifferent(const T* const buffer_a, const T* const buffer_b,
 template<typename T>
 void SetMemory(T* ptr, const T& value, std::size_t num);
 
+/// Fill buffer with copies of pattern.  Single byte patterns use memset; for
+/// longer ones the strategy comes from the MemFillDispatchTable (see below).
 void* MemFill(void* buffer, std::size_t buffer_size_bytes,
               const void* pattern, std::size_t pattern_size_bytes);
 
@@ -46,12 +96,241 @@ void* MemFillSimple(void* buffer, std::size_t buffer_size_bytes,
 void* MemFillChunks(void* buffer, std::size_t buffer_size_bytes,
                     const void* pattern, std::size_t pattern_size_bytes);
 
+/// Fill buffers with copies of a multi-byte pattern using vector stores.
+///
+/// The constructor lays the pattern out repeatedly over a block whose size is
+/// the least common multiple of the pattern size and the vector width, so
+/// that the block is a whole number of vector registers.  Fill(...) aligns the
+/// destination with a short scalar head, loads the block (rotated to match
+/// the head) into registers once, and then streams them out with aligned
+/// stores.  Each call to Fill(...) starts at the beginning of the pattern, so
+/// one filler can be reused for every row of a strided image or window.
+///
+/// Patterns whose block would exceed MAX_BLOCK_BYTES (those longer than
+/// MAX_BLOCK_BYTES / MAX_VECTOR_BYTES bytes, roughly) fall back to
+/// MemFillChunks(...), which is already efficient for long patterns.
+class PatternFiller {
+ public:
+  static const constexpr std::size_t MAX_VECTOR_BYTES = 32;
+  static const constexpr std::size_t MAX_BLOCK_BYTES = 2048;
+
+  PatternFiller(const void* pattern, std::size_t pattern_size_bytes);
+
+  void Fill(void* buffer, std::size_t buffer_size_bytes) const;
+
+  /// As Fill(...), but with non-temporal stores that bypass the cache (where
+  /// the target has them), followed by a store fence.  Only worthwhile for
+  /// buffers much larger than the last level cache.
+  void FillNonTemporal(void* buffer, std::size_t buffer_size_bytes) const;
+
+ private:
+  const void* pattern_;
+  std::size_t pattern_size_bytes_;
+  // Bytes of the block that form whole pattern copies; 0 when the block is
+  // not used.
+  std::size_t block_size_bytes_;
+  // The pattern repeated over block_size_bytes_ + one more vector, so that
+  // any rotation of the block can be loaded with unaligned loads.
+  alignas(MAX_VECTOR_BYTES)
+      uint8_t block_[MAX_BLOCK_BYTES + MAX_VECTOR_BYTES];
+};
+
+/// Equivalent to MemFill(...), but faster for patterns of a few bytes (such as
+/// 3 byte RGB pixels) since it uses a PatternFiller.
+void* MemFillPattern(void* buffer, std::size_t buffer_size_bytes,
+                     const void* pattern, std::size_t pattern_size_bytes);
+
+/// As MemFillPattern(...), but using PatternFiller::FillNonTemporal(...).
+void* MemFillPatternNonTemporal(void* buffer, std::size_t buffer_size_bytes,
+                                const void* pattern,
+                                std::size_t pattern_size_bytes);
+
+/// Fill num_rows rows of row_size_bytes each, with row_stride_bytes between
+/// the start of consecutive rows, each row starting with the start of the
+/// pattern.  The bytes between rows are not touched.
+void* MemFillPatternRows(void* buffer, std::size_t row_size_bytes,
+                         std::size_t num_rows, std::size_t row_stride_bytes,
+                         const void* pattern, std::size_t pattern_size_bytes);
+
+
+/// How large writes (image fills and copies) should treat the cache.
+enum CacheHint {
+  CACHE_HINT_AUTO,          // Non-temporal if the destination is at least
+                            // NonTemporalThresholdBytes().
+  CACHE_HINT_CACHED,        // Always use ordinary stores.
+  CACHE_HINT_NON_TEMPORAL   // Always use non-temporal stores.
+};
+
+/// Destinations at least this large are written with non-temporal stores
+/// under CACHE_HINT_AUTO, since they would evict the whole cache (and pay for
+/// reading every destination line in first) with ordinary stores.  Defaults
+/// to the last level cache size reported by the OS, or 8MB if it reports
+/// none.
+std::size_t NonTemporalThresholdBytes();
+void SetNonTemporalThresholdBytes(std::size_t threshold_bytes);
+
+/// Return true if writing destination_size_bytes with the given hint should
+/// use non-temporal stores.
+bool UseNonTemporalStores(std::size_t destination_size_bytes, CacheHint hint);
+
+/// memcpy(...) for non-overlapping buffers, but with non-temporal stores
+/// (where the target has them) followed by a store fence.
+void* CopyNonTemporal(void* dst, const void* src, std::size_t num_bytes);
+
+/// SetMemory(...) with non-temporal stores, via PatternFiller.
+template<typename T>
+void SetMemoryNonTemporal(T* ptr, const T& value, std::size_t num);
+
+
+/// The ways MemFill(...) can fill a buffer with a multi-byte pattern.
+enum MemFillStrategy {
+  MEM_FILL_SIMPLE,        // MemFillSimple(...)
+  MEM_FILL_CHUNKS,        // MemFillChunks(...)
+  MEM_FILL_VECTOR,        // MemFillPattern(...)
+  MEM_FILL_NON_TEMPORAL,  // MemFillPatternNonTemporal(...)
+  NUM_MEM_FILL_STRATEGIES
+};
+
+/// Short name of the strategy ("simple", "chunks", "vector" or
+/// "non_temporal"), as used in saved profiles and benchmark labels.
+const char* MemFillStrategyName(MemFillStrategy strategy);
+
+/// The MemFill(...) strategy to use for each combination of buffer size and
+/// pattern size, each rounded up to one of a few buckets.  Buffer buckets
+/// grow by 8x from 64 bytes up to 16MB (plus one for anything larger), and
+/// pattern buckets are 2, 4, 8, 16 and 64 bytes (plus one for anything
+/// larger).
+///
+/// A default constructed table holds fixed rules of thumb.  Calibrate()
+/// times every strategy on this machine instead, and the result can be saved
+/// with Serialize() (or Save(...)) and restored with Parse(...) (or
+/// Load(...)) to skip calibrating on later runs.  A profile is text with one
+/// "<buffer bucket limit> <pattern bucket limit> <strategy name>" line per
+/// cell, where the last bucket of each kind has the limit "max".
+class MemFillDispatchTable {
+ public:
+  static const constexpr int NUM_BUFFER_BUCKETS = 8;
+  static const constexpr int NUM_PATTERN_BUCKETS = 6;
+
+  MemFillDispatchTable();
+
+  /// The largest size in each bucket; SIZE_MAX for the last one.
+  static std::size_t BufferBucketLimit(int bucket);
+  static std::size_t PatternBucketLimit(int bucket);
+  /// The bucket that a size falls into.
+  static int BufferBucket(std::size_t buffer_size_bytes);
+  static int PatternBucket(std::size_t pattern_size_bytes);
+
+  MemFillStrategy Lookup(std::size_t buffer_size_bytes,
+                         std::size_t pattern_size_bytes) const {
+    return Get(BufferBucket(buffer_size_bytes),
+               PatternBucket(pattern_size_bytes));
+  }
+  MemFillStrategy Get(int buffer_bucket, int pattern_bucket) const;
+  void Set(int buffer_bucket, int pattern_bucket, MemFillStrategy strategy);
+
+  std::string Serialize() const;
+  /// Replace the table with a serialized one.  Returns false (leaving the
+  /// table unchanged) if profile is malformed or doesn't cover every cell.
+  bool Parse(const std::string& profile);
+  bool Save(const std::string& path) const;
+  bool Load(const std::string& path);
+
+  /// Time every strategy for each cell and build a table from the fastest.
+  /// Takes a fraction of a second, mostly in the largest buffer bucket.
+  static MemFillDispatchTable Calibrate();
+
+ private:
+  uint8_t strategies_[NUM_BUFFER_BUCKETS][NUM_PATTERN_BUCKETS];
+};
+
+/// The table that MemFill(...) uses.  Until CalibrateMemFill() or
+/// SetMemFillDispatchTable(...) is called, this is the profile named by the
+/// JR_MEMFILL_PROFILE environment variable if that is set and valid (loaded
+/// on first use), and the default table otherwise.  MemFill(...) itself never
+/// calibrates.
+MemFillDispatchTable GetMemFillDispatchTable();
+
+/// Override the table that MemFill(...) uses.
+void SetMemFillDispatchTable(const MemFillDispatchTable& table);
+
+/// Calibrate a table for this machine (see MemFillDispatchTable::Calibrate())
+/// and install it for MemFill(...).  Meant to be called once at startup,
+/// since it takes a fraction of a second; Save(...) the returned table and
+/// point JR_MEMFILL_PROFILE at it to skip this on later runs.
+MemFillDispatchTable CalibrateMemFill();
+
+
+/// Split num_pixels interleaved pixels (num_channels values each) starting at
+/// src into num_channels separate planes.  Channel c of pixel i is written to
+/// dst[c * dst_plane_stride + i].
+template<typename T>
+void Deinterleave(const T* src, std::size_t num_pixels, int num_channels,
+                  T* dst, std::size_t dst_plane_stride);
+
+/// The inverse of Deinterleave(...).  Gather num_pixels values from each of
+/// num_channels planes (plane c starts at src + c * src_plane_stride) and write
+/// them out as interleaved pixels starting at dst.
+template<typename T>
+void Interleave(const T* src, std::size_t src_plane_stride,
+                std::size_t num_pixels, int num_channels, T* dst);
+
+
+/// Return true if every byte of value is zero.  Unlike value == T(0), this is
+/// false for -0.0f.
+template<typename T>
+bool IsZeroBits(const T& value);
 
 /// Return true if the pointer is aligned to a byte_alignment boundary.
 template<typename T>
 bool IsPointerAligned(const T* const pointer, std::size_t byte_alignment);
 
 
+/// Size of a transparent huge page on x86-64 and most aarch64 kernels.
+const constexpr std::size_t HUGE_PAGE_BYTES = std::size_t(2) << 20;
+
+/// NUMA placement policies for HugePageMap(...).
+enum NumaPolicy {
+  NUMA_FIRST_TOUCH,  // OS default; each page lands on the node that first touches it.
+  NUMA_BIND,         // All pages are placed on a single node.
+  NUMA_INTERLEAVE    // Pages are spread round robin across all nodes.
+};
+
+/// Map num_bytes of zeroed anonymous memory aligned to HUGE_PAGE_BYTES, ask the
+/// kernel to back it with transparent huge pages, and apply the given NUMA
+/// policy (node is only used by NUMA_BIND).  Requests smaller than a huge page
+/// are only page aligned.  The THP and NUMA requests are hints: if the kernel
+/// does not support them the memory is still returned.  Returns nullptr on
+/// failure.  Memory must be released with HugePageUnmap(...), passing the same
+/// num_bytes.
+void* HugePageMap(std::size_t num_bytes, NumaPolicy policy, int node);
+void HugePageUnmap(void* ptr, std::size_t num_bytes);
+
+
+/// Allocate uninitialized memory for num_Ts objects of type T, aligned to a
+/// byte_alignment boundary (which must be 0 or a power of 2).  The memory must
+/// be released with AlignedDelete(...).  Throws std::bad_alloc on failure.
+///
+/// Where the C library provides posix_memalign (JR_HAVE_POSIX_MEMALIGN) the
+/// allocation is a single call to it, with no per-block bookkeeping of our own.
+/// Elsewhere this falls back to HeaderAlignedNew(...).
+template<typename T>
+T* AlignedNew(std::size_t num_Ts, std::size_t byte_alignment);
+
+template<typename T>
+void AlignedDelete(T* to_delete);
+
+/// Portable aligned allocation built on new[]: over-allocates by
+/// sizeof(AlignmentMetadata) + byte_alignment bytes and stores the address of
+/// the underlying block just before the returned pointer.  Memory must be
+/// released with HeaderAlignedDelete(...).
+template<typename T>
+T* HeaderAlignedNew(std::size_t num_Ts, std::size_t byte_alignment);
+
+template<typename T>
+void HeaderAlignedDelete(T* to_delete);
+
+
 struct AlignmentMetadata {
   // - base_mem_addr: the memory location of the base address that came directly
   //   from the new[] operator.
@@ -75,7 +354,7 @@ static_assert(std::is_standard_layout<AlignmentMetadata>::value,
               "they are used with reinterpret_cast.");
 
 template<typename T>
-T* AlignedNew(std::size_t num_Ts, std::size_t byte_alignment) {
+T* HeaderAlignedNew(std::size_t num_Ts, std::size_t byte_alignment) {
   // byte_alignment must be a power of 2 or 0.
   const bool byte_alignmnt_ok = ((byte_alignment & (byte_alignment - 1)) == 0);
   assert(byte_alignmnt_ok);
@@ -120,7 +399,7 @@ T* AlignedNew(std::size_t num_Ts, std::size_t byte_alignment) {
 }
 
 template<typename T>
-void AlignedDelete(T* to_delete) {
+void HeaderAlignedDelete(T* to_delete) {
   if (to_delete != nullptr) {
     //  const AlignmentMetadata& alignment_info =
     //      *(reinterpret_cast<const AlignmentMetadata* const>(to_delete) - 1);
@@ -129,34 +408,326 @@ void AlignedDelete(T* to_delete) {
   }
 }
 
+#if JR_HAVE_POSIX_MEMALIGN
+
+template<typename T>
+T* AlignedNew(std::size_t num_Ts, std::size_t byte_alignment) {
+  // byte_alignment must be a power of 2 or 0.
+  const bool byte_alignmnt_ok = ((byte_alignment & (byte_alignment - 1)) == 0);
+  assert(byte_alignmnt_ok);
+  if (!byte_alignmnt_ok) {
+    return nullptr;
+  }
+
+  // posix_memalign wants a multiple of sizeof(void*).  Unlike aligned_alloc it
+  // does not require the size to be a multiple of the alignment, so there is
+  // no rounding up of odd sized requests.  Zero byte requests still get a
+  // unique pointer, as they did from new[].
+  byte_alignment = std::max(byte_alignment, sizeof(void*));
+  const std::size_t num_bytes = std::max<std::size_t>(num_Ts * sizeof(T), 1);
+  void* buffer = nullptr;
+  if (posix_memalign(&buffer, byte_alignment, num_bytes) != 0) {
+    throw std::bad_alloc();
+  }
+  return static_cast<T*>(buffer);
+}
+
+template<typename T>
+void AlignedDelete(T* to_delete) {
+  free(const_cast<void*>(static_cast<const void*>(to_delete)));
+}
+
+#else  // JR_HAVE_POSIX_MEMALIGN
+
+template<typename T>
+T* AlignedNew(std::size_t num_Ts, std::size_t byte_alignment) {
+  return HeaderAlignedNew<T>(num_Ts, byte_alignment);
+}
+
+template<typename T>
+void AlignedDelete(T* to_delete) {
+  HeaderAlignedDelete(to_delete);
+}
+
+#endif  // JR_HAVE_POSIX_MEMALIGN
+
 
 // Implementation details only below this line. -------------------------------
 
 namespace implementation_details {
 template<std::size_t TYPE_SIZE_BYTES>
 void SetMem(uint8_t* ptr, const uint8_t* const value_to_set, std::size_t num);
+
+// Versions of Deinterleave(...) and Interleave(...) with the channel count
+// fixed at compile time.  The inner loops have a constant stride, which lets
+// the compiler unroll and vectorize them.
+template<typename T, int NUM_CHANNELS>
+inline void DeinterleaveFixed(const T* __restrict__ src, std::size_t num_pixels,
+                              T* __restrict__ dst, std::size_t dst_plane_stride) {
+  for (int c = 0; c < NUM_CHANNELS; ++c) {
+    T* __restrict__ plane = dst + c * dst_plane_stride;
+    for (std::size_t i = 0; i < num_pixels; ++i) {
+      plane[i] = src[i * NUM_CHANNELS + c];
+    }
+  }
+}
+
+template<typename T, int NUM_CHANNELS>
+inline void InterleaveFixed(const T* __restrict__ src,
+                            std::size_t src_plane_stride,
+                            std::size_t num_pixels, T* __restrict__ dst) {
+  for (int c = 0; c < NUM_CHANNELS; ++c) {
+    const T* __restrict__ plane = src + c * src_plane_stride;
+    for (std::size_t i = 0; i < num_pixels; ++i) {
+      dst[i * NUM_CHANNELS + c] = plane[i];
+    }
+  }
+}
+}  // namespace implementation_details
+
+template<typename T>
+inline void Deinterleave(const T* src, std::size_t num_pixels, int num_channels,
+                         T* dst, std::size_t dst_plane_stride) {
+  using implementation_details::DeinterleaveFixed;
+  switch (num_channels) {
+    case 1: DeinterleaveFixed<T, 1>(src, num_pixels, dst, dst_plane_stride); return;
+    case 2: DeinterleaveFixed<T, 2>(src, num_pixels, dst, dst_plane_stride); return;
+    case 3: DeinterleaveFixed<T, 3>(src, num_pixels, dst, dst_plane_stride); return;
+    case 4: DeinterleaveFixed<T, 4>(src, num_pixels, dst, dst_plane_stride); return;
+    default: break;
+  }
+  for (int c = 0; c < num_channels; ++c) {
+    T* plane = dst + c * dst_plane_stride;
+    for (std::size_t i = 0; i < num_pixels; ++i) {
+      plane[i] = src[i * num_channels + c];
+    }
+  }
+}
+
+template<typename T>
+inline void Interleave(const T* src, std::size_t src_plane_stride,
+                       std::size_t num_pixels, int num_channels, T* dst) {
+  using implementation_details::InterleaveFixed;
+  switch (num_channels) {
+    case 1: InterleaveFixed<T, 1>(src, src_plane_stride, num_pixels, dst); return;
+    case 2: InterleaveFixed<T, 2>(src, src_plane_stride, num_pixels, dst); return;
+    case 3: InterleaveFixed<T, 3>(src, src_plane_stride, num_pixels, dst); return;
+    case 4: InterleaveFixed<T, 4>(src, src_plane_stride, num_pixels, dst); return;
+    default: break;
+  }
+  for (int c = 0; c < num_channels; ++c) {
+    const T* plane = src + c * src_plane_stride;
+    for (std::size_t i = 0; i < num_pixels; ++i) {
+      dst[i * num_channels + c] = plane[i];
+    }
+  }
+}
+
+namespace implementation_details {
+
+// Vectorized comparison kernels.  Each returns the index of the first element
+// that differs (num_elements if none do), or the number that differ.
+//
+// The "bits" kernels compare elements of element_size (1, 2, 4 or 8) bytes
+// bitwise, which is what operator!= does for integers.
+std::size_t FindFirstDifferentBits(const void* buffer_a, const void* buffer_b,
+                                   std::size_t num_elements,
+                                   std::size_t element_size);
+std::size_t CountDifferentBits(const void* buffer_a, const void* buffer_b,
+                               std::size_t num_elements,
+                               std::size_t element_size);
+// Floating point kernels, with the semantics of operator!=.
+std::size_t FindFirstDifferent(const float* buffer_a, const float* buffer_b,
+                               std::size_t num_elements);
+std::size_t FindFirstDifferent(const double* buffer_a, const double* buffer_b,
+                               std::size_t num_elements);
+std::size_t CountDifferent(const float* buffer_a, const float* buffer_b,
+                           std::size_t num_elements);
+std::size_t CountDifferent(const double* buffer_a, const double* buffer_b,
+                           std::size_t num_elements);
+
+// How ArraysAreDifferent(...) compares arrays of T.
+enum ArrayComparisonKind {
+  COMPARE_BITS,      // Integers (and enums): bitwise.
+  COMPARE_FLOATING,  // float and double: vector compares.
+  COMPARE_GENERIC    // Anything else: operator!=, one element at a time.
+};
+
+template<typename T>
+struct ArrayComparison
+    : std::integral_constant<
+          ArrayComparisonKind,
+          std::is_same<T, float>::value || std::is_same<T, double>::value
+              ? COMPARE_FLOATING
+              : (std::is_integral<T>::value || std::is_enum<T>::value) &&
+                        (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 ||
+                         sizeof(T) == 8)
+                    ? COMPARE_BITS
+                    : COMPARE_GENERIC> {};
+
+template<typename T>
+inline std::size_t FindFirstDifference(
+    const T* buffer_a, const T* buffer_b, std::size_t num_elements,
+    std::integral_constant<ArrayComparisonKind, COMPARE_BITS>) {
+  return FindFirstDifferentBits(buffer_a, buffer_b, num_elements, sizeof(T));
+}
+template<typename T>
+inline std::size_t FindFirstDifference(
+    const T* buffer_a, const T* buffer_b, std::size_t num_elements,
+    std::integral_constant<ArrayComparisonKind, COMPARE_FLOATING>) {
+  return FindFirstDifferent(buffer_a, buffer_b, num_elements);
+}
+template<typename T>
+inline std::size_t FindFirstDifference(
+    const T* buffer_a, const T* buffer_b, std::size_t num_elements,
+    std::integral_constant<ArrayComparisonKind, COMPARE_GENERIC>) {
+  std::size_t i = 0;
+  while (i < num_elements && !(buffer_a[i] != buffer_b[i])) {
+    ++i;
+  }
+  return i;
+}
+
+template<typename T>
+inline std::size_t CountDifferences(
+    const T* buffer_a, const T* buffer_b, std::size_t num_elements,
+    std::integral_constant<ArrayComparisonKind, COMPARE_BITS>) {
+  return CountDifferentBits(buffer_a, buffer_b, num_elements, sizeof(T));
+}
+template<typename T>
+inline std::size_t CountDifferences(
+    const T* buffer_a, const T* buffer_b, std::size_t num_elements,
+    std::integral_constant<ArrayComparisonKind, COMPARE_FLOATING>) {
+  return CountDifferent(buffer_a, buffer_b, num_elements);
+}
+template<typename T>
+inline std::size_t CountDifferences(
+    const T* buffer_a, const T* buffer_b, std::size_t num_elements,
+    std::integral_constant<ArrayComparisonKind, COMPARE_GENERIC>) {
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < num_elements; ++i) {
+    count += buffer_a[i] != buffer_b[i];
+  }
+  return count;
+}
+
+// Vectorized MeasureErrors(...) kernels.
+ErrorStats MeasureErrorsKernel(const float* buffer_a, const float* buffer_b,
+                               std::size_t num_elements, double absolute,
+                               double relative);
+ErrorStats MeasureErrorsKernel(const double* buffer_a, const double* buffer_b,
+                               std::size_t num_elements, double absolute,
+                               double relative);
+ErrorStats MeasureErrorsKernel(const uint8_t* buffer_a, const uint8_t* buffer_b,
+                               std::size_t num_elements, double absolute,
+                               double relative);
+ErrorStats MeasureErrorsKernel(const uint16_t* buffer_a,
+                               const uint16_t* buffer_b,
+                               std::size_t num_elements, double absolute,
+                               double relative);
+
+template<typename T>
+struct HasErrorKernel
+    : std::integral_constant<bool, std::is_same<T, float>::value ||
+                                   std::is_same<T, double>::value ||
+                                   std::is_same<T, uint8_t>::value ||
+                                   std::is_same<T, uint16_t>::value> {};
+
+// The error of one pair of values, and whether it exceeds the tolerance, as
+// defined by MeasureErrors(...).  The kernels use these for their scalar
+// tails, computing in the same ErrorT as their vectors, so both agree.
+template<typename ErrorT>
+inline ErrorT ValueError(ErrorT a, ErrorT b) {
+  if (a == b) {
+    return 0;
+  } else if (std::isnan(a) || std::isnan(b)) {
+    return std::isnan(a) && std::isnan(b)
+               ? 0 : std::numeric_limits<ErrorT>::infinity();
+  }
+  return std::fabs(a - b);
+}
+
+template<typename ErrorT>
+inline bool ErrorExceeds(ErrorT error, ErrorT a, ErrorT b, ErrorT absolute,
+                         ErrorT relative) {
+  return error > std::max(absolute,
+                          relative * std::max(std::fabs(a), std::fabs(b))) ||
+         error == std::numeric_limits<ErrorT>::infinity();
+}
+
+template<typename T>
+inline ErrorStats MeasureErrors(const T* buffer_a, const T* buffer_b,
+                                std::size_t num_elements, double absolute,
+                                double relative, std::true_type) {
+  return MeasureErrorsKernel(buffer_a, buffer_b, num_elements, absolute,
+                             relative);
+}
+template<typename T>
+inline ErrorStats MeasureErrors(const T* buffer_a, const T* buffer_b,
+                                std::size_t num_elements, double absolute,
+                                double relative, std::false_type) {
+  ErrorStats stats = {0, 0.0, 0.0, 0};
+  for (std::size_t i = 0; i < num_elements; ++i) {
+    const double a = static_cast<double>(buffer_a[i]);
+    const double b = static_cast<double>(buffer_b[i]);
+    const double error = ValueError(a, b);
+    stats.num_over += ErrorExceeds(error, a, b, absolute, relative);
+    stats.sum_error += error;
+    if (error > stats.max_error) {
+      stats.max_error = error;
+      stats.max_error_index = i;
+    }
+  }
+  return stats;
+}
+
 }  // namespace implementation_details
 
 template<typename T>
 inline bool ArraysAreDifferent(const T* const buffer_a, const T* const buffer_b,
                         std::size_t num_elements, std::size_t* diff_index) {
+  typedef implementation_details::ArrayComparison<T> KindT;
   // If the caller does not care about the location of the first difference,
-  // then we can just call memcmp.
-  if (diff_index == nullptr) {
+  // and bitwise equality is equality, then we can just call memcmp.
+  if (diff_index == nullptr &&
+      KindT::value == implementation_details::COMPARE_BITS) {
     return memcmp(static_cast<const void*>(buffer_a),
                   static_cast<const void*>(buffer_b),
                   num_elements * sizeof(T)) != 0;
   }
 
-  for (std::size_t i = 0; i < num_elements; ++i) {
-    if (buffer_a[i] != buffer_b[i]) {
-      if (diff_index != nullptr) {
-        *diff_index = i;
-      }
-      return true;
-    }
+  const std::size_t index = implementation_details::FindFirstDifference(
+      buffer_a, buffer_b, num_elements,
+      std::integral_constant<implementation_details::ArrayComparisonKind,
+                             KindT::value>());
+  if (index == num_elements) {
+    return false;
   }
-  return false;
+  if (diff_index != nullptr) {
+    *diff_index = index;
+  }
+  return true;
+}
+
+template<typename T>
+inline std::size_t CountDifferences(const T* const buffer_a,
+                                    const T* const buffer_b,
+                                    std::size_t num_elements) {
+  typedef implementation_details::ArrayComparison<T> KindT;
+  return implementation_details::CountDifferences(
+      buffer_a, buffer_b, num_elements,
+      std::integral_constant<implementation_details::ArrayComparisonKind,
+                             KindT::value>());
+}
+
+template<typename T>
+inline ErrorStats MeasureErrors(const T* const buffer_a,
+                                const T* const buffer_b,
+                                std::size_t num_elements, double absolute,
+                                double relative) {
+  return implementation_details::MeasureErrors(
+      buffer_a, buffer_b, num_elements, absolute, relative,
+      implementation_details::HasErrorKernel<T>());
 }
 
 template<typename T>
@@ -171,6 +742,22 @@ inline void SetMemory(T* ptr, const T& value, std::size_t num) {
   // TODO(cbraley): Why is std::fill so fast!
 }
 
+template<typename T>
+inline void SetMemoryNonTemporal(T* ptr, const T& value, std::size_t num) {
+  PatternFiller(&value, sizeof(T)).FillNonTemporal(ptr, num * sizeof(T));
+}
+
+template<typename T>
+inline bool IsZeroBits(const T& value) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+  for (std::size_t i = 0; i < sizeof(T); ++i) {
+    if (bytes[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
 template<typename T>
 inline bool IsPointerAligned(const T* const pointer, std::size_t byte_alignment) {
   return byte_alignment == 0 ||
@@ -4,6 +4,7 @@
 
 #include "gtest/gtest.h"
 
+#include "jrimage.h"
 #include "jrimage_allocators.h"
 #include  "mem_utils.h"
 
@@ -34,4 +35,185 @@ TEST(Allocators, AlignedAlloc) {
   }
 }
 
+
+TEST(Allocators, HugePageAlloc) {
+  const jr::mem_utils::NumaPolicy policies[] = {
+      jr::mem_utils::NUMA_FIRST_TOUCH, jr::mem_utils::NUMA_BIND,
+      jr::mem_utils::NUMA_INTERLEAVE};
+  for (jr::mem_utils::NumaPolicy policy : policies) {
+    jr::HugePageAllocator<float> allocator(policy, 0);
+
+    // Small allocations are page aligned and usable.
+    std::vector<float, jr::HugePageAllocator<float>> small(100, 1.0f, allocator);
+    EXPECT_TRUE(jr::mem_utils::IsPointerAligned(small.data(), 4096));
+    EXPECT_EQ(1.0f, small[99]);
+
+    // Large allocations are huge page aligned, and come back zeroed.
+    const std::size_t numel = 3 * jr::mem_utils::HUGE_PAGE_BYTES / sizeof(float) + 5;
+    float* big = allocator.allocate(numel);
+    EXPECT_TRUE(jr::mem_utils::IsPointerAligned(big, jr::mem_utils::HUGE_PAGE_BYTES));
+    EXPECT_EQ(0.0f, big[numel - 1]);
+    big[0] = big[numel - 1] = 2.0f;
+    allocator.deallocate(big, numel);
+  }
+
+  // Rebinding keeps the policy.
+  jr::HugePageAllocator<double> rebound(
+      jr::HugePageAllocator<float>(jr::mem_utils::NUMA_BIND, 1));
+  EXPECT_EQ(jr::mem_utils::NUMA_BIND, rebound.Policy());
+  EXPECT_EQ(1, rebound.Node());
+}
+
+TEST(Allocators, HugePageImageParallelFirstTouch) {
+  typedef jr::ImageBuf<float, 3, jr::HugePageAllocator<float>> ImageT;
+  ImageT image(1000, 700);
+  image.SetAll(5.0f);
+  jr::ParallelFirstTouch(image, 4);
+  EXPECT_EQ(0.0f, image.Get(999, 699, 2));
+  EXPECT_EQ(0.0f, image.Get(0, 0, 0));
+  EXPECT_EQ(0.0f, image.Get(500, 349, 1));
+
+  jr::PlanarImageBuf<uint8_t, 2> planar(13, 5);
+  planar.SetAll(9);
+  jr::ParallelFirstTouch(planar, 8);  // More threads than rows.
+  EXPECT_EQ(0, planar.Get(12, 4, 1));
+  EXPECT_EQ(0, planar.Get(0, 2, 0));
+}
+
+
+TEST(Allocators, FrameArena) {
+  jr::FrameArena arena(1000);
+  EXPECT_EQ(1u, arena.NumHeapAllocations());
+  EXPECT_EQ(1000u, arena.Capacity());
+
+  void* a = arena.Allocate(10, 1);
+  void* b = arena.Allocate(100, 64);
+  EXPECT_TRUE(jr::mem_utils::IsPointerAligned(b, 64));
+  EXPECT_GE(static_cast<uint8_t*>(b), static_cast<uint8_t*>(a) + 10);
+  EXPECT_GE(arena.BytesUsed(), 110u);
+
+  // Overflowing adds a block, and Reset() coalesces the blocks so the same
+  // frame fits next time without touching the heap.
+  void* big = arena.Allocate(5000, 256);
+  EXPECT_TRUE(jr::mem_utils::IsPointerAligned(big, 256));
+  EXPECT_EQ(2u, arena.NumHeapAllocations());
+  arena.Reset();
+  EXPECT_EQ(0u, arena.BytesUsed());
+  EXPECT_EQ(3u, arena.NumHeapAllocations());
+  for (int frame = 0; frame < 10; ++frame) {
+    arena.Allocate(10, 1);
+    arena.Allocate(100, 64);
+    arena.Allocate(5000, 256);
+    arena.Reset();
+  }
+  EXPECT_EQ(3u, arena.NumHeapAllocations());
+}
+
+TEST(Allocators, ArenaBackedImages) {
+  typedef jr::ArenaAllocator<float> AllocatorT;
+  typedef jr::ImageBuf<float, 3, AllocatorT, 64> ImageT;
+  jr::FrameArena arena(4 << 20);
+  const AllocatorT allocator(&arena);
+
+  // The first frame overflows the arena; after that no frame allocates.
+  std::size_t heap_allocations_after_first_frame = 0;
+  for (int frame = 0; frame < 5; ++frame) {
+    ImageT a(640, 480, allocator);
+    ImageT b(allocator);
+    EXPECT_EQ(&arena, a.GetAllocator().Arena());
+    EXPECT_TRUE(jr::mem_utils::IsPointerAligned(a.GetRow(1), 64));
+    a.SetAll(static_cast<float>(frame));
+    EXPECT_TRUE(a.CopyInto(b));
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(&arena, b.GetAllocator().Arena());
+
+    // Windows inherit the allocator, so images allocated through them land in
+    // the arena too.
+    ImageT win;
+    EXPECT_EQ(nullptr, win.GetAllocator().Arena());
+    EXPECT_TRUE(a.GetWindow(10, 10, 20, 20, win));
+    EXPECT_EQ(&arena, win.GetAllocator().Arena());
+    win.Allocate(8, 8);
+    win.SetAll(1.0f);
+
+    // Moves carry the allocator along with the buffer.
+    ImageT moved(std::move(a));
+    EXPECT_EQ(&arena, moved.GetAllocator().Arena());
+    arena.Reset();
+    if (frame == 0) {
+      heap_allocations_after_first_frame = arena.NumHeapAllocations();
+    }
+  }
+  EXPECT_EQ(heap_allocations_after_first_frame, arena.NumHeapAllocations());
+
+  // Without an arena, the allocator falls back to the heap.
+  jr::ImageBuf<float, 3, AllocatorT> heap(4, 4);
+  heap.SetAll(2.0f);
+  EXPECT_EQ(2.0f, heap.Get(3, 3, 2));
+}
+
+TEST(Allocators, TrackingAllocatorStats) {
+  typedef jr::TrackingAllocator<float, jr::AlignedAllocator<float, 64>>
+      AllocatorT;
+  typedef jr::ImageBuf<float, 3, AllocatorT> ImageT;
+  jr::AllocationTracker tracker;
+  const AllocatorT pyramid("pyramid", &tracker);
+  const AllocatorT thumbs("thumbs", &tracker);
+  EXPECT_TRUE(pyramid == AllocatorT("pyramid", &tracker));
+  EXPECT_TRUE(pyramid != thumbs);
+
+  const std::size_t level_bytes = 64 * 32 * 3 * sizeof(float);
+  {
+    ImageT level0(64, 32, pyramid);
+    ImageT level1(32, 16, pyramid);
+    ImageT thumb(8, 8, thumbs);
+    EXPECT_TRUE(jr::mem_utils::IsPointerAligned(level0.GetRow(0), 64));
+
+    // Windows share the parent's block and don't allocate.
+    ImageT win;
+    EXPECT_TRUE(level0.GetWindow(0, 0, 10, 10, win));
+
+    const std::vector<jr::AllocationStats> stats = tracker.Snapshot();
+    ASSERT_EQ(2u, stats.size());
+    EXPECT_EQ("pyramid", stats[0].tag);
+    EXPECT_EQ(level_bytes + level_bytes / 4, stats[0].live_bytes);
+    EXPECT_EQ(2u, stats[0].live_allocations);
+    EXPECT_EQ("thumbs", stats[1].tag);
+    EXPECT_EQ(8u * 8 * 3 * sizeof(float), stats[1].live_bytes);
+
+    // 24576 bytes lands in [2^14, 2^15), 6144 bytes in [2^12, 2^13).
+    ASSERT_EQ(static_cast<std::size_t>(jr::AllocationStats::NUM_SIZE_BUCKETS),
+              stats[0].size_histogram.size());
+    EXPECT_EQ(1u, stats[0].size_histogram[14]);
+    EXPECT_EQ(1u, stats[0].size_histogram[12]);
+  }
+
+  // Everything is freed, but the peak and totals remain.
+  const std::vector<jr::AllocationStats> stats = tracker.Snapshot();
+  EXPECT_EQ(0u, stats[0].live_bytes);
+  EXPECT_EQ(0u, stats[0].live_allocations);
+  EXPECT_EQ(level_bytes + level_bytes / 4, stats[0].peak_bytes);
+  EXPECT_EQ(2u, stats[0].total_allocations);
+  EXPECT_EQ(level_bytes + level_bytes / 4, stats[0].total_bytes);
+
+  // Rebinding keeps the tag.
+  std::vector<uint8_t, AllocatorT::rebind<uint8_t>::other> bytes(
+      100, 0, AllocatorT::rebind<uint8_t>::other(pyramid));
+  EXPECT_EQ(100u, tracker.Snapshot()[0].live_bytes);
+
+  // Default constructed allocators use the global tracker.
+  {
+    jr::ImageBuf<float, 1, jr::TrackingAllocator<float>> untagged(16, 16);
+    bool found = false;
+    for (const jr::AllocationStats& s :
+         jr::AllocationTracker::Global().Snapshot()) {
+      if (s.tag == "untagged") {
+        found = true;
+        EXPECT_LE(16u * 16 * sizeof(float), s.live_bytes);
+      }
+    }
+    EXPECT_TRUE(found);
+  }
+}
+
 }
@@ -0,0 +1,237 @@
+#include <string>
+#include <cstdint>
+#include <limits>
+
+#include "gtest/gtest.h"
+
+#include "jrimage.h"
+#include "jrimage_compare.h"
+#include "jrimage_cow.h"
+#include "jrimage_sparse.h"
+#include "jrimage_test_utils.h"
+#include "jrimage_tiled.h"
+
+namespace {
+
+using jr::test_utils::SampleFuncIntoImageBuf;
+
+float Pattern(int x, int y, int c) { return x * 0.5f + y * 4.0f + c; }
+
+
+TEST(JRImageCompare, ToleranceAndStatistics) {
+  jr::ImageBuf<float, 3> a(37, 21), b;
+  SampleFuncIntoImageBuf(Pattern, a);
+  ASSERT_TRUE(a.CopyInto(b));
+
+  jr::ImageDifference diff = jr::CompareImages(a, b);
+  EXPECT_TRUE(diff.dimensions_match);
+  EXPECT_TRUE(diff.within_tolerance);
+  EXPECT_TRUE(diff.complete);
+  EXPECT_EQ(37u * 21 * 3, diff.num_compared);
+  EXPECT_EQ(0u, diff.num_over);
+  EXPECT_EQ(0.0, diff.max_error);
+  EXPECT_EQ(-1, diff.max_error_x);
+  EXPECT_EQ(0.0, diff.mean_error);
+
+  b.Set(30, 7, 1, b.Get(30, 7, 1) + 0.25f);
+  b.Set(2, 19, 2, b.Get(2, 19, 2) - 0.5f);
+  b.Set(36, 20, 0, b.Get(36, 20, 0) + 0.125f);
+  diff = jr::CompareImages(a, b);
+  EXPECT_FALSE(diff.within_tolerance);
+  EXPECT_EQ(3u, diff.num_over);
+
+  // Full statistics, and the location of the largest error.
+  diff = jr::CompareImages(a, b, jr::ImageTolerance(0.2, 0.0, 0, false));
+  EXPECT_FALSE(diff.within_tolerance);
+  EXPECT_TRUE(diff.complete);
+  EXPECT_EQ(2u, diff.num_over);
+  EXPECT_EQ(0.5, diff.max_error);
+  EXPECT_EQ(2, diff.max_error_x);
+  EXPECT_EQ(19, diff.max_error_y);
+  EXPECT_EQ(2, diff.max_error_channel);
+  EXPECT_DOUBLE_EQ(0.875 / (37 * 21 * 3), diff.mean_error);
+
+  EXPECT_TRUE(jr::ImagesAreClose(a, b, jr::ImageTolerance(0.5)));
+  EXPECT_TRUE(jr::ImagesAreClose(a, b, jr::ImageTolerance(0.2, 0.0, 2)));
+  EXPECT_FALSE(jr::ImagesAreClose(a, b, jr::ImageTolerance(0.2, 0.0, 1)));
+  // Pattern(2, 19, 2) is 79, and 0.5 is within 1% of it.
+  EXPECT_TRUE(jr::ImagesAreClose(a, b, jr::ImageTolerance(0.25, 0.01)));
+
+  // Mismatched dimensions are never within tolerance.
+  jr::ImageBuf<float, 3> small(36, 21);
+  diff = jr::CompareImages(a, small, jr::ImageTolerance(1e9));
+  EXPECT_FALSE(diff.dimensions_match);
+  EXPECT_FALSE(diff.within_tolerance);
+}
+
+TEST(JRImageCompare, StopsEarly) {
+  jr::ImageBuf<float, 1> a(512, 512), b(512, 512);
+  a.SetAll(0.0f);
+  b.SetAll(0.0f);
+  b.Set(3, 1, 0, 1.0f);
+  b.Set(500, 500, 0, 2.0f);
+
+  // Reading stops once the images are known to differ.
+  jr::ImageDifference diff = jr::CompareImages(a, b);
+  EXPECT_FALSE(diff.within_tolerance);
+  EXPECT_FALSE(diff.complete);
+  EXPECT_LT(diff.num_compared, 512u * 512);
+  EXPECT_EQ(1u, diff.num_over);
+  EXPECT_EQ(3, diff.max_error_x);
+
+  // Unless more differences are allowed, or every value is wanted.
+  diff = jr::CompareImages(a, b, jr::ImageTolerance(0.0, 0.0, 2));
+  EXPECT_TRUE(diff.within_tolerance);
+  EXPECT_TRUE(diff.complete);
+  diff = jr::CompareImages(a, b, jr::ImageTolerance(0.0, 0.0, 0, false));
+  EXPECT_TRUE(diff.complete);
+  EXPECT_EQ(2u, diff.num_over);
+  EXPECT_EQ(2.0, diff.max_error);
+  EXPECT_EQ(500, diff.max_error_x);
+  EXPECT_EQ(500, diff.max_error_y);
+}
+
+TEST(JRImageCompare, NonFiniteValues) {
+  jr::ImageBuf<double, 1> a(9, 5), b(9, 5);
+  a.SetAll(1.0);
+  b.SetAll(1.0);
+  a.Set(4, 4, 0, std::numeric_limits<double>::quiet_NaN());
+  b.Set(4, 4, 0, std::numeric_limits<double>::quiet_NaN());
+  EXPECT_TRUE(jr::ImagesAreClose(a, b));
+  b.Set(8, 0, 0, std::numeric_limits<double>::infinity());
+  const jr::ImageDifference diff =
+      jr::CompareImages(a, b, jr::ImageTolerance(1e300, 1e300));
+  EXPECT_FALSE(diff.within_tolerance);
+  EXPECT_EQ(8, diff.max_error_x);
+  EXPECT_EQ(0, diff.max_error_y);
+}
+
+// Images with different layouts report the same errors at the same places.
+TEST(JRImageCompare, MixedLayoutsAndWindows) {
+  typedef jr::ImageBuf<uint16_t, 3> DenseT;
+  DenseT reference(70, 12);
+  for (int y = 0; y < reference.Height(); ++y) {
+    for (int x = 0; x < reference.Width(); ++x) {
+      for (int c = 0; c < 3; ++c) {
+        reference.Set(x, y, c, static_cast<uint16_t>(x * 7 + y * 300 + c));
+      }
+    }
+  }
+  jr::ImageBuf<uint16_t, 3, std::allocator<uint16_t>, 64> padded;
+  jr::ImageBuf<uint16_t, 3, std::allocator<uint16_t>, jr::PACKED_ROWS,
+               jr::PlanarLayout> planar;
+  jr::TiledImageBuf<uint16_t, 3, std::allocator<uint16_t>,
+                    jr::TiledLayout<16, 8>> tiled;
+  ASSERT_TRUE(reference.CopyInto(padded));
+  ASSERT_TRUE(reference.CopyInto(planar));
+  ASSERT_TRUE(reference.CopyInto(tiled));
+  decltype(planar) clean_planar;
+  decltype(tiled) clean_tiled;
+  ASSERT_TRUE(reference.CopyInto(clean_planar));
+  ASSERT_TRUE(reference.CopyInto(clean_tiled));
+  padded.Set(50, 9, 2, 0);
+  planar.Set(50, 9, 2, 0);
+  tiled.Set(50, 9, 2, 0);
+  const uint16_t expected_error = 50 * 7 + 9 * 300 + 2;
+
+  auto expect_one_error = [expected_error](const jr::ImageDifference& diff) {
+    EXPECT_TRUE(diff.complete);
+    EXPECT_EQ(70u * 12 * 3, diff.num_compared);
+    EXPECT_EQ(1u, diff.num_over);
+    EXPECT_EQ(expected_error, diff.max_error);
+    EXPECT_EQ(50, diff.max_error_x);
+    EXPECT_EQ(9, diff.max_error_y);
+    EXPECT_EQ(2, diff.max_error_channel);
+  };
+  const jr::ImageTolerance tolerance(0.0, 0.0, 1);
+  expect_one_error(jr::CompareImages(reference, padded, tolerance));
+  expect_one_error(jr::CompareImages(planar, reference, tolerance));
+  expect_one_error(jr::CompareImages(reference, tiled, tolerance));
+  expect_one_error(jr::CompareImages(tiled, clean_planar, tolerance));
+  expect_one_error(jr::CompareImages(clean_tiled, planar, tolerance));
+  expect_one_error(jr::CompareImages(padded, clean_tiled, tolerance));
+
+  // Windows are measured a row at a time, with locations relative to them.
+  DenseT window;
+  jr::ImageBuf<uint16_t, 3, std::allocator<uint16_t>, 64> padded_window;
+  ASSERT_TRUE(reference.GetWindow(40, 5, 20, 7, window));
+  ASSERT_TRUE(padded.GetWindow(40, 5, 20, 7, padded_window));
+  const jr::ImageDifference diff =
+      jr::CompareImages(window, padded_window, tolerance);
+  EXPECT_EQ(1u, diff.num_over);
+  EXPECT_EQ(10, diff.max_error_x);
+  EXPECT_EQ(4, diff.max_error_y);
+  EXPECT_EQ(2, diff.max_error_channel);
+}
+
+TEST(JRImageCompare, UniformImages) {
+  typedef jr::CowImageBuf<uint8_t, 2> CowT;
+  CowT a(40, 30), b(40, 30);
+  a.SetAll(100);
+  b.SetAll(103);
+  jr::ImageDifference diff =
+      jr::CompareImages(a, b, jr::ImageTolerance(2.0, 0.0, 0, false));
+  EXPECT_EQ(40u * 30 * 2, diff.num_over);
+  EXPECT_EQ(3.0, diff.mean_error);
+  EXPECT_EQ(0, diff.max_error_x);
+  EXPECT_TRUE(jr::ImagesAreClose(a, b, jr::ImageTolerance(3.0)));
+  EXPECT_EQ(0, a.NumMaterializedBlocks());
+
+  // One uniform side is compared against the values of the other.
+  jr::ImageBuf<uint8_t, 2> dense(40, 30);
+  dense.SetAll(100);
+  dense.Set(39, 29, 1, 90);
+  diff = jr::CompareImages(dense, a, jr::ImageTolerance(5.0));
+  EXPECT_FALSE(diff.within_tolerance);
+  EXPECT_EQ(10.0, diff.max_error);
+  EXPECT_EQ(39, diff.max_error_x);
+  EXPECT_EQ(29, diff.max_error_y);
+  EXPECT_EQ(1, diff.max_error_channel);
+  EXPECT_EQ(0, a.NumMaterializedBlocks());
+}
+
+// Comparing only reads: absent sparse tiles aren't allocated, and shared
+// copy-on-write blocks aren't detached.
+TEST(JRImageCompare, DoesNotAllocateOrDetach) {
+  jr::SparseImageBuf<float, 1, std::allocator<float>, jr::TiledLayout<64, 64>>
+      sparse(1024, 1024);
+  sparse.SetAll(1.0f);
+  sparse.Set(70, 5, 0, 3.0f);
+  EXPECT_EQ(1u, sparse.NumOccupiedTiles());
+  jr::ImageBuf<float, 1> dense(1024, 1024);
+  dense.SetAll(1.0f);
+  dense.Set(70, 5, 0, 3.0f);
+  dense.Set(900, 1000, 0, 1.5f);
+
+  const jr::ImageTolerance all_values(0.0, 0.0, 0, false);
+  jr::ImageDifference diff = jr::CompareImages(sparse, dense, all_values);
+  EXPECT_EQ(1u, diff.num_over);
+  EXPECT_EQ(0.5, diff.max_error);
+  EXPECT_EQ(900, diff.max_error_x);
+  EXPECT_EQ(1000, diff.max_error_y);
+  diff = jr::CompareImages(dense, sparse, all_values);
+  EXPECT_EQ(1u, diff.num_over);
+  EXPECT_EQ(1u, sparse.NumOccupiedTiles());
+
+  typedef jr::CowImageBuf<float, 1, std::allocator<float>, 128> CowT;
+  CowT frame(1024, 1024);
+  ASSERT_TRUE(dense.CopyInto(frame));
+  CowT copy(frame);
+  EXPECT_EQ(8, copy.NumSharedBlocks());
+  diff = jr::CompareImages(copy, sparse, all_values);
+  EXPECT_EQ(1u, diff.num_over);
+  EXPECT_EQ(8, copy.NumSharedBlocks());
+  EXPECT_EQ(1u, sparse.NumOccupiedTiles());
+
+  // A uniform image is compared against the spans of the other one.
+  CowT uniform(1024, 1024);
+  uniform.SetAll(1.0f);
+  diff = jr::CompareImages(uniform, sparse, all_values);
+  EXPECT_EQ(1u, diff.num_over);
+  EXPECT_EQ(2.0, diff.max_error);
+  EXPECT_EQ(70, diff.max_error_x);
+  EXPECT_EQ(5, diff.max_error_y);
+  EXPECT_EQ(1u, sparse.NumOccupiedTiles());
+}
+
+}  // anonymous namespace
@@ -0,0 +1,250 @@
+#include <string>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "jrimage.h"
+#include "jrimage_compare.h"
+#include "jrimage_cow.h"
+#include "jrimage_test_utils.h"
+#include "jrimage_tiled.h"
+
+namespace {
+
+using jr::test_utils::SampleFuncIntoImageBuf;
+
+float Pattern(int x, int y, int c) { return x * 1000.0f + y * 10.0f + c; }
+
+TEST(JRImageCow, CopiesShareUntilWritten) {
+  typedef jr::CowImageBuf<float, 3> CowT;
+  CowT frame(20, 10);
+  SampleFuncIntoImageBuf(Pattern, frame);
+  EXPECT_EQ(1, frame.NumBlocks());
+  EXPECT_FALSE(frame.IsShared());
+
+  CowT reader(frame);
+  CowT writer;
+  writer = frame;
+  EXPECT_TRUE(frame.IsShared());
+  const CowT& const_reader = reader;
+  EXPECT_EQ(static_cast<const CowT&>(frame).GetRow(0), const_reader.GetRow(0));
+
+  // Reads don't detach.
+  EXPECT_EQ(Pattern(3, 4, 2), reader.Get(3, 4, 2));
+  EXPECT_EQ(frame, reader);
+  EXPECT_TRUE(reader.IsShared());
+
+  // The first write detaches only the writer.
+  writer.Set(3, 4, 2, -1.0f);
+  EXPECT_FALSE(writer.IsShared());
+  EXPECT_TRUE(reader.IsShared());
+  EXPECT_EQ(-1.0f, writer.Get(3, 4, 2));
+  EXPECT_EQ(Pattern(3, 4, 2), frame.Get(3, 4, 2));
+  EXPECT_EQ(Pattern(5, 5, 0), writer.Get(5, 5, 0));  // Contents were copied.
+
+  // SetAll on a shared image gets fresh memory.
+  reader.SetAll(7.0f);
+  EXPECT_EQ(7.0f, reader.Get(19, 9, 2));
+  EXPECT_EQ(Pattern(19, 9, 2), frame.Get(19, 9, 2));
+  EXPECT_FALSE(frame.IsShared());
+
+  // Moves transfer the blocks.
+  CowT moved(std::move(writer));
+  EXPECT_EQ(-1.0f, moved.Get(3, 4, 2));
+  EXPECT_EQ(0, writer.NumBlocks());
+}
+
+TEST(JRImageCow, PerBlockDetach) {
+  typedef jr::CowImageBuf<float, 1, std::allocator<float>, 8> CowT;
+  CowT frame(64, 30);
+  SampleFuncIntoImageBuf(Pattern, frame);
+  EXPECT_EQ(4, frame.NumBlocks());
+  EXPECT_FALSE(frame.IsMemoryContiguous());
+
+  CowT roi_consumer(frame);
+  EXPECT_EQ(4, roi_consumer.NumSharedBlocks());
+  // Touch rows 9 through 12; only the second block gets copied.
+  for (int y = 9; y <= 12; ++y) {
+    roi_consumer.GetRow(y)[5] = 0.0f;
+  }
+  EXPECT_EQ(3, roi_consumer.NumSharedBlocks());
+  EXPECT_EQ(3, frame.NumSharedBlocks());
+  EXPECT_EQ(0.0f, roi_consumer.Get(5, 10, 0));
+  EXPECT_EQ(Pattern(5, 10, 0), frame.Get(5, 10, 0));
+  EXPECT_EQ(frame.Get(6, 10, 0), roi_consumer.Get(6, 10, 0));
+
+  roi_consumer.Detach();
+  EXPECT_FALSE(roi_consumer.IsShared());
+
+  // Round trips through ImageBuf.
+  jr::ImageBuf<float, 1> plain;
+  EXPECT_TRUE(frame.CopyInto(plain));
+  EXPECT_EQ(frame, plain);
+  CowT from_plain;
+  EXPECT_TRUE(plain.CopyInto(from_plain));
+  EXPECT_EQ(plain, from_plain);
+  EXPECT_EQ(4, from_plain.NumBlocks());
+}
+
+TEST(JRImageCow, UniformBlocksAreLazy) {
+  typedef jr::CowImageBuf<float, 2, std::allocator<float>, 4> CowT;
+  CowT image(50, 20);
+  EXPECT_EQ(5, image.NumBlocks());
+  EXPECT_EQ(0, image.NumMaterializedBlocks());
+  EXPECT_TRUE(image.IsKnownZero());
+  EXPECT_EQ(0.0f, image.Get(49, 19, 1));
+
+  // Filling doesn't allocate.
+  image.SetAll(3.0f);
+  float value = 0.0f;
+  EXPECT_TRUE(image.IsUniform(&value));
+  EXPECT_EQ(3.0f, value);
+  EXPECT_FALSE(image.IsKnownZero());
+  EXPECT_EQ(3.0f, image.Get(10, 10, 0));
+  EXPECT_EQ(0, image.NumMaterializedBlocks());
+  const float gray[2] = {3.0f, 3.0f};
+  image.SetAllPixels(gray);  // Matching channels; still a lazy fill.
+  EXPECT_EQ(0, image.NumMaterializedBlocks());
+
+  // Uniform images compare and copy by value.
+  CowT other(50, 20);
+  EXPECT_FALSE(image == other);
+  other.SetAll(3.0f);
+  EXPECT_EQ(image, other);
+  jr::ImageBuf<float, 2> plain;
+  EXPECT_TRUE(image.CopyInto(plain));
+  EXPECT_EQ(3.0f, plain.Get(49, 19, 1));
+  EXPECT_EQ(image, plain);
+  EXPECT_EQ(0, image.NumMaterializedBlocks());
+
+  // Writing materializes only the block written to.
+  image.Set(7, 9, 1, -1.0f);
+  EXPECT_EQ(1, image.NumMaterializedBlocks());
+  EXPECT_FALSE(image.IsUniform(&value));
+  EXPECT_EQ(-1.0f, image.Get(7, 9, 1));
+  EXPECT_EQ(3.0f, image.Get(7, 9, 0));
+  EXPECT_EQ(3.0f, image.Get(0, 8, 0));
+  EXPECT_EQ(3.0f, image.Get(0, 19, 0));
+
+  // Const row pointers into other blocks point at a row of the fill value.
+  const CowT& const_image = image;
+  EXPECT_EQ(3.0f, const_image.GetRow(19)[99]);
+  EXPECT_EQ(-1.0f, const_image.GetRow(9)[15]);
+  EXPECT_EQ(1, image.NumMaterializedBlocks());
+  image.Set(0, 19, 0, 3.0f);
+  EXPECT_EQ(2, image.NumMaterializedBlocks());
+
+  // Copies of a partly materialized image share the materialized blocks.
+  CowT copy(image);
+  EXPECT_EQ(2, copy.NumSharedBlocks());
+  copy.SetAll(0.0f);
+  EXPECT_TRUE(copy.IsKnownZero());
+  EXPECT_EQ(0, copy.NumMaterializedBlocks());
+  EXPECT_EQ(0, image.NumSharedBlocks());
+  EXPECT_EQ(-1.0f, image.Get(7, 9, 1));
+
+  // Comparing or copying out of a non-uniform image reads every row, but
+  // doesn't materialize the blocks that were never written.
+  EXPECT_FALSE(image == other);
+  plain.Set(7, 9, 1, -1.0f);
+  EXPECT_EQ(image, plain);
+  EXPECT_EQ(plain, image);
+  EXPECT_TRUE(jr::ImagesAreClose(image, plain));
+  jr::ImageBuf<float, 2> copied;
+  EXPECT_TRUE(image.CopyInto(copied));
+  EXPECT_EQ(plain, copied);
+  jr::TiledImageBuf<float, 2, std::allocator<float>, jr::TiledLayout<16, 8>>
+      tiled;
+  EXPECT_TRUE(image.CopyInto(tiled));
+  EXPECT_EQ(image, tiled);
+  EXPECT_EQ(2, image.NumMaterializedBlocks());
+}
+
+// The same with a single block: an unmaterialized image isn't contiguous.
+TEST(JRImageCow, ReadingDoesNotMaterialize) {
+  typedef jr::CowImageBuf<uint8_t, 1, std::allocator<uint8_t>, 16> CowT;
+  CowT canvas(1000, 1000);
+  canvas.SetAll(0);
+  canvas.Set(500, 500, 0, 255);
+  EXPECT_EQ(1, canvas.NumMaterializedBlocks());
+  jr::ImageBuf<uint8_t, 1> expected(1000, 1000), copied;
+  expected.SetAll(0);
+  expected.Set(500, 500, 0, 255);
+  EXPECT_TRUE(canvas == expected);
+  EXPECT_TRUE(jr::CompareImages(canvas, expected).within_tolerance);
+  EXPECT_TRUE(canvas.CopyInto(copied));
+  EXPECT_EQ(expected, copied);
+  EXPECT_EQ(1, canvas.NumMaterializedBlocks());
+
+  jr::CowImageBuf<uint8_t, 1> whole(30, 20);
+  whole.SetAll(7);
+  const jr::CowImageBuf<uint8_t, 1>& const_whole = whole;
+  EXPECT_FALSE(whole.IsMemoryContiguous());
+  EXPECT_EQ(7, const_whole.GetRow(19)[29]);
+  EXPECT_EQ(0, whole.NumMaterializedBlocks());
+  whole.Set(0, 0, 0, 1);
+  EXPECT_TRUE(whole.IsMemoryContiguous());
+}
+
+// Tiled images are walked a span at a time, through the read-only span
+// accessor, so comparing against them or copying into them doesn't detach.
+TEST(JRImageCow, ReadingAgainstTiledKeepsSharing) {
+  typedef jr::CowImageBuf<float, 3, std::allocator<float>, 4> CowT;
+  CowT frame(37, 10);
+  SampleFuncIntoImageBuf(Pattern, frame);
+  CowT copy(frame);
+  EXPECT_EQ(3, copy.NumSharedBlocks());
+
+  jr::TiledImageBuf<float, 3, std::allocator<float>, jr::TiledLayout<16, 8>>
+      tiled;
+  ASSERT_TRUE(copy.CopyInto(tiled));
+  EXPECT_EQ(3, copy.NumSharedBlocks());
+  EXPECT_TRUE(copy == tiled);
+  EXPECT_TRUE(tiled == copy);
+  EXPECT_EQ(3, copy.NumSharedBlocks());
+  EXPECT_EQ(3, frame.NumSharedBlocks());
+
+  tiled.Set(36, 9, 2, -1.0f);
+  EXPECT_FALSE(copy == tiled);
+  EXPECT_EQ(3, copy.NumSharedBlocks());
+
+  // Copying into a shared image still detaches it.
+  ASSERT_TRUE(tiled.CopyInto(copy));
+  EXPECT_EQ(0, copy.NumSharedBlocks());
+  EXPECT_EQ(-1.0f, copy.Get(36, 9, 2));
+  EXPECT_EQ(Pattern(36, 9, 2), frame.Get(36, 9, 2));
+}
+
+TEST(JRImageCow, ConcurrentConsumers) {
+  typedef jr::CowImageBuf<float, 1, std::allocator<float>, 16> CowT;
+  CowT frame(128, 128);
+  frame.SetAll(1.0f);
+  frame.Detach();  // Materialize every block, so the consumers share them.
+  EXPECT_EQ(8, frame.NumMaterializedBlocks());
+
+  const int kNumConsumers = 8;
+  std::vector<CowT> outputs(kNumConsumers);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumConsumers; ++i) {
+    threads.push_back(std::thread([&frame, &outputs, i]() {
+      CowT mine(frame);
+      if (i % 2 == 0) {
+        mine.Set(i, i * 16, 0, static_cast<float>(i));
+      }
+      outputs[i] = mine;
+    }));
+  }
+  for (std::size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  for (int i = 0; i < kNumConsumers; ++i) {
+    EXPECT_EQ(i % 2 == 0 ? static_cast<float>(i) : 1.0f,
+              outputs[i].Get(i, i * 16, 0));
+    EXPECT_EQ(1.0f, outputs[i].Get(0, 127, 0));
+  }
+  EXPECT_EQ(1.0f, frame.Get(2, 32, 0));
+}
+
+}  // anonymous namespace
@@ -0,0 +1,111 @@
+#include <string>
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "jrimage.h"
+#include "jrimage_fixed.h"
+#include "jrimage_test_utils.h"
+#include "jrimage_tiled.h"
+
+namespace {
+
+using jr::test_utils::SampleFuncIntoImageBuf;
+
+float Pattern(int x, int y, int c) { return x * 1000.0f + y * 10.0f + c; }
+
+typedef jr::FixedImageBuf<float, 8, 4, 3> PatchT;
+
+TEST(JRImageFixed, BasicsAndCopies) {
+  PatchT patch;
+  EXPECT_EQ(8, patch.Width());
+  EXPECT_EQ(4, patch.Height());
+  EXPECT_EQ(3, patch.Channels());
+  EXPECT_TRUE(patch.IsMemoryContiguous());
+  EXPECT_EQ(8u * 4 * 3 * sizeof(float), patch.TotalByteCount());
+  EXPECT_TRUE(jr::mem_utils::IsPointerAligned(patch.GetRow(0), 32));
+  EXPECT_TRUE(PatchT::IsChannelCountStatic());
+
+  patch.SetAll(2.5f);
+  EXPECT_EQ(2.5f, patch.Get(7, 3, 2));
+  SampleFuncIntoImageBuf(Pattern, patch);
+  EXPECT_EQ(Pattern(5, 2, 1), patch.Get(5, 2, 1));
+
+  // Copies are deep.
+  PatchT copy(patch);
+  EXPECT_EQ(patch, copy);
+  copy.Set(0, 0, 0, -1.0f);
+  EXPECT_NE(patch, copy);
+  copy = patch;
+  EXPECT_EQ(patch, copy);
+
+  std::vector<PatchT> patches(3, patch);
+  EXPECT_EQ(patch, patches[2]);
+
+  // Only the matching size is a valid "resize".
+  EXPECT_TRUE(patch.Resize(8, 4, 3));
+  EXPECT_FALSE(patch.Resize(8, 5, 3));
+}
+
+TEST(JRImageFixed, InteropWithImageBuf) {
+  PatchT patch;
+  SampleFuncIntoImageBuf(Pattern, patch);
+
+  // Fixed -> heap image.
+  jr::ImageBuf<float, 3> heap;
+  EXPECT_TRUE(patch.CopyInto(heap));
+  EXPECT_EQ(patch, heap);
+  jr::PlanarImageBuf<float, 3> planar;
+  EXPECT_TRUE(patch.CopyInto(planar));
+  EXPECT_EQ(patch, planar);
+
+  // Heap image -> fixed, only if the size matches.
+  PatchT back;
+  EXPECT_TRUE(heap.CopyInto(back));
+  EXPECT_EQ(heap, back);
+  jr::ImageBuf<float, 3> wrong_size(8, 5);
+  EXPECT_FALSE(wrong_size.CopyInto(back));
+
+  // Windows are ImageBuf views of the patch's pixels.
+  jr::ImageBuf<float, 3> win;
+  EXPECT_TRUE(patch.GetWindow(2, 1, 3, 2, win));
+  EXPECT_EQ(3, win.Width());
+  EXPECT_EQ(Pattern(4, 2, 1), win.Get(2, 1, 1));
+  win.Set(0, 0, 0, -7.0f);
+  EXPECT_EQ(-7.0f, patch.Get(2, 1, 0));
+  EXPECT_FALSE(patch.GetWindow(6, 0, 3, 1, win));
+}
+
+template <typename ImageT>
+void PatchExtractionTest(ImageT& image) {
+  SampleFuncIntoImageBuf(Pattern, image);
+  PatchT patch;
+  ASSERT_TRUE(patch.CopyFrom(image, 13, 7));
+  for (int y = 0; y < PatchT::HEIGHT; ++y) {
+    for (int x = 0; x < PatchT::WIDTH; ++x) {
+      for (int c = 0; c < PatchT::CHANNELS; ++c) {
+        ASSERT_EQ(Pattern(x + 13, y + 7, c), patch.Get(x, y, c));
+      }
+    }
+  }
+  EXPECT_TRUE(patch.CopyFrom(image, image.Width() - 8, image.Height() - 4));
+  EXPECT_FALSE(patch.CopyFrom(image, image.Width() - 7, 0));
+  EXPECT_FALSE(patch.CopyFrom(image, -1, 0));
+}
+
+TEST(JRImageFixed, PatchExtraction) {
+  jr::ImageBuf<float, 3> interleaved(40, 30);
+  PatchExtractionTest(interleaved);
+  jr::PlanarImageBuf<float, 3> planar(40, 30);
+  PatchExtractionTest(planar);
+  jr::TiledImageBuf<float, 3, std::allocator<float>, jr::TiledLayout<16, 16>>
+      tiled(40, 30);
+  PatchExtractionTest(tiled);
+
+  jr::ImageBuf<float> four_channels(40, 30, 4);
+  PatchT patch;
+  EXPECT_FALSE(patch.CopyFrom(four_channels, 0, 0));
+}
+
+}  // anonymous namespace
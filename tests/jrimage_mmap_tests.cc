@@ -0,0 +1,106 @@
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "jrimage.h"
+#include "jrimage_mmap.h"
+
+namespace {
+
+std::string TempPath(const std::string& name) {
+  return "/tmp/jrimage_mmap_" + std::to_string(getpid()) + "_" + name;
+}
+
+TEST(JRImageMmap, CreateWriteSyncAndReopen) {
+  const std::string path = TempPath("rw.raw");
+  const int w = 37, h = 21;
+  {
+    std::shared_ptr<jr::MappedFile> file =
+        jr::MappedFile::Create(path, w * h * 2 * sizeof(float));
+    ASSERT_TRUE(file != nullptr);
+    EXPECT_TRUE(file->IsWritable());
+
+    jr::ImageBuf<float, 2> image;
+    ASSERT_TRUE(jr::MapImage(file, w, h, 2, image));
+    EXPECT_TRUE(image.IsShared());
+    EXPECT_EQ(0.0f, image.Get(w - 1, h - 1, 1));  // New files are zeroed.
+    for (int y = 0; y < h; ++y) {
+      for (int x = 0; x < w; ++x) {
+        image.Set(x, y, 0, static_cast<float>(x));
+        image.Set(x, y, 1, static_cast<float>(y));
+      }
+    }
+    EXPECT_TRUE(file->Advise(jr::ACCESS_SEQUENTIAL));
+    EXPECT_TRUE(file->Sync());
+
+    // Too large for the file.
+    jr::ImageBuf<float, 2> too_big;
+    EXPECT_FALSE(jr::MapImage(file, w, h + 1, 2, too_big));
+    EXPECT_FALSE(jr::MapImage(file, w, h, 2, too_big, jr::PACKED_ROWS, 4));
+  }
+
+  // The pixels are in the file, in plain row major order.
+  std::ifstream in(path.c_str(), std::ios::binary);
+  std::vector<float> raw(w * h * 2);
+  in.read(reinterpret_cast<char*>(raw.data()), raw.size() * sizeof(float));
+  EXPECT_TRUE(in.good());
+  EXPECT_EQ(5.0f, raw[(3 * w + 5) * 2]);
+  EXPECT_EQ(3.0f, raw[(3 * w + 5) * 2 + 1]);
+
+  std::remove(path.c_str());
+}
+
+TEST(JRImageMmap, ReadOnlyWithPitchAndOffset) {
+  const std::string path = TempPath("ro.raw");
+  const int w = 5, h = 4;
+  const std::size_t header = 16, pitch = 8;
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    std::vector<uint8_t> bytes(header + pitch * h, 0xEE);
+    for (int y = 0; y < h; ++y) {
+      for (int x = 0; x < w; ++x) {
+        bytes[header + y * pitch + x] = static_cast<uint8_t>(y * 10 + x);
+      }
+    }
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  }
+
+  jr::ImageBuf<uint8_t, 1> window;
+  {
+    std::shared_ptr<jr::MappedFile> file =
+        jr::MappedFile::Open(path, jr::READ_ONLY_MAPPING);
+    ASSERT_TRUE(file != nullptr);
+    EXPECT_FALSE(file->IsWritable());
+    EXPECT_TRUE(file->Advise(jr::ACCESS_WILL_NEED, header, pitch * h));
+
+    jr::ImageBuf<uint8_t, 1> image;
+    ASSERT_TRUE(jr::MapImage(file, w, h, 1, image, pitch, header));
+    EXPECT_EQ(34, image.Get(4, 3, 0));
+
+    jr::ImageBuf<uint8_t, 1> copy;
+    EXPECT_TRUE(image.CopyInto(copy));
+    EXPECT_EQ(image, copy);
+    EXPECT_TRUE(image.GetWin(1, 1, 3, 3, window));
+
+    // Wider types need an offset that keeps them aligned.
+    jr::ImageBuf<uint16_t, 1> wide;
+    EXPECT_TRUE(jr::MapImage(file, 2, h - 1, 1, wide, pitch, header));
+    EXPECT_FALSE(jr::MapImage(file, 2, h - 1, 1, wide, pitch, header + 1));
+    EXPECT_EQ(2, wide.Width());
+  }
+
+  // The window keeps the mapping alive after the file and image are gone.
+  EXPECT_EQ(33, window.Get(2, 2, 0));
+
+  EXPECT_TRUE(jr::MappedFile::Open(TempPath("missing.raw"),
+                                   jr::READ_ONLY_MAPPING) == nullptr);
+  std::remove(path.c_str());
+}
+
+}  // anonymous namespace
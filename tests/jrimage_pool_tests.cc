@@ -0,0 +1,107 @@
+#include <string>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "jrimage.h"
+#include "jrimage_pool.h"
+
+namespace {
+
+typedef jr::ImageBuf<float, 3> ImageT;
+typedef jr::ImagePool<ImageT> PoolT;
+
+const std::size_t BYTES_10x10 = 10 * 10 * 3 * sizeof(float);
+
+TEST(JRImagePool, RecyclesSameShape) {
+  PoolT pool(1 << 20);
+  const float* block = nullptr;
+  {
+    PoolT::Handle a = pool.Acquire(10, 10, 3);
+    EXPECT_TRUE(static_cast<bool>(a));
+    EXPECT_EQ(10, a->Width());
+    block = a->GetRow(0);
+    a->SetAll(1.0f);
+  }
+  PoolT::Stats stats = pool.GetStats();
+  EXPECT_EQ(0u, stats.hits);
+  EXPECT_EQ(1u, stats.misses);
+  EXPECT_EQ(1u, stats.idle_images);
+  EXPECT_EQ(BYTES_10x10, stats.idle_bytes);
+
+  // Same shape: recycled.  Different shape: allocated.
+  PoolT::Handle b = pool.Acquire(10, 10, 3);
+  EXPECT_EQ(block, b->GetRow(0));
+  PoolT::Handle c = pool.Acquire(10, 11, 3);
+  EXPECT_NE(block, c->GetRow(0));
+  stats = pool.GetStats();
+  EXPECT_EQ(1u, stats.hits);
+  EXPECT_EQ(2u, stats.misses);
+  EXPECT_EQ(0u, stats.idle_images);
+
+  // Handles are movable, and Release() returns early.
+  PoolT::Handle moved(std::move(b));
+  EXPECT_FALSE(static_cast<bool>(b));
+  moved.Release();
+  EXPECT_FALSE(static_cast<bool>(moved));
+  EXPECT_EQ(1u, pool.GetStats().idle_images);
+
+  // Clear drops idle images.
+  pool.Clear();
+  EXPECT_EQ(0u, pool.GetStats().idle_bytes);
+}
+
+TEST(JRImagePool, LruEvictionWithinBudget) {
+  PoolT pool(3 * BYTES_10x10);
+  {
+    std::vector<PoolT::Handle> handles;
+    for (int i = 0; i < 4; ++i) {
+      handles.push_back(pool.Acquire(10, 10, 3));
+    }
+    // Return them oldest first; the last one returned pushes the first out.
+    for (std::size_t i = 0; i < handles.size(); ++i) {
+      handles[i].Release();
+    }
+  }
+  PoolT::Stats stats = pool.GetStats();
+  EXPECT_EQ(1u, stats.evictions);
+  EXPECT_EQ(3u, stats.idle_images);
+  EXPECT_EQ(3 * BYTES_10x10, stats.idle_bytes);
+
+  // Images bigger than the whole budget are never kept.
+  pool.Acquire(100, 100, 3);
+  EXPECT_EQ(3u, pool.GetStats().idle_images);
+
+  // Shrinking the budget evicts.
+  pool.SetByteBudget(BYTES_10x10);
+  stats = pool.GetStats();
+  EXPECT_EQ(3u, stats.evictions);
+  EXPECT_EQ(1u, stats.idle_images);
+}
+
+TEST(JRImagePool, ConcurrentAcquireAndRelease) {
+  PoolT pool(64 << 20);
+  const int kNumThreads = 8;
+  const int kIterations = 200;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.push_back(std::thread([&pool, t]() {
+      for (int i = 0; i < kIterations; ++i) {
+        PoolT::Handle image = pool.Acquire(16 + (i % 3), 16, 3);
+        image->SetAll(static_cast<float>(t));
+        EXPECT_EQ(static_cast<float>(t), image->Get(15, 15, 2));
+      }
+    }));
+  }
+  for (std::size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  const PoolT::Stats stats = pool.GetStats();
+  EXPECT_EQ(static_cast<std::size_t>(kNumThreads * kIterations),
+            stats.hits + stats.misses);
+  EXPECT_LE(stats.misses, static_cast<std::size_t>(kNumThreads * 3));
+}
+
+}  // anonymous namespace
@@ -0,0 +1,176 @@
+#include <string>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "jrimage.h"
+#include "jrimage_allocators.h"
+#include "jrimage_ring.h"
+
+namespace {
+
+typedef jr::ImageBuf<uint32_t, 1> FrameT;
+
+// Stamp every pixel of frame with its sequence number.
+void WriteFrame(FrameT& frame, uint32_t sequence) { frame.SetAll(sequence); }
+
+bool FrameIsIntact(const FrameT& frame, uint32_t sequence) {
+  for (int y = 0; y < frame.Height(); ++y) {
+    for (int x = 0; x < frame.Width(); ++x) {
+      if (frame.Get(x, y, 0) != sequence) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+TEST(JRFrameRing, Backpressure) {
+  jr::FrameRing<FrameT> ring(3, 8, 4, 1);
+  EXPECT_EQ(3u, ring.NumSlots());
+  EXPECT_TRUE(ring.AcquireRead() == nullptr);
+
+  // Slots are preallocated with the requested shape.
+  std::vector<FrameT*> slots;
+  for (uint32_t i = 0; i < 3; ++i) {
+    FrameT* frame = ring.AcquireWrite();
+    ASSERT_TRUE(frame != nullptr);
+    EXPECT_EQ(8, frame->Width());
+    EXPECT_EQ(4, frame->Height());
+    WriteFrame(*frame, i);
+    ring.Publish();
+    slots.push_back(frame);
+  }
+  EXPECT_EQ(3u, ring.Size());
+  EXPECT_TRUE(ring.AcquireWrite() == nullptr);  // Full.
+
+  // Frames come out in order, and their slots are reused in order.
+  FrameT* frame = ring.AcquireRead();
+  ASSERT_TRUE(frame != nullptr);
+  EXPECT_EQ(slots[0], frame);
+  EXPECT_TRUE(FrameIsIntact(*frame, 0));
+  EXPECT_TRUE(ring.AcquireWrite() == nullptr);  // Still being read.
+  ring.Release();
+  EXPECT_EQ(slots[0], ring.AcquireWrite());
+  ring.Publish();
+
+  for (uint32_t i = 1; i < 3; ++i) {
+    frame = ring.AcquireRead();
+    ASSERT_TRUE(frame != nullptr);
+    EXPECT_TRUE(FrameIsIntact(*frame, i));
+    ring.Release();
+  }
+
+  const jr::FrameRing<FrameT>::Stats stats = ring.GetStats();
+  EXPECT_EQ(4u, stats.published);
+  EXPECT_EQ(3u, stats.consumed);
+  EXPECT_EQ(0u, stats.dropped);
+  EXPECT_EQ(2u, stats.rejected);
+  ASSERT_EQ(3u, stats.slots.size());
+  EXPECT_EQ(1u, stats.slots[0].frames);
+  EXPECT_EQ(1u, stats.slots[2].frames);
+  EXPECT_LE(stats.slots[0].max_latency_ns, stats.slots[0].total_latency_ns);
+}
+
+TEST(JRFrameRing, DropOldest) {
+  jr::FrameRing<FrameT> ring(2, 4, 4, 1, jr::RING_DROP_OLDEST);
+  for (uint32_t i = 0; i < 5; ++i) {
+    FrameT* frame = ring.AcquireWrite();
+    ASSERT_TRUE(frame != nullptr);
+    WriteFrame(*frame, i);
+    ring.Publish();
+  }
+  EXPECT_EQ(2u, ring.Size());
+
+  // Only the newest frames survive.
+  FrameT* frame = ring.AcquireRead();
+  ASSERT_TRUE(frame != nullptr);
+  EXPECT_TRUE(FrameIsIntact(*frame, 3));
+
+  // The frame being read is never overwritten, even though the producer
+  // never waits.
+  for (uint32_t i = 5; i < 8; ++i) {
+    FrameT* next = ring.AcquireWrite();
+    ASSERT_TRUE(next != nullptr);
+    EXPECT_NE(frame, next);
+    WriteFrame(*next, i);
+    ring.Publish();
+  }
+  EXPECT_EQ(1u, ring.Size());
+  EXPECT_TRUE(FrameIsIntact(*frame, 3));
+  ring.Release();
+
+  frame = ring.AcquireRead();
+  ASSERT_TRUE(frame != nullptr);
+  EXPECT_TRUE(FrameIsIntact(*frame, 7));
+  ring.Release();
+  EXPECT_TRUE(ring.AcquireRead() == nullptr);
+
+  const jr::FrameRing<FrameT>::Stats stats = ring.GetStats();
+  EXPECT_EQ(8u, stats.published);
+  EXPECT_EQ(2u, stats.consumed);
+  EXPECT_EQ(6u, stats.dropped);
+  EXPECT_EQ(0u, stats.rejected);
+}
+
+TEST(JRFrameRing, AlignedSlots) {
+  typedef jr::ImageBuf<float, 3, jr::AlignedAllocator<float, 64>, 64> ImageT;
+  jr::FrameRing<ImageT> ring(2, 33, 7, 3);
+  ImageT* frame = ring.AcquireWrite();
+  ASSERT_TRUE(frame != nullptr);
+  for (int y = 0; y < frame->Height(); ++y) {
+    EXPECT_TRUE(jr::mem_utils::IsPointerAligned(frame->GetRow(y), 64));
+  }
+}
+
+// Run a producer and a consumer thread against each other, checking that the
+// consumer sees frames in order and never sees one being overwritten.
+void RunProducerConsumer(jr::RingFullPolicy policy) {
+  const uint32_t kNumFrames = 20000;
+  jr::FrameRing<FrameT> ring(4, 16, 16, 1, policy);
+
+  std::thread producer([&ring, kNumFrames]() {
+    for (uint32_t i = 1; i <= kNumFrames;) {
+      if (FrameT* frame = ring.AcquireWrite()) {
+        WriteFrame(*frame, i++);
+        ring.Publish();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t last = 0;
+  bool in_order = true, intact = true;
+  while (last < kNumFrames) {
+    if (const FrameT* frame = ring.AcquireRead()) {
+      const uint32_t sequence = frame->Get(0, 0, 0);
+      in_order = in_order && sequence > last;
+      intact = intact && FrameIsIntact(*frame, sequence);
+      last = sequence;
+      ring.Release();
+    }
+  }
+  producer.join();
+
+  EXPECT_TRUE(in_order);
+  EXPECT_TRUE(intact);
+  const jr::FrameRing<FrameT>::Stats stats = ring.GetStats();
+  EXPECT_EQ(kNumFrames, stats.published);
+  EXPECT_EQ(kNumFrames, stats.consumed + stats.dropped);
+  if (policy == jr::RING_BACKPRESSURE) {
+    EXPECT_EQ(0u, stats.dropped);
+  }
+}
+
+TEST(JRFrameRing, ConcurrentBackpressure) {
+  RunProducerConsumer(jr::RING_BACKPRESSURE);
+}
+
+TEST(JRFrameRing, ConcurrentDropOldest) {
+  RunProducerConsumer(jr::RING_DROP_OLDEST);
+}
+
+}  // anonymous namespace
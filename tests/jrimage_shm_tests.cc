@@ -0,0 +1,174 @@
+#include <string>
+#include <cstdint>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "jrimage.h"
+#include "jrimage_shm.h"
+
+namespace {
+
+std::string SegmentName(const std::string& name) {
+  return "/jrimage_shm_" + std::to_string(getpid()) + "_" + name;
+}
+
+uint16_t Pattern(int x, int y, int c, uint64_t generation) {
+  return static_cast<uint16_t>(x * 100 + y * 10 + c + generation * 1000);
+}
+
+TEST(JRImageShm, CreateMapAndReopen) {
+  typedef jr::ImageBuf<float, 3> ImageT;
+  const std::string name = SegmentName("reopen");
+  std::shared_ptr<jr::SharedImageSegment> segment =
+      jr::SharedImageSegment::Create(
+          name, jr::SharedImageFormatFor<ImageT>(17, 9, 3));
+  ASSERT_TRUE(segment != nullptr);
+  EXPECT_TRUE(segment->IsWritable());
+  EXPECT_EQ(0u, segment->Generation());
+  EXPECT_EQ(17 * 3 * sizeof(float), segment->Header().row_pitch_bytes);
+
+  ImageT writer;
+  ASSERT_TRUE(jr::MapImage(segment, writer));
+  EXPECT_EQ(17, writer.Width());
+  EXPECT_EQ(0.0f, writer.Get(16, 8, 2));  // New segments are zeroed.
+  writer.Set(16, 8, 2, 5.0f);
+  EXPECT_EQ(1u, segment->Publish());
+
+  // A second mapping of the same segment sees the same pixels.
+  std::shared_ptr<jr::SharedImageSegment> reopened =
+      jr::SharedImageSegment::Open(name, jr::READ_ONLY_MAPPING);
+  ASSERT_TRUE(reopened != nullptr);
+  EXPECT_FALSE(reopened->IsWritable());
+  EXPECT_EQ(1u, reopened->Generation());
+  ImageT reader;
+  ASSERT_TRUE(jr::MapImage(reopened, reader));
+  EXPECT_EQ(5.0f, reader.Get(16, 8, 2));
+  EXPECT_EQ(writer, reader);
+
+  // The image keeps the mapping alive.
+  reopened.reset();
+  writer.Set(0, 0, 0, 1.0f);
+  EXPECT_EQ(1.0f, reader.Get(0, 0, 0));
+
+  // Pixel type, layout and channel count must match.
+  jr::ImageBuf<uint8_t, 3> wrong_type;
+  EXPECT_FALSE(jr::MapImage(segment, wrong_type));
+  jr::ImageBuf<float, 3, std::allocator<float>, jr::PACKED_ROWS,
+               jr::PlanarLayout> wrong_layout;
+  EXPECT_FALSE(jr::MapImage(segment, wrong_layout));
+  jr::ImageBuf<float, 4> wrong_channels;
+  EXPECT_FALSE(jr::MapImage(segment, wrong_channels));
+
+  EXPECT_TRUE(jr::SharedImageSegment::Unlink(name));
+  EXPECT_TRUE(jr::SharedImageSegment::Open(name, jr::READ_ONLY_MAPPING) ==
+              nullptr);
+  EXPECT_FALSE(jr::SharedImageSegment::Unlink(name));
+}
+
+TEST(JRImageShm, PaddedPlanarSegment) {
+  typedef jr::ImageBuf<int16_t, jr::DYNAMIC_CHANNELS, std::allocator<int16_t>,
+                       64, jr::PlanarLayout> ImageT;
+  const std::string name = SegmentName("planar");
+  std::shared_ptr<jr::SharedImageSegment> segment =
+      jr::SharedImageSegment::Create(
+          name, jr::SharedImageFormatFor<ImageT>(10, 4, 2, 64));
+  ASSERT_TRUE(segment != nullptr);
+  ImageT image;
+  ASSERT_TRUE(jr::MapImage(segment, image));
+  EXPECT_EQ(2, image.Channels());
+  image.Set(9, 3, 1, -7);
+  EXPECT_EQ(-7, static_cast<const int16_t*>(segment->PixelData())[
+                    (4 + 3) * 32 + 9]);
+
+  // Pitches too small for the rows are rejected.
+  EXPECT_TRUE(jr::SharedImageSegment::Create(
+                  SegmentName("bad"),
+                  jr::SharedImageFormatFor<ImageT>(10, 4, 2, 8)) == nullptr);
+  EXPECT_TRUE(jr::SharedImageSegment::Unlink(name));
+}
+
+// A producer process publishes frames that a consumer process reads through
+// its own read-only mapping.
+TEST(JRImageShm, CrossProcessHandoff) {
+  typedef jr::ImageBuf<uint16_t, 2> ImageT;
+  const int w = 64, h = 48;
+  const uint64_t kNumFrames = 5;
+  const std::string name = SegmentName("handoff");
+  std::shared_ptr<jr::SharedImageSegment> segment =
+      jr::SharedImageSegment::Create(name,
+                                     jr::SharedImageFormatFor<ImageT>(w, h, 2));
+  ASSERT_TRUE(segment != nullptr);
+  ImageT frame;
+  ASSERT_TRUE(jr::MapImage(segment, frame));
+
+  // The pipes carry only notifications: "frame n is ready" one way, and
+  // "done with frame n" the other.
+  int ready[2], done[2];
+  ASSERT_EQ(0, pipe(ready));
+  ASSERT_EQ(0, pipe(done));
+  const pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (child == 0) {
+    // Consumer.  Report failures through the exit status.
+    std::shared_ptr<jr::SharedImageSegment> view =
+        jr::SharedImageSegment::Open(name, jr::READ_ONLY_MAPPING);
+    ImageT consumer;
+    if (view == nullptr || !jr::MapImage(view, consumer)) {
+      _exit(2);
+    }
+    for (uint64_t n = 1; n <= kNumFrames; ++n) {
+      uint64_t generation = 0;
+      if (read(ready[0], &generation, sizeof(generation)) !=
+              sizeof(generation) ||
+          generation != n || view->Generation() != n) {
+        _exit(3);
+      }
+      for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+          for (int c = 0; c < 2; ++c) {
+            if (consumer.Get(x, y, c) != Pattern(x, y, c, n)) {
+              _exit(4);
+            }
+          }
+        }
+      }
+      if (write(done[1], &generation, sizeof(generation)) !=
+          sizeof(generation)) {
+        _exit(5);
+      }
+    }
+    _exit(0);
+  }
+
+  // Producer.
+  for (uint64_t n = 1; n <= kNumFrames; ++n) {
+    for (int y = 0; y < h; ++y) {
+      for (int x = 0; x < w; ++x) {
+        for (int c = 0; c < 2; ++c) {
+          frame.Set(x, y, c, Pattern(x, y, c, n));
+        }
+      }
+    }
+    uint64_t generation = segment->Publish();
+    EXPECT_EQ(n, generation);
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(generation)),
+              write(ready[1], &generation, sizeof(generation)));
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(generation)),
+              read(done[0], &generation, sizeof(generation)));
+  }
+
+  int status = 0;
+  ASSERT_EQ(child, waitpid(child, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+  close(ready[0]);
+  close(ready[1]);
+  close(done[0]);
+  close(done[1]);
+  EXPECT_TRUE(jr::SharedImageSegment::Unlink(name));
+}
+
+}  // anonymous namespace
@@ -0,0 +1,164 @@
+#include <string>
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "jrimage.h"
+#include "jrimage_sparse.h"
+#include "jrimage_tiled.h"
+
+namespace {
+
+typedef jr::SparseImageBuf<uint16_t, 2, std::allocator<uint16_t>,
+                           jr::TiledLayout<8, 4>> SparseT;
+
+TEST(JRSparseImageBuf, AbsentTilesReadAsFill) {
+  SparseT image(45, 30);
+  EXPECT_EQ(6, image.TilesAcross());
+  EXPECT_EQ(8, image.TilesDown());
+  EXPECT_EQ(0u, image.NumOccupiedTiles());
+  EXPECT_TRUE(image.IsKnownZero());
+  EXPECT_EQ(0, image.Get(44, 29, 1));
+
+  image.SetAll(9);
+  EXPECT_EQ(9, image.FillValue());
+  EXPECT_EQ(9, image.Get(17, 3, 0));
+  EXPECT_EQ(0u, image.NumOccupiedTiles());
+  EXPECT_EQ(0u, image.TotalByteCount());
+
+  // Writes allocate only the tile they land in, filled with the fill value.
+  image.Set(17, 3, 1, 100);
+  EXPECT_EQ(1u, image.NumOccupiedTiles());
+  EXPECT_TRUE(image.IsTileOccupied(2, 0));
+  EXPECT_FALSE(image.IsTileOccupied(2, 1));
+  EXPECT_EQ(100, image.Get(17, 3, 1));
+  EXPECT_EQ(9, image.Get(17, 3, 0));
+  EXPECT_EQ(9, image.Get(16, 0, 1));
+  EXPECT_TRUE(image.FindTile(0, 0) == nullptr);
+  EXPECT_EQ(9, image.FindTile(2, 0)[0]);
+
+  // Reads never allocate.
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      image.Get(x, y, 0);
+    }
+  }
+  EXPECT_EQ(1u, image.NumOccupiedTiles());
+
+  // A tile set back to the fill value can be compacted away.
+  image.Set(44, 29, 0, 1);
+  EXPECT_EQ(2u, image.NumOccupiedTiles());
+  image.Set(17, 3, 1, 9);
+  EXPECT_EQ(1u, image.Compact());
+  EXPECT_EQ(1u, image.NumOccupiedTiles());
+  EXPECT_EQ(1, image.Get(44, 29, 0));
+  image.ReleaseTile(5, 7);
+  EXPECT_EQ(9, image.Get(44, 29, 0));
+
+  // SetAll frees everything.
+  image.Set(0, 0, 0, 5);
+  image.SetAll(0);
+  EXPECT_EQ(0u, image.NumOccupiedTiles());
+  EXPECT_TRUE(image.IsKnownZero());
+}
+
+TEST(JRSparseImageBuf, ForEachOccupiedTile) {
+  // Enough tiles to span several bitmap words.
+  jr::SparseImageBuf<uint8_t, 1, std::allocator<uint8_t>,
+                     jr::TiledLayout<4, 4>> image(200, 50);
+  EXPECT_EQ(50 * 13, image.TilesAcross() * image.TilesDown());
+  const int points[][2] = {{0, 0}, {199, 0}, {100, 17}, {3, 49}, {199, 49}};
+  for (const auto& point : points) {
+    image.Set(point[0], point[1], 0, 1);
+  }
+
+  std::vector<std::pair<int, int>> visited;
+  image.ForEachOccupiedTile([&visited](int x0, int y0, int width, int height,
+                                       const uint8_t* tile) {
+    EXPECT_EQ(4, width);
+    EXPECT_LE(height, 4);
+    EXPECT_TRUE(tile != nullptr);
+    visited.push_back(std::make_pair(x0, y0));
+  });
+  ASSERT_EQ(5u, visited.size());
+  EXPECT_EQ(std::make_pair(0, 0), visited[0]);
+  EXPECT_EQ(std::make_pair(196, 0), visited[1]);
+  EXPECT_EQ(std::make_pair(100, 16), visited[2]);
+  EXPECT_EQ(std::make_pair(0, 48), visited[3]);
+  EXPECT_EQ(std::make_pair(196, 48), visited[4]);
+}
+
+TEST(JRSparseImageBuf, CopyIntoAndCompare) {
+  SparseT sparse(45, 30);
+  sparse.SetAll(3);
+  sparse.Set(10, 10, 0, 7);
+  sparse.Set(44, 29, 1, 8);
+  EXPECT_EQ(2u, sparse.NumOccupiedTiles());
+
+  // Into a dense image.
+  jr::ImageBuf<uint16_t, 2> dense;
+  EXPECT_TRUE(sparse.CopyInto(dense));
+  EXPECT_EQ(3, dense.Get(0, 0, 0));
+  EXPECT_EQ(7, dense.Get(10, 10, 0));
+  EXPECT_EQ(8, dense.Get(44, 29, 1));
+  EXPECT_TRUE(sparse == dense);
+  EXPECT_TRUE(dense == sparse);
+  dense.Set(30, 20, 1, 0);
+  EXPECT_FALSE(sparse == dense);
+  EXPECT_TRUE(dense != sparse);
+  EXPECT_EQ(2u, sparse.NumOccupiedTiles());  // Comparing didn't allocate.
+
+  // Into a tiled image with a different tile size.
+  jr::TiledImageBuf<uint16_t, 2, std::allocator<uint16_t>,
+                    jr::TiledLayout<16, 16>> tiled;
+  EXPECT_TRUE(sparse.CopyInto(tiled));
+  EXPECT_TRUE(sparse == tiled);
+  EXPECT_EQ(7, tiled.Get(10, 10, 0));
+
+  // Into another sparse image, and back from a dense one.
+  SparseT copy;
+  EXPECT_TRUE(sparse.CopyInto(copy));
+  EXPECT_EQ(2u, copy.NumOccupiedTiles());
+  EXPECT_TRUE(copy == sparse);
+  copy.Set(44, 29, 1, 3);
+  EXPECT_FALSE(copy == sparse);
+  copy.Set(44, 29, 1, 8);
+  EXPECT_TRUE(copy == sparse);
+
+  // Sparse images compare equal whatever their tiles, if the values match.
+  SparseT other(45, 30);
+  other.SetAll(3);
+  other.Set(10, 10, 0, 7);
+  other.Set(44, 29, 1, 8);
+  other.Set(20, 20, 0, 3);  // Occupied here, but equal to sparse's fill.
+  EXPECT_EQ(3u, other.NumOccupiedTiles());
+  EXPECT_TRUE(other == sparse);
+  EXPECT_TRUE(sparse == other);
+  other.SetAll(4);
+  other.Set(10, 10, 0, 7);
+  EXPECT_FALSE(other == sparse);
+
+  // Planar destinations are written value by value.
+  jr::ImageBuf<uint16_t, 2, std::allocator<uint16_t>, jr::PACKED_ROWS,
+               jr::PlanarLayout> planar;
+  EXPECT_TRUE(sparse.CopyInto(planar));
+  EXPECT_TRUE(planar == sparse);
+}
+
+TEST(JRSparseImageBuf, ZOrderTiles) {
+  jr::SparseImageBuf<float, 1, std::allocator<float>,
+                     jr::TiledLayout<8, 8, true>> image(20, 20);
+  image.SetAll(-1.0f);
+  for (int x = 0; x < 20; ++x) {
+    image.Set(x, 9, 0, static_cast<float>(x));
+  }
+  EXPECT_EQ(3u, image.NumOccupiedTiles());
+  jr::ImageBuf<float, 1> dense;
+  EXPECT_TRUE(image.CopyInto(dense));
+  EXPECT_EQ(13.0f, dense.Get(13, 9, 0));
+  EXPECT_EQ(-1.0f, dense.Get(13, 8, 0));
+  EXPECT_TRUE(image == dense);
+}
+
+}  // anonymous namespace
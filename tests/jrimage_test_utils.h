@@ -0,0 +1,36 @@
+#ifndef JRIMAGE_TEST_UTILS_H_
+#define JRIMAGE_TEST_UTILS_H_
+
+#include <functional>
+
+#include "jrimage.h"
+
+// Helpers shared by the jrimage unit tests.
+
+namespace jr {
+namespace test_utils {
+
+// Set every value of image (of any image type) to func(x, y, c).  Returns the
+// number of values set.  func is called through a std::function, so that tests
+// comparing values against direct calls to it see the same rounding.
+template <typename ImageT>
+int SampleFuncIntoImageBuf(
+    const std::function<typename ImageTraits<ImageT>::ChannelT(int, int, int)>&
+        func,
+    ImageT& image) {
+  int num_evals = 0;
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      for (int c = 0; c < image.Channels(); ++c) {
+        image.Set(x, y, c, func(x, y, c));
+        ++num_evals;
+      }
+    }
+  }
+  return num_evals;
+}
+
+}  // namespace test_utils
+}  // namespace jr
+
+#endif  // JRIMAGE_TEST_UTILS_H_
@@ -2,14 +2,23 @@
 #include <iostream>
 #include <random>
 #include <cstdint>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "gtest/gtest.h"
 
 #include "jrimage.h"
 #include "jrimage_allocators.h"
+#include "jrimage_test_utils.h"
 
 namespace {
 
+using jr::test_utils::SampleFuncIntoImageBuf;
+
 TEST(JRImageBuf_Allocators, PixelSetters) {
   jr::ImageBuf<float, 3, jr::AlignedAllocator<float>> a;
 }
@@ -177,6 +186,88 @@ TEST(JRImageBuf, SimpleSetAllChannels) {
   EXPECT_EQ(13, buf[0]);
 }
 
+TEST(JRImageBuf, SetAllPixels) {
+  const uint8_t rgb[3] = {10, 20, 30};
+  jr::ImageBuf<uint8_t, 3> image(37, 5);
+  image.SetAllPixels(rgb);
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      for (int c = 0; c < 3; ++c) {
+        ASSERT_EQ(rgb[c], image.Get(x, y, c));
+      }
+    }
+  }
+
+  // Windows only touch their own pixels.
+  const uint8_t other[3] = {1, 2, 3};
+  jr::ImageBuf<uint8_t, 3> win;
+  EXPECT_TRUE(image.GetWindow(3, 1, 29, 3, win));
+  win.SetAllPixels(other);
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      const bool inside = x >= 3 && x < 32 && y >= 1 && y < 4;
+      for (int c = 0; c < 3; ++c) {
+        ASSERT_EQ(inside ? other[c] : rgb[c], image.Get(x, y, c));
+      }
+    }
+  }
+
+  // Planar images fill each plane, and padded rows keep their padding.
+  jr::ImageBuf<float, jr::DYNAMIC_CHANNELS, std::allocator<float>, 64,
+               jr::PlanarLayout> planar(9, 4, 2);
+  const float values[2] = {-1.0f, 2.5f};
+  planar.SetAllPixels(values);
+  EXPECT_FALSE(planar.IsMemoryContiguous());
+  EXPECT_EQ(-1.0f, planar.Get(8, 3, 0));
+  EXPECT_EQ(2.5f, planar.Get(8, 3, 1));
+
+  // A pixel with matching channels is an ordinary SetAll(...).
+  const uint8_t grays[3] = {7, 7, 7};
+  image.SetAllPixels(grays);
+  EXPECT_EQ(7, image.Get(0, 0, 0));
+  EXPECT_EQ(7, image.Get(36, 4, 2));
+}
+
+// Non-temporal fills and copies must write exactly what ordinary ones do, and
+// never touch row padding or pixels outside a window.
+TEST(JRImageBuf, NonTemporalSetAllAndCopyInto) {
+  const std::size_t original_threshold =
+      jr::mem_utils::NonTemporalThresholdBytes();
+  typedef jr::ImageBuf<uint16_t, 3, std::allocator<uint16_t>, 64> ImageT;
+  ImageT image(150, 20);
+  image.SetAll(1, jr::mem_utils::CACHE_HINT_CACHED);
+  ImageT win;
+  EXPECT_TRUE(image.GetWindow(5, 2, 131, 9, win));
+
+  // CACHE_HINT_AUTO switches over at the threshold.
+  for (jr::mem_utils::CacheHint hint : {jr::mem_utils::CACHE_HINT_AUTO,
+                                        jr::mem_utils::CACHE_HINT_NON_TEMPORAL}) {
+    jr::mem_utils::SetNonTemporalThresholdBytes(1024);
+    win.SetAll(7, hint);
+    const uint16_t pixel[3] = {8, 9, 10};
+    jr::ImageBuf<uint16_t, 3> expected(150, 20);
+    expected.SetAll(1);
+    for (int y = 2; y < 11; ++y) {
+      for (int x = 5; x < 136; ++x) {
+        expected.SetAllChannels(x, y, pixel);
+      }
+    }
+    win.SetAllPixels(pixel, hint);
+    EXPECT_EQ(expected, image);
+
+    // Copies out of and into windows.
+    jr::ImageBuf<uint16_t, 3> copy;
+    EXPECT_TRUE(win.CopyInto(copy, hint));
+    EXPECT_EQ(win, copy);
+    copy.Set(130, 8, 2, 11);
+    EXPECT_TRUE(copy.CopyInto(win, hint));
+    EXPECT_EQ(11, image.Get(135, 10, 2));
+    EXPECT_EQ(1, image.Get(136, 10, 2));
+    image.SetAll(1, jr::mem_utils::CACHE_HINT_CACHED);
+  }
+  jr::mem_utils::SetNonTemporalThresholdBytes(original_threshold);
+}
+
 // Set random pixel values many times and make sure we can read the
 // same values back.
 TEST(JRImageBuf_Stress, PixelSetters) {
@@ -279,37 +370,25 @@ double Func(int x, int y, int chan) {
   return dx * dy * dc + dx * 23.0 + dy * dy * 14.0 + sin(dc);
 }
 
-template <typename T, int CHAN>
-int SampleFuncIntoImageBuf(const std::function<T(int, int, int)>& func,
-                        jr::ImageBuf<T, CHAN>& image) {
-  int num_evals = 0;
-  for (int y = 0; y < image.Height(); ++y) {
-    for (int x = 0; x < image.Width(); ++x) {
-      for (int c = 0; c < image.Channels(); ++c) {
-        image.Set(x, y, c, func(x, y, c));
-        ++num_evals;
-      }
-    }
-  }
-  return num_evals;
-}
-
 float F(int x, int y, int c) {
   return static_cast<float>(x + y + c) + 12.0f +
          static_cast<float>(x * x * -1.f) + static_cast<float>(y * x * 3.3f) +
          static_cast<float>(c * y * 2.0f);
 }
 
-/*
+uint32_t U(int x, int y, int c) {
+  return static_cast<uint32_t>(x * 1000000 + y * 1000 + c);
+}
+
 TEST(JRImageBuf, ImageBufResizing) {
   jr::ImageBuf<uint32_t> gold(100, 200, 4);
-  SampleFuncIntoImageBuf<uint32_t, jr::DYNAMIC_CHANNELS>(F, gold);
+  SampleFuncIntoImageBuf(U, gold);
 
   jr::ImageBuf<uint32_t> resized_gold(11, 30, 4);
-  SampleFuncIntoImageBuf<uint32_t, jr::DYNAMIC_CHANNELS>(F, resized_gold);
+  SampleFuncIntoImageBuf(U, resized_gold);
 
   jr::ImageBuf<uint32_t> resized_two_chan_gold(5, 13, 2);
-  SampleFuncIntoImageBuf<uint32_t, jr::DYNAMIC_CHANNELS>(F, resized_two_chan_gold);
+  SampleFuncIntoImageBuf(U, resized_two_chan_gold);
 
   jr::ImageBuf<uint32_t, 4> dest_static;
   gold.CopyInto(dest_static);
@@ -319,16 +398,117 @@ TEST(JRImageBuf, ImageBufResizing) {
   gold.CopyInto(dest_dynamic);
   EXPECT_EQ(gold, dest_static);
 
-  dest_static.Resize(11, 30, dest_static.Channels());
+  dest_static.Resize(11, 30, dest_static.Channels(), jr::PRESERVE_CONTENTS);
   EXPECT_EQ(resized_gold, dest_static);
 
-  dest_dynamic.Resize(11, 30, dest_dynamic.Channels());
+  dest_dynamic.Resize(11, 30, dest_dynamic.Channels(), jr::PRESERVE_CONTENTS);
   EXPECT_EQ(resized_gold, dest_dynamic);
 
-  dest_dynamic.Resize(5, 13, 2);
+  dest_dynamic.Resize(5, 13, 2, jr::PRESERVE_CONTENTS);
   EXPECT_EQ(resized_two_chan_gold, dest_dynamic);
+
+  // Growing keeps the old pixels and zeros the new ones.
+  dest_dynamic.Resize(7, 15, 3, jr::PRESERVE_CONTENTS);
+  for (int y = 0; y < dest_dynamic.Height(); ++y) {
+    for (int x = 0; x < dest_dynamic.Width(); ++x) {
+      for (int c = 0; c < dest_dynamic.Channels(); ++c) {
+        const uint32_t expected =
+            resized_two_chan_gold.InBounds(x, y, c) ? U(x, y, c) : 0;
+        EXPECT_EQ(expected, dest_dynamic.Get(x, y, c));
+      }
+    }
+  }
+}
+
+// Resize the image with PRESERVE_CONTENTS through a sequence of shapes, and
+// check the result against a freshly sampled image each time.
+template <typename ImageT>
+void CheckPreservingResizes(ImageT& image) {
+  const int shapes[][3] = {{40, 30, 3}, {17, 30, 3}, {17, 9, 2}, {33, 12, 2},
+                           {33, 12, 4}, {8, 40, 1}, {50, 2, 3}, {3, 3, 3}};
+  image.Resize(40, 30, 3);
+  SampleFuncIntoImageBuf(U, image);
+  int valid_w = 40, valid_h = 30, valid_c = 3;
+  for (const auto& shape : shapes) {
+    EXPECT_TRUE(image.Resize(shape[0], shape[1], shape[2], jr::PRESERVE_CONTENTS));
+    for (int y = 0; y < shape[1]; ++y) {
+      for (int x = 0; x < shape[0]; ++x) {
+        for (int c = 0; c < shape[2]; ++c) {
+          const bool kept = x < valid_w && y < valid_h && c < valid_c;
+          EXPECT_EQ(kept ? U(x, y, c) : 0, image.Get(x, y, c));
+        }
+      }
+    }
+    valid_w = std::min(valid_w, shape[0]);
+    valid_h = std::min(valid_h, shape[1]);
+    valid_c = std::min(valid_c, shape[2]);
+  }
+}
+
+TEST(JRImageBuf, PreservingResizeLayouts) {
+  jr::ImageBuf<uint32_t> interleaved;
+  CheckPreservingResizes(interleaved);
+
+  jr::ImageBuf<uint32_t, jr::DYNAMIC_CHANNELS, jr::AlignedAllocator<uint32_t, 64>, 64>
+      aligned;
+  CheckPreservingResizes(aligned);
+
+  jr::PlanarImageBuf<uint32_t, jr::DYNAMIC_CHANNELS> planar;
+  CheckPreservingResizes(planar);
+
+  // Same again, but with room to do every resize in place.
+  jr::ImageBuf<uint32_t> reserved;
+  EXPECT_TRUE(reserved.Reserve(64, 64, 4));
+  CheckPreservingResizes(reserved);
+
+  jr::PlanarImageBuf<uint32_t, jr::DYNAMIC_CHANNELS, std::allocator<uint32_t>, 16>
+      reserved_planar;
+  EXPECT_TRUE(reserved_planar.Reserve(64, 64, 4));
+  CheckPreservingResizes(reserved_planar);
+}
+
+TEST(JRImageBuf, CapacityReuse) {
+  typedef jr::ImageBuf<float, 3> ImageT;
+  ImageT image(100, 80);
+  const std::size_t full = ImageT::RequiredNumel(100, 80, 3);
+  EXPECT_EQ(full, image.Capacity());
+  const float* block = image.GetRow(0);
+
+  // Shrinking, or growing back within capacity, reuses the block.
+  EXPECT_TRUE(image.Resize(20, 10, 3));
+  EXPECT_EQ(block, image.GetRow(0));
+  EXPECT_EQ(full, image.Capacity());
+  image.Allocate(80, 100);
+  EXPECT_EQ(block, image.GetRow(0));
+  EXPECT_EQ(full, image.Capacity());
+
+  // ShrinkToFit gives back the excess, and keeps the pixels.
+  EXPECT_TRUE(image.Resize(20, 10, 3));
+  SampleFuncIntoImageBuf(F, image);
+  image.ShrinkToFit();
+  EXPECT_EQ(ImageT::RequiredNumel(20, 10, 3), image.Capacity());
+  ImageT gold(20, 10);
+  SampleFuncIntoImageBuf(F, gold);
+  EXPECT_EQ(gold, image);
+
+  // Reserve grows the capacity and keeps the pixels too.
+  EXPECT_TRUE(image.Reserve(200, 200, 3));
+  EXPECT_EQ(ImageT::RequiredNumel(200, 200, 3), image.Capacity());
+  EXPECT_EQ(gold, image);
+  block = image.GetRow(0);
+  EXPECT_TRUE(image.Resize(150, 190, 3));
+  EXPECT_EQ(block, image.GetRow(0));
+
+  // Reserving less than the current capacity is a no-op.
+  EXPECT_TRUE(image.Reserve(1, 1, 3));
+  EXPECT_EQ(block, image.GetRow(0));
+
+  // Windows have no capacity of their own.
+  ImageT win;
+  EXPECT_TRUE(image.GetWin(0, 0, 10, 10, win));
+  EXPECT_EQ(0u, win.Capacity());
+  EXPECT_FALSE(win.Reserve(20, 20, 3));
 }
-*/
 
 TEST(JRImageBuf, ImageBufCopying) {
   {
@@ -353,15 +533,15 @@ TEST(JRImageBuf, ImageBufCopying) {
   jr::ImageBuf<float> dynamic_gold(312, 453, 6);
   EXPECT_EQ(6, dynamic_gold.Channels());
 
-  SampleFuncIntoImageBuf<float, 6>(F, static_gold);
-  SampleFuncIntoImageBuf<float, jr::DYNAMIC_CHANNELS>(F, dynamic_gold);
+  SampleFuncIntoImageBuf(F, static_gold);
+  SampleFuncIntoImageBuf(F, dynamic_gold);
   EXPECT_EQ(static_gold, dynamic_gold);
 
   // Static to static.
   {
     jr::ImageBuf<float, 2> gold(1, 2);
     EXPECT_EQ(2, gold.Channels());
-    SampleFuncIntoImageBuf<float, 2>(F, gold);
+    SampleFuncIntoImageBuf(F, gold);
 
     jr::ImageBuf<float, 2> copy(333, 1);
     EXPECT_TRUE(gold.CopyInto(copy));
@@ -377,5 +557,482 @@ TEST(JRImageBuf, ImageBufCopying) {
 }
 
 
+TEST(JRImageBuf, AlignedRowPitch) {
+  // 5 float pixels of 3 channels is 60 bytes, which gets padded to 64.
+  jr::AlignedImageBuf<float, 3, 64> padded(5, 4);
+  EXPECT_EQ(16u, padded.RowStride());
+  EXPECT_EQ(64u, padded.RowPitchBytes());
+  EXPECT_FALSE(padded.IsMemoryContiguous());
+  for (int y = 0; y < padded.Height(); ++y) {
+    EXPECT_TRUE(jr::mem_utils::IsPointerAligned(padded.GetRow(y), 64));
+  }
+
+  // Fill the padding in one image with garbage; it must never affect
+  // comparisons or be copied.
+  jr::AlignedImageBuf<float, 3, 64> other(5, 4);
+  for (int y = 0; y < other.Height(); ++y) {
+    float* row = other.GetRow(y);
+    for (std::size_t i = 5 * 3; i < other.RowStride(); ++i) {
+      row[i] = -123.0f;
+    }
+  }
+  padded.SetAll(7.0f);
+  other.SetAll(7.0f);
+  EXPECT_EQ(padded, other);
+  EXPECT_EQ(-123.0f, other.GetRow(2)[15]);
+
+  // Padded and packed images with the same pixels compare equal, in both
+  // directions of copying.
+  SampleFuncIntoImageBuf(F, padded);
+  jr::ImageBuf<float, 3> packed;
+  EXPECT_TRUE(padded.CopyInto(packed));
+  EXPECT_TRUE(packed.IsMemoryContiguous());
+  EXPECT_EQ(padded, packed);
+  EXPECT_TRUE(packed.CopyInto(other));
+  EXPECT_EQ(padded, other);
+  EXPECT_EQ(-123.0f, other.GetRow(3)[15]);
+
+  // Windows share the parent's pitch.
+  jr::AlignedImageBuf<float, 3, 64> win;
+  EXPECT_TRUE(padded.GetWindow(1, 1, 3, 2, win));
+  EXPECT_EQ(padded.RowStride(), win.RowStride());
+  for (int y = 0; y < win.Height(); ++y) {
+    for (int x = 0; x < win.Width(); ++x) {
+      for (int c = 0; c < win.Channels(); ++c) {
+        EXPECT_EQ(padded.Get(x + 1, y + 1, c), win.Get(x, y, c));
+      }
+    }
+  }
+  win.SetAll(1.0f);
+  EXPECT_EQ(1.0f, padded.Get(3, 2, 2));
+  EXPECT_EQ(F(4, 2, 2), padded.Get(4, 2, 2));
+  EXPECT_EQ(-123.0f, other.GetRow(1)[15]);
+}
+
+// Windows into packed multi-channel images must address the parent's rows.
+TEST(JRImageBuf, WindowsCopyAndCompare) {
+  jr::ImageBuf<int, 3> image(7, 5);
+  SampleFuncIntoImageBuf(
+      [](int x, int y, int c) { return x * 100 + y * 10 + c; }, image);
+  EXPECT_TRUE(image.IsMemoryContiguous());
+
+  jr::ImageBuf<int, 3> win;
+  EXPECT_TRUE(image.GetWindow(2, 1, 4, 3, win));
+  EXPECT_FALSE(win.IsMemoryContiguous());
+  EXPECT_EQ(2 * 100 + 3 * 10 + 1, win.Get(0, 2, 1));
+
+  jr::ImageBuf<int, 3> copy;
+  EXPECT_TRUE(win.CopyInto(copy));
+  EXPECT_EQ(win, copy);
+  EXPECT_EQ(5 * 100 + 3 * 10 + 2, copy.Get(3, 2, 2));
+
+  // Copying into a window of matching size writes through to the parent.
+  copy.SetAll(-1);
+  EXPECT_TRUE(copy.CopyInto(win));
+  EXPECT_EQ(-1, image.Get(5, 3, 2));
+  EXPECT_EQ(6 * 100 + 3 * 10 + 2, image.Get(6, 3, 2));
+}
+
+TEST(JRImageBuf, PlanarLayout) {
+  jr::PlanarImageBuf<float, 3> planar(6, 5);
+  EXPECT_TRUE(planar.IsPlanar());
+  EXPECT_EQ(3, planar.NumPlanes());
+  EXPECT_TRUE(planar.IsMemoryContiguous());
+  EXPECT_EQ(6u * 5u, planar.PlaneStride());
+  SampleFuncIntoImageBuf(F, planar);
+
+  // Each channel is stored in its own contiguous plane.
+  for (int c = 0; c < planar.Channels(); ++c) {
+    const float* row = planar.GetPlaneRow(c, 4);
+    for (int x = 0; x < planar.Width(); ++x) {
+      EXPECT_EQ(F(x, 4, c), row[x]);
+    }
+  }
+
+  float pixel[3];
+  planar.GetAllChannels(2, 3, pixel);
+  EXPECT_EQ(F(2, 3, 1), pixel[1]);
+  pixel[2] = -5.0f;
+  planar.SetAllChannels(2, 3, pixel);
+  EXPECT_EQ(-5.0f, planar.Get(2, 3, 2));
+
+  // Planar -> interleaved -> planar round trips.
+  jr::ImageBuf<float, 3> interleaved;
+  EXPECT_TRUE(planar.CopyInto(interleaved));
+  EXPECT_FALSE(interleaved.IsPlanar());
+  EXPECT_EQ(planar, interleaved);
+  EXPECT_EQ(interleaved, planar);
+  EXPECT_EQ(-5.0f, interleaved.Get(2, 3, 2));
+
+  jr::PlanarImageBuf<float> planar_dynamic;
+  EXPECT_TRUE(interleaved.CopyInto(planar_dynamic));
+  EXPECT_EQ(planar, planar_dynamic);
+  interleaved.Set(5, 4, 0, 1000.0f);
+  EXPECT_NE(planar, interleaved);
+  EXPECT_NE(interleaved, planar);
+}
+
+TEST(JRImageBuf, PlanarLayoutPaddingAndWindows) {
+  jr::ImageBuf<uint8_t, 4, jr::AlignedAllocator<uint8_t, 32>, 32,
+               jr::PlanarLayout> planar(10, 7);
+  EXPECT_EQ(32u, planar.RowStride());
+  EXPECT_EQ(32u * 7u, planar.PlaneStride());
+  EXPECT_FALSE(planar.IsMemoryContiguous());
+  for (int c = 0; c < planar.Channels(); ++c) {
+    EXPECT_TRUE(jr::mem_utils::IsPointerAligned(planar.GetPlaneRow(c, 3), 32));
+  }
+  SampleFuncIntoImageBuf(
+      [](int x, int y, int c) { return x + 10 * y + 50 * c; }, planar);
+
+  decltype(planar) win;
+  EXPECT_TRUE(planar.GetWindow(3, 2, 4, 5, win));
+  EXPECT_EQ(3 + 1 + 10 * (2 + 4) + 50 * 3, win.Get(1, 4, 3));
+  win.SetAll(255);
+  EXPECT_EQ(255, planar.Get(6, 6, 2));
+  EXPECT_EQ(2 + 10 * 6 + 50 * 2, planar.Get(2, 6, 2));
+
+  jr::ImageBuf<uint8_t, 4> interleaved;
+  EXPECT_TRUE(win.CopyInto(interleaved));
+  EXPECT_EQ(win, interleaved);
+  interleaved.SetAll(9);
+  EXPECT_TRUE(interleaved.CopyInto(win));
+  EXPECT_EQ(9, planar.Get(3, 2, 0));
+  EXPECT_EQ(win, interleaved);
+}
+
+jr::ImageBuf<float, 3> MakeSampledImage(int width, int height) {
+  jr::ImageBuf<float, 3> image(width, height);
+  SampleFuncIntoImageBuf(F, image);
+  return image;
+}
+
+TEST(JRImageBuf, MoveAndSwap) {
+  typedef jr::ImageBuf<float, 3> ImageT;
+  static_assert(std::is_nothrow_move_constructible<ImageT>::value,
+                "ImageBuf should be nothrow move constructible.");
+  static_assert(std::is_nothrow_move_assignable<ImageT>::value,
+                "ImageBuf should be nothrow move assignable.");
+
+  ImageT gold(9, 4);
+  SampleFuncIntoImageBuf(F, gold);
+
+  // Return by value.
+  ImageT a = MakeSampledImage(9, 4);
+  EXPECT_EQ(gold, a);
+
+  // Move construction transfers the buffer, and windows stay valid.
+  ImageT win;
+  EXPECT_TRUE(a.GetWindow(1, 1, 3, 2, win));
+  const float* data = a.GetRow(0);
+  ImageT b(std::move(a));
+  EXPECT_EQ(data, b.GetRow(0));
+  EXPECT_EQ(-1, a.Width());
+  EXPECT_EQ(gold, b);
+  EXPECT_EQ(gold.Get(2, 2, 1), win.Get(1, 1, 1));
+
+  // Move assignment releases the old buffer and takes the new one.
+  ImageT c(2, 2);
+  c = std::move(b);
+  EXPECT_EQ(data, c.GetRow(0));
+  EXPECT_EQ(-1, b.Width());
+  EXPECT_EQ(gold, c);
+
+  // A moved-from image is reusable.
+  b.Allocate(1, 1);
+  b.SetAll(5.0f);
+  EXPECT_EQ(5.0f, b.Get(0, 0, 2));
+
+  // Swap, including padded row strides.
+  jr::AlignedImageBuf<float, 3> p(5, 3), q(2, 7);
+  p.SetAll(1.0f);
+  q.SetAll(2.0f);
+  const std::size_t p_stride = p.RowStride();
+  const std::size_t q_stride = q.RowStride();
+  swap(p, q);
+  EXPECT_EQ(2, p.Width());
+  EXPECT_EQ(7, p.Height());
+  EXPECT_EQ(q_stride, p.RowStride());
+  EXPECT_EQ(p_stride, q.RowStride());
+  EXPECT_EQ(2.0f, p.Get(1, 6, 2));
+  EXPECT_EQ(1.0f, q.Get(4, 2, 2));
+
+  // Windows don't own their data, and neither does what they are moved into.
+  {
+    ImageT moved_win(std::move(win));
+    EXPECT_EQ(gold.Get(3, 2, 0), moved_win.Get(2, 1, 0));
+  }
+  EXPECT_EQ(gold, c);
+}
+
+TEST(JRImageBuf, StoreInVector) {
+  std::vector<jr::ImageBuf<float, 3>> images;
+  for (int i = 1; i <= 20; ++i) {
+    images.push_back(MakeSampledImage(i, 2 * i));
+  }
+  for (int i = 1; i <= 20; ++i) {
+    const jr::ImageBuf<float, 3>& im = images[i - 1];
+    EXPECT_EQ(i, im.Width());
+    EXPECT_EQ(2 * i, im.Height());
+    EXPECT_EQ(F(i - 1, 2 * i - 1, 2), im.Get(i - 1, 2 * i - 1, 2));
+  }
+}
+
+TEST(JRImageBuf, SharedWindowsOutliveParent) {
+  typedef jr::ImageBuf<float, 3> ImageT;
+  ImageT gold = MakeSampledImage(16, 12);
+
+  ImageT win_a, win_b, raw_win;
+  {
+    ImageT parent = MakeSampledImage(16, 12);
+    EXPECT_FALSE(parent.IsShared());
+    EXPECT_EQ(0, parent.SharedUseCount());
+    EXPECT_TRUE(parent.GetSharedWin(2, 3, 5, 4, win_a));
+    EXPECT_TRUE(parent.IsShared());
+    EXPECT_TRUE(win_a.IsShared());
+    EXPECT_EQ(2, parent.SharedUseCount());
+
+    // Once shared, plain GetWin windows (and windows of windows) also hold a
+    // reference.
+    EXPECT_TRUE(win_a.GetWin(1, 1, 2, 2, win_b));
+    EXPECT_EQ(3, parent.SharedUseCount());
+
+    // Windows stay zero-copy; writes go through to the parent.
+    win_b.Set(0, 0, 0, -7.0f);
+    EXPECT_EQ(-7.0f, parent.Get(3, 4, 0));
+    parent.Set(3, 4, 0, gold.Get(3, 4, 0));
+
+    // Resizing a shared parent detaches it from the windows.
+    EXPECT_TRUE(parent.Resize(4, 4, 3));
+    EXPECT_FALSE(parent.IsShared());
+    EXPECT_EQ(2, win_a.SharedUseCount());
+    parent.SetAll(0.0f);
+  }
+
+  // The parent is gone, but the windows still reference valid memory.
+  for (int y = 0; y < win_a.Height(); ++y) {
+    for (int x = 0; x < win_a.Width(); ++x) {
+      for (int c = 0; c < 3; ++c) {
+        EXPECT_EQ(gold.Get(x + 2, y + 3, c), win_a.Get(x, y, c));
+      }
+    }
+  }
+  EXPECT_EQ(gold.Get(4, 5, 2), win_b.Get(1, 1, 2));
+
+  // Re-pointing a window at other memory drops its reference.
+  EXPECT_TRUE(gold.GetWin(0, 0, 1, 1, win_a));
+  EXPECT_FALSE(win_a.IsShared());
+  EXPECT_EQ(1, win_b.SharedUseCount());
+
+  // A shared window can be resized, which detaches it.
+  EXPECT_TRUE(win_b.Resize(3, 3, 3));
+  EXPECT_FALSE(win_b.IsShared());
+
+  // Unshared windows cannot share or be resized.
+  EXPECT_TRUE(gold.GetWin(0, 0, 2, 2, raw_win));
+  EXPECT_FALSE(raw_win.Share());
+  EXPECT_FALSE(raw_win.Resize(3, 3, 3));
+}
+
+TEST(JRImageBuf, SharedWindowsReleasedAcrossThreads) {
+  const int kNumThreads = 8;
+  const int kStripHeight = 16;
+  typedef jr::ImageBuf<int, 1> ImageT;
+  std::vector<ImageT> strips(kNumThreads);
+  {
+    ImageT frame(64, kStripHeight * kNumThreads);
+    frame.SetAll(0);
+    for (int i = 0; i < kNumThreads; ++i) {
+      EXPECT_TRUE(frame.GetSharedWin(0, i * kStripHeight, frame.Width(),
+                                     kStripHeight, strips[i]));
+    }
+    EXPECT_EQ(kNumThreads + 1, frame.SharedUseCount());
+  }
+
+  // Each worker fills its strip, checks it, and then releases it; the last one
+  // to finish frees the frame.
+  std::vector<std::thread> workers;
+  std::vector<int> ok(kNumThreads, 0);
+  for (int i = 0; i < kNumThreads; ++i) {
+    workers.push_back(std::thread([i, &strips, &ok]() {
+      ImageT strip(std::move(strips[i]));
+      strip.SetAll(i + 1);
+      ok[i] = strip.Get(strip.Width() - 1, strip.Height() - 1, 0) == i + 1;
+    }));
+  }
+  for (std::size_t i = 0; i < workers.size(); ++i) {
+    workers[i].join();
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    EXPECT_TRUE(ok[i]);
+    EXPECT_FALSE(strips[i].IsShared());
+  }
+}
+
+TEST(JRImageBuf, WrapExternalMemory) {
+  // A 5x3 RGB image of uint16_t's with a pitch of 37 bytes, which is not a
+  // multiple of the pixel size.  Rows are padded to 38 bytes so each one
+  // starts on a uint16_t boundary.
+  const int w = 5, h = 3;
+  const std::size_t pitch = 38;
+  std::vector<uint16_t> frame(pitch / sizeof(uint16_t) * h, 0xFFFF);
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      for (int c = 0; c < 3; ++c) {
+        frame[y * pitch / sizeof(uint16_t) + x * 3 + c] =
+            static_cast<uint16_t>(x * 100 + y * 10 + c);
+      }
+    }
+  }
+
+  jr::ImageBuf<uint16_t, 3> view;
+  EXPECT_TRUE(view.WrapExternal(frame.data(), w, h, 3, pitch));
+  EXPECT_FALSE(view.IsShared());
+  EXPECT_EQ(pitch, view.RowPitchBytes());
+  EXPECT_EQ(4 * 100 + 2 * 10 + 1, view.Get(4, 2, 1));
+
+  // Image algorithms run directly on the foreign memory, padding untouched.
+  jr::ImageBuf<uint16_t, 3> copy;
+  EXPECT_TRUE(view.CopyInto(copy));
+  EXPECT_EQ(view, copy);
+  view.SetAll(7);
+  EXPECT_EQ(7, frame[pitch / sizeof(uint16_t) + 14]);
+  EXPECT_EQ(0xFFFF, frame[pitch / sizeof(uint16_t) - 1]);
+
+  // Invalid descriptions are rejected, and leave the image as it was.
+  EXPECT_FALSE(view.WrapExternal(frame.data(), w, h, 3, pitch - 1));
+  EXPECT_FALSE(view.WrapExternal(frame.data(), w, h, 3, 28));
+  EXPECT_FALSE(view.WrapExternal(frame.data(), w, h, 4, pitch));
+  EXPECT_FALSE(view.WrapExternal(nullptr, w, h, 3, pitch));
+  EXPECT_EQ(w, view.Width());
+
+  // Packed external memory, viewed as a planar image.
+  std::vector<float> planes(4 * 2 * 3);
+  for (std::size_t i = 0; i < planes.size(); ++i) {
+    planes[i] = static_cast<float>(i);
+  }
+  jr::PlanarImageBuf<float, 3> planar;
+  EXPECT_TRUE(planar.WrapExternal(planes.data(), 4, 2, 3));
+  EXPECT_EQ(8 * 2 + 4 + 3, planar.Get(3, 1, 2));
+
+  // Aligned image types only accept suitably aligned memory.
+  jr::AlignedImageBuf<float, 1> aligned;
+  EXPECT_FALSE(aligned.WrapExternal(planes.data() + 1, 4, 2, 1, 64));
+}
+
+TEST(JRImageBuf, WrapExternalMemoryWithDeleter) {
+  int num_deletes = 0;
+  auto deleter = [&num_deletes](int* p) {
+    ++num_deletes;
+    delete[] p;
+  };
+
+  jr::ImageBuf<int, 2> window;
+  {
+    jr::ImageBuf<int, 2> image;
+    EXPECT_TRUE(image.WrapExternal(new int[6 * 4 * 2], 6, 4, 2,
+                                   jr::PACKED_ROWS, deleter));
+    EXPECT_TRUE(image.IsShared());
+    image.SetAll(3);
+    EXPECT_TRUE(image.GetWin(1, 1, 2, 2, window));
+  }
+  // The window keeps the adopted buffer alive.
+  EXPECT_EQ(0, num_deletes);
+  EXPECT_EQ(3, window.Get(1, 1, 1));
+
+  // Detaching the last reference hands the buffer back to the deleter.
+  EXPECT_TRUE(window.Resize(8, 8, 2));
+  EXPECT_EQ(1, num_deletes);
+
+  // Wrapping over an adopted buffer releases it.
+  jr::ImageBuf<int, 2> image;
+  EXPECT_TRUE(image.WrapExternal(new int[2], 1, 1, 2, jr::PACKED_ROWS, deleter));
+  int local[2] = {1, 2};
+  EXPECT_TRUE(image.WrapExternal(local, 1, 1, 2));
+  EXPECT_EQ(2, num_deletes);
+  EXPECT_EQ(2, image.Get(0, 0, 1));
+
+  // Data that is misaligned for T is rejected, leaving the image as it was.
+  alignas(int) uint8_t bytes[3 * sizeof(int)] = {};
+  EXPECT_FALSE(image.WrapExternal(reinterpret_cast<int*>(bytes + 1), 1, 1, 2));
+  EXPECT_EQ(2, image.Get(0, 0, 1));
+}
+
+TEST(JRImageBuf, LazilyZeroedAllocation) {
+  typedef jr::ImageBuf<float, 3, jr::ZeroedAllocator<float>> ImageT;
+  ImageT image(300, 200);
+  EXPECT_TRUE(image.IsKnownZero());
+  EXPECT_EQ(0.0f, image.Get(299, 199, 2));  // Reading keeps the guarantee.
+  EXPECT_TRUE(image.IsKnownZero());
+
+  // SetAll(0) is a no-op, but -0.0f still has to be written.
+  image.SetAll(0.0f);
+  EXPECT_TRUE(image.IsKnownZero());
+  image.SetAll(-0.0f);
+  EXPECT_FALSE(image.IsKnownZero());
+  EXPECT_TRUE(std::signbit(image.Get(10, 10, 1)));
+
+  // Shrinking reuses the (no longer zero) block.
+  image.Allocate(50, 40);
+  EXPECT_FALSE(image.IsKnownZero());
+
+  // Any write access clears the flag, so later SetAll(0) calls do write.
+  image.Allocate(500, 400);
+  EXPECT_TRUE(image.IsKnownZero());
+  image.Set(3, 4, 1, 7.0f);
+  EXPECT_FALSE(image.IsKnownZero());
+  image.SetAll(0.0f);
+  EXPECT_EQ(0.0f, image.Get(3, 4, 1));
+
+  // Windows can write to their parent's memory.
+  image.Allocate(600, 400);
+  EXPECT_TRUE(image.IsKnownZero());
+  ImageT win;
+  EXPECT_TRUE(image.GetWin(1, 1, 2, 2, win));
+  EXPECT_FALSE(image.IsKnownZero());
+  EXPECT_FALSE(win.IsKnownZero());
+
+  // Copying into a fresh zeroed image writes it.
+  ImageT src(4, 4), dst;
+  src.SetAll(2.0f);
+  EXPECT_TRUE(src.CopyInto(dst));
+  EXPECT_FALSE(dst.IsKnownZero());
+  EXPECT_EQ(src, dst);
+
+  // Known zero images are uniform, which lets comparisons and copies skip
+  // reading them.
+  float value = 1.0f;
+  ImageT zero(4, 4), nonzero(4, 4);
+  EXPECT_TRUE(zero.IsUniform(&value));
+  EXPECT_EQ(0.0f, value);
+  EXPECT_FALSE(src.IsUniform(&value));
+  EXPECT_FALSE(zero == src);
+  nonzero.SetAll(0.0f);
+  EXPECT_EQ(zero, nonzero);
+  EXPECT_TRUE(zero.CopyInto(src));
+  EXPECT_EQ(0.0f, src.Get(3, 3, 2));
+
+  // Growing with PRESERVE_CONTENTS moves to a new block, but copies the old
+  // pixels into it, so it is not zero.
+  ImageT grown(4, 4), zeros(8, 8);
+  grown.SetAll(5.0f);
+  grown.Resize(8, 8, 3, jr::PRESERVE_CONTENTS);
+  EXPECT_FALSE(grown.IsKnownZero());
+  EXPECT_EQ(5.0f, grown.Get(3, 3, 2));
+  EXPECT_FALSE(grown == zeros);
+  ImageT grown_copy;
+  EXPECT_TRUE(grown.CopyInto(grown_copy));
+  EXPECT_EQ(5.0f, grown_copy.Get(3, 3, 2));
+  EXPECT_EQ(0.0f, grown_copy.Get(7, 7, 0));
+  grown.SetAll(0.0f);
+  EXPECT_EQ(0.0f, grown.Get(3, 3, 2));
+  EXPECT_EQ(zeros, grown);
+
+  // Allocators that don't zero never claim to.
+  jr::ImageBuf<float, 3> plain(10, 10);
+  EXPECT_FALSE(plain.IsKnownZero());
+  jr::ImageBuf<float, 3, jr::HugePageAllocator<float>> huge(10, 10);
+  EXPECT_TRUE(huge.IsKnownZero());
+}
+
 }  // anonymous namespace
 
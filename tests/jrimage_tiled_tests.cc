@@ -0,0 +1,147 @@
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <functional>
+
+#include "gtest/gtest.h"
+
+#include "jrimage.h"
+#include "jrimage_test_utils.h"
+#include "jrimage_tiled.h"
+
+namespace {
+
+using jr::test_utils::SampleFuncIntoImageBuf;
+
+int Pattern(int x, int y, int c) { return x * 1000 + y * 10 + c; }
+
+template <typename ImageT>
+void ExpectMatchesPattern(const ImageT& image, int x_offset = 0,
+                          int y_offset = 0) {
+  for (int y = 0; y < image.Height(); ++y) {
+    for (int x = 0; x < image.Width(); ++x) {
+      for (int c = 0; c < image.Channels(); ++c) {
+        ASSERT_EQ(Pattern(x + x_offset, y + y_offset, c), image.Get(x, y, c))
+            << "at (" << x << ", " << y << ", " << c << ")";
+      }
+    }
+  }
+}
+
+template <typename TiledT>
+void TiledRoundTripTest() {
+  // Deliberately not a multiple of the tile size in either dimension.
+  TiledT tiled(37, 21);
+  EXPECT_FALSE(tiled.HasLinearRows());
+  EXPECT_EQ((37 + TiledT::TILE_WIDTH - 1) / TiledT::TILE_WIDTH,
+            tiled.TilesAcross());
+  EXPECT_EQ((21 + TiledT::TILE_HEIGHT - 1) / TiledT::TILE_HEIGHT,
+            tiled.TilesDown());
+  SampleFuncIntoImageBuf(Pattern, tiled);
+  ExpectMatchesPattern(tiled);
+
+  // Tiled -> row major -> tiled.
+  jr::ImageBuf<int, 3> linear;
+  EXPECT_TRUE(tiled.CopyInto(linear));
+  ExpectMatchesPattern(linear);
+  EXPECT_EQ(tiled, linear);
+  EXPECT_EQ(linear, tiled);
+
+  TiledT tiled_copy;
+  EXPECT_TRUE(linear.CopyInto(tiled_copy));
+  EXPECT_EQ(tiled, tiled_copy);
+
+  // Planar images go through the element by element path.
+  jr::PlanarImageBuf<int, 3> planar;
+  EXPECT_TRUE(tiled.CopyInto(planar));
+  EXPECT_EQ(planar, tiled);
+
+  linear.Set(36, 20, 2, -1);
+  EXPECT_NE(tiled, linear);
+
+  tiled_copy.SetAll(5);
+  for (int y = 0; y < tiled_copy.Height(); ++y) {
+    for (int x = 0; x < tiled_copy.Width(); ++x) {
+      ASSERT_EQ(5, tiled_copy.Get(x, y, 1));
+    }
+  }
+}
+
+TEST(JRTiledImageBuf, RowMajorTiles) {
+  TiledRoundTripTest<
+      jr::TiledImageBuf<int, 3, std::allocator<int>, jr::TiledLayout<8, 8>>>();
+  TiledRoundTripTest<
+      jr::TiledImageBuf<int, 3, std::allocator<int>, jr::TiledLayout<16, 4>>>();
+}
+
+TEST(JRTiledImageBuf, ZOrderTiles) {
+  TiledRoundTripTest<jr::ZOrderImageBuf<int, 3, 8>>();
+  TiledRoundTripTest<jr::ZOrderImageBuf<int, 3, 1>>();
+}
+
+TEST(JRTiledImageBuf, TileAccess) {
+  typedef jr::TiledImageBuf<int, 3, std::allocator<int>, jr::TiledLayout<8, 4>>
+      TiledT;
+  TiledT tiled(20, 10);
+  SampleFuncIntoImageBuf(Pattern, tiled);
+
+  // Tile rows hold TILE_WIDTH contiguous pixels.
+  const int* row = tiled.GetTileRow(1, 2, 1);
+  for (int x = 0; x < 8; ++x) {
+    EXPECT_EQ(Pattern(8 + x, 9, 0), row[x * 3]);
+  }
+
+  // Row spans never cross a tile boundary or the image edge.
+  int span = 0;
+  EXPECT_EQ(tiled.GetPointer(3, 5, 0), tiled.GetRowSpan(3, 5, &span));
+  EXPECT_EQ(5, span);
+  tiled.GetRowSpan(16, 5, &span);
+  EXPECT_EQ(4, span);
+
+  // ForEachTile visits every pixel exactly once.
+  int num_tiles = 0;
+  int num_pixels = 0;
+  tiled.ForEachTile([&](int x0, int y0, int w, int h, const int* tile) {
+    ++num_tiles;
+    for (int y = 0; y < h; ++y) {
+      for (int x = 0; x < w; ++x) {
+        EXPECT_EQ(Pattern(x0 + x, y0 + y, 2),
+                  tile[TiledT::TileOffset(x, y) * 3 + 2]);
+        ++num_pixels;
+      }
+    }
+  });
+  EXPECT_EQ(3 * 3, num_tiles);
+  EXPECT_EQ(20 * 10, num_pixels);
+}
+
+TEST(JRTiledImageBuf, Windows) {
+  jr::ZOrderImageBuf<int, 3, 4> tiled(13, 11);
+  SampleFuncIntoImageBuf(Pattern, tiled);
+
+  // Windows must be tile aligned.
+  jr::ZOrderImageBuf<int, 3, 4> win;
+  EXPECT_FALSE(tiled.GetWindow(1, 0, 2, 2, win));
+  EXPECT_TRUE(tiled.GetWindow(4, 8, 7, 3, win));
+  EXPECT_EQ(7, win.Width());
+  EXPECT_EQ(3, win.Height());
+  ExpectMatchesPattern(win, 4, 8);
+
+  jr::ImageBuf<int, 3> linear;
+  EXPECT_TRUE(win.CopyInto(linear));
+  EXPECT_EQ(win, linear);
+
+  win.SetAll(-7);
+  EXPECT_EQ(-7, tiled.Get(10, 10, 0));
+  EXPECT_EQ(Pattern(11, 10, 0), tiled.Get(11, 10, 0));
+  EXPECT_EQ(Pattern(3, 10, 0), tiled.Get(3, 10, 0));
+
+  const int pixel[3] = {-1, -2, -3};
+  win.SetAllPixels(pixel);
+  EXPECT_EQ(-3, tiled.Get(10, 10, 2));
+  EXPECT_EQ(-2, tiled.Get(4, 8, 1));
+  EXPECT_EQ(Pattern(11, 10, 2), tiled.Get(11, 10, 2));
+  EXPECT_EQ(Pattern(4, 7, 1), tiled.Get(4, 7, 1));
+}
+
+}  // anonymous namespace
@@ -3,6 +3,7 @@
 #include <random>
 #include <limits>
 #include <cstdint>
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -21,6 +22,62 @@ TEST(MathUtils, Clamp) {
   EXPECT_EQ(25, jr::math_utils::Clamp<int>(25, 12, 44));
 }
 
+TEST(MathUtils, MortonEncode2D) {
+  static_assert(MortonEncode2D(0, 0) == 0, "Morton encoding of the origin.");
+  EXPECT_EQ(1u, MortonEncode2D(1, 0));
+  EXPECT_EQ(2u, MortonEncode2D(0, 1));
+  EXPECT_EQ(3u, MortonEncode2D(1, 1));
+  EXPECT_EQ(4u, MortonEncode2D(2, 0));
+  EXPECT_EQ(0x55555555u, MortonEncode2D(0xFFFF, 0));
+  EXPECT_EQ(0xAAAAAAAAu, MortonEncode2D(0, 0xFFFF));
+
+  // Every point in an 8x8 block maps to a distinct index in [0, 64).
+  std::vector<bool> seen(64, false);
+  for (uint32_t y = 0; y < 8; ++y) {
+    for (uint32_t x = 0; x < 8; ++x) {
+      const uint32_t index = MortonEncode2D(x, y);
+      ASSERT_LT(index, 64u);
+      EXPECT_FALSE(seen[index]);
+      seen[index] = true;
+    }
+  }
+}
+
+TEST(MathUtils, IsPowerOfTwo) {
+  EXPECT_FALSE(IsPowerOfTwo(0));
+  EXPECT_TRUE(IsPowerOfTwo(1));
+  EXPECT_TRUE(IsPowerOfTwo(2));
+  EXPECT_FALSE(IsPowerOfTwo(3));
+  EXPECT_TRUE(IsPowerOfTwo(64));
+  EXPECT_FALSE(IsPowerOfTwo(96));
+}
+
+TEST(MathUtils, CountTrailingZeros) {
+  EXPECT_EQ(0, CountTrailingZeros(1));
+  EXPECT_EQ(0, CountTrailingZeros(0xFF));
+  EXPECT_EQ(3, CountTrailingZeros(8));
+  EXPECT_EQ(40, CountTrailingZeros(uint64_t(5) << 40));
+  EXPECT_EQ(63, CountTrailingZeros(uint64_t(1) << 63));
+}
+
+TEST(MathUtils, CountSetBits) {
+  EXPECT_EQ(0, CountSetBits(0));
+  EXPECT_EQ(1, CountSetBits(8));
+  EXPECT_EQ(8, CountSetBits(0xFF));
+  EXPECT_EQ(64, CountSetBits(~uint64_t(0)));
+  EXPECT_EQ(2, CountSetBits((uint64_t(1) << 63) | 1));
+}
+
+TEST(MathUtils, GreatestCommonDivisorAndLeastCommonMultiple) {
+  EXPECT_EQ(1u, GreatestCommonDivisor(3, 16));
+  EXPECT_EQ(4u, GreatestCommonDivisor(12, 32));
+  EXPECT_EQ(7u, GreatestCommonDivisor(7, 7));
+  EXPECT_EQ(48u, LeastCommonMultiple(3, 16));
+  EXPECT_EQ(96u, LeastCommonMultiple(12, 32));
+  EXPECT_EQ(32u, LeastCommonMultiple(32, 8));
+  EXPECT_EQ(1u, LeastCommonMultiple(1, 1));
+}
+
 TEST(MathUtils, ConvertWithSaturationWideToNarrow) {
   // Test uint -> uint8_t.
   uint8_t v = ConvertWithSaturation<uint32_t, uint8_t>(256);
@@ -1,9 +1,13 @@
 #include <string>
 #include <iostream>
 #include <random>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
 #include <random>
 #include <functional>
+#include <limits>
+#include <vector>
 
 #include "mem_utils.h"
 #include "gtest/gtest.h"
@@ -99,6 +103,34 @@ TEST(MemUtils, AlignedAllocStressTests) {
   }
 }
 
+TEST(MemUtils, HeaderAlignedAllocFallback) {
+  const std::size_t ALIGNMENTS[] = {0, 2, 16, 128, 4096};
+  for (std::size_t align : ALIGNMENTS) {
+    for (std::size_t numel = 0; numel < 300; numel += 37) {
+      double* mem = jr::mem_utils::HeaderAlignedNew<double>(numel, align);
+      ASSERT_TRUE(mem != nullptr);
+      EXPECT_TRUE(jr::mem_utils::IsPointerAligned(mem, align));
+      for (std::size_t i = 0; i < numel; ++i) {
+        mem[i] = TestFunc<double>(i);
+      }
+      for (std::size_t i = 0; i < numel; ++i) {
+        EXPECT_EQ(TestFunc<double>(i), mem[i]);
+      }
+      jr::mem_utils::HeaderAlignedDelete(mem);
+    }
+  }
+}
+
+TEST(MemUtils, AlignedAllocEmptyBlocksAreUnique) {
+  uint8_t* a = jr::mem_utils::AlignedNew<uint8_t>(0, 64);
+  uint8_t* b = jr::mem_utils::AlignedNew<uint8_t>(0, 64);
+  EXPECT_TRUE(a != nullptr);
+  EXPECT_NE(a, b);
+  jr::mem_utils::AlignedDelete(a);
+  jr::mem_utils::AlignedDelete(b);
+  jr::mem_utils::AlignedDelete<uint8_t>(nullptr);
+}
+
 TEST(MemUtils, IsPointerAligned) {
   uint8_t* pointer = reinterpret_cast<uint8_t*>(0x0F);
 
@@ -169,6 +201,176 @@ TEST(MemUtils, MemFillVariantStressTest) {
   }
 }
 
+// Compare MemFillPattern against MemFillSimple for every rotation of the
+// destination against the vector width, and for buffers spanning the short,
+// whole block and partial block paths.
+TEST(MemUtils, MemFillPatternMatchesSimple) {
+  const std::size_t kBufferBytes = 700;
+  const std::size_t kPatternSizes[] = {2, 3, 4, 5, 6, 7, 12, 24, 33, 48, 100};
+  uint8_t expected[kBufferBytes + 64];
+  uint8_t actual[kBufferBytes + 64];
+  for (std::size_t pattern_bytes : kPatternSizes) {
+    uint8_t* pattern = AllocateRandomBuffer(pattern_bytes);
+    for (std::size_t offset = 0; offset < 33; ++offset) {
+      for (std::size_t num_bytes = 1; num_bytes <= kBufferBytes;
+           num_bytes += 13) {
+        memset(expected, 0xAB, sizeof(expected));
+        memset(actual, 0xAB, sizeof(actual));
+        jr::mem_utils::MemFillSimple(expected + offset, num_bytes, pattern,
+                                     pattern_bytes);
+        jr::mem_utils::MemFillPattern(actual + offset, num_bytes, pattern,
+                                      pattern_bytes);
+        ASSERT_EQ(0, memcmp(expected, actual, sizeof(expected)))
+            << "pattern size " << pattern_bytes << ", offset " << offset
+            << ", buffer size " << num_bytes;
+      }
+    }
+    delete[] pattern;
+  }
+
+  // Patterns too long for the block, and single bytes.
+  const std::size_t kLongPattern = 301;
+  uint8_t* pattern = AllocateRandomBuffer(kLongPattern);
+  jr::mem_utils::MemFillSimple(expected, kBufferBytes, pattern, kLongPattern);
+  jr::mem_utils::MemFillPattern(actual, kBufferBytes, pattern, kLongPattern);
+  EXPECT_EQ(0, memcmp(expected, actual, kBufferBytes));
+  jr::mem_utils::MemFillPattern(actual, kBufferBytes, pattern, 1);
+  EXPECT_EQ(pattern[0], actual[kBufferBytes - 1]);
+  delete[] pattern;
+}
+
+TEST(MemUtils, MemFillPatternRows) {
+  const uint8_t pattern[3] = {1, 2, 3};
+  std::vector<uint8_t> buffer(5 * 100, 0);
+  // 4 rows of 61 bytes (20 whole pixels and a partial one), 100 bytes apart,
+  // starting at an odd address.
+  jr::mem_utils::MemFillPatternRows(&buffer[1], 61, 4, 100, pattern, 3);
+  for (std::size_t i = 0; i < buffer.size(); ++i) {
+    const std::size_t row = (i - 1) / 100, column = (i - 1) % 100;
+    const bool in_row = i >= 1 && row < 4 && column < 61;
+    ASSERT_EQ(in_row ? pattern[column % 3] : 0, buffer[i]) << i;
+  }
+}
+
+TEST(MemUtils, MemFillNonTemporalMatchesSimple) {
+  const std::size_t kBufferBytes = 5000;
+  std::vector<uint8_t> expected(kBufferBytes), actual(kBufferBytes);
+  for (std::size_t pattern_bytes : {1, 3, 12, 100}) {
+    uint8_t* pattern = AllocateRandomBuffer(pattern_bytes);
+    for (std::size_t offset : {0, 1, 7}) {
+      const std::size_t num_bytes = kBufferBytes - offset;
+      jr::mem_utils::MemFillSimple(&expected[offset], num_bytes, pattern,
+                                   pattern_bytes);
+      jr::mem_utils::MemFillPatternNonTemporal(&actual[offset], num_bytes,
+                                               pattern, pattern_bytes);
+      ASSERT_EQ(0, memcmp(&expected[offset], &actual[offset], num_bytes))
+          << "pattern size " << pattern_bytes << ", offset " << offset;
+    }
+    delete[] pattern;
+  }
+}
+
+TEST(MemUtils, CopyNonTemporal) {
+  const std::size_t kBufferBytes = 3000;
+  uint8_t* src = AllocateRandomBuffer(kBufferBytes);
+  std::vector<uint8_t> dst(kBufferBytes + 64);
+  for (std::size_t offset : {0, 1, 13}) {
+    for (std::size_t num_bytes : {0, 5, 100, 1000, 2999 - 13}) {
+      std::fill(dst.begin(), dst.end(), 0);
+      jr::mem_utils::CopyNonTemporal(&dst[offset], src + 1, num_bytes);
+      ASSERT_EQ(0, memcmp(&dst[offset], src + 1, num_bytes))
+          << "offset " << offset << ", size " << num_bytes;
+      EXPECT_EQ(0, dst[offset + num_bytes]);
+    }
+  }
+  delete[] src;
+}
+
+TEST(MemUtils, NonTemporalThreshold) {
+  const std::size_t original = jr::mem_utils::NonTemporalThresholdBytes();
+  EXPECT_GT(original, 0u);
+  jr::mem_utils::SetNonTemporalThresholdBytes(1000);
+  EXPECT_FALSE(jr::mem_utils::UseNonTemporalStores(
+      999, jr::mem_utils::CACHE_HINT_AUTO));
+  EXPECT_TRUE(jr::mem_utils::UseNonTemporalStores(
+      1000, jr::mem_utils::CACHE_HINT_AUTO));
+  EXPECT_FALSE(jr::mem_utils::UseNonTemporalStores(
+      1 << 30, jr::mem_utils::CACHE_HINT_CACHED));
+  EXPECT_TRUE(jr::mem_utils::UseNonTemporalStores(
+      1, jr::mem_utils::CACHE_HINT_NON_TEMPORAL));
+  jr::mem_utils::SetNonTemporalThresholdBytes(original);
+}
+
+TEST(MemUtils, MemFillDispatchTable) {
+  typedef jr::mem_utils::MemFillDispatchTable TableT;
+  EXPECT_EQ(0, TableT::BufferBucket(1));
+  EXPECT_EQ(0, TableT::BufferBucket(64));
+  EXPECT_EQ(1, TableT::BufferBucket(65));
+  EXPECT_EQ(6, TableT::BufferBucket(16 << 20));
+  EXPECT_EQ(7, TableT::BufferBucket((16 << 20) + 1));
+  EXPECT_EQ(0, TableT::PatternBucket(2));
+  EXPECT_EQ(1, TableT::PatternBucket(3));
+  EXPECT_EQ(4, TableT::PatternBucket(64));
+  EXPECT_EQ(5, TableT::PatternBucket(1000));
+
+  // Defaults: vector stores, except for long patterns and huge buffers.
+  TableT table;
+  EXPECT_EQ(jr::mem_utils::MEM_FILL_VECTOR, table.Lookup(4096, 3));
+  EXPECT_EQ(jr::mem_utils::MEM_FILL_CHUNKS, table.Lookup(4096, 65));
+  EXPECT_EQ(jr::mem_utils::MEM_FILL_NON_TEMPORAL,
+            table.Lookup(64 << 20, 12));
+
+  // Profiles round trip, and malformed ones are rejected.
+  table.Set(2, 1, jr::mem_utils::MEM_FILL_SIMPLE);
+  const std::string profile = table.Serialize();
+  EXPECT_NE(std::string::npos, profile.find("4096 4 simple\n"));
+  EXPECT_NE(std::string::npos, profile.find("max max chunks\n"));
+  TableT parsed;
+  EXPECT_TRUE(parsed.Parse(profile));
+  EXPECT_EQ(jr::mem_utils::MEM_FILL_SIMPLE, parsed.Get(2, 1));
+  EXPECT_EQ(profile, parsed.Serialize());
+  EXPECT_FALSE(parsed.Parse("64 2 vector\n"));  // Missing cells.
+  EXPECT_FALSE(parsed.Parse(profile + "64 2 fastest\n"));
+  EXPECT_FALSE(parsed.Parse(profile + "63 2 vector\n"));
+  EXPECT_EQ(profile, parsed.Serialize());  // Unchanged by failures.
+
+  // Without a profile MemFill(...) starts out with the defaults, rather than
+  // calibrating on first use.
+  const TableT original = jr::mem_utils::GetMemFillDispatchTable();
+  if (getenv("JR_MEMFILL_PROFILE") == nullptr) {
+    EXPECT_EQ(TableT().Serialize(), original.Serialize());
+  }
+
+  // Every strategy MemFill(...) can be told to use fills correctly.
+  const uint8_t pattern[5] = {1, 2, 3, 4, 5};
+  std::vector<uint8_t> expected(3000), actual(3000);
+  jr::mem_utils::MemFillSimple(expected.data(), expected.size(), pattern, 5);
+  for (int s = 0; s < jr::mem_utils::NUM_MEM_FILL_STRATEGIES; ++s) {
+    const jr::mem_utils::MemFillStrategy strategy =
+        static_cast<jr::mem_utils::MemFillStrategy>(s);
+    TableT forced;
+    for (int b = 0; b < TableT::NUM_BUFFER_BUCKETS; ++b) {
+      for (int p = 0; p < TableT::NUM_PATTERN_BUCKETS; ++p) {
+        forced.Set(b, p, strategy);
+      }
+    }
+    jr::mem_utils::SetMemFillDispatchTable(forced);
+    EXPECT_EQ(strategy, jr::mem_utils::GetMemFillDispatchTable().Get(3, 2));
+    std::fill(actual.begin(), actual.end(), 0);
+    jr::mem_utils::MemFill(actual.data(), actual.size(), pattern, 5);
+    EXPECT_EQ(expected, actual) << jr::mem_utils::MemFillStrategyName(strategy);
+  }
+
+  // Calibrating installs the calibrated table.
+  const TableT calibrated = jr::mem_utils::CalibrateMemFill();
+  EXPECT_EQ(calibrated.Serialize(),
+            jr::mem_utils::GetMemFillDispatchTable().Serialize());
+  std::fill(actual.begin(), actual.end(), 0);
+  jr::mem_utils::MemFill(actual.data(), actual.size(), pattern, 5);
+  EXPECT_EQ(expected, actual);
+  jr::mem_utils::SetMemFillDispatchTable(original);
+}
+
 TEST(MemUtils, MemFillEdgeCases) {
   // Array of the various MemFill.* functions to test with.
   std::function<void*(void*, std::size_t, const void*, std::size_t)> funcs[3] =
@@ -216,5 +418,183 @@ TEST(MemUtils, MemFillEdgeCases) {
 
 
 
+// Check ArraysAreDifferent(...) and CountDifferences(...) against a scalar
+// loop, for differences at every position of arrays of every length up to a
+// few vectors, with misaligned starts.
+template <typename T>
+void ArrayDifferenceTest() {
+  const std::size_t kMaxElements = 150;
+  std::vector<T> a(kMaxElements + 1), b(kMaxElements + 1);
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    a[i] = b[i] = static_cast<T>(i * 3 + 1);
+  }
+  for (std::size_t n = 0; n <= kMaxElements; n += (n < 40 ? 1 : 7)) {
+    std::size_t diff_index = 12345;
+    EXPECT_FALSE(jr::mem_utils::ArraysAreDifferent(&a[1], &b[1], n,
+                                                   &diff_index));
+    EXPECT_EQ(12345u, diff_index);
+    EXPECT_EQ(0u, jr::mem_utils::CountDifferences(&a[1], &b[1], n));
+    for (std::size_t first = 0; first < n; ++first) {
+      // A difference at first, and another one later.
+      b[1 + first] = static_cast<T>(b[1 + first] + 1);
+      const std::size_t second = first + (n - first) / 2;
+      if (second != first) {
+        b[1 + second] = static_cast<T>(b[1 + second] + 1);
+      }
+      ASSERT_TRUE(jr::mem_utils::ArraysAreDifferent(&a[1], &b[1], n,
+                                                    &diff_index));
+      ASSERT_EQ(first, diff_index) << "n = " << n;
+      ASSERT_TRUE(jr::mem_utils::ArraysAreDifferent(&a[1], &b[1], n));
+      ASSERT_EQ(second != first ? 2u : 1u,
+                jr::mem_utils::CountDifferences(&a[1], &b[1], n))
+          << "n = " << n << ", first = " << first;
+      b[1 + first] = a[1 + first];
+      b[1 + second] = a[1 + second];
+    }
+  }
+}
+
+TEST(MemUtils, ArraysAreDifferent) {
+  ArrayDifferenceTest<uint8_t>();
+  ArrayDifferenceTest<int16_t>();
+  ArrayDifferenceTest<uint32_t>();
+  ArrayDifferenceTest<int64_t>();
+  ArrayDifferenceTest<float>();
+  ArrayDifferenceTest<double>();
+  ArrayDifferenceTest<long double>();
+}
+
+TEST(MemUtils, ArraysAreDifferentFloatingPointPolicy) {
+  // -0.0 equals 0.0, and NaN differs from everything, including itself,
+  // whether or not the caller asks for the index.
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  std::vector<float> a(37, 1.0f), b(37, 1.0f);
+  a[5] = 0.0f;
+  b[5] = -0.0f;
+  std::size_t diff_index = 0;
+  EXPECT_FALSE(jr::mem_utils::ArraysAreDifferent(a.data(), b.data(), a.size()));
+  EXPECT_FALSE(jr::mem_utils::ArraysAreDifferent(a.data(), b.data(), a.size(),
+                                                 &diff_index));
+  a[20] = b[20] = nan;
+  a[36] = b[36] = nan;
+  EXPECT_TRUE(jr::mem_utils::ArraysAreDifferent(a.data(), b.data(), a.size()));
+  EXPECT_TRUE(jr::mem_utils::ArraysAreDifferent(a.data(), b.data(), a.size(),
+                                                &diff_index));
+  EXPECT_EQ(20u, diff_index);
+  EXPECT_EQ(2u, jr::mem_utils::CountDifferences(a.data(), b.data(), a.size()));
+
+  std::vector<double> c(9, 2.0), d(9, 2.0);
+  c[8] = std::numeric_limits<double>::quiet_NaN();
+  EXPECT_TRUE(jr::mem_utils::ArraysAreDifferent(c.data(), d.data(), c.size(),
+                                                &diff_index));
+  EXPECT_EQ(8u, diff_index);
+  EXPECT_EQ(1u, jr::mem_utils::CountDifferences(c.data(), d.data(), c.size()));
+}
+
+// Compare MeasureErrors(...) against a plain loop, on values small enough that
+// every error is exact in float.
+template <typename T>
+void MeasureErrorsTest(T scale) {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> dist(0, 60);
+  for (std::size_t n : {0, 1, 7, 31, 1000, 1024, 1025, 5000}) {
+    std::vector<T> a(n), b(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      a[i] = static_cast<T>(dist(rng) * scale);
+      b[i] = static_cast<T>(dist(rng) * scale);
+    }
+    const double absolute = 20 * std::fabs(static_cast<double>(scale));
+    const double relative = 0.5;
+    std::size_t num_over = 0, max_index = 0;
+    double sum = 0.0, max_error = 0.0;
+    for (std::size_t i = 0; i < n; ++i) {
+      const double x = static_cast<double>(a[i]), y = static_cast<double>(b[i]);
+      const double error = std::fabs(x - y);
+      num_over += error > std::max(absolute,
+                                   relative * std::max(std::fabs(x),
+                                                       std::fabs(y)));
+      sum += error;
+      if (error > max_error) {
+        max_error = error;
+        max_index = i;
+      }
+    }
+    const jr::mem_utils::ErrorStats stats = jr::mem_utils::MeasureErrors(
+        a.data(), b.data(), n, absolute, relative);
+    EXPECT_EQ(num_over, stats.num_over) << n;
+    EXPECT_DOUBLE_EQ(sum, stats.sum_error) << n;
+    EXPECT_EQ(max_error, stats.max_error) << n;
+    EXPECT_EQ(max_index, stats.max_error_index) << n;
+  }
+}
+
+TEST(MemUtils, MeasureErrors) {
+  MeasureErrorsTest<uint8_t>(1);
+  MeasureErrorsTest<uint16_t>(1000);
+  MeasureErrorsTest<int16_t>(-3);
+  MeasureErrorsTest<int32_t>(7);
+  MeasureErrorsTest<float>(0.25f);
+  MeasureErrorsTest<double>(-0.125);
+}
+
+TEST(MemUtils, MeasureErrorsSpecialValues) {
+  const float inf = std::numeric_limits<float>::infinity();
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  // Lanes 0-7 and 8-15 fill vectors of either width; the rest are a tail.
+  std::vector<float> a(19, 1.0f), b(19, 1.0f);
+  a[1] = b[1] = inf;  // Equal infinities and NaN pairs have no error...
+  a[2] = b[2] = nan;
+  a[3] = 0.0f;
+  b[3] = -0.0f;
+  a[9] = 4.0f;  // ...but a mismatched infinity or NaN is always over.
+  b[11] = inf;
+  a[18] = nan;
+  jr::mem_utils::ErrorStats stats = jr::mem_utils::MeasureErrors(
+      a.data(), b.data(), a.size(), 10.0, 1000.0);
+  EXPECT_EQ(2u, stats.num_over);
+  EXPECT_EQ(inf, stats.max_error);
+  EXPECT_EQ(11u, stats.max_error_index);
+  EXPECT_EQ(inf, stats.sum_error);
+
+  b[11] = 1.0f;
+  a[18] = 1.0f;
+  stats = jr::mem_utils::MeasureErrors(a.data(), b.data(), a.size(), 2.0, 0.0);
+  EXPECT_EQ(1u, stats.num_over);
+  EXPECT_EQ(3.0, stats.max_error);
+  EXPECT_EQ(9u, stats.max_error_index);
+  EXPECT_EQ(3.0, stats.sum_error);
+  // The relative tolerance scales with the larger magnitude.
+  stats = jr::mem_utils::MeasureErrors(a.data(), b.data(), a.size(), 0.0, 0.75);
+  EXPECT_EQ(0u, stats.num_over);
+}
+
+TEST(MemUtils, InterleaveDeinterleaveRoundTrip) {
+  const std::size_t NUM_PIXELS = 37;
+  const std::size_t PLANE_STRIDE = 40;
+  for (int channels = 1; channels <= 7; ++channels) {
+    std::vector<int> interleaved(NUM_PIXELS * channels);
+    for (std::size_t i = 0; i < interleaved.size(); ++i) {
+      interleaved[i] = static_cast<int>(i);
+    }
+
+    std::vector<int> planar(PLANE_STRIDE * channels, -1);
+    jr::mem_utils::Deinterleave(interleaved.data(), NUM_PIXELS, channels,
+                                planar.data(), PLANE_STRIDE);
+    for (int c = 0; c < channels; ++c) {
+      for (std::size_t i = 0; i < NUM_PIXELS; ++i) {
+        ASSERT_EQ(static_cast<int>(i * channels + c),
+                  planar[c * PLANE_STRIDE + i]);
+      }
+      // Padding at the end of each plane is untouched.
+      EXPECT_EQ(-1, planar[c * PLANE_STRIDE + NUM_PIXELS]);
+    }
+
+    std::vector<int> round_trip(interleaved.size(), -1);
+    jr::mem_utils::Interleave(planar.data(), PLANE_STRIDE, NUM_PIXELS,
+                              channels, round_trip.data());
+    EXPECT_EQ(interleaved, round_trip) << "channels = " << channels;
+  }
+}
+
 }  // anonymous namespace
 